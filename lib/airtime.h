@@ -0,0 +1,36 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Decides when the next LoRaWAN uplink may go out. Only uses standard types so it builds for the host as well.
+
+#define AIRTIME_LORAWAN_OVERHEAD 13 // MHDR, FHDR, FPort and MIC added to the application payload
+
+typedef enum {
+    AIRTIME_CRITICAL, // errors, only held back by the regional duty cycle
+    AIRTIME_ROUTINE,  // normal logs, leave a reserve of the budget for critical ones
+    AIRTIME_BULK,     // log exports, only use the budget when plenty is left
+    AIRTIME_PRIORITY_COUNT
+} airtime_priority;
+
+typedef struct airtime_config {
+    uint8_t spreading_factor;  // 7 to 12
+    uint16_t bandwidth_khz;    // 125 or 250
+    uint16_t duty_cycle_div;   // 100 for a 1 % duty cycle, the band is off for (div - 1) * time on air after a send
+    uint32_t budget_ms;        // time on air allowed per budget period, network fair use policy
+    uint32_t budget_period_ms;
+    uint32_t modem_busy_ms;    // how long the modem is busy with the receive windows after a send
+    uint32_t retry_ms;         // wait after the modem refused a message
+} airtime_config;
+
+void airtime_init(const airtime_config *config, uint32_t time_ms);
+void airtime_set_spreading_factor(uint8_t sf);
+uint32_t airtime_time_on_air_us(uint8_t payload_len);
+uint32_t airtime_wait_ms(airtime_priority prio, uint8_t payload_len, uint32_t time_ms);
+void airtime_sent(uint8_t payload_len, uint32_t time_ms);
+void airtime_failed(uint32_t time_ms);
+int32_t airtime_get_budget_ms(uint32_t time_ms);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Byte addressed storage made of pages, so the logs and records don't need to know which chips hold them.
+// Writes are split on page boundaries before they reach the device. Flash has to be erased a sector at a time
+// before it can be written again, EEPROM writes in place and has no erase. Several devices with the same page size
+// can be put one after another to look like one. Only uses standard types so it builds for the host as well.
+
+#define BLOCKDEV_MAX_PARTS 4
+
+typedef struct blockdev blockdev;
+
+typedef struct blockdev_ops {
+    bool (*read)(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size);
+    bool (*program)(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size); // within one page
+    bool (*erase)(const blockdev *dev, uint32_t address); // one erase block, NULL if the device writes in place
+} blockdev_ops;
+
+struct blockdev {
+    const blockdev_ops *ops;
+    const void *ctx;     // what the device needs to find itself, a chip description for example
+    uint32_t size;       // bytes
+    uint16_t page_size;  // most bytes programmed at once, a write never crosses a page
+    uint32_t erase_size; // bytes in an erase block, 0 if the device writes in place
+};
+
+typedef struct blockdev_concat {
+    const blockdev *parts[BLOCKDEV_MAX_PARTS];
+    uint8_t count;
+} blockdev_concat;
+
+bool blockdev_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size);
+bool blockdev_write(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size);
+bool blockdev_erase(const blockdev *dev, uint32_t address);
+bool blockdev_concat_init(blockdev *dev, blockdev_concat *cat, const blockdev *parts, uint8_t count);
+
+#endif
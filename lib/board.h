@@ -0,0 +1,39 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+// Pins, wheel geometry and timings of the board profile picked with cmake -DDISPENSER_BOARD=<name>.
+// Profiles are headers in lib/boards, everything in them is a compile time constant.
+
+#ifdef DISPENSER_BOARD_HEADER
+#include DISPENSER_BOARD_HEADER
+#else
+#include "boards/pill_dispenser_v1.h"
+#endif
+
+#include "wheel.h"
+
+#if WHEEL_COMPARTMENTS < WHEEL_MIN_COMPARTMENTS || WHEEL_COMPARTMENTS > WHEEL_MAX_COMPARTMENTS
+#error "WHEEL_COMPARTMENTS must be between WHEEL_MIN_COMPARTMENTS and WHEEL_MAX_COMPARTMENTS"
+#endif
+
+#if CAROUSEL_COUNT < 1 || CAROUSEL_COUNT > 4
+#error "CAROUSEL_COUNT must be between 1 and 4, a PIO has 4 state machines for the motors"
+#endif
+
+#if EEPROM_CHIP_COUNT < 1 || EEPROM_CHIP_COUNT > 4
+#error "EEPROM_CHIP_COUNT must be between 1 and 4, see BLOCKDEV_MAX_PARTS"
+#endif
+
+#if FLASH_LOG_SECTORS < 2
+#error "FLASH_LOG_SECTORS must be at least 2, one is written while the next one is erased"
+#endif
+
+#if MOTOR_POWER_SLOTS < 1
+#error "MOTOR_POWER_SLOTS must be at least 1"
+#endif
+
+#if BUTTON2 != BUTTON1 + 1 || BUTTON3 != BUTTON1 + 2
+#error "Buttons must be on consecutive pins starting from BUTTON1"
+#endif
+
+#endif
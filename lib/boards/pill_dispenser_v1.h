@@ -0,0 +1,62 @@
+#ifndef BOARDS_PILL_DISPENSER_V1_H
+#define BOARDS_PILL_DISPENSER_V1_H
+
+// First hardware revision with the 8 compartment wheel, one compartment is left empty for calibration.
+
+// LoRa modem
+#define LORA_UART uart1
+#define UART_TX_PIN 4
+#define UART_RX_PIN 5
+
+// EEPROM
+#define EEPROM_I2C i2c0
+#define EEPROM_SDA_PIN 16
+#define EEPROM_SCL_PIN 17
+// Chips on the bus in the order their memory is used: {I2C address, size, page size, address bytes}
+#define EEPROM_CHIP_COUNT 1
+#define EEPROM_CHIPS { \
+    {0x50, 32768, 64, 2} /* 24C256 */ \
+}
+
+// Logs in the last 4 KB sectors of the Pico's flash instead of the EEPROM, built with -DFLASH_LOG=ON
+#define FLASH_LOG_SECTORS 64
+
+// Sensors
+#define OPTO_FORK_PIN 28
+#define PIEZO_PIN 27
+
+// Buttons, debounced as a block of consecutive pins starting from BUTTON1
+#define BUTTON1 7
+#define BUTTON2 8
+#define BUTTON3 9
+
+// LEDs
+#define LED1 20
+#define LED2 21
+#define LED3 22
+
+// Stepper motor coils by wire color
+#define STEPPER_PIN_BLUE 2
+#define STEPPER_PIN_PINK 3
+#define STEPPER_PIN_YELLOW 6
+#define STEPPER_PIN_ORANGE 13
+
+// Carousels, each with its own motor, opto fork and piezo sensor: {{blue, pink, yellow, orange}, fork, piezo}
+#define CAROUSEL_COUNT 1
+#define CAROUSEL_PINS { \
+    {{STEPPER_PIN_BLUE, STEPPER_PIN_PINK, STEPPER_PIN_YELLOW, STEPPER_PIN_ORANGE}, OPTO_FORK_PIN, PIEZO_PIN} \
+}
+#define MOTOR_POWER_SLOTS 1 // motors the supply can drive at once
+
+// Step counts a calibration may find for one revolution
+#define MAX_VALID_MAX_STEP_COUNT_BOUND_MIN 4000
+#define MAX_VALID_MAX_STEP_COUNT_BOUND_MAX 5500
+
+// Pill wheel, default until a geometry is set over LoRa (see CMD_SET_WHEEL)
+#define WHEEL_COMPARTMENTS 8 // including the empty calibration compartment
+
+// Timings
+#define STEPPER_SPEED_RPM 10
+#define PILL_DROP_DELAY_MS 5000
+
+#endif
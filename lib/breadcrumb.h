@@ -0,0 +1,35 @@
+#ifndef BREADCRUMB_H
+#define BREADCRUMB_H
+
+#include "pico/stdlib.h"
+
+// What the firmware was doing, kept in watchdog scratch registers 0-2 so it survives a watchdog reboot.
+// Scratch registers 4-7 are used by the SDK's watchdog_reboot().
+
+// Keep in the same order as the LOG_WATCHDOG_STALL_* log numbers.
+typedef enum {
+    ACTIVITY_MAIN_LOOP,
+    ACTIVITY_SLEEP,
+    ACTIVITY_STATE_MACHINE,
+    ACTIVITY_EEPROM_WRITE,
+    ACTIVITY_EEPROM_READ,
+    ACTIVITY_LORA_WRITE,
+    ACTIVITY_LORA_READ,
+    ACTIVITY_LOG_DUMP,
+    ACTIVITY_COUNT
+} breadcrumb_activity;
+
+typedef struct breadcrumb {
+    breadcrumb_activity activity;
+    uint8_t state;   // state machine state
+    uint32_t time_ms; // time since boot when the activity started
+} breadcrumb;
+
+void breadcrumb_init(void);
+breadcrumb_activity breadcrumb_enter(breadcrumb_activity activity);
+void breadcrumb_leave(breadcrumb_activity previous);
+void breadcrumb_set_state(uint8_t state);
+bool breadcrumb_get_previous(breadcrumb *crumb);
+const char *breadcrumb_activity_name(breadcrumb_activity activity);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CALIBCACHE_H
+#define CALIBCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Last few full calibrations of a carousel and how much they can be trusted. Calibrations that agree with each other
+// at about the same temperature make it safe to skip turning the wheel after a clean shutdown.
+// Only uses standard types so it builds for the host as well.
+
+#define CALIBCACHE_HISTORY 4
+#define CALIBCACHE_PHASES 8         // phases of the motor's half step sequence
+#define CALIBCACHE_NO_TEMP INT8_MIN // temperature of a calibration carried over from the status record
+#define CALIBCACHE_NO_PHASE 0xFF    // phase of the motor isn't known, the wheel has to turn to find the hole
+#define CALIBCACHE_RECORD_LEN (3 + CALIBCACHE_HISTORY * 5) // count, next, phase, samples, does not include CRC
+
+#define CALIBCACHE_HALF_CONFIDENCE 20   // enough to find the hole again with a half calibration
+#define CALIBCACHE_RESUME_CONFIDENCE 60 // enough to resume without turning the wheel at all
+
+typedef struct calib_sample {
+    uint16_t step_max;   // steps in one revolution
+    uint16_t edge_steps; // width of the opto fork hole in steps
+    int8_t temp_c;       // chip temperature during the calibration, CALIBCACHE_NO_TEMP if unknown
+} calib_sample;
+
+typedef struct calib_cache {
+    calib_sample samples[CALIBCACHE_HISTORY];
+    uint8_t count; // samples in use
+    uint8_t next;  // where the next sample goes, the newest one is right before it
+    uint8_t phase; // motor phase at step 0 of the newest calibration, see stepper_get_phase_offset()
+} calib_cache;
+
+void calibcache_init(calib_cache *c);
+void calibcache_add(calib_cache *c, uint16_t step_max, uint16_t edge_steps, int8_t temp_c);
+bool calibcache_newest(const calib_cache *c, calib_sample *s);
+uint8_t calibcache_confidence(const calib_cache *c, uint16_t min_steps, uint16_t max_steps, int8_t temp_c);
+void calibcache_encode(const calib_cache *c, uint8_t *dst);
+bool calibcache_decode(calib_cache *c, const uint8_t *src);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef CHIPTEMP_H
+#define CHIPTEMP_H
+
+#include "pico/stdlib.h"
+
+// Temperature of the RP2040 from its internal sensor, close enough to the board's to tell a cold boot from a warm one.
+
+void chiptemp_init(void);
+int8_t chiptemp_read_c(void);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "schedule.h"
+
+#define COMMAND_PORT 10 // LoRaWAN port the commands are sent to
+
+#define COMMAND_ALL_CAROUSELS 0
+
+// Multi-byte arguments are little endian. An optional carousel byte picks one carousel, numbered from 1, the
+// command goes to all carousels without it.
+typedef enum {
+    CMD_CALIBRATE = 0x01,    // optional carousel (1)
+    CMD_DISPENSE_NOW = 0x02, // pills (1), optional carousel (1)
+    CMD_SET_SCHEDULE = 0x03, // count (1), then count * [minute of day (2), pills (1)]
+    CMD_REQUEST_LOGS = 0x04, // first log index (2), logs from it to the newest are sent in packed frames
+    CMD_SET_TIME = 0x05,     // unix time (4)
+    CMD_SET_TIMING = 0x06,   // timing_param (1), value in ms (4)
+    CMD_SET_WHEEL = 0x07,    // compartments (1), clears the offsets and starts over from calibration
+    CMD_SET_COMPARTMENT_OFFSET = 0x08 // compartment (1), offset in 1/4096 of a revolution (1, signed)
+} command_opcode;
+
+typedef enum {
+    TIMING_PILL_DROP_DELAY,
+    TIMING_PILL_NOT_DROPPED_DELAY,
+    TIMING_PARAM_COUNT
+} timing_param;
+
+typedef struct command {
+    command_opcode opcode;
+    uint8_t carousel; // carousel number from 1, COMMAND_ALL_CAROUSELS if the command didn't name one
+    union {
+        uint8_t pills;
+        struct {
+            dose doses[SCHEDULE_MAX_DOSES];
+            uint8_t count;
+        } schedule;
+        uint16_t first_log;
+        uint32_t unix_s;
+        struct {
+            timing_param param;
+            uint32_t value_ms;
+        } timing;
+        uint8_t compartments;
+        struct {
+            uint8_t compartment;
+            int8_t offset;
+        } offset;
+    } args;
+} command;
+
+bool command_parse(const uint8_t *data, uint8_t len, command *cmd);
+
+#endif
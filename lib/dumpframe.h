@@ -0,0 +1,57 @@
+#ifndef DUMPFRAME_H
+#define DUMPFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Binary frames for pulling the raw EEPROM and flash log over the serial line. Shared by the firmware and the host
+// tools. A frame is a type byte and its fields, then the CRC of both, most significant byte first. It is COBS
+// encoded, so it has no zero bytes, and sent between two zero bytes. Text printed on the same line between frames
+// reads as a frame with a bad CRC and is dropped. Multi-byte fields are little endian.
+// Only uses standard types so it builds for the host as well.
+//
+// The host asks for one chunk at a time and only asks for the next one after the chunk arrived with a good CRC, so
+// a READ also acknowledges the chunk before it. A lost frame is asked for again, and a dump that stopped is resumed
+// by asking from where it got to.
+
+#define DUMPFRAME_VERSION 2
+
+// host to device
+#define DUMPFRAME_START 0x53 // opens a dump session, answered with DUMPFRAME_HELLO
+#define DUMPFRAME_READ  0x52 // offset (4), length (2), answered with DUMPFRAME_DATA or DUMPFRAME_ERROR
+#define DUMPFRAME_END   0x51 // closes the session
+
+// device to host
+#define DUMPFRAME_HELLO 0x48 // version (1), board id (8), EEPROM size (4), flash log size (4), chunk (2), boot (2),
+                             // log head (2): index of the next log, changes whenever a log is written
+#define DUMPFRAME_DATA  0x44 // offset (4), then the bytes read
+#define DUMPFRAME_ERROR 0x45 // offset (4) of a read that failed or is outside the dump
+
+// The dump is the whole EEPROM from address 0, then the flash log's sectors if the logs are in flash.
+#define DUMPFRAME_CHUNK 240 // most bytes in one DUMPFRAME_DATA frame
+#define DUMPFRAME_BOARD_ID_LEN 8
+#define DUMPFRAME_HELLO_LEN (1 + 1 + DUMPFRAME_BOARD_ID_LEN + 4 + 4 + 2 + 2 + 2)
+#define DUMPFRAME_READ_LEN (1 + 4 + 2)
+#define DUMPFRAME_DATA_HEADER_LEN (1 + 4)
+#define DUMPFRAME_MAX_PAYLOAD (DUMPFRAME_DATA_HEADER_LEN + DUMPFRAME_CHUNK)
+#define DUMPFRAME_CRC_LEN 2
+#define DUMPFRAME_MAX_COBS (DUMPFRAME_MAX_PAYLOAD + DUMPFRAME_CRC_LEN + (DUMPFRAME_MAX_PAYLOAD + DUMPFRAME_CRC_LEN) / 254 + 1)
+#define DUMPFRAME_MAX_LEN (DUMPFRAME_MAX_COBS + 2) // with the zero bytes around it
+
+// Frame being received, fed a byte at a time.
+typedef struct dumpframe_rx {
+    uint8_t buf[DUMPFRAME_MAX_COBS]; // the payload after a frame is complete
+    size_t len;
+    bool overflow; // the frame is longer than any valid one, it is dropped at its end
+} dumpframe_rx;
+
+size_t dumpframe_encode(uint8_t *dst, const uint8_t *payload, size_t len);
+void dumpframe_rx_init(dumpframe_rx *rx);
+int dumpframe_rx_feed(dumpframe_rx *rx, uint8_t byte);
+void dumpframe_put_u16(uint8_t *dst, uint16_t value);
+void dumpframe_put_u32(uint8_t *dst, uint32_t value);
+uint16_t dumpframe_get_u16(const uint8_t *src);
+uint32_t dumpframe_get_u32(const uint8_t *src);
+
+#endif
@@ -5,12 +5,24 @@
 #include <stdbool.h>
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#include "blockdev.h"
 
+// I2C EEPROM chips of a board, see EEPROM_CHIPS in the board profile. Addresses run through the chips in order.
+typedef struct eeprom_chip {
+    uint8_t i2c_address;   // 7 bit address with the chip's address pins, 0x50 with them all low
+    uint32_t size;         // bytes
+    uint16_t page_size;    // bytes written at once
+    uint8_t address_bytes; // 1 for the 24C01 to 24C16, 2 for the 24C32 to 24M01, higher bits go in the I2C address
+} eeprom_chip;
 
-void eeprom_init_i2c(i2c_inst_t *i2c, uint baud, uint32_t write_cycle_max_ms);
-void eeprom_write_byte(uint16_t address, char c);
-char eeprom_read_byte(uint16_t address);
-void eeprom_write_page(uint16_t address, uint8_t *src, size_t size);
-void eeprom_read_page(uint16_t address, uint8_t *dst, size_t size);
+bool eeprom_init_i2c(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baud, uint32_t write_cycle_max_ms, const eeprom_chip *chips, uint8_t chip_count);
+void eeprom_write_byte(uint32_t address, char c);
+char eeprom_read_byte(uint32_t address);
+void eeprom_write_page(uint32_t address, uint8_t *src, size_t size);
+void eeprom_read_page(uint32_t address, uint8_t *dst, size_t size);
+uint32_t eeprom_size();
+#ifdef EEPROM_BENCH_ENABLED
+void eeprom_benchmark(uint16_t address, uint16_t size);
+#endif
 
-#endif
\ No newline at end of file
+#endif
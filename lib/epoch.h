@@ -0,0 +1,40 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Device time: seconds that only count up, across reboots as well, so logs from every boot can be put in order.
+// The Pico has no clock that runs while it is off, so a boot starts a second after the newest thing the boots before
+// it are known to have done. When the network time arrives the device time jumps forward to it and follows unix time
+// from then on. It never goes back: if it is already ahead, the difference is kept as an offset instead.
+// A boot after a sync carries on from the unix time of the boot before, but how long the device was off is unknown,
+// so its device time is only a unix time again once it has synced itself.
+// Only uses standard types so it builds for the host as well.
+
+#define EPOCH_RECORD_LEN 11        // boot count, boot time, unix offset, flags, does not include CRC
+#define EPOCH_SYNCED 0x01          // the device time has been synced to the network time at least once
+#define EPOCH_BOOT_SYNCED 0x02     // the device time has been synced since this boot started, cleared at every boot
+#define EPOCH_UNIX_MIN 1577836800u // 2020-01-01, device times from here on are unix times
+
+typedef struct epoch {
+    uint16_t boot_count;   // boots since the record was created, the first boot is 1
+    uint32_t boot_s;       // device time when this boot started, moved forward by a sync
+    uint32_t prev_boot_s;  // device time when the previous boot started, not stored
+    int32_t unix_offset_s; // unix time minus device time at the last sync, 0 or less
+    uint8_t flags;
+} epoch;
+
+void epoch_init(epoch *e);
+void epoch_start_boot(epoch *e, uint32_t newest_s, uint32_t prev_uptime_ms);
+uint32_t epoch_now(const epoch *e, uint32_t time_ms);
+uint32_t epoch_previous_boot(const epoch *e, uint32_t time_ms);
+uint32_t epoch_sync(epoch *e, uint32_t unix_s, uint32_t time_ms);
+bool epoch_boot_synced(const epoch *e);
+void epoch_civil_from_days(int32_t z, int32_t *year, uint32_t *month, uint32_t *day);
+int epoch_format(char *dst, size_t size, uint32_t device_s, bool utc);
+void epoch_encode(const epoch *e, uint8_t *dst);
+bool epoch_decode(epoch *e, const uint8_t *src);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "pico/stdlib.h"
+
+typedef enum {
+    EVENT_NONE,
+    EVENT_BUTTON,   // data: gpio of the button that went down
+    EVENT_PIEZO,    // data: timestamp of the pulse that opened a new burst
+    EVENT_TIMER,    // data: unused, wake-up deadline reached
+    EVENT_UART_RX,  // data: unused, the LoRa modem sent something
+    EVENT_SERIAL_RX // data: unused, bytes arrived on the stdio UART
+} event_type;
+
+typedef struct event {
+    event_type type;
+    uint32_t data;
+    uint32_t timestamp_us; // when the event was posted
+} event;
+
+void events_init(void);
+bool events_post(event_type type, uint32_t data);
+bool events_get(event *ev);
+bool events_pending(void);
+void events_wait_ms(uint32_t timeout_ms);
+uint32_t events_get_max_latency_us(void);
+uint32_t events_get_overflow_count(void);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef FLASHDEV_H
+#define FLASHDEV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blockdev.h"
+
+// The end of the Pico's QSPI flash as a block device, past the firmware. Code runs from the same flash, so
+// interrupts are disabled while it is programmed or erased and the watchdog gets a longer timeout for an erase.
+// Core 1 isn't used by the firmware, nothing else runs from flash in the meantime.
+
+bool flashdev_init(blockdev *dev, uint32_t size);
+
+#endif
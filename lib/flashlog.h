@@ -0,0 +1,38 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blockdev.h"
+
+// Log records appended to flash sectors used as a ring. Every sector starts with a header holding its erase count
+// and a sequence number, so the sector being written and the next free record are found at boot from the headers
+// and a binary search, without reading every record. Sectors are used in turn, so they all wear the same.
+// The sector after the one being written is erased ahead of time with flashlog_maintain(), when erasing does no harm.
+// Only uses standard types so it builds for the host as well.
+
+#define FLASHLOG_RECORD_LEN 8
+#define FLASHLOG_HEADER_LEN 16
+#define FLASHLOG_MAX_RECORDS 0xFFFF // record indexes are 16 bit in export frames
+
+typedef struct flashlog {
+    const blockdev *dev; // erase_size is the sector size
+    uint16_t sectors;
+    uint16_t per_sector; // records in a sector
+    uint16_t active;     // sector being written
+    uint16_t slot;       // next free record in the active sector, per_sector when it is full
+    uint32_t sequence;   // of the active sector, the newest sector has the highest
+    bool ahead_ready;    // the sector after the active one is erased and has its header
+    uint32_t erases;     // sector erases since mount
+} flashlog;
+
+bool flashlog_mount(flashlog *fl, const blockdev *dev);
+bool flashlog_append(flashlog *fl, const uint8_t *record);
+bool flashlog_read(const flashlog *fl, int index, uint8_t *record);
+int flashlog_head(const flashlog *fl);
+int flashlog_capacity(const flashlog *fl);
+bool flashlog_maintain(flashlog *fl);
+bool flashlog_format(flashlog *fl);
+bool flashlog_erase_count(const flashlog *fl, uint16_t sector, uint32_t *count);
+
+#endif
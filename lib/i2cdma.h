@@ -0,0 +1,30 @@
+#ifndef I2CDMA_H
+#define I2CDMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+
+// I2C transfers moved by DMA, so the CPU only sets a transfer up and handles its end. One transfer at a time.
+// The I2C peripheral needs a command word for every byte, so writes are gathered from their segments into the
+// driver's own buffer and the caller's buffers are free again as soon as the write has started. Reads send their
+// header from that buffer and receive straight into the caller's buffer.
+
+#define I2CDMA_MAX_WRITE 68 // bytes in one write, a two byte address and a 64 byte EEPROM page with room to spare
+
+typedef void (*i2cdma_callback)(bool ok, void *arg); // called from the I2C interrupt when a transfer ends
+
+typedef struct i2cdma_segment {
+    const uint8_t *data;
+    size_t len;
+} i2cdma_segment;
+
+void i2cdma_init(i2c_inst_t *i2c);
+bool i2cdma_write(uint8_t addr, const i2cdma_segment *segments, uint8_t count, i2cdma_callback done, void *arg);
+bool i2cdma_read(uint8_t addr, const uint8_t *header, size_t header_len, uint8_t *dst, size_t len, i2cdma_callback done, void *arg);
+bool i2cdma_busy(void);
+bool i2cdma_wait(uint32_t timeout_us);
+uint32_t i2cdma_cpu_us(void);
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef logHandling_h
 #define logHandling_h
 
-#include "ring_buffer.h"
+#include <stddef.h>
+#include "logqueue.h"
+#include "wheel.h"
+#include "calibcache.h"
+#include "epoch.h"
+#include "logrecord.h"
+#include "blockdev.h"
 
 extern const char *logMessages[];
 extern const char *pillDispenserStatus[];
@@ -16,8 +22,8 @@ typedef enum {
 typedef enum {
     LOG_IDLE,
     LOG_WATCHDOG_REBOOT,
-    LOG_DISPENSE1,
-    LOG_DISPENSE2,
+    LOG_DISPENSE1,           // LOG_DISPENSE1 to 7 and LOG_DISPENSE1_ERROR to 7 are no longer logged, they are kept
+    LOG_DISPENSE2,           // so logs written before the compartment field still print
     LOG_DISPENSE3,
     LOG_DISPENSE4,
     LOG_DISPENSE5,
@@ -42,7 +48,23 @@ typedef enum {
     LOG_GREMLINS,
     LOG_DISPENSER_STATUS_READ_ERROR,
     LOG_BOOTFINISHED,
-    NOSEND
+    LOG_SCHEDULED_DOSE,
+    LOG_DOSE_MISSED,
+    LOG_REMOTE_COMMAND,
+    LOG_REMOTE_COMMAND_REJECTED,
+    LOG_WATCHDOG_STALL_MAIN_LOOP, // watchdog stall logs follow the breadcrumb_activity order
+    LOG_WATCHDOG_STALL_SLEEP,
+    LOG_WATCHDOG_STALL_STATE_MACHINE,
+    LOG_WATCHDOG_STALL_EEPROM_WRITE,
+    LOG_WATCHDOG_STALL_EEPROM_READ,
+    LOG_WATCHDOG_STALL_LORA_WRITE,
+    LOG_WATCHDOG_STALL_LORA_READ,
+    LOG_WATCHDOG_STALL_LOG_DUMP,
+    LOG_DISPENSE,            // compartment field is the compartment being turned to
+    LOG_DISPENSE_ERROR,      // compartment field is the compartment that was being turned to
+    LOG_CALIBRATION_RESUMED,
+    LOG_TIME_SYNCED,
+    NOSEND                   // codes are stored in 6 bits, see logrecord.h
 } log_number;
 
 typedef enum {
@@ -51,9 +73,25 @@ typedef enum {
     PREV_CALIB_STEP_COUNT_LSB,
     PREV_CALIB_STEP_COUNT_MSB,
     PREV_CALIB_EDGE_COUNT_LSB,
-    PREV_CALIB_EDGE_COUNT_MSB
+    PREV_CALIB_EDGE_COUNT_MSB,
+    LAST_DOSE_TIME_LSB,
+    LAST_DOSE_TIME_LSB1,
+    LAST_DOSE_TIME_LSB2,
+    LAST_DOSE_TIME_MSB
 } PillDispenserStatusArray;
 
+// Byte LOG_USE_STATUS: bit 0 is set when the log is in use, bits 1-7 are the location the log is about.
+#define LOG_IN_USE LOGRECORD_IN_USE
+#define LOG_COMPARTMENT_SHIFT LOGRECORD_LOCATION_SHIFT
+
+// Location of a log: bits 0-4 are the compartment of dispensing logs, bits 5-6 the carousel. Carousel 0 logs
+// have the same location as logs written before there were carousels. The compartment arguments and fields
+// of the log functions carry the whole location.
+#define LOG_COMPARTMENT_MASK 0x1F
+#define LOG_CAROUSEL_SHIFT 5
+#define LOG_MAX_CAROUSELS 4
+#define LOG_LOCATION(carousel, compartment) ((uint8_t)(((carousel) << LOG_CAROUSEL_SHIFT) | (compartment)))
+
 typedef enum {
     LOG_USE_STATUS,
     MESSAGE_CODE,
@@ -69,29 +107,54 @@ typedef struct DeviceStatus
     reboot_num rebootStatusCode;
     uint16_t prevCalibStepCount;
     uint16_t prevCalibEdgeCount;
+    uint32_t lastDoseTime; // unix time the last scheduled dose was started, 0 if never
+    uint8_t carousel;      // carousel the status is for, picks its EEPROM record and tags its logs
 
-    int unusedLogIndex; // index of log the program will use.
+    int unusedLogIndex; // index of log the program will use, only kept in the status of carousel 0.
 } DeviceStatus;
 
-uint16_t crc16(const uint8_t *data, size_t length);
 void appendCrcToBase8Array(uint8_t *base8Array, int *arrayLen);
 int getChecksum(uint8_t *base8Array, int *arrayLen);
 bool verifyDataIntegrity(uint8_t *base8Array, int *arrayLen);
-void reboot_sequence(struct DeviceStatus *ptrToStruct, const uint32_t bootTimestamp, ring_buffer *rb);
+void reboot_sequence(struct DeviceStatus *ptrToStruct, const uint32_t bootTimestamp, log_queue *queue);
+void restoreCarouselStatus(DeviceStatus *carousel, DeviceStatus *logDev, const uint32_t bootTimestamp, log_queue *queue);
 void enterLogToEeprom(uint8_t *base8Array, int *arrayLen, int logAddr);
 void zeroAllLogs();
-int createLogArray(uint8_t *array, int messageCode, uint32_t timestamp);
-int createPillDispenserStatusLogArray(uint8_t *array, uint8_t pillDispenseState, uint8_t rebootStatusCode, uint16_t prevCalibStepCount, uint16_t calibEdgeCount);
+int createPillDispenserStatusLogArray(uint8_t *array, uint8_t pillDispenseState, uint8_t rebootStatusCode, uint16_t prevCalibStepCount, uint16_t calibEdgeCount, uint32_t lastDoseTime);
 void updatePillDispenserStatus(struct DeviceStatus *ptrToStruct);
 bool readPillDispenserStatus(struct DeviceStatus *ptrToStruct);
 int findFirstAvailableLog();
 uint32_t getTimestampSinceBoot(const uint64_t bootTimestamp);
-void pushLogToEeprom(DeviceStatus *pillDispenserStatusStruct, log_number messageCode, uint32_t time_ms);
+void pushLogToEeprom(DeviceStatus *pillDispenserStatusStruct, log_number messageCode, uint8_t compartment, uint32_t time_ms);
+void pushRecordToEeprom(DeviceStatus *pillDispenserStatusStruct, const logrecord *record);
 void updateUnusedLogIndex(struct DeviceStatus *pillDispenserStatusStruct);
+bool readLogFromEeprom(int index, uint8_t *messageCode, uint8_t *compartment, uint32_t *timestamp);
+bool readLogRecord(int index, logrecord *record, int *slots);
+bool logHasCompartment(uint8_t messageCode);
+bool logTimeIsUtc(bool utcBefore, uint8_t messageCode);
+int formatLogMessage(char *dst, size_t size, uint8_t messageCode, uint8_t compartment);
+bool readWheelConfig(wheel *w);
+bool readCalibrationCache(uint8_t carousel, calib_cache *c);
+void updateCalibrationCache(uint8_t carousel, const calib_cache *c);
+void updateWheelConfig(const wheel *w);
 void printValidLogs();
 bool isValueInArray(int value, int *array, int size);
 
-void logger_log(DeviceStatus *dev, log_number num, uint32_t time_ms, ring_buffer *rb);
-void logger_try_send_lora(ring_buffer *rb, uint32_t time_ms);
+void logger_log(DeviceStatus *dev, log_number num, uint32_t time_ms, log_queue *queue);
+void logger_log_compartment(DeviceStatus *dev, log_number num, uint8_t compartment, uint32_t time_ms, log_queue *queue);
+void logger_log_values(DeviceStatus *dev, log_number num, uint8_t compartment, uint32_t time_ms,
+                       const int32_t *values, uint8_t count, log_queue *queue);
+void logger_log_record(DeviceStatus *dev, const logrecord *record, uint32_t time_ms, log_queue *queue);
+uint16_t logger_boot_count(void);
+bool logger_boot_synced(void);
+void logger_sync_time(DeviceStatus *dev, uint32_t unix_s, uint32_t time_ms, log_queue *queue);
+void logger_init_airtime(int spreading_factor, uint32_t time_ms);
+void logger_try_send_lora(log_queue *queue, uint32_t time_ms);
+uint32_t logger_get_wake_ms(log_queue *queue, uint32_t time_ms);
+void logger_start_export(uint16_t first, int unusedLogIndex);
+bool logger_export_active(void);
+void logger_queue_telemetry(void);
+void logger_maintain_storage(void);
+const blockdev *logger_flash_storage(void);
 
 #endif
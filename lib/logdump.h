@@ -0,0 +1,15 @@
+#ifndef LOGDUMP_H
+#define LOGDUMP_H
+
+#include "pico/stdlib.h"
+#include "logHandling.h"
+
+// Binary dump of the raw EEPROM and flash log over the stdio UART, in the frames of dumpframe.h, for tools/logpull.
+// A session is opened by a DUMPFRAME_START from the host or by button 3, and the host then reads the dump a chunk
+// at a time. Received bytes wake the main loop, which answers them between its other work.
+
+void logdump_init(const DeviceStatus *log_dev);
+void logdump_start(uint32_t time_ms);
+void logdump_poll(uint32_t time_ms);
+
+#endif
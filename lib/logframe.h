@@ -0,0 +1,69 @@
+#ifndef LOGFRAME_H
+#define LOGFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Packed log frames for sending stored logs over LoRa. Shared by the firmware and the host tools.
+//
+// Frame layout:
+//  0     LOGFRAME_TYPE, LOGFRAME_TYPE_BOOT_MS from firmware before there was a device time
+//  1     frame number, counts up from 0 in one export
+//  2-3   index of the first log slot in this frame, little endian
+//  4     number of log slots in this frame, with the value slots
+//  5     flags, LOGFRAME_FLAG_LAST on the last frame of an export
+//  6-9   device time of the first valid log in seconds (see epoch.h), little endian. ms since boot in a
+//        LOGFRAME_TYPE_BOOT_MS frame
+//  10-   message codes, one nibble each. Codes >= 15 are escaped as 0xF followed by the code in two nibbles.
+//        A log with a compartment is escaped as 0xF, the code with LOGFRAME_COMPARTMENT_FLAG set in two nibbles
+//        and the compartment in two nibbles. A log with values has LOGFRAME_VALUES_FLAG set in the escaped code and
+//        is followed by a nibble with the number of value slots after it, which the frame skips. Padded to a whole
+//        byte.
+//  then  for every valid log after the first: zigzag varint of the timestamp delta in seconds.
+
+#define LOGFRAME_TYPE 0x54
+#define LOGFRAME_TYPE_BOOT_MS 0x4C
+#define LOGFRAME_HEADER_LEN 10
+#define LOGFRAME_FLAG_LAST 0x01
+#define LOGFRAME_INVALID_CODE 0xFF // empty or corrupted slot, has no timestamp
+#define LOGFRAME_MAX_RECORDS 255
+#define LOGFRAME_COMPARTMENT_FLAG 0x80 // set on an escaped code that is followed by a compartment
+#define LOGFRAME_VALUES_FLAG 0x40      // set on an escaped code that is followed by its number of value slots
+#define LOGFRAME_MAX_SLOTS 16          // most slots one log can take with its values
+
+typedef struct logframe_record {
+    uint8_t code;
+    uint8_t compartment; // 0 for logs that are not about a compartment
+    uint32_t timestamp_s;
+    uint8_t slots;       // log slots the log takes, 1 for a log without values or an invalid slot
+} logframe_record;
+
+typedef struct logframe_header {
+    uint8_t frame_number;
+    uint16_t first_index;
+    uint8_t count;
+    uint8_t flags;
+    uint32_t base_s;
+    bool since_boot; // decoded from a LOGFRAME_TYPE_BOOT_MS frame, the timestamps are seconds since boot
+} logframe_header;
+
+// Position of an export in the log slots. The logs are a ring, so an export walks from the first slot asked for to
+// the unused one and wraps at the end of the log area. A frame's slots are consecutive, so none crosses the wrap.
+typedef struct logframe_cursor {
+    int next;     // index of the first log slot not yet sent
+    int left;     // log slots still to send
+    int capacity; // log slots in the ring
+} logframe_cursor;
+
+void logframe_cursor_start(logframe_cursor *c, int first, int unused, int capacity);
+int logframe_cursor_run(const logframe_cursor *c, int max);
+void logframe_cursor_advance(logframe_cursor *c, int slots);
+int logframe_encode(uint8_t *frame, int max_len, uint8_t frame_number, uint16_t first_index,
+                    const logframe_record *records, int count, int *encoded);
+void logframe_mark_last(uint8_t *frame);
+int logframe_varint_len(uint32_t v);
+int logframe_put_varint(uint8_t *buf, uint32_t v);
+int logframe_get_varint(const uint8_t *buf, const uint8_t *end, uint32_t *v);
+int logframe_decode(const uint8_t *frame, int len, logframe_header *hdr, logframe_record *records, int max_records);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef LOGQUEUE_H
+#define LOGQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fixed size queue of logs waiting to be sent. Higher priority logs are taken first and push lower ones out
+// when the queue is full. Only uses standard types so it builds for the host as well.
+
+#define LOGQUEUE_LEN 24
+#define LOGQUEUE_NO_COALESCE -1
+
+typedef enum {
+    LOG_PRIORITY_CRITICAL, // never pushed out by other logs, merged with ones of the same log when the queue is full
+    LOG_PRIORITY_NORMAL,
+    LOG_PRIORITY_LOW,      // progress logs, first to go when the queue is full
+    LOG_PRIORITY_COUNT
+} log_priority;
+
+typedef struct log_entry {
+    int num;              // log number
+    uint8_t compartment;  // compartment of the newest log merged into this entry, 0 for none
+    uint32_t timestamp;   // time of the newest log merged into this entry
+    uint16_t count;       // number of logs merged into this entry
+    uint8_t priority;     // log_priority
+    int16_t coalesce_key; // logs with the same key in a row are merged, LOGQUEUE_NO_COALESCE for never
+} log_entry;
+
+typedef struct log_queue {
+    log_entry entries[LOGQUEUE_LEN]; // oldest first
+    uint8_t len;
+    uint8_t high_water;
+    uint32_t coalesced;
+    uint32_t dropped[LOG_PRIORITY_COUNT];
+} log_queue;
+
+void logqueue_init(log_queue *q);
+bool logqueue_put(log_queue *q, int num, uint8_t compartment, uint32_t timestamp, log_priority priority, int16_t coalesce_key);
+bool logqueue_peek(const log_queue *q, log_entry *entry);
+bool logqueue_pop(log_queue *q, log_entry *entry);
+bool logqueue_empty(const log_queue *q);
+
+#endif
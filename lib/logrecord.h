@@ -0,0 +1,58 @@
+#ifndef LOGRECORD_H
+#define LOGRECORD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Log records in 8 byte slots, each ending in a CRC. Shared by the firmware and the host tools.
+// A simple event is one head slot, the same as logs have always been. A record with values takes continuation
+// slots after its head: the values are zigzag varints in the order the schema of the message code lists them.
+//
+// Head slot:
+//  0     LOGRECORD_IN_USE, location in bits 1-7
+//  1     message code in bits 0-5, LOGRECORD_DEVICE_TIME, LOGRECORD_HAS_FIELDS set if continuation slots follow
+//  2-5   timestamp, most significant byte first: device time in seconds (see epoch.h) with LOGRECORD_DEVICE_TIME,
+//        ms since boot for logs written before there was a device time
+//  6-7   CRC of bytes 0-5, most significant byte first
+//
+// Continuation slot:
+//  0     LOGRECORD_CONTINUATION, bit 0 is clear so readers that don't know it skip it
+//  1-5   value stream: the first slot starts with the number of bytes of varints that follow, then the varints
+//  6-7   CRC of the previous slot's CRC and bytes 0-5, so a slot left over from an older record doesn't match
+
+#define LOGRECORD_SLOT_LEN 8
+#define LOGRECORD_DATA_LEN 6 // slot bytes before the CRC
+#define LOGRECORD_MAX_FIELDS 4
+#define LOGRECORD_MAX_SLOTS 6 // a head and enough continuations for LOGRECORD_MAX_FIELDS 5 byte varints
+#define LOGRECORD_IN_USE 0x01
+#define LOGRECORD_LOCATION_SHIFT 1
+#define LOGRECORD_CODE_MASK 0x3F
+#define LOGRECORD_DEVICE_TIME 0x40
+#define LOGRECORD_HAS_FIELDS 0x80
+#define LOGRECORD_CONTINUATION 0x02
+
+typedef struct logrecord {
+    uint8_t code;
+    uint8_t location; // see LOG_LOCATION
+    uint32_t time_s;  // device time, or seconds since boot if since_boot is set
+    bool since_boot;  // written by firmware before there was a device time
+    uint8_t field_count;
+    int32_t fields[LOGRECORD_MAX_FIELDS];
+} logrecord;
+
+// Names of the values a message code carries, in the order they are stored.
+typedef struct logrecord_schema {
+    uint8_t code;
+    uint8_t field_count;
+    const char *names[LOGRECORD_MAX_FIELDS];
+} logrecord_schema;
+
+uint16_t crc16(const uint8_t *data, size_t length);
+int logrecord_encode(const logrecord *r, uint8_t *slots);
+int logrecord_decode(const uint8_t *slots, int count, logrecord *r);
+bool logrecord_is_continuation(const uint8_t *slot);
+const logrecord_schema *logrecord_schema_for(uint8_t code);
+int logrecord_format_fields(char *dst, size_t size, const logrecord *r);
+
+#endif
@@ -1,7 +1,19 @@
 #pragma once
 
+#define LORA_MAX_PAYLOAD 64
+
+typedef struct lora_downlink {
+    uint8_t port;
+    uint8_t len;
+    uint8_t data[LORA_MAX_PAYLOAD];
+} lora_downlink;
+
 bool lora_init(uart_inst_t *uart, uint TX_pin, uint RX_pin);
 bool lora_write(char *string);
 int lora_wait();
 int lora_read_uart(char *dst, int size);
-bool lora_message(const char *string);
\ No newline at end of file
+bool lora_message(const char *string);
+bool lora_message_hex(const uint8_t *data, int len);
+int lora_get_spreading_factor(void);
+void lora_poll(void);
+bool lora_get_downlink(lora_downlink *dl);
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Runtime counters and log2 histograms in fixed memory. Recording is a few instructions so it can be used on
+// hot paths, but only from the main loop. Only uses standard types so it builds for the host as well.
+
+#define METRICS_FRAME_TYPE 0x4D
+#define METRICS_BUCKETS 32 // bucket b holds values from 2^(b-1) to 2^b - 1, bucket 0 holds 0
+
+typedef enum {
+    METRIC_I2C_ERRORS,
+    METRIC_LORA_SENT,
+    METRIC_LORA_RETRIES,
+    METRIC_LOG_QUEUE_HIGH_WATER,
+    METRIC_FLASH_LOG_ERRORS, // records the flash log couldn't write, their slots are skipped
+    METRIC_COUNTER_COUNT
+} metric_counter;
+
+typedef enum {
+    METRIC_MAIN_LOOP_US,     // active time of one main loop iteration, sleep not included
+    METRIC_EEPROM_WRITE_US,  // including the wait for the previous write cycle
+    METRIC_LORA_LATENCY_MS,  // from the log to its uplink
+    METRIC_PIEZO_LATENCY_US, // from the pill hit to the state machine seeing it
+    METRIC_CALIBRATION_MS,
+    METRIC_HISTOGRAM_COUNT
+} metric_histogram;
+
+typedef struct metric_hist {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} metric_hist;
+
+typedef struct metric_summary {
+    uint32_t count;
+    uint32_t max;
+    uint8_t p50_bucket;
+    uint8_t p99_bucket;
+} metric_summary;
+
+typedef struct metrics_snapshot {
+    uint32_t counters[METRIC_COUNTER_COUNT];
+    metric_summary histograms[METRIC_HISTOGRAM_COUNT];
+    uint8_t counter_count;   // can be lower than METRIC_COUNTER_COUNT when decoded from an older firmware
+    uint8_t histogram_count; // histograms that fit in the frame
+} metrics_snapshot;
+
+extern uint32_t metrics_counters[METRIC_COUNTER_COUNT];
+extern metric_hist metrics_histograms[METRIC_HISTOGRAM_COUNT];
+
+static inline void metrics_count(metric_counter c) {
+    metrics_counters[c]++;
+}
+
+static inline void metrics_set(metric_counter c, uint32_t value) {
+    metrics_counters[c] = value;
+}
+
+static inline void metrics_observe(metric_histogram h, uint32_t value) {
+    metric_hist *m = &metrics_histograms[h];
+    int b = value ? 32 - __builtin_clz(value) : 0;
+    if (b >= METRICS_BUCKETS) b = METRICS_BUCKETS - 1;
+    m->buckets[b]++;
+    m->count++;
+    if (value > m->max) m->max = value;
+}
+
+static inline uint32_t metrics_bucket_limit(uint8_t bucket) {
+    return (bucket >= METRICS_BUCKETS - 1) ? UINT32_MAX : ((uint32_t)1 << bucket) - 1; // last bucket holds the rest
+}
+
+void metrics_reset(void);
+void metrics_take_snapshot(metrics_snapshot *s);
+int metrics_encode(const metrics_snapshot *s, uint8_t *frame, int max_len);
+bool metrics_decode(const uint8_t *frame, int len, metrics_snapshot *s);
+void metrics_print(const metrics_snapshot *s);
+void metrics_dump(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PIEZO_H
+#define PIEZO_H
+
+#include "pico/stdlib.h"
+
+#define PIEZO_MAX_SENSORS 4
+#define PIEZO_NO_SENSOR 0xFF
+
+typedef struct piezo_event {
+    uint32_t timestamp_us; // time of the falling edge that started the burst
+    uint16_t width_us;     // width of the longest qualified pulse in the burst
+    uint8_t pulses;        // number of qualified pulses in the burst
+} piezo_event;
+
+uint8_t piezo_init(uint pin);
+void piezo_flush(uint8_t sensor);
+bool piezo_get_drop(uint8_t sensor, piezo_event *event);
+uint32_t piezo_get_rejected_count(void);
+uint32_t piezo_get_overflow_count(void);
+
+#endif
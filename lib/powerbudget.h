@@ -0,0 +1,27 @@
+#ifndef POWERBUDGET_H
+#define POWERBUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Shares a limited number of motor slots between the carousels, so the supply never has to drive more motors
+// than it can. Motors that ask for a slot while none is free wait in line and get one in the order they asked.
+// Only uses standard types so it builds for the host as well.
+
+#define POWERBUDGET_MAX_MOTORS 8
+
+typedef struct power_budget {
+    uint8_t slots;                           // motors allowed to run at once
+    uint8_t holders;                         // bit per motor that holds a slot
+    uint8_t queue[POWERBUDGET_MAX_MOTORS];   // motors waiting for a slot, oldest first
+    uint8_t queued;
+} power_budget;
+
+void powerbudget_init(power_budget *pb, uint8_t slots);
+bool powerbudget_acquire(power_budget *pb, uint8_t motor);
+bool powerbudget_release(power_budget *pb, uint8_t motor);
+bool powerbudget_holds(const power_budget *pb, uint8_t motor);
+bool powerbudget_is_waiting(const power_budget *pb, uint8_t motor);
+uint8_t powerbudget_running(const power_budget *pb);
+
+#endif
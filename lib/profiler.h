@@ -0,0 +1,45 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Opt-in profiler for named code sections, enabled with the PROFILER CMake option (defines PROFILER_ENABLED).
+// When disabled the PROFILE_* macros compile to nothing. The clock is passed in, time_us_32 on the pico,
+// so the same instrumentation runs in host builds too. Only uses standard types.
+
+typedef enum {
+    PROF_LOOP,          // whole active part of a main loop iteration
+    PROF_EVENTS,        // draining the event queue, includes button 3 dumps
+    PROF_DOWNLINKS,
+    PROF_LORA_SEND,     // logger_try_send_lora
+    PROF_STATEMACHINE,
+    PROF_LOG_WRITE,     // writing a log to EEPROM
+    PROF_EEPROM_WAIT,   // waiting for the previous EEPROM write cycle
+    PROF_LORA_WRITE,    // lora_write, including the wait for the modem to answer
+    PROF_LORA_READ,     // lora_read_uart
+    PROF_SECTION_COUNT
+} profiler_section;
+
+typedef uint32_t (*profiler_clock)(void);
+
+#ifdef PROFILER_ENABLED
+#define PROFILE_INIT(clock) profiler_init(clock)
+#define PROFILE_BEGIN(section) uint32_t profile_start_##section = profiler_now_us()
+#define PROFILE_END(section) profiler_record(section, profiler_now_us() - profile_start_##section)
+#define PROFILE_DUMP() profiler_dump()
+#else
+#define PROFILE_INIT(clock)
+#define PROFILE_BEGIN(section)
+#define PROFILE_END(section)
+#define PROFILE_DUMP()
+#endif
+
+void profiler_init(profiler_clock clock);
+uint32_t profiler_now_us(void);
+void profiler_record(profiler_section section, uint32_t duration_us);
+uint32_t profiler_percentile_us(profiler_section section, uint32_t percent);
+void profiler_reset(void);
+void profiler_dump(void);
+
+#endif
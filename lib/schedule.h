@@ -0,0 +1,25 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHEDULE_MAX_DOSES 8
+
+typedef struct dose {
+    uint16_t minute_of_day; // UTC minutes after midnight, 0-1439
+    uint8_t pills;          // compartments to turn for this dose
+} dose;
+
+void schedule_init(uint32_t last_dose_s);
+bool schedule_set(const dose *doses, uint8_t count, uint32_t now_s);
+uint8_t schedule_get(dose *dst);
+void schedule_replan(void);
+bool schedule_dose_due(uint32_t now_s);
+uint8_t schedule_due_pills(void);
+void schedule_dose_started(uint32_t now_s);
+uint8_t schedule_take_missed(void);
+uint32_t schedule_last_dose_s(void);
+uint32_t schedule_ms_until_due(uint32_t now_s);
+
+#endif
@@ -1,42 +1,60 @@
 #ifndef STATEMACHINE_H
 #define STATEMACHINE_H
 
-#include "pico/stdlib.h"
-
-typedef enum state {
-    CALIBRATE,
-    HALF_CALIBRATE,
-    WAIT_FOR_DISPENSE,
-    DISPENSE,
-    CHECK_IF_DISPENSED,
-    PILL_NOT_DROPPED,
-    
-} state_enum;
-
-typedef struct sm {
-    state_enum state;
-    uint pills_dropped;
-    uint32_t time_ms;
-    uint32_t time_drop_started_ms;
-    uint8_t error_blink_counter;
-} state_machine;
-
-state_machine statemachine_get(uint times_stepper_turned) {
-    state_machine sm;
-    sm.pills_dropped = times_stepper_turned;
-    if (times_stepper_turned <= 0 || times_stepper_turned >= 7) {
-        sm.state = CALIBRATE;
-    } else {
-        sm.state = HALF_CALIBRATE;
-    }
-    sm.time_ms = to_ms_since_boot(get_absolute_time());
-    sm.time_drop_started_ms = 0;
-    sm.error_blink_counter = 0;
-    return sm;
-}
-
-void state_machine_update_time(state_machine *sm) {
-    sm->time_ms = to_ms_since_boot(get_absolute_time());
-}
-
-#endif
\ No newline at end of file
+#include <stdint.h>
+#include <stdbool.h>
+
+// The engine only uses standard types so it builds for the host as well as the pico.
+
+#define SM_NO_PARENT 0xFF
+#define SM_NO_TIMER 0
+#define SM_MAX_DEPTH 8 // deepest state nesting supported
+
+typedef uint8_t sm_state_id;
+
+typedef struct sm state_machine;
+typedef void (*sm_action)(state_machine *sm);
+typedef bool (*sm_guard)(state_machine *sm);
+
+typedef struct sm_state {
+    const char *name;
+    sm_state_id parent; // SM_NO_PARENT for top level states, transitions of the parent are tried after the state's own
+    sm_action entry;    // run when the state is entered, may be NULL
+    sm_action exit;     // run when the state is left, may be NULL
+    sm_action during;   // run on every tick that doesn't take a transition, may be NULL
+} sm_state;
+
+typedef struct sm_transition {
+    sm_state_id from;
+    uint32_t after_ms;  // SM_NO_TIMER or how long the machine must have been in 'from' before the transition is
+                        // possible, counted from when 'from' was entered, moves between its children don't restart it
+    sm_guard guard;     // transition is taken when this returns true, NULL means always
+    sm_action action;   // run after exiting 'from' and before entering 'to', may be NULL
+    sm_state_id to;
+} sm_transition;
+
+typedef struct sm_table {
+    const sm_state *states;           // indexed by state id
+    uint8_t state_count;
+    const sm_transition *transitions; // tried in order, first match wins
+    uint8_t transition_count;
+} sm_table;
+
+struct sm {
+    const sm_table *table;
+    sm_state_id state;
+    uint8_t depth;          // nesting level of the current state, 0 for a top level state
+    uint32_t time_ms;       // time of the current tick
+    uint32_t entered_ms[SM_MAX_DEPTH]; // time each state in the chain from the top level down to the current one was
+                                       // entered, indexed by nesting level
+    void *ctx;              // application data for actions and guards
+};
+
+void statemachine_init(state_machine *sm, const sm_table *table, sm_state_id initial, void *ctx, uint32_t time_ms);
+bool statemachine_tick(state_machine *sm, uint32_t time_ms);
+void statemachine_goto(state_machine *sm, sm_state_id to);
+uint32_t statemachine_time_in_state(const state_machine *sm);
+uint32_t statemachine_next_timer_ms(const state_machine *sm);
+const char *statemachine_state_name(const state_machine *sm);
+
+#endif
@@ -2,48 +2,61 @@
 #define STEPPER_H
 
 #include "hardware/pio.h"
+#include "board.h"
+#include "stepperdiv.h"
 
 #define STEPPER_CLOCKWISE true
 #define STEPPER_ANTICLOCKWISE false
 
-#define RPM_MAX 15.
-#define RPM_MIN 1.8
+#define STEPPER_MAX_MOTORS 8 // one per PIO state machine on pio0 and pio1
 
 typedef enum _stepper_pins{
-    BLUE = 2,
-    PINK = 3,
-    YELLOW = 6,
-    ORANGE = 13
+    BLUE = STEPPER_PIN_BLUE,
+    PINK = STEPPER_PIN_PINK,
+    YELLOW = STEPPER_PIN_YELLOW,
+    ORANGE = STEPPER_PIN_ORANGE
 } stepper_pins;
 
+typedef enum {
+    STEPPER_CALIBRATION_NONE,
+    STEPPER_CALIBRATION_FULL,
+    STEPPER_CALIBRATION_HALF
+} stepper_calibration;
+
 typedef struct stepper_ctx{
     uint pins[4];
     uint opto_fork_pin;
-    int8_t sequence_counter;
+    int8_t sequence_counter; // phase on the pins, 0 to 7 in clockwise order
     int16_t step_counter;
     uint64_t step_memory; // magic buffer... :D
     uint16_t step_max;
     uint16_t edge_steps;
     bool direction;
-    float speed;
+    uint16_t speed; // hundredths of an RPM
     bool stepper_calibrated;
     bool stepper_calibrating;
     bool running;
     PIO pio_instance;
     uint state_machine;
     uint program_offset;
+    // calibration in progress, used by the opto fork interrupt
+    uint8_t calibration;     // stepper_calibration
+    bool calibration_stage;  // true once the first edge of the hole has been seen
+    uint16_t original_speed; // speed to go back to after calibration
+    uint16_t resume_steps;   // half calibration: position to turn to afterwards
 } stepper_ctx;
 
 stepper_ctx stepper_get_ctx(void);
-void stepper_init(stepper_ctx *ctx, PIO pio, const uint *stepper_pins, const uint opto_fork_pin, const float rpm, const bool clockwise);
+void stepper_init(stepper_ctx *ctx, PIO pio, const uint *stepper_pins, const uint opto_fork_pin, const uint16_t rpm_x100, const bool clockwise);
 
 void stepper_turn_steps(stepper_ctx *ctx, const uint16_t steps);
 void stepper_turn_one_revolution(stepper_ctx *ctx);
-void stepper_set_speed(stepper_ctx *ctx, float rpm);
+void stepper_set_speed(stepper_ctx *ctx, uint16_t rpm_x100);
 void stepper_stop(stepper_ctx *ctx);
 void stepper_set_direction(stepper_ctx *ctx, bool clockwise);
 void stepper_calibrate(stepper_ctx *ctx);
-void stepper_half_calibrate(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint pills_dispensed);
+void stepper_half_calibrate(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint16_t position_steps);
+void stepper_resume(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint16_t position_steps, uint8_t phase_offset);
 
 bool stepper_is_running(const stepper_ctx *ctx);
 bool stepper_is_calibrated(const stepper_ctx *ctx);
@@ -52,5 +65,6 @@ uint16_t stepper_get_max_steps(const stepper_ctx *ctx);
 int16_t stepper_get_step_count(const stepper_ctx *ctx);
 bool stepper_get_direction(const stepper_ctx *ctx);
 uint16_t stepper_get_edge_steps(const stepper_ctx *ctx);
+uint8_t stepper_get_phase_offset(const stepper_ctx *ctx);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef STEPPERDIV_H
+#define STEPPERDIV_H
+
+#include <stdint.h>
+
+// Speed of the stepper motors and the PIO clock divider that gives it, without the SDK's float math.
+// Only uses standard types so it builds for the host as well.
+
+// Speeds are in hundredths of an RPM so no float math is needed, the RP2040 has no FPU.
+#define STEPPER_RPM(rpm) ((uint16_t)((rpm) * 100 + 0.5)) // for constants only, folded by the compiler
+#define RPM_MAX STEPPER_RPM(15)
+#define RPM_MIN STEPPER_RPM(1.8)
+
+// The PIO program takes 16 cycles per half step and a revolution is 4096 half steps, so the divider for a speed is
+// clk_hz * 60 / (16 * 4096 * rpm). In 16.8 fixed point with the speed in hundredths of an RPM that is
+// clk_khz * 46875 / (2 * rpm_x100), rounded to the nearest 1/256.
+#define STEPPER_CLKDIV_16_8(clk_khz, rpm_x100) \
+    ((uint32_t)(((uint64_t)(clk_khz) * 46875 + (rpm_x100)) / (2 * (uint32_t)(rpm_x100))))
+
+typedef struct stepper_clkdiv {
+    uint16_t div_int;
+    uint8_t div_frac; // 1/256 units
+} stepper_clkdiv;
+
+/**
+ * Calculates the PIO clock divider for a speed. Inlined, so constant speeds are folded to a constant divider.
+ *
+ * @param clk_khz  System clock in kHz.
+ * @param rpm_x100 Desired motor speed in hundredths of an RPM, clamped to RPM_MIN and RPM_MAX.
+ * @return The clock divider, fits 16.8 for RPM_MIN and up at 125 MHz.
+ */
+static inline stepper_clkdiv stepper_clkdiv_for(uint32_t clk_khz, uint16_t rpm_x100) {
+    if (rpm_x100 > RPM_MAX) rpm_x100 = RPM_MAX; // Cap the RPM value at the maximum RPM
+    if (rpm_x100 < RPM_MIN) rpm_x100 = RPM_MIN; // Ensure the RPM value is not below the minimum RPM
+
+    uint32_t div = STEPPER_CLKDIV_16_8(clk_khz, rpm_x100);
+    return (stepper_clkdiv){ .div_int = (uint16_t)(div >> 8), .div_frac = (uint8_t)(div & 0xFF) };
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include "pico/stdlib.h"
+
+#define SUPERVISOR_MAX_STEPPERS 4 // one stepper task per carousel motor
+
+// Tasks that must check in with the supervisor. The hardware watchdog is only fed while every live task
+// has checked in within its own deadline.
+typedef enum {
+    TASK_UI,      // main loop, live from supervisor_init()
+    TASK_STEPPER, // live while the motor turns, TASK_STEPPER + n for the motor of carousel n
+    TASK_STEPPER_LAST = TASK_STEPPER + SUPERVISOR_MAX_STEPPERS - 1,
+    TASK_EEPROM,  // live during an EEPROM transfer, blocks the main loop
+    TASK_LORA,    // live while waiting for the modem, blocks the main loop
+    TASK_COUNT
+} supervisor_task;
+
+void supervisor_init(uint32_t watchdog_ms, uint32_t ui_deadline_ms);
+void supervisor_start(supervisor_task task, uint32_t deadline_ms);
+void supervisor_checkin(supervisor_task task);
+void supervisor_stop(supervisor_task task);
+void supervisor_suspend(uint32_t max_ms);
+void supervisor_resume(void);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include "pico/stdlib.h"
+
+#define SECONDS_PER_DAY 86400u
+
+void wallclock_init(void);
+void wallclock_sync(uint32_t unix_s);
+bool wallclock_is_valid(void);
+uint32_t wallclock_now(void);
+uint32_t wallclock_get_sync_count(void);
+
+#endif
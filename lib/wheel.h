@@ -0,0 +1,30 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pill wheel geometry: how many compartments the wheel has and how far each one is from its nominal position.
+// Compartment 0 is the empty one over the opto fork hole that calibration finds, pills are in 1 to compartments - 1.
+// Only uses standard types so it builds for the host as well.
+
+#define WHEEL_MIN_COMPARTMENTS 4
+#define WHEEL_MAX_COMPARTMENTS 32
+#define WHEEL_ANGLE_UNITS 4096 // offsets are in 1/4096 of a revolution, about one motor step
+#define WHEEL_RECORD_LEN (1 + WHEEL_MAX_COMPARTMENTS) // compartments + offsets, does not include CRC
+
+typedef struct wheel {
+    uint8_t compartments;                  // including compartment 0
+    int8_t offset[WHEEL_MAX_COMPARTMENTS]; // correction of each compartment, offset[0] is always 0
+} wheel;
+
+void wheel_init(wheel *w, uint8_t compartments);
+bool wheel_set_compartments(wheel *w, uint8_t compartments);
+bool wheel_set_offset(wheel *w, uint8_t compartment, int8_t offset);
+uint8_t wheel_pills(const wheel *w);
+uint16_t wheel_position_steps(const wheel *w, uint16_t steps_per_rev, uint8_t compartment);
+uint16_t wheel_turn_steps(const wheel *w, uint16_t steps_per_rev, uint8_t from);
+void wheel_encode(const wheel *w, uint8_t *dst);
+bool wheel_decode(wheel *w, const uint8_t *src);
+
+#endif
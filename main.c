@@ -10,237 +10,958 @@
 #include "logHandling.h"
 #include "statemachine.h"
 #include "led.h"
+#include "piezo.h"
+#include "events.h"
+#include "wallclock.h"
+#include "schedule.h"
+#include "commands.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "breadcrumb.h"
+#include "supervisor.h"
+#include "powerbudget.h"
+#include "chiptemp.h"
+#include "logdump.h"
 #include <time.h>
 #include "stdlib.h"
-#include "hardware/watchdog.h"
 
 #include "hardware/pio.h"
+#include "board.h" // pins, pill wheel and timings, see lib/boards
 
-#define UART_TX_PIN 4
-#define UART_RX_PIN 5
 #define EEPROM_ARR_LENGTH 64
 #define LOG_START_ADDR 0
 
-#define OPTO_FORK_PIN 28
-#define PIEZO_PIN 27
-#define BUTTON1 7
-#define BUTTON2 8
-#define BUTTON3 9
-#define NUMBER_OF_DEBOUNCED_BUTTONS 2
+#define NUMBER_OF_DEBOUNCED_BUTTONS 3
 
-#define STEPPER_SPEED_RPM 10
 #define PILL_DROP_MARGIN_MS 100
 
-#define PILL_DROP_DELAY_MS 5000
-#define PILL_NOT_DROPPED_DELAY_MS ((60000 / STEPPER_SPEED_RPM) / 8) + PILL_DROP_MARGIN_MS
+// limits for timings set over LoRa
+#define PILL_DROP_DELAY_MIN_MS 1000
+#define PILL_DROP_DELAY_MAX_MS 600000
+#define PILL_NOT_DROPPED_DELAY_MIN_MS 500
+#define PILL_NOT_DROPPED_DELAY_MAX_MS 60000
 
 #define ERROR_BLINK_TIMES 5
-#define MAX_PILLS 7
-#define MAX_TURNS 8
-#define MAX_VALID_MAX_STEP_COUNT_BOUND_MIN 4000
-#define MAX_VALID_MAX_STEP_COUNT_BOUND_MAX 5500
 
 #define EEPROM_BAUD_RATE 1000000
 #define EEPROM_WRITE_CYCLE_MAX_MS 5
 
-#define WATCHDOG_WORST_CASE_SCEN 2000
+#define WATCHDOG_TIMEOUT_MS 100 // the supervisor feeds the watchdog only while every task is on time
+#define UI_DEADLINE_MS (MAX_SLEEP_MS + 500) // a main loop pass, not counting EEPROM and LoRa waits
+// how long the motor may turn after it was started in a state
+#define CALIBRATION_BUDGET_MS ((uint32_t)4 * 60000 * 100 / RPM_MAX) // full calibration turns up to three revolutions
+#define DROP_TURN_BUDGET_MS (60000 / STEPPER_SPEED_RPM / 2) // twice a turn of the smallest wheel, a quarter turn
 
+#define MAX_SLEEP_MS 1000
+#define MOTOR_POLL_MS 10 // PIO has no done irq, so poll this often while the motor turns
+#define DROP_POLL_MS 10 // how often to check for a finished piezo burst
+#define TELEMETRY_INTERVAL_MS (6 * 60 * 60 * 1000) // metrics uplink every 6 hours
+
+#define LED_CAROUSEL 0 // the leds show what this carousel is doing
+
+#if CAROUSEL_COUNT > SUPERVISOR_MAX_STEPPERS || CAROUSEL_COUNT > LOG_MAX_CAROUSELS || CAROUSEL_COUNT > PIEZO_MAX_SENSORS
+#error "The board has more carousels than the supervisor, the logs or the piezo driver can tell apart"
+#endif
+
+typedef struct carousel_pins {
+    uint stepper[4]; // blue, pink, yellow, orange
+    uint opto_fork;
+    uint piezo;
+} carousel_pins;
+
+static const carousel_pins carousel_pin_table[CAROUSEL_COUNT] = CAROUSEL_PINS;
+static const eeprom_chip eeprom_chips[EEPROM_CHIP_COUNT] = EEPROM_CHIPS;
 
-static bool calib_btn_pressed = false;
-static bool dispense_btn_pressed = false;
 
 void button_handler(uint gpio, uint32_t mask) {
-    if (gpio == BUTTON1) {
-        if (mask & GPIO_IRQ_EDGE_FALL) {
-            calib_btn_pressed = true;
-        } 
-        if (mask & GPIO_IRQ_EDGE_RISE) {
-            calib_btn_pressed = false;
+    if (mask & GPIO_IRQ_EDGE_FALL) {
+        events_post(EVENT_BUTTON, gpio); // wake the main loop, it hands the press to the carousels
+    }
+}
+
+typedef enum {
+    CALIBRATE,
+    HALF_CALIBRATE,
+    CALIBRATING,
+    WAIT_FOR_DISPENSE,
+    DISPENSE_CYCLE, // parent of the dispensing states below
+    DISPENSE,
+    CHECK_IF_DISPENSED,
+    PILL_NOT_DROPPED,
+    STATE_COUNT
+} state_enum;
+
+// Dispense pipeline of one carousel. Every carousel runs its own state machine, they only share the leds,
+// the buttons and the power budget of the motors.
+typedef struct dispenser {
+    uint8_t carousel;         // carousel number from 0, also the motor's number in the power budget
+    stepper_ctx *step_ctx;
+    uint8_t piezo;            // piezo sensor under the carousel
+    DeviceStatus *dev_status; // status of this carousel
+    DeviceStatus *log_dev;    // status of carousel 0, keeps the log index
+    log_queue *logq;
+    power_budget *power;
+    wheel wheel;
+    calib_cache calib;        // last full calibrations, the newest one matches dev_status
+    uint8_t calib_confidence; // how far the calibration can be trusted at boot, see calibcache_confidence()
+    bool full_calibration;    // the calibration running is a full one
+    uint pills_dropped;
+    uint dose_remaining; // compartments left to turn in the current dose
+    uint32_t time_drop_started_ms;
+    uint8_t error_blink_counter;
+    bool leds;                // the leds show this carousel
+    bool calibrate_requested; // calibration requested with the button or over LoRa
+    bool button_dose;         // dispense button pressed while waiting
+    uint remote_pills;        // pills requested over LoRa, 0 if none
+    uint scheduled_pills;     // pills of a scheduled dose handed out by the coordinator, 0 if none
+    uint32_t drop_delay_ms; // time between pill drops
+    uint32_t drop_timeout_ms; // time to wait for the piezo before a pill counts as not dropped
+} dispenser;
+
+// Runs the dispense pipelines of all carousels side by side.
+typedef struct coordinator {
+    dispenser carousels[CAROUSEL_COUNT];
+    state_machine machines[CAROUSEL_COUNT];
+    power_budget power;
+    log_queue *logq;
+} coordinator;
+
+/**
+ * Logs an event of the carousel with values, named by the schema of the log number (see logrecord.c).
+ *
+ * @param sm     Pointer to the state machine.
+ * @param num    Log number to store and send.
+ * @param values Pointer to the values, NULL if count is 0.
+ * @param count  Number of values.
+ */
+static void dispenser_log_values(state_machine *sm, log_number num, const int32_t *values, uint8_t count) {
+    dispenser *d = sm->ctx;
+    logger_log_values(d->log_dev, num, LOG_LOCATION(d->carousel, 0), sm->time_ms, values, count, d->logq);
+}
+
+/**
+ * Logs an event of the carousel with the current state machine time.
+ *
+ * @param sm  Pointer to the state machine.
+ * @param num Log number to store and send.
+ */
+static void dispenser_log(state_machine *sm, log_number num) {
+    dispenser_log_values(sm, num, NULL, 0);
+}
+
+/**
+ * Turns the leds off if they show this carousel.
+ *
+ * @param sm Pointer to the state machine.
+ */
+static void dispenser_led_off(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds) led_off();
+}
+
+/**
+ * Stores the reboot status and pill count to EEPROM and logs an event with values. Dispensing logs get the
+ * compartment the wheel is turning to.
+ *
+ * @param sm     Pointer to the state machine.
+ * @param code   What the device is doing, used to resume after a reboot.
+ * @param num    Log number to store and send.
+ * @param values Pointer to the values of the log, NULL if count is 0.
+ * @param count  Number of values.
+ */
+static void dispenser_save_status_values(state_machine *sm, reboot_num code, log_number num, const int32_t *values, uint8_t count) {
+    dispenser *d = sm->ctx;
+    d->dev_status->rebootStatusCode = code;
+    d->dev_status->pillDispenseState = d->pills_dropped;
+    updatePillDispenserStatus(d->dev_status);
+    uint8_t compartment = logHasCompartment(num) ? d->pills_dropped + 1 : 0;
+    logger_log_values(d->log_dev, num, LOG_LOCATION(d->carousel, compartment), sm->time_ms, values, count, d->logq);
+}
+
+/**
+ * Stores the reboot status and pill count to EEPROM and logs an event.
+ *
+ * @param sm   Pointer to the state machine.
+ * @param code What the device is doing, used to resume after a reboot.
+ * @param num  Log number to store and send.
+ */
+static void dispenser_save_status(state_machine *sm, reboot_num code, log_number num) {
+    dispenser_save_status_values(sm, code, num, NULL, 0);
+}
+
+// GUARDS
+
+static bool motor_granted(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return powerbudget_acquire(d->power, d->carousel); // waits in line while the other motors use the budget
+}
+
+static bool calib_requested(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->calibrate_requested && motor_granted(sm);
+}
+
+static bool dispense_button_pressed(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->button_dose;
+}
+
+static bool remote_dispense_requested(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->remote_pills > 0;
+}
+
+static bool scheduled_dose_due(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->scheduled_pills > 0;
+}
+
+static bool dose_done(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->dose_remaining == 0;
+}
+
+static bool calibration_invalid(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->calib_confidence < CALIBCACHE_HALF_CONFIDENCE;
+}
+
+/**
+ * Checks if the wheel can be taken to be where it was left: the last shutdown was clean, so the motor didn't move
+ * since, the phase it rests at is known and the calibration history agrees with itself.
+ *
+ * @param d Pointer to the dispenser.
+ * @return true if the calibration can be restored without turning the wheel.
+ */
+static bool dispenser_can_resume(const dispenser *d) {
+    return d->dev_status->rebootStatusCode == IDLE && d->calib.phase != CALIBCACHE_NO_PHASE &&
+           d->calib_confidence >= CALIBCACHE_RESUME_CONFIDENCE;
+}
+
+static bool calibration_trusted(state_machine *sm) {
+    return dispenser_can_resume(sm->ctx);
+}
+
+static bool motor_stopped(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return !stepper_is_calibrating(d->step_ctx) && !stepper_is_running(d->step_ctx);
+}
+
+static bool dispenser_empty(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return d->pills_dropped >= wheel_pills(&d->wheel); // maximum number of pills dropped (or didnt drop but was supposed to)
+}
+
+static bool drop_delay_passed(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return (sm->time_ms - d->time_drop_started_ms) > d->drop_delay_ms && motor_granted(sm);
+}
+
+static bool drop_timed_out(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    return motor_stopped(sm) && statemachine_time_in_state(sm) > d->drop_timeout_ms;
+}
+
+static bool pill_detected(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    piezo_event drop;
+    if (!motor_stopped(sm) || !piezo_get_drop(d->piezo, &drop)) return false; // consumes the drop when the guard passes
+    metrics_observe(METRIC_PIEZO_LATENCY_US, time_us_32() - drop.timestamp_us);
+    return true;
+}
+
+static bool blinks_done(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    // 2 times the error blink times because led_error_toggle returns true when state changes not when leds go on.
+    // The other carousels have no leds to blink and go on right away.
+    return !d->leds || d->error_blink_counter >= (2 * ERROR_BLINK_TIMES);
+}
+
+// STATE ACTIONS
+
+static void calibrate_entry(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    d->step_ctx->stepper_calibrated = false; // set stepper calibrated status to false.
+    d->button_dose = false; // doses handed out before the wheel ran empty or was recalibrated are void
+    d->remote_pills = 0;
+    d->scheduled_pills = 0;
+}
+
+static void calibrate_during(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds) led_wait_toggle(sm->time_ms); // toggling all leds on and off while waiting for a button press.
+}
+
+static void calibrating_during(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds) led_calibration_toggle(sm->time_ms); // toggling leds in a nice pattern.
+}
+
+static void wait_for_dispense_entry(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds) led_on(); // turn leds on when user can press the button to start dispensing.
+}
+
+static void dispense_cycle_exit(state_machine *sm) {
+    dispenser_led_off(sm);
+}
+
+static void check_if_dispensed_during(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds) led_run_toggle(sm->time_ms); // pretty lights while the stepper turns and we wait for the drop
+}
+
+static void pill_not_dropped_entry(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    d->error_blink_counter = 0;
+}
+
+static void pill_not_dropped_during(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    if (d->leds && led_error_toggle(sm->time_ms)) d->error_blink_counter++;
+}
+
+// TRANSITION ACTIONS
+
+static void start_full_calibration(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    stepper_calibrate(d->step_ctx); // calibrate :D
+    d->calibrate_requested = false;
+    d->full_calibration = true;
+    dispenser_led_off(sm);
+    d->pills_dropped = 0; // reset pill dropping count.
+    dispenser_save_status(sm, FULL_CALIBRATION, LOG_FULL_CALIBRATION);
+}
+
+static void start_half_calibration(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    // half calibrate takes: max steps, hole width, steps to the compartment the wheel was at
+    uint16_t position = wheel_position_steps(&d->wheel, d->dev_status->prevCalibStepCount, d->pills_dropped);
+    stepper_half_calibrate(d->step_ctx, d->dev_status->prevCalibStepCount, d->dev_status->prevCalibEdgeCount, position);
+    d->full_calibration = false;
+    dispenser_log(sm, LOG_HALF_CALIBRATION);
+}
+
+static void resume_calibration(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    uint16_t position = wheel_position_steps(&d->wheel, d->dev_status->prevCalibStepCount, d->pills_dropped);
+    stepper_resume(d->step_ctx, d->dev_status->prevCalibStepCount, d->dev_status->prevCalibEdgeCount, position, d->calib.phase);
+    int32_t values[] = {d->dev_status->prevCalibStepCount, d->calib_confidence};
+    dispenser_log_values(sm, LOG_CALIBRATION_RESUMED, values, 2);
+}
+
+static void save_calibration(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    uint32_t calibration_ms = statemachine_time_in_state(sm); // still the time in CALIBRATING
+    metrics_observe(METRIC_CALIBRATION_MS, calibration_ms);
+    d->dev_status->prevCalibStepCount = stepper_get_max_steps(d->step_ctx);
+    d->dev_status->prevCalibEdgeCount = stepper_get_edge_steps(d->step_ctx);
+    if (d->full_calibration) {
+        calibcache_add(&d->calib, d->dev_status->prevCalibStepCount, d->dev_status->prevCalibEdgeCount, chiptemp_read_c());
+    }
+    d->calib.phase = stepper_get_phase_offset(d->step_ctx); // a half calibration may end in another phase
+    updateCalibrationCache(d->carousel, &d->calib);
+    int32_t values[] = {d->dev_status->prevCalibStepCount, d->dev_status->prevCalibEdgeCount, (int32_t)calibration_ms};
+    dispenser_save_status_values(sm, IDLE, LOG_CALIBRATION_FINISHED, values, 3);
+}
+
+static void log_button_press(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    d->dose_remaining = wheel_pills(&d->wheel); // button dispenses everything that is left
+    d->button_dose = false;
+    dispenser_log(sm, LOG_BUTTON_PRESS);
+    dispenser_led_off(sm);
+}
+
+static void start_remote_dose(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    d->dose_remaining = d->remote_pills;
+    d->remote_pills = 0;
+    dispenser_led_off(sm);
+}
+
+static void start_scheduled_dose(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    d->dose_remaining = d->scheduled_pills;
+    d->scheduled_pills = 0;
+    dispenser_log(sm, LOG_SCHEDULED_DOSE);
+    dispenser_led_off(sm);
+}
+
+static void log_dispenser_empty(state_machine *sm) {
+    dispenser_log(sm, LOG_DISPENSER_EMPTY);
+}
+
+static void start_drop(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    stepper_turn_steps(d->step_ctx, wheel_turn_steps(&d->wheel, stepper_get_max_steps(d->step_ctx), d->pills_dropped)); // turn to the next compartment.
+    d->time_drop_started_ms = sm->time_ms;
+    d->dose_remaining--;
+    piezo_flush(d->piezo); // forget anything the sensor picked up before this drop
+    dispenser_save_status(sm, DISPENSING, LOG_DISPENSE);
+}
+
+static void pill_dispensed(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    dispenser_led_off(sm);
+    d->pills_dropped++;
+    int32_t drop_ms = (int32_t)(sm->time_ms - d->time_drop_started_ms);
+    dispenser_save_status_values(sm, IDLE, LOG_PILL_DISPENSED, &drop_ms, 1);
+}
+
+static void pill_not_dropped(state_machine *sm) {
+    dispenser *d = sm->ctx;
+    dispenser_led_off(sm);
+    d->pills_dropped++; // increment turned count
+    int32_t waited_ms = (int32_t)(sm->time_ms - d->time_drop_started_ms);
+    dispenser_save_status_values(sm, IDLE, LOG_PILL_ERROR, &waited_ms, 1);
+}
+
+static const sm_state dispenser_states[STATE_COUNT] = {
+    [CALIBRATE]          = {"CALIBRATE",          SM_NO_PARENT,   calibrate_entry,         NULL,                calibrate_during},
+    [HALF_CALIBRATE]     = {"HALF_CALIBRATE",     SM_NO_PARENT,   NULL,                    NULL,                NULL},
+    [CALIBRATING]        = {"CALIBRATING",        SM_NO_PARENT,   NULL,                    NULL,                calibrating_during},
+    [WAIT_FOR_DISPENSE]  = {"WAIT_FOR_DISPENSE",  SM_NO_PARENT,   wait_for_dispense_entry, NULL,                NULL},
+    [DISPENSE_CYCLE]     = {"DISPENSE_CYCLE",     SM_NO_PARENT,   NULL,                    dispense_cycle_exit, NULL},
+    [DISPENSE]           = {"DISPENSE",           DISPENSE_CYCLE, NULL,                    NULL,                NULL},
+    [CHECK_IF_DISPENSED] = {"CHECK_IF_DISPENSED", DISPENSE_CYCLE, NULL,                    NULL,                check_if_dispensed_during},
+    [PILL_NOT_DROPPED]   = {"PILL_NOT_DROPPED",   DISPENSE_CYCLE, pill_not_dropped_entry,  NULL,                pill_not_dropped_during},
+};
+
+static const sm_transition dispenser_transitions[] = {
+    // from              timer        guard                      action                  to
+    {CALIBRATE,          SM_NO_TIMER, calib_requested,           start_full_calibration, CALIBRATING},
+    {HALF_CALIBRATE,     SM_NO_TIMER, calibration_invalid,       NULL,                   CALIBRATE},
+    {HALF_CALIBRATE,     SM_NO_TIMER, calibration_trusted,       resume_calibration,     WAIT_FOR_DISPENSE},
+    {HALF_CALIBRATE,     SM_NO_TIMER, motor_granted,             start_half_calibration, CALIBRATING},
+    {CALIBRATING,        SM_NO_TIMER, motor_stopped,             save_calibration,       WAIT_FOR_DISPENSE},
+    {WAIT_FOR_DISPENSE,  SM_NO_TIMER, dispense_button_pressed,   log_button_press,       DISPENSE},
+    {WAIT_FOR_DISPENSE,  SM_NO_TIMER, remote_dispense_requested, start_remote_dose,      DISPENSE},
+    {WAIT_FOR_DISPENSE,  SM_NO_TIMER, scheduled_dose_due,        start_scheduled_dose,   DISPENSE},
+    {DISPENSE,           SM_NO_TIMER, dispenser_empty,           log_dispenser_empty,    CALIBRATE},
+    {DISPENSE,           SM_NO_TIMER, dose_done,                 NULL,                   WAIT_FOR_DISPENSE},
+    {DISPENSE,           SM_NO_TIMER, drop_delay_passed,         start_drop,             CHECK_IF_DISPENSED},
+    {CHECK_IF_DISPENSED, SM_NO_TIMER, pill_detected,             pill_dispensed,         DISPENSE},
+    {CHECK_IF_DISPENSED, SM_NO_TIMER, drop_timed_out,            pill_not_dropped,       PILL_NOT_DROPPED},
+    {PILL_NOT_DROPPED,   SM_NO_TIMER, blinks_done,               NULL,                   DISPENSE},
+};
+
+static const sm_table dispenser_table = {
+    dispenser_states, STATE_COUNT,
+    dispenser_transitions, count_of(dispenser_transitions)
+};
+
+/**
+ * Loads the calibration history of a carousel and scores it against the temperature now. A calibration in the
+ * status record that the history doesn't have, made before the history was kept, is added without a temperature.
+ *
+ * @param d      Pointer to the dispenser.
+ * @param temp_c Chip temperature now.
+ */
+static void dispenser_load_calibration(dispenser *d, int8_t temp_c) {
+    calibcache_init(&d->calib);
+    readCalibrationCache(d->carousel, &d->calib);
+    calib_sample newest;
+    if (!calibcache_newest(&d->calib, &newest) || newest.step_max != d->dev_status->prevCalibStepCount ||
+        newest.edge_steps != d->dev_status->prevCalibEdgeCount) {
+        calibcache_add(&d->calib, d->dev_status->prevCalibStepCount, d->dev_status->prevCalibEdgeCount, CALIBCACHE_NO_TEMP);
+    }
+    d->calib_confidence = calibcache_confidence(&d->calib, MAX_VALID_MAX_STEP_COUNT_BOUND_MIN, MAX_VALID_MAX_STEP_COUNT_BOUND_MAX, temp_c);
+}
+
+/**
+ * Picks the state to start in based on how many pills were dispensed before the reboot and the stored calibration.
+ *
+ * @param d Pointer to the dispenser, after dispenser_load_calibration().
+ * @return CALIBRATE if the wheel is empty, or full with no calibration to go on. HALF_CALIBRATE if dispensing should
+ *         resume, or the wheel is full after a clean shutdown with a valid calibration stored. HALF_CALIBRATE restores
+ *         a trusted calibration without turning, see dispenser_can_resume().
+ */
+static state_enum dispenser_initial_state(const dispenser *d) {
+    if (d->pills_dropped >= wheel_pills(&d->wheel)) {
+        return CALIBRATE;
+    }
+    if (d->pills_dropped == 0 &&
+        (d->dev_status->rebootStatusCode != IDLE || d->calib_confidence < CALIBCACHE_HALF_CONFIDENCE)) {
+        return CALIBRATE;
+    }
+    return HALF_CALIBRATE;
+}
+
+// Watchdog budget of the motor in each state, 0 if the motor is never started in the state.
+static const uint32_t stepper_budget_ms[STATE_COUNT] = {
+    [CALIBRATING]        = CALIBRATION_BUDGET_MS,
+    [CHECK_IF_DISPENSED] = DROP_TURN_BUDGET_MS
+};
+
+/**
+ * Checks if the carousel is in a state that starts the motor as soon as it gets a slot of the power budget.
+ *
+ * @param sm Pointer to the state machine.
+ * @return true if the carousel should keep its place in line.
+ */
+static bool motor_wanted(const state_machine *sm) {
+    const dispenser *d = sm->ctx;
+    switch (sm->state) {
+    case CALIBRATE:
+        return d->calibrate_requested;
+    case HALF_CALIBRATE:
+    case DISPENSE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Supervises the motor with the budget of the state it was started in, until it stops. A stopped motor gives its
+ * slot of the power budget back, and so does a carousel that no longer waits for one.
+ *
+ * @param sm            Pointer to the state machine.
+ * @param state_changed true if the last tick took a transition.
+ * @return true if a slot was freed for a carousel that waits for one.
+ */
+static bool supervise_motor(state_machine *sm, bool state_changed) {
+    dispenser *d = sm->ctx;
+    if (motor_stopped(sm)) {
+        supervisor_stop(TASK_STEPPER + d->carousel);
+        if (!motor_wanted(sm)) return powerbudget_release(d->power, d->carousel);
+    } else if (state_changed && stepper_budget_ms[sm->state] > 0) {
+        supervisor_start(TASK_STEPPER + d->carousel, stepper_budget_ms[sm->state]);
+    }
+    return false;
+}
+
+/**
+ * Calculates the default time to wait for the piezo after a drop: the time the motor takes to turn one compartment
+ * plus a margin.
+ *
+ * @param w Pointer to the pill wheel geometry.
+ * @return Timeout in milliseconds.
+ */
+static uint32_t drop_timeout_default_ms(const wheel *w) {
+    return (60000 / STEPPER_SPEED_RPM) / w->compartments + PILL_DROP_MARGIN_MS;
+}
+
+/**
+ * Calculates how long the main loop can sleep in the current state before it has something to do.
+ * Button and piezo interrupts wake the loop earlier.
+ *
+ * @param sm Pointer to the state machine.
+ * @return Milliseconds to sleep, 0 if the state should be run again right away.
+ */
+static uint32_t state_wake_ms(const state_machine *sm) {
+    const dispenser *d = sm->ctx;
+    uint32_t wake = statemachine_next_timer_ms(sm);
+    uint32_t elapsed = sm->time_ms - d->time_drop_started_ms;
+    switch (sm->state) {
+    case CALIBRATE:
+    case PILL_NOT_DROPPED:
+        return MIN(wake, led_get_wake_ms(sm->time_ms)); // only the led pattern changes until something happens
+    case CALIBRATING:
+    case CHECK_IF_DISPENSED:
+        return MIN(wake, MOTOR_POLL_MS); // PIO has no done irq and piezo bursts close on a timeout
+    case WAIT_FOR_DISPENSE:
+        return MIN(wake, schedule_ms_until_due(wallclock_now()));
+    case DISPENSE:
+        if (powerbudget_is_waiting(d->power, d->carousel)) return wake; // asked again when a motor stops
+        return (elapsed > d->drop_delay_ms) ? 0 : d->drop_delay_ms - elapsed + 1;
+    default:
+        return wake;
+    }
+}
+
+/**
+ * Checks if the carousel's motor is turning or about to, so it mustn't be interrupted.
+ *
+ * @param sm Pointer to the state machine.
+ * @return true if the motor is busy.
+ */
+static bool dispenser_motor_busy(const state_machine *sm) {
+    const dispenser *d = sm->ctx;
+    return sm->state == CALIBRATING || stepper_is_running(d->step_ctx);
+}
+
+/**
+ * Runs the part of a command received over LoRa that is about one carousel. Commands only set flags so they finish
+ * quickly, the state machine does the actual work on its next tick.
+ *
+ * @param sm  Pointer to the state machine.
+ * @param cmd Pointer to the decoded command.
+ * @return true if the command was accepted, false if it can't be run in the current state.
+ */
+static bool dispenser_execute(state_machine *sm, const command *cmd) {
+    dispenser *d = sm->ctx;
+    switch (cmd->opcode) {
+    case CMD_CALIBRATE:
+        if (dispenser_motor_busy(sm)) return false; // don't interrupt the motor
+        d->calibrate_requested = true;
+        if (sm->state != CALIBRATE) statemachine_goto(sm, CALIBRATE);
+        return true;
+    case CMD_DISPENSE_NOW:
+        if (sm->state != WAIT_FOR_DISPENSE) return false;
+        d->remote_pills = cmd->args.pills;
+        return true;
+    case CMD_SET_TIMING:
+        if (cmd->args.timing.param == TIMING_PILL_DROP_DELAY) {
+            if (cmd->args.timing.value_ms < PILL_DROP_DELAY_MIN_MS || cmd->args.timing.value_ms > PILL_DROP_DELAY_MAX_MS) return false;
+            d->drop_delay_ms = cmd->args.timing.value_ms;
+        } else {
+            if (cmd->args.timing.value_ms < PILL_NOT_DROPPED_DELAY_MIN_MS || cmd->args.timing.value_ms > PILL_NOT_DROPPED_DELAY_MAX_MS) return false;
+            d->drop_timeout_ms = cmd->args.timing.value_ms;
         }
-    } else {
-        if (mask & GPIO_IRQ_EDGE_FALL) {
-            dispense_btn_pressed = true;
-        } 
-        if (mask & GPIO_IRQ_EDGE_RISE) {
-            dispense_btn_pressed = false;
+        return true;
+    case CMD_SET_WHEEL:
+        if (!wheel_set_compartments(&d->wheel, cmd->args.compartments)) return false;
+        d->drop_timeout_ms = drop_timeout_default_ms(&d->wheel);
+        d->pills_dropped = 0; // old positions mean nothing on a new wheel, it has to be refilled and calibrated
+        d->dev_status->rebootStatusCode = IDLE;
+        d->dev_status->pillDispenseState = 0;
+        updatePillDispenserStatus(d->dev_status);
+        if (sm->state != CALIBRATE) statemachine_goto(sm, CALIBRATE);
+        return true;
+    case CMD_SET_COMPARTMENT_OFFSET:
+        return wheel_set_offset(&d->wheel, cmd->args.offset.compartment, cmd->args.offset.offset);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Stores the time of the last scheduled dose in the status of every carousel that has an older one, so the doses up
+ * to it aren't counted as missed after a reboot.
+ *
+ * @param co     Pointer to the coordinator.
+ * @param dose_s Unix time of the dose.
+ */
+static void coordinator_store_last_dose(coordinator *co, uint32_t dose_s) {
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        DeviceStatus *status = co->carousels[i].dev_status;
+        if (dose_s <= status->lastDoseTime) continue;
+        status->lastDoseTime = dose_s;
+        updatePillDispenserStatus(status);
+    }
+}
+
+/**
+ * Runs a command received over LoRa. Commands about the whole device are run here, the rest go to the carousel the
+ * command names or to all of them. All carousels have the same wheel, it is stored once.
+ *
+ * @param co  Pointer to the coordinator.
+ * @param cmd Pointer to the decoded command.
+ * @return true if the command was accepted, false if it can't be run in the current state. A command for all
+ *         carousels is rejected if any of them couldn't run it, the others still do.
+ */
+static bool coordinator_execute(coordinator *co, const command *cmd) {
+    switch (cmd->opcode) {
+    case CMD_SET_SCHEDULE: {
+        uint32_t now_s = wallclock_now();
+        if (!schedule_set(cmd->args.schedule.doses, cmd->args.schedule.count, now_s)) return false;
+        coordinator_store_last_dose(co, now_s); // doses before the schedule was set aren't missed after a reboot either
+        return true;
+    }
+    case CMD_REQUEST_LOGS:
+        logger_start_export(cmd->args.first_log, co->carousels[0].log_dev->unusedLogIndex);
+        return true;
+    case CMD_SET_TIME:
+        wallclock_sync(cmd->args.unix_s);
+        logger_sync_time(co->carousels[0].log_dev, cmd->args.unix_s, co->machines[0].time_ms, co->logq);
+        schedule_replan();
+        return true;
+    case CMD_SET_WHEEL:
+        for (int i = 0; i < CAROUSEL_COUNT; i++) {
+            if (dispenser_motor_busy(&co->machines[i])) return false; // don't interrupt the motor
         }
+        break;
+    default:
+        break;
+    }
+
+    if (cmd->carousel > CAROUSEL_COUNT) return false;
+    bool ok = true;
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        if (cmd->carousel != COMMAND_ALL_CAROUSELS && cmd->carousel != i + 1) continue;
+        ok = dispenser_execute(&co->machines[i], cmd) && ok;
+    }
+    if (ok && (cmd->opcode == CMD_SET_WHEEL || cmd->opcode == CMD_SET_COMPARTMENT_OFFSET)) {
+        updateWheelConfig(&co->carousels[0].wheel);
+    }
+    return ok;
+}
+
+/**
+ * Decodes and runs all downlinks received since the last call. Every command is logged as received or rejected.
+ *
+ * @param co Pointer to the coordinator.
+ */
+static void coordinator_handle_downlinks(coordinator *co) {
+    lora_downlink dl;
+    command cmd;
+    lora_poll();
+    while (lora_get_downlink(&dl)) {
+        if (dl.port != COMMAND_PORT) continue;
+        bool ok = command_parse(dl.data, dl.len, &cmd) && coordinator_execute(co, &cmd);
+        int32_t opcode = dl.len > 0 ? dl.data[0] : -1;
+        dispenser_log_values(&co->machines[0], ok ? LOG_REMOTE_COMMAND : LOG_REMOTE_COMMAND_REJECTED, &opcode, 1);
     }
 }
 
-static bool dropped = false;
+/**
+ * Hands a button press to the carousels it is meant for: the calibration button to the carousels waiting to be
+ * calibrated, the dispense button to the carousels waiting to dispense.
+ *
+ * @param co   Pointer to the coordinator.
+ * @param gpio Button that was pressed.
+ */
+static void coordinator_button(coordinator *co, uint gpio) {
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        dispenser *d = &co->carousels[i];
+        sm_state_id state = co->machines[i].state;
+        if (gpio == BUTTON1 && state == CALIBRATE) d->calibrate_requested = true;
+        if (gpio == BUTTON2 && state == WAIT_FOR_DISPENSE) d->button_dose = true;
+    }
+}
+
+/**
+ * Logs the scheduled doses found missed and stores the last of them, so they aren't logged again after a reboot.
+ *
+ * @param co      Pointer to the coordinator.
+ * @param time_ms Current time in milliseconds.
+ */
+static void coordinator_log_missed_doses(coordinator *co, uint32_t time_ms) {
+    uint8_t missed = schedule_take_missed();
+    if (missed == 0) return;
+    for (; missed > 0; missed--) {
+        logger_log(co->carousels[0].log_dev, LOG_DOSE_MISSED, time_ms, co->logq);
+    }
+    coordinator_store_last_dose(co, schedule_last_dose_s());
+}
 
-void piezo_handler(void) {
-    if (gpio_get_irq_event_mask(PIEZO_PIN) & GPIO_IRQ_EDGE_FALL) {
-        gpio_acknowledge_irq(PIEZO_PIN, GPIO_IRQ_EDGE_FALL);
-        dropped = true;
+/**
+ * Hands a due scheduled dose to every carousel that is waiting to dispense. The dose waits until no carousel is
+ * busy, then they all dispense it side by side and it takes as long as the slowest carousel. A dose that waited
+ * past the schedule's late limit is logged as missed instead, see schedule_dose_due().
+ *
+ * @param co      Pointer to the coordinator.
+ * @param now_s   Current unix time.
+ * @param time_ms Current time in milliseconds.
+ */
+static void coordinator_start_scheduled_dose(coordinator *co, uint32_t now_s, uint32_t time_ms) {
+    bool due = schedule_dose_due(now_s);
+    coordinator_log_missed_doses(co, time_ms);
+    if (!due) return;
+    bool any_waiting = false;
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        sm_state_id state = co->machines[i].state;
+        if (state != WAIT_FOR_DISPENSE && state != CALIBRATE) return; // still busy
+        if (state == WAIT_FOR_DISPENSE) any_waiting = true;
     }
+    if (!any_waiting) return; // nothing to dispense with, the dose stays due
+
+    uint8_t pills = schedule_due_pills();
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        dispenser *d = &co->carousels[i];
+        if (co->machines[i].state == WAIT_FOR_DISPENSE) d->scheduled_pills = pills;
+        d->dev_status->lastDoseTime = now_s; // stored with the status when the first drop starts
+    }
+    schedule_dose_started(now_s);
 }
 
+/**
+ * Calculates how long the main loop can sleep before any carousel has something to do.
+ *
+ * @param co Pointer to the coordinator.
+ * @return Milliseconds to sleep.
+ */
+static uint32_t coordinator_wake_ms(const coordinator *co) {
+    uint32_t wake = UINT32_MAX;
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        wake = MIN(wake, state_wake_ms(&co->machines[i]));
+    }
+    return wake;
+}
 
+/**
+ * Checks if every carousel waits for something to do with its motor stopped, so nothing minds the main loop
+ * stalling for a while.
+ *
+ * @param co Pointer to the coordinator.
+ * @return true if all carousels are idle.
+ */
+static bool coordinator_idle(const coordinator *co) {
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        sm_state_id state = co->machines[i].state;
+        if (state != WAIT_FOR_DISPENSE && state != CALIBRATE) return false;
+        if (dispenser_motor_busy(&co->machines[i])) return false;
+    }
+    return true;
+}
 
 int main()
 {
 
-    // WELCOME TO SPAGHETTI
+    breadcrumb_init(); // keep the previous boot's breadcrumb before anything leaves a new one
     stdio_init_all();
+    PROFILE_INIT(time_us_32); // no-op unless built with -DPROFILER=ON
+    events_init();
+    wallclock_init(); // invalid until the time is received from the network
     //EEPROM
-    eeprom_init_i2c(i2c0, EEPROM_BAUD_RATE, EEPROM_WRITE_CYCLE_MAX_MS);
+    if (!eeprom_init_i2c(EEPROM_I2C, EEPROM_SDA_PIN, EEPROM_SCL_PIN, EEPROM_BAUD_RATE, EEPROM_WRITE_CYCLE_MAX_MS, eeprom_chips, EEPROM_CHIP_COUNT)) printf("eeprom error\n");
+#ifdef EEPROM_BENCH_ENABLED
+    eeprom_benchmark(LOG_START_ADDR, 2048); // the log area, leaves it as it was
+#endif
     //LORAWAN
-    if (!lora_init(uart1, UART_TX_PIN, UART_RX_PIN)) printf("lora error\n");
+    if (!lora_init(LORA_UART, UART_TX_PIN, UART_RX_PIN)) printf("lora error\n");
+    logger_init_airtime(lora_get_spreading_factor(), to_ms_since_boot(get_absolute_time()));
 
-    // STEPPER MOTOR
-    uint stepperpins[4] = {BLUE, PINK, YELLOW, ORANGE}; // pins by color, see stepper.h for pin numbers.
-    stepper_ctx step_ctx = stepper_get_ctx(); // context for the stepper motor, includes useful stuff.
-    stepper_init(&step_ctx, pio0, stepperpins, OPTO_FORK_PIN, STEPPER_SPEED_RPM, STEPPER_CLOCKWISE); // inits everything, uses pio to drive stepper motor.
     //LEDS
     led_init(); // inits pwm for leds so we don't get blind.
     //BUTTONS
     init_button_with_callback(BUTTON1, NUMBER_OF_DEBOUNCED_BUTTONS, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, button_handler); // set debounced irq for buttons.
-    // PIEZO SENSOR
-    gpio_init(PIEZO_PIN); // enabled, func set, dir in.
-    gpio_pull_up(PIEZO_PIN); // pull up
-    gpio_add_raw_irq_handler(PIEZO_PIN, piezo_handler); // adding raw handler since we dont want this debounced.
-    gpio_set_irq_enabled(PIEZO_PIN, GPIO_IRQ_EDGE_FALL, true); // irq enabled, only interested in falling edge (something hit the sensor).
-
-
-    // RING BUFFER
-    #define LOG_LEN 20
-    logdata rb_buffer[LOG_LEN];
-    ring_buffer ringbuf;
-    rb_init(&ringbuf, rb_buffer, LOG_LEN);
+
+    // LOG QUEUE
+    log_queue logq;
+    logqueue_init(&logq); // errors go first and progress logs get merged, see logHandling.c
     // Reboot sequence
     const uint32_t bootTime = to_ms_since_boot(get_absolute_time());
-    DeviceStatus devStatus;
-    reboot_sequence(&devStatus, bootTime, &ringbuf);
+    DeviceStatus devStatus[CAROUSEL_COUNT];
+    reboot_sequence(&devStatus[0], bootTime, &logq); // finds the log index, restores carousel 0
+    for (int i = 1; i < CAROUSEL_COUNT; i++) {
+        devStatus[i].carousel = i;
+        restoreCarouselStatus(&devStatus[i], &devStatus[0], bootTime, &logq);
+    }
+    logdump_init(&devStatus[0]); // binary log dumps over the stdio UART, see tools/logpull
 
+    wheel pill_wheel;
+    wheel_init(&pill_wheel, WHEEL_COMPARTMENTS);
+    readWheelConfig(&pill_wheel); // the profile's wheel is used until one is set over LoRa
+    uint32_t lastDoseTime = 0;
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        if (devStatus[i].rebootStatusCode == DISPENSING) devStatus[i].pillDispenseState++;
+        lastDoseTime = MAX(lastDoseTime, devStatus[i].lastDoseTime);
+    }
+    schedule_init(lastDoseTime); // doses missed while we were off are found once the clock is set
 
-    if (devStatus.rebootStatusCode == DISPENSING) devStatus.pillDispenseState++;
-    state_machine sm = statemachine_get(devStatus.pillDispenseState);
+    //CAROUSELS
+    chiptemp_init(); // calibrations are trusted less the further the temperature is from theirs
+    int8_t boot_temp_c = chiptemp_read_c();
+    stepper_ctx step_ctx[CAROUSEL_COUNT];
+    coordinator co = { .logq = &logq };
+    powerbudget_init(&co.power, MOTOR_POWER_SLOTS);
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        const carousel_pins *pins = &carousel_pin_table[i];
+        // STEPPER MOTOR
+        step_ctx[i] = stepper_get_ctx(); // context for the stepper motor, includes useful stuff.
+        stepper_init(&step_ctx[i], pio0, pins->stepper, pins->opto_fork, STEPPER_RPM(STEPPER_SPEED_RPM), STEPPER_CLOCKWISE); // inits everything, uses pio to drive stepper motor.
+        // PIEZO SENSOR
+        uint8_t piezo = piezo_init(pins->piezo); // measures pulse widths and groups bounces so only real drops get queued.
 
-    //STATE MACHINE
-    if (sm.state == HALF_CALIBRATE) {
-        // half calibrate takes: max steps, hole width, number of pills dispensed (how many time stepper has turned)
-        if (devStatus.prevCalibStepCount < MAX_VALID_MAX_STEP_COUNT_BOUND_MIN || devStatus.prevCalibStepCount > MAX_VALID_MAX_STEP_COUNT_BOUND_MAX) {
-            sm.state = CALIBRATE;
-        } else {
-            stepper_half_calibrate(&step_ctx, devStatus.prevCalibStepCount, devStatus.prevCalibEdgeCount, devStatus.pillDispenseState); // start half calibration if its prudent to do so //TODO: REPLACE MAGIC NUMBERS
-            logger_log(&devStatus, LOG_HALF_CALIBRATION, bootTime, &ringbuf);
-            sm.state = WAIT_FOR_DISPENSE; // state to wait for dispense button press
-        }
+        //STATE MACHINE
+        co.carousels[i] = (dispenser){
+            .carousel = i,
+            .step_ctx = &step_ctx[i],
+            .piezo = piezo,
+            .dev_status = &devStatus[i],
+            .log_dev = &devStatus[0],
+            .logq = &logq,
+            .power = &co.power,
+            .wheel = pill_wheel,
+            .full_calibration = false,
+            .pills_dropped = devStatus[i].pillDispenseState,
+            .dose_remaining = 0,
+            .time_drop_started_ms = 0,
+            .error_blink_counter = 0,
+            .leds = i == LED_CAROUSEL,
+            .calibrate_requested = false,
+            .button_dose = false,
+            .remote_pills = 0,
+            .scheduled_pills = 0,
+            .drop_delay_ms = PILL_DROP_DELAY_MS,
+            .drop_timeout_ms = drop_timeout_default_ms(&pill_wheel)
+        };
+        dispenser_load_calibration(&co.carousels[i], boot_temp_c);
+        state_machine *sm = &co.machines[i];
+        statemachine_init(sm, &dispenser_table, dispenser_initial_state(&co.carousels[i]), &co.carousels[i], bootTime);
+        statemachine_tick(sm, bootTime); // start or skip half calibration before boot is logged as finished
     }
 
-    logger_log(&devStatus, LOG_BOOTFINISHED, bootTime, &ringbuf); // log boot finished
-
-    bool logged = false;
+    // sessions in the logs start at the boot finished log, the boot isn't synced to the network time yet
+    int32_t boot[2] = {logger_boot_count(), logger_boot_synced()};
+    logger_log_values(&devStatus[0], LOG_BOOTFINISHED, 0, bootTime, boot, 2, &logq); // log boot finished
 
-    // button 3 is for printing logs
-    gpio_init(BUTTON3);
-    gpio_pull_up(BUTTON3);
-    bool pressed = false;
+    event ev;
     
-    watchdog_enable(WATCHDOG_WORST_CASE_SCEN, true);
+    uint32_t telemetry_ms = bootTime;
+
+    supervisor_init(WATCHDOG_TIMEOUT_MS, UI_DEADLINE_MS);
+    for (int i = 0; i < CAROUSEL_COUNT; i++) {
+        supervise_motor(&co.machines[i], true); // the boot tick may have started a calibration
+    }
     while (1) {
-        watchdog_update();
-        if (!gpio_get(BUTTON3) && !pressed) {
-            printValidLogs();
-            pressed = true;
-        } else if (pressed && gpio_get(9)) {
-            pressed = false;
-        }
-        logger_try_send_lora(&ringbuf, sm.time_ms);
-        state_machine_update_time(&sm); // get current time
-        switch (sm.state) {
-        case CALIBRATE:
-        // TODO: logs and lorawan
-            step_ctx.stepper_calibrated = false; // set stepper calibrated status to false.
-            led_wait_toggle(sm.time_ms); // toggling all leds on and off while waiting for a button press.
-            if (calib_btn_pressed) { // if button is pressed
-                stepper_calibrate(&step_ctx); // calibrate :D
-                led_off(); // leds off
-                devStatus.rebootStatusCode = FULL_CALIBRATION;
-                devStatus.pillDispenseState = 0;
-                updatePillDispenserStatus(&devStatus);
-                logger_log(&devStatus, LOG_FULL_CALIBRATION, sm.time_ms, &ringbuf); // log to eeprom
-                sm.pills_dropped = 0; // reset pill dropping count.
-                sm.state = WAIT_FOR_DISPENSE; // when calibration is done move to next state.
-            }
-            break;
-        case WAIT_FOR_DISPENSE:
-            if (stepper_is_running(&step_ctx)) { // if calibrating
-                led_calibration_toggle(sm.time_ms); // toggling leds in a nice pattern.
+        supervisor_checkin(TASK_UI);
+        uint32_t loop_start_us = time_us_32();
+        PROFILE_BEGIN(PROF_LOOP);
+        PROFILE_BEGIN(PROF_EVENTS);
+        while (events_get(&ev)) {
+            if (ev.type != EVENT_BUTTON) continue;
+            if (ev.data == BUTTON3) { // button 3 is for printing logs
+                printValidLogs();
+                printf("Max wake-up latency %u us\n", events_get_max_latency_us());
+                printf("Log queue: high water %u, merged %u, dropped %u/%u/%u (critical/normal/low)\n",
+                       logq.high_water, logq.coalesced, logq.dropped[LOG_PRIORITY_CRITICAL],
+                       logq.dropped[LOG_PRIORITY_NORMAL], logq.dropped[LOG_PRIORITY_LOW]);
+                metrics_set(METRIC_LOG_QUEUE_HIGH_WATER, logq.high_water);
+                supervisor_checkin(TASK_UI); // each dump can take a good part of the main loop's deadline
+                metrics_dump();
+                supervisor_checkin(TASK_UI);
+                PROFILE_DUMP();
+                logdump_start(to_ms_since_boot(get_absolute_time())); // a waiting tools/logpull starts reading
             } else {
-                if (!logged) {
-                    devStatus.rebootStatusCode = IDLE;
-                    devStatus.prevCalibStepCount = stepper_get_max_steps(&step_ctx);
-                    devStatus.prevCalibEdgeCount = stepper_get_edge_steps(&step_ctx);
-                    updatePillDispenserStatus(&devStatus);
-                    logger_log(&devStatus, LOG_CALIBRATION_FINISHED, sm.time_ms, &ringbuf);
-                    logged = true;
-                }
-                led_on(); // turn leds on when user can press the button to start dispensing.
-                if (dispense_btn_pressed) { // if button pressed
-                    logged = false; // reset logged bool
-                    logger_log(&devStatus, LOG_BUTTON_PRESS, sm.time_ms, &ringbuf);
-                    led_off(); // turn the led off
-                    sm.state = DISPENSE; // move to state where dispensing is actually done.
-                }
-            }
-            break;
-        case DISPENSE:
-            if ((sm.pills_dropped) >= MAX_PILLS) { // if maximum number of pills dropped (or didnt drop was but supposed to)
-                logger_log(&devStatus, LOG_DISPENSER_EMPTY, sm.time_ms, &ringbuf);
-                sm.state = CALIBRATE; // set state to calibration. (start all over again)
-            } else if ((sm.time_ms - sm.time_drop_started_ms) > PILL_DROP_DELAY_MS) { // if enough time has passed from last pill drop.
-                stepper_turn_steps(&step_ctx, stepper_get_max_steps(&step_ctx) / MAX_TURNS); // turn stepper eighth of a full turn.
-                sm.time_drop_started_ms = sm.time_ms; // set the drop starting time to current time.
-                dropped = false; // reset dropped status
-                devStatus.rebootStatusCode = DISPENSING;
-                devStatus.pillDispenseState = sm.pills_dropped;
-                updatePillDispenserStatus(&devStatus);
-                logger_log(&devStatus, LOG_DISPENSE1 + sm.pills_dropped, sm.time_ms, &ringbuf);
-                sm.state = CHECK_IF_DISPENSED; // go to check if pill was dispensed correctly.
-            }
-            break;
-        case CHECK_IF_DISPENSED:
-            if (stepper_is_running(&step_ctx)) { // if stepper is still running we let it do its thing
-                led_run_toggle(sm.time_ms); // and toggle some pretty lights
-            } else if (dropped) { // if pill drop was detected by piezo sensor
-                led_off();
-                sm.pills_dropped++; // increment pill drop count
-                dropped = false; // reset dropped status
-                devStatus.rebootStatusCode = IDLE;
-                devStatus.pillDispenseState = sm.pills_dropped;
-                updatePillDispenserStatus(&devStatus);
-                logger_log(&devStatus, LOG_PILL_DISPENSED, sm.time_ms, &ringbuf);
-                sm.state = DISPENSE; // if number of pills dropped not max dispense another
-            } else { // if stepper is not running and no pill drop detected
-                if (sm.time_ms - sm.time_drop_started_ms > PILL_NOT_DROPPED_DELAY_MS) { // if too much time between pill drop starting and not sensing a drop
-                    led_off(); // leds off
-                    sm.pills_dropped++; // increment turned count
-                    devStatus.rebootStatusCode = IDLE;
-                    devStatus.pillDispenseState = sm.pills_dropped;
-                    updatePillDispenserStatus(&devStatus);
-                    logger_log(&devStatus, LOG_PILL_ERROR, sm.time_ms, &ringbuf);
-                    sm.state = PILL_NOT_DROPPED; // go to error state
-                } else { // if we are still waiting for the drop
-                    led_run_toggle(sm.time_ms); // pretty lights
-                }
+                coordinator_button(&co, ev.data);
             }
-            break;
-        case PILL_NOT_DROPPED:
-            if (led_error_toggle(sm.time_ms)) { // if led is toggled
-                // 2 times the error blink times because led_error_toggle returns true when state changes not when leds go on.
-                if (++(sm.error_blink_counter) >= (2 * ERROR_BLINK_TIMES)) { // increment blink counter if its twice needed blink times
-                    sm.error_blink_counter = 0; // reset blink counter
-                    sm.state = DISPENSE; // set state to dispense (do we want it to recalibrate here?)
-                }
-            }
-            break;
-        default:
-            // should never get here maybe log unexpected error?
-            sm.state = CALIBRATE;
-            break;
-        } 
+        }
+        PROFILE_END(PROF_EVENTS);
+        PROFILE_BEGIN(PROF_DOWNLINKS);
+        coordinator_handle_downlinks(&co);
+        logdump_poll(to_ms_since_boot(get_absolute_time()));
+        PROFILE_END(PROF_DOWNLINKS);
+        PROFILE_BEGIN(PROF_LORA_SEND);
+        logger_try_send_lora(&logq, co.machines[0].time_ms);
+        PROFILE_END(PROF_LORA_SEND);
+
+        PROFILE_BEGIN(PROF_STATEMACHINE);
+        uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+        coordinator_start_scheduled_dose(&co, wallclock_now(), now_ms);
+        bool state_changed = false;
+        for (int i = 0; i < CAROUSEL_COUNT; i++) {
+            state_machine *sm = &co.machines[i];
+            breadcrumb_set_state((i << 4) | sm->state); // carousel in the high nibble
+            breadcrumb_enter(ACTIVITY_STATE_MACHINE);
+            bool changed = statemachine_tick(sm, now_ms);
+            breadcrumb_set_state((i << 4) | sm->state);
+            breadcrumb_leave(ACTIVITY_MAIN_LOOP);
+            if (supervise_motor(sm, changed)) changed = true; // a carousel waiting for the motor slot goes next pass
+            state_changed = state_changed || changed;
+        }
+        PROFILE_END(PROF_STATEMACHINE);
+        if (now_ms - telemetry_ms >= TELEMETRY_INTERVAL_MS) {
+            telemetry_ms = now_ms;
+            metrics_set(METRIC_LOG_QUEUE_HIGH_WATER, logq.high_water);
+            logger_queue_telemetry();
+        }
+
+        // sleep until the next deadline or an interrupt posts an event
+        uint32_t wake_ms = 0;
+        if (!state_changed) {
+            if (coordinator_idle(&co)) logger_maintain_storage(); // flash erases stall the CPU, only when idle
+            wake_ms = MIN(coordinator_wake_ms(&co), logger_get_wake_ms(&logq, now_ms));
+            wake_ms = MIN(wake_ms, MAX_SLEEP_MS);
+        }
+        metrics_observe(METRIC_MAIN_LOOP_US, time_us_32() - loop_start_us);
+        PROFILE_END(PROF_LOOP);
+        breadcrumb_enter(ACTIVITY_SLEEP);
+        events_wait_ms(wake_ms);
+        breadcrumb_leave(ACTIVITY_MAIN_LOOP);
     }
     return 0;
 
@@ -1,11 +1,14 @@
 #include "pico/stdlib.h"
 #include "eeprom.h"
 #include "logHandling.h"
+#include "board.h"
+
+static const eeprom_chip eeprom_chips[EEPROM_CHIP_COUNT] = EEPROM_CHIPS;
 
 int main() {
 
     stdio_init_all();
-    eeprom_init_i2c(i2c0, 1000000, 5);
+    eeprom_init_i2c(EEPROM_I2C, EEPROM_SDA_PIN, EEPROM_SCL_PIN, 1000000, 5, eeprom_chips, EEPROM_CHIP_COUNT);
 
     // printValidLogs();
     zeroAllLogs();
@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "airtime.h"
+
+#define PREAMBLE_SYMBOLS 8
+#define CODING_RATE 1 // 4/5
+
+static airtime_config cfg;
+static uint32_t band_free_ms = 0;   // regional duty cycle off time ends
+static uint32_t modem_free_ms = 0;  // receive windows of the last uplink are over
+static int64_t budget_us = 0;       // fair use budget left, goes negative when critical messages overdraw it
+static uint32_t budget_updated_ms = 0;
+
+/**
+ * Checks if a time is after another, works across the 32-bit millisecond wrap.
+ */
+static inline bool airtime_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/**
+ * Refills the fair use budget for the time passed since the last refill. Only the time that refilled
+ * whole microseconds is consumed, so frequent calls don't lose the remainder.
+ *
+ * @param time_ms Current time in milliseconds.
+ */
+static void airtime_refill(uint32_t time_ms) {
+    uint32_t elapsed = time_ms - budget_updated_ms;
+    uint64_t rate = (uint64_t)cfg.budget_ms * 1000; // us of budget per period
+    uint64_t refill = (uint64_t)elapsed * rate / cfg.budget_period_ms;
+    if (refill == 0) return;
+    budget_updated_ms += (uint32_t)(refill * cfg.budget_period_ms / rate);
+    budget_us += (int64_t)refill;
+    if (budget_us > (int64_t)rate) budget_us = (int64_t)rate;
+}
+
+/**
+ * Gets the part of the budget a priority has to leave unused.
+ *
+ * @param prio Priority of the message.
+ * @return Reserve in microseconds.
+ */
+static int64_t airtime_reserve_us(airtime_priority prio) {
+    int64_t full = (int64_t)cfg.budget_ms * 1000;
+    switch (prio) {
+    case AIRTIME_ROUTINE:
+        return full / 4;
+    case AIRTIME_BULK:
+        return full / 2;
+    default:
+        return INT64_MIN / 2; // critical messages may overdraw the budget
+    }
+}
+
+/**
+ * Initializes the airtime scheduler with a full budget.
+ *
+ * @param config  Pointer to the radio and budget settings, copied.
+ * @param time_ms Current time in milliseconds.
+ */
+void airtime_init(const airtime_config *config, uint32_t time_ms) {
+    cfg = *config;
+    band_free_ms = time_ms;
+    modem_free_ms = time_ms;
+    budget_us = (int64_t)cfg.budget_ms * 1000;
+    budget_updated_ms = time_ms;
+}
+
+/**
+ * Changes the spreading factor used for the time on air estimate, for example after the network changed the data rate.
+ *
+ * @param sf Spreading factor 7 to 12, other values are ignored.
+ */
+void airtime_set_spreading_factor(uint8_t sf) {
+    if (sf >= 7 && sf <= 12) cfg.spreading_factor = sf;
+}
+
+/**
+ * Calculates the time on air of an uplink with the formula from the Semtech SX1276 datasheet.
+ * Explicit header, CRC on and low data rate optimization for SF11 and SF12 at 125 kHz.
+ *
+ * @param payload_len Application payload length in bytes, the LoRaWAN overhead is added here.
+ * @return Time on air in microseconds.
+ */
+uint32_t airtime_time_on_air_us(uint8_t payload_len) {
+    int sf = cfg.spreading_factor;
+    int de = (sf >= 11 && cfg.bandwidth_khz == 125) ? 1 : 0;
+    int pl = payload_len + AIRTIME_LORAWAN_OVERHEAD;
+
+    int num = 8 * pl - 4 * sf + 28 + 16; // CRC on, explicit header
+    int den = 4 * (sf - 2 * de);
+    int payload_symbols = 8;
+    if (num > 0) payload_symbols += ((num + den - 1) / den) * (CODING_RATE + 4);
+
+    // count in quarter symbols, the preamble is 4.25 symbols longer than its programmed length
+    uint64_t quarter_symbols = 4 * (PREAMBLE_SYMBOLS + payload_symbols) + 17;
+    return (uint32_t)(quarter_symbols * ((uint64_t)1000 << sf) / (4 * cfg.bandwidth_khz));
+}
+
+/**
+ * Calculates how long a message has to wait before it may be sent.
+ *
+ * @param prio        Priority of the message.
+ * @param payload_len Application payload length in bytes.
+ * @param time_ms     Current time in milliseconds.
+ * @return Milliseconds to wait, 0 if the message can be sent now.
+ */
+uint32_t airtime_wait_ms(airtime_priority prio, uint8_t payload_len, uint32_t time_ms) {
+    uint32_t wait = 0;
+    if (airtime_after(band_free_ms, time_ms)) wait = band_free_ms - time_ms;
+    if (airtime_after(modem_free_ms, time_ms) && modem_free_ms - time_ms > wait) wait = modem_free_ms - time_ms;
+
+    airtime_refill(time_ms);
+    int64_t needed = (int64_t)airtime_time_on_air_us(payload_len) + airtime_reserve_us(prio) - budget_us;
+    if (needed > 0) {
+        // time for the refill to cover the shortfall, rounded up
+        uint64_t rate = (uint64_t)cfg.budget_ms * 1000;
+        uint64_t refill_ms = ((uint64_t)needed * cfg.budget_period_ms + rate - 1) / rate;
+        if (refill_ms > UINT32_MAX) refill_ms = UINT32_MAX;
+        if (refill_ms > wait) wait = (uint32_t)refill_ms;
+    }
+    return wait;
+}
+
+/**
+ * Records a message the modem accepted. Starts the duty cycle off time and charges the budget.
+ *
+ * @param payload_len Application payload length in bytes.
+ * @param time_ms     Time the message was sent in milliseconds.
+ */
+void airtime_sent(uint8_t payload_len, uint32_t time_ms) {
+    uint32_t toa_us = airtime_time_on_air_us(payload_len);
+    uint32_t toa_ms = (toa_us + 999) / 1000;
+    airtime_refill(time_ms);
+    budget_us -= toa_us;
+    band_free_ms = time_ms + toa_ms * cfg.duty_cycle_div; // time on air plus (div - 1) times it off
+    modem_free_ms = time_ms + toa_ms + cfg.modem_busy_ms;
+}
+
+/**
+ * Records a message the modem refused, for example because it was still busy. Holds all messages back for the retry time.
+ *
+ * @param time_ms Time the message was refused in milliseconds.
+ */
+void airtime_failed(uint32_t time_ms) {
+    uint32_t retry = time_ms + cfg.retry_ms;
+    if (airtime_after(retry, modem_free_ms)) modem_free_ms = retry;
+}
+
+/**
+ * Gets the fair use budget left.
+ *
+ * @param time_ms Current time in milliseconds.
+ * @return Time on air left in milliseconds, negative if critical messages have overdrawn it.
+ */
+int32_t airtime_get_budget_ms(uint32_t time_ms) {
+    airtime_refill(time_ms);
+    return (int32_t)(budget_us / 1000);
+}
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "blockdev.h"
+
+/**
+ * Checks that a range is inside a device.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte of the range.
+ * @param size    Bytes in the range.
+ * @return true if the whole range is on the device.
+ */
+static bool blockdev_in_range(const blockdev *dev, uint32_t address, size_t size) {
+    return address <= dev->size && size <= dev->size - address;
+}
+
+/**
+ * Reads from a device.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to read.
+ * @param dst     Pointer to the buffer to read into.
+ * @param size    Bytes to read.
+ * @return false if the range is outside the device or the device failed.
+ */
+bool blockdev_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size) {
+    if (!blockdev_in_range(dev, address, size)) return false;
+    if (size == 0) return true;
+    return dev->ops->read(dev, address, dst, size);
+}
+
+/**
+ * Writes to a device, one program operation for every page the data touches.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to write.
+ * @param src     Pointer to the data.
+ * @param size    Bytes to write.
+ * @return false if the range is outside the device or the device failed, pages before the failed one are written.
+ */
+bool blockdev_write(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size) {
+    if (!blockdev_in_range(dev, address, size)) return false;
+    while (size > 0) {
+        size_t chunk = dev->page_size - address % dev->page_size; // to the end of the page
+        if (chunk > size) chunk = size;
+        if (!dev->ops->program(dev, address, src, chunk)) return false;
+        address += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+/**
+ * Erases the erase block starting at an address, every byte reads 0xFF after it.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte of the erase block.
+ * @return false if the device has no erase, the address isn't on a block boundary or the device failed.
+ */
+bool blockdev_erase(const blockdev *dev, uint32_t address) {
+    if (dev->ops->erase == NULL || dev->erase_size == 0) return false;
+    if (address % dev->erase_size != 0 || !blockdev_in_range(dev, address, dev->erase_size)) return false;
+    return dev->ops->erase(dev, address);
+}
+
+/**
+ * Finds the part of a concatenated device that holds an address.
+ *
+ * @param cat     Pointer to the parts.
+ * @param address Address on the concatenated device, changed to the address on the part.
+ * @return Pointer to the part, NULL if the address is past the end.
+ */
+static const blockdev *blockdev_concat_find(const blockdev_concat *cat, uint32_t *address) {
+    for (uint8_t i = 0; i < cat->count; i++) {
+        if (*address < cat->parts[i]->size) return cat->parts[i];
+        *address -= cat->parts[i]->size;
+    }
+    return NULL;
+}
+
+/**
+ * Reads from a concatenated device, a part at a time.
+ *
+ * @param dev     Pointer to the concatenated device.
+ * @param address First byte to read.
+ * @param dst     Pointer to the buffer to read into.
+ * @param size    Bytes to read.
+ * @return false if a part failed.
+ */
+static bool blockdev_concat_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size) {
+    const blockdev_concat *cat = dev->ctx;
+    while (size > 0) {
+        uint32_t part_address = address;
+        const blockdev *part = blockdev_concat_find(cat, &part_address);
+        if (part == NULL) return false;
+        size_t chunk = part->size - part_address; // to the end of the part
+        if (chunk > size) chunk = size;
+        if (!part->ops->read(part, part_address, dst, chunk)) return false;
+        address += chunk;
+        dst += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+/**
+ * Programs a page of a concatenated device.
+ *
+ * @param dev     Pointer to the concatenated device.
+ * @param address First byte to program.
+ * @param src     Pointer to the data.
+ * @param size    Bytes to program, all in one page.
+ * @return false if the part failed.
+ */
+static bool blockdev_concat_program(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size) {
+    const blockdev_concat *cat = dev->ctx;
+    const blockdev *part = blockdev_concat_find(cat, &address);
+    if (part == NULL) return false;
+    return part->ops->program(part, address, src, size); // parts are whole pages, so a page is on one part
+}
+
+/**
+ * Erases an erase block of a concatenated device.
+ *
+ * @param dev     Pointer to the concatenated device.
+ * @param address First byte of the erase block.
+ * @return false if the part failed.
+ */
+static bool blockdev_concat_erase(const blockdev *dev, uint32_t address) {
+    const blockdev_concat *cat = dev->ctx;
+    const blockdev *part = blockdev_concat_find(cat, &address);
+    if (part == NULL) return false;
+    return blockdev_erase(part, address);
+}
+
+static const blockdev_ops concat_ops = {
+    .read = blockdev_concat_read,
+    .program = blockdev_concat_program,
+    .erase = blockdev_concat_erase
+};
+
+/**
+ * Puts devices one after another to look like one. The parts must have the same page and erase block sizes and
+ * be made of whole pages and erase blocks, so none is split between two of them.
+ *
+ * @param dev   Pointer to the concatenated device to set up.
+ * @param cat   Pointer to where the parts are kept, has to live as long as the device.
+ * @param parts Pointer to the devices, in address order. They have to live as long as the device.
+ * @param count Number of devices, 1 to BLOCKDEV_MAX_PARTS.
+ * @return false if the parts can't be concatenated.
+ */
+bool blockdev_concat_init(blockdev *dev, blockdev_concat *cat, const blockdev *parts, uint8_t count) {
+    if (count == 0 || count > BLOCKDEV_MAX_PARTS) return false;
+    uint32_t size = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (parts[i].page_size != parts[0].page_size || parts[i].size % parts[i].page_size != 0) return false;
+        if (parts[i].erase_size != parts[0].erase_size) return false;
+        if (parts[i].erase_size != 0 && parts[i].size % parts[i].erase_size != 0) return false;
+        if (parts[i].size > UINT32_MAX - size) return false;
+        size += parts[i].size;
+        cat->parts[i] = &parts[i];
+    }
+    cat->count = count;
+    dev->ops = &concat_ops;
+    dev->ctx = cat;
+    dev->size = size;
+    dev->page_size = parts[0].page_size;
+    dev->erase_size = parts[0].erase_size;
+    return true;
+}
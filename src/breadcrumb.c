@@ -0,0 +1,115 @@
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+
+#include "breadcrumb.h"
+
+#define BREADCRUMB_MAGIC 0xBC5A0000 // top half of scratch 0, tells a breadcrumb from power on garbage
+#define BREADCRUMB_MAGIC_MASK 0xFFFF0000
+#define BREADCRUMB_CHECK 0x5EED5EED
+
+enum {
+    SCRATCH_WORD,  // magic, activity and state
+    SCRATCH_TIME,
+    SCRATCH_CHECK
+};
+
+static breadcrumb_activity current_activity = ACTIVITY_MAIN_LOOP;
+static uint8_t current_state = 0;
+static bool previous_valid = false;
+static breadcrumb previous;
+
+static const char *activity_names[ACTIVITY_COUNT] = {
+    "main loop",
+    "sleep",
+    "state machine",
+    "EEPROM write",
+    "EEPROM read",
+    "LoRa write",
+    "LoRa read",
+    "log dump"
+};
+
+/**
+ * Writes the current activity and state with the current time to the scratch registers.
+ */
+static void breadcrumb_write(void) {
+    uint32_t word = BREADCRUMB_MAGIC | ((uint32_t)current_activity << 8) | current_state;
+    uint32_t time = to_ms_since_boot(get_absolute_time());
+    watchdog_hw->scratch[SCRATCH_WORD] = word;
+    watchdog_hw->scratch[SCRATCH_TIME] = time;
+    watchdog_hw->scratch[SCRATCH_CHECK] = word ^ time ^ BREADCRUMB_CHECK;
+}
+
+/**
+ * Saves the breadcrumb left by the previous boot and starts a new one. Call this first thing in main,
+ * before anything that leaves breadcrumbs.
+ */
+void breadcrumb_init(void) {
+    uint32_t word = watchdog_hw->scratch[SCRATCH_WORD];
+    uint32_t time = watchdog_hw->scratch[SCRATCH_TIME];
+    uint32_t check = watchdog_hw->scratch[SCRATCH_CHECK];
+    previous_valid = (word & BREADCRUMB_MAGIC_MASK) == BREADCRUMB_MAGIC && check == (word ^ time ^ BREADCRUMB_CHECK)
+                     && ((word >> 8) & 0xFF) < ACTIVITY_COUNT;
+    if (previous_valid) {
+        previous.activity = (word >> 8) & 0xFF;
+        previous.state = word & 0xFF;
+        previous.time_ms = time;
+    }
+    current_activity = ACTIVITY_MAIN_LOOP;
+    current_state = 0;
+    breadcrumb_write();
+}
+
+/**
+ * Marks the start of an activity that could block.
+ *
+ * @param activity The activity.
+ * @return The activity that was going on before, give it to breadcrumb_leave().
+ */
+breadcrumb_activity breadcrumb_enter(breadcrumb_activity activity) {
+    breadcrumb_activity before = current_activity;
+    current_activity = activity;
+    breadcrumb_write();
+    return before;
+}
+
+/**
+ * Marks the end of an activity.
+ *
+ * @param previous Return value of the matching breadcrumb_enter().
+ */
+void breadcrumb_leave(breadcrumb_activity previous) {
+    current_activity = previous;
+    breadcrumb_write();
+}
+
+/**
+ * Records the state machine state. Written with the next activity change.
+ *
+ * @param state Current state.
+ */
+void breadcrumb_set_state(uint8_t state) {
+    current_state = state;
+}
+
+/**
+ * Gets what the firmware was doing when the previous boot ended.
+ * Only meaningful after a watchdog reboot, otherwise it is the last activity before a reset.
+ *
+ * @param crumb Pointer to where the breadcrumb is stored.
+ * @return true if the previous boot left a valid breadcrumb.
+ */
+bool breadcrumb_get_previous(breadcrumb *crumb) {
+    if (previous_valid) *crumb = previous;
+    return previous_valid;
+}
+
+/**
+ * Gets the name of an activity for printing.
+ *
+ * @param activity The activity.
+ * @return Name of the activity.
+ */
+const char *breadcrumb_activity_name(breadcrumb_activity activity) {
+    return (activity < ACTIVITY_COUNT) ? activity_names[activity] : "unknown";
+}
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "calibcache.h"
+
+#define CALIBCACHE_AGREE_STEPS 8       // revolutions this close agree, about 0.7 degrees
+#define CALIBCACHE_AGREE_EDGE_STEPS 16 // the fork edges are soft, so the hole width varies more
+#define CALIBCACHE_TEMP_DRIFT_C 15     // this much warmer or colder than the calibration and the belt may have moved
+
+// confidence points
+#define CALIBCACHE_BASE 40          // one calibration in bounds
+#define CALIBCACHE_PER_AGREEING 20  // every older calibration that agrees with the newest
+#define CALIBCACHE_PER_DRIFTED 20   // taken off for every older calibration that doesn't
+#define CALIBCACHE_TEMP_UNKNOWN 10  // taken off if either temperature is unknown
+#define CALIBCACHE_TEMP_DRIFTED 30  // taken off if the temperature changed too much
+
+/**
+ * Gets a sample by age.
+ *
+ * @param c   Pointer to the cache.
+ * @param age 0 for the newest sample, must be below c->count.
+ * @return Pointer to the sample.
+ */
+static const calib_sample *calibcache_get(const calib_cache *c, uint8_t age) {
+    return &c->samples[(c->next + CALIBCACHE_HISTORY - 1 - age) % CALIBCACHE_HISTORY];
+}
+
+/**
+ * Initializes an empty cache.
+ *
+ * @param c Pointer to the cache.
+ */
+void calibcache_init(calib_cache *c) {
+    memset(c, 0, sizeof(*c));
+    c->phase = CALIBCACHE_NO_PHASE;
+}
+
+/**
+ * Adds a full calibration, pushing the oldest one out when the cache is full. The phase is forgotten until it is set
+ * for the new calibration.
+ *
+ * @param c          Pointer to the cache.
+ * @param step_max   Steps in one revolution.
+ * @param edge_steps Width of the opto fork hole in steps.
+ * @param temp_c     Chip temperature, CALIBCACHE_NO_TEMP if unknown.
+ */
+void calibcache_add(calib_cache *c, uint16_t step_max, uint16_t edge_steps, int8_t temp_c) {
+    calib_sample *s = &c->samples[c->next];
+    s->step_max = step_max;
+    s->edge_steps = edge_steps;
+    s->temp_c = temp_c;
+    c->next = (c->next + 1) % CALIBCACHE_HISTORY;
+    if (c->count < CALIBCACHE_HISTORY) c->count++;
+    c->phase = CALIBCACHE_NO_PHASE;
+}
+
+/**
+ * Gets the newest calibration.
+ *
+ * @param c Pointer to the cache.
+ * @param s Pointer to where the sample will be stored.
+ * @return false if the cache is empty.
+ */
+bool calibcache_newest(const calib_cache *c, calib_sample *s) {
+    if (c->count == 0) return false;
+    *s = *calibcache_get(c, 0);
+    return true;
+}
+
+/**
+ * Scores how far the newest calibration can be trusted. It has to be in bounds, then every older calibration that
+ * agrees with it adds confidence and every one that doesn't takes some away. A temperature far from the newest
+ * calibration's, or one that isn't known, takes some away too.
+ *
+ * @param c         Pointer to the cache.
+ * @param min_steps Fewest steps a revolution may have.
+ * @param max_steps Most steps a revolution may have.
+ * @param temp_c    Chip temperature now, CALIBCACHE_NO_TEMP if unknown.
+ * @return Confidence from 0, nothing to go by, to 100.
+ */
+uint8_t calibcache_confidence(const calib_cache *c, uint16_t min_steps, uint16_t max_steps, int8_t temp_c) {
+    if (c->count == 0) return 0;
+    const calib_sample *newest = calibcache_get(c, 0);
+    if (newest->step_max < min_steps || newest->step_max > max_steps) return 0;
+
+    int score = CALIBCACHE_BASE;
+    for (uint8_t age = 1; age < c->count; age++) {
+        const calib_sample *s = calibcache_get(c, age);
+        bool agrees = abs(s->step_max - newest->step_max) <= CALIBCACHE_AGREE_STEPS &&
+                      abs(s->edge_steps - newest->edge_steps) <= CALIBCACHE_AGREE_EDGE_STEPS;
+        score += agrees ? CALIBCACHE_PER_AGREEING : -CALIBCACHE_PER_DRIFTED;
+    }
+
+    if (temp_c == CALIBCACHE_NO_TEMP || newest->temp_c == CALIBCACHE_NO_TEMP) {
+        score -= CALIBCACHE_TEMP_UNKNOWN;
+    } else if (abs(temp_c - newest->temp_c) > CALIBCACHE_TEMP_DRIFT_C) {
+        score -= CALIBCACHE_TEMP_DRIFTED;
+    }
+
+    if (score < 0) return 0;
+    if (score > 100) return 100;
+    return (uint8_t)score;
+}
+
+/**
+ * Writes the cache in its EEPROM record format: count, next, phase, then every sample as step_max and edge_steps
+ * LSB first and the temperature.
+ *
+ * @param c   Pointer to the cache.
+ * @param dst Pointer to CALIBCACHE_RECORD_LEN bytes.
+ */
+void calibcache_encode(const calib_cache *c, uint8_t *dst) {
+    dst[0] = c->count;
+    dst[1] = c->next;
+    dst[2] = c->phase;
+    for (int i = 0; i < CALIBCACHE_HISTORY; i++) {
+        uint8_t *p = &dst[3 + i * 5];
+        p[0] = (uint8_t)(c->samples[i].step_max & 0xFF);
+        p[1] = (uint8_t)(c->samples[i].step_max >> 8);
+        p[2] = (uint8_t)(c->samples[i].edge_steps & 0xFF);
+        p[3] = (uint8_t)(c->samples[i].edge_steps >> 8);
+        p[4] = (uint8_t)c->samples[i].temp_c;
+    }
+}
+
+/**
+ * Reads a cache from its EEPROM record format.
+ *
+ * @param c   Pointer to the cache, only changed if the record is valid.
+ * @param src Pointer to CALIBCACHE_RECORD_LEN bytes.
+ * @return false if the count, the position of the next sample or the phase is out of range.
+ */
+bool calibcache_decode(calib_cache *c, const uint8_t *src) {
+    if (src[0] > CALIBCACHE_HISTORY || src[1] >= CALIBCACHE_HISTORY || (src[2] >= CALIBCACHE_PHASES && src[2] != CALIBCACHE_NO_PHASE)) return false;
+    c->count = src[0];
+    c->next = src[1];
+    c->phase = src[2];
+    for (int i = 0; i < CALIBCACHE_HISTORY; i++) {
+        const uint8_t *p = &src[3 + i * 5];
+        c->samples[i].step_max = (uint16_t)(p[0] | (p[1] << 8));
+        c->samples[i].edge_steps = (uint16_t)(p[2] | (p[3] << 8));
+        c->samples[i].temp_c = (int8_t)p[4];
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+
+#include "chiptemp.h"
+
+#define CHIPTEMP_ADC_INPUT 4     // the temperature sensor is on ADC input 4
+#define CHIPTEMP_VREF_MV 3300
+#define CHIPTEMP_SAMPLES 16      // averaged, one reading is noisy by a few degrees
+// from the RP2040 datasheet: 0.706 V at 27 C, -1.721 mV per degree
+#define CHIPTEMP_MV_AT_27C 706
+#define CHIPTEMP_UV_PER_C 1721
+
+/**
+ * Starts the ADC and turns the temperature sensor on.
+ */
+void chiptemp_init(void) {
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+}
+
+/**
+ * Reads the chip temperature. Integer math only, the RP2040 has no FPU.
+ *
+ * @return Temperature in whole degrees Celsius.
+ */
+int8_t chiptemp_read_c(void) {
+    adc_select_input(CHIPTEMP_ADC_INPUT);
+    uint32_t raw = 0;
+    for (int i = 0; i < CHIPTEMP_SAMPLES; i++) {
+        raw += adc_read();
+    }
+    int32_t uv = (int32_t)((uint64_t)raw * CHIPTEMP_VREF_MV * 1000 / (4096 * CHIPTEMP_SAMPLES));
+    int32_t c = 27 - (uv - CHIPTEMP_MV_AT_27C * 1000) / CHIPTEMP_UV_PER_C;
+    if (c <= INT8_MIN) c = INT8_MIN + 1; // INT8_MIN means unknown to the calibration cache
+    if (c > INT8_MAX) c = INT8_MAX;
+    return (int8_t)c;
+}
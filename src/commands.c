@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "commands.h"
+
+/**
+ * Reads a little endian 16 bit value.
+ *
+ * @param p Pointer to the first byte.
+ * @return The value.
+ */
+static inline uint16_t command_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/**
+ * Reads a little endian 32 bit value.
+ *
+ * @param p Pointer to the first byte.
+ * @return The value.
+ */
+static inline uint32_t command_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Decodes and validates a binary command from a downlink payload. Only checks the format, whether the command can
+ * be run right now is up to the caller.
+ *
+ * @param data Pointer to the payload.
+ * @param len  Length of the payload.
+ * @param cmd  Pointer to where the decoded command will be stored.
+ * @return true if the payload is a valid command, false otherwise.
+ */
+bool command_parse(const uint8_t *data, uint8_t len, command *cmd) {
+    if (len < 1) return false;
+    const uint8_t *arg = data + 1;
+    uint8_t arg_len = len - 1;
+
+    cmd->opcode = data[0];
+    cmd->carousel = COMMAND_ALL_CAROUSELS;
+    switch (cmd->opcode) {
+    case CMD_CALIBRATE:
+        if (arg_len > 1) return false;
+        if (arg_len == 1) cmd->carousel = arg[0];
+        return true;
+    case CMD_DISPENSE_NOW:
+        if (arg_len < 1 || arg_len > 2 || arg[0] == 0) return false;
+        cmd->args.pills = arg[0];
+        if (arg_len == 2) cmd->carousel = arg[1];
+        return true;
+    case CMD_SET_SCHEDULE:
+        if (arg_len < 1 || arg[0] > SCHEDULE_MAX_DOSES || arg_len != 1 + arg[0] * 3) return false;
+        cmd->args.schedule.count = arg[0];
+        for (int i = 0; i < arg[0]; i++) {
+            cmd->args.schedule.doses[i].minute_of_day = command_u16(&arg[1 + i * 3]);
+            cmd->args.schedule.doses[i].pills = arg[3 + i * 3];
+        }
+        return true;
+    case CMD_REQUEST_LOGS:
+        if (arg_len != 2) return false;
+        cmd->args.first_log = command_u16(arg);
+        return true;
+    case CMD_SET_TIME:
+        if (arg_len != 4) return false;
+        cmd->args.unix_s = command_u32(arg);
+        return true;
+    case CMD_SET_TIMING:
+        if (arg_len != 5 || arg[0] >= TIMING_PARAM_COUNT) return false;
+        cmd->args.timing.param = arg[0];
+        cmd->args.timing.value_ms = command_u32(&arg[1]);
+        return true;
+    case CMD_SET_WHEEL:
+        if (arg_len != 1) return false;
+        cmd->args.compartments = arg[0];
+        return true;
+    case CMD_SET_COMPARTMENT_OFFSET:
+        if (arg_len != 2) return false;
+        cmd->args.offset.compartment = arg[0];
+        cmd->args.offset.offset = (int8_t)arg[1];
+        return true;
+    default:
+        return false;
+    }
+}
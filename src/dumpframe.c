@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dumpframe.h"
+#include "logrecord.h"
+
+/**
+ * COBS encodes bytes, replacing each zero byte with the distance to the next one.
+ *
+ * @param src Pointer to the bytes.
+ * @param len Number of bytes.
+ * @param dst Pointer to room for len + len / 254 + 1 bytes.
+ * @return Number of bytes written, none of them zero.
+ */
+static size_t dumpframe_cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t code_at = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[code_at] = code;
+            code_at = out++;
+            code = 1;
+            continue;
+        }
+        dst[out++] = src[i];
+        if (++code == 0xFF) { // longest run without a zero, the next code doesn't stand for one
+            dst[code_at] = code;
+            code_at = out++;
+            code = 1;
+        }
+    }
+    dst[code_at] = code;
+    return out;
+}
+
+/**
+ * Decodes COBS encoded bytes. Decoding in place works, the output is never ahead of the input.
+ *
+ * @param src Pointer to the encoded bytes, without the zero bytes around them.
+ * @param len Number of encoded bytes.
+ * @param dst Pointer to room for len bytes.
+ * @return Number of bytes decoded, -1 if the bytes aren't valid COBS.
+ */
+static int dumpframe_cobs_decode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len) {
+        uint8_t code = src[in++];
+        if (code == 0 || in + code - 1 > len) return -1;
+        for (uint8_t i = 1; i < code; i++) dst[out++] = src[in++];
+        if (code < 0xFF && in < len) dst[out++] = 0;
+    }
+    return (int)out;
+}
+
+/**
+ * Builds a frame ready to send: the CRC is added, the payload and CRC are COBS encoded and put between zero bytes.
+ *
+ * @param dst     Pointer to room for DUMPFRAME_MAX_LEN bytes.
+ * @param payload Pointer to the type byte and the fields.
+ * @param len     Length of the payload, at most DUMPFRAME_MAX_PAYLOAD.
+ * @return Number of bytes to send.
+ */
+size_t dumpframe_encode(uint8_t *dst, const uint8_t *payload, size_t len) {
+    uint8_t buf[DUMPFRAME_MAX_PAYLOAD + DUMPFRAME_CRC_LEN];
+    if (len > DUMPFRAME_MAX_PAYLOAD) len = DUMPFRAME_MAX_PAYLOAD;
+    memcpy(buf, payload, len);
+    uint16_t crc = crc16(buf, len);
+    buf[len] = crc >> 8;
+    buf[len + 1] = crc & 0xFF;
+    dst[0] = 0; // ends whatever was printed before the frame
+    size_t n = 1 + dumpframe_cobs_encode(buf, len + DUMPFRAME_CRC_LEN, dst + 1);
+    dst[n++] = 0;
+    return n;
+}
+
+/**
+ * Initializes a receiver, waiting for the start of a frame.
+ *
+ * @param rx Pointer to the receiver.
+ */
+void dumpframe_rx_init(dumpframe_rx *rx) {
+    rx->len = 0;
+    rx->overflow = false;
+}
+
+/**
+ * Feeds a received byte to a receiver.
+ *
+ * @param rx   Pointer to the receiver.
+ * @param byte Byte received.
+ * @return Length of the payload in rx->buf when the byte ended a frame with a matching CRC. 0 if no frame ended,
+ *         -1 if a frame ended that is too long, isn't valid COBS or fails its CRC. The payload is valid until the
+ *         next byte is fed.
+ */
+int dumpframe_rx_feed(dumpframe_rx *rx, uint8_t byte) {
+    if (byte != 0) {
+        if (rx->len < sizeof(rx->buf)) {
+            rx->buf[rx->len++] = byte;
+        } else {
+            rx->overflow = true;
+        }
+        return 0;
+    }
+    size_t len = rx->len;
+    bool overflow = rx->overflow;
+    dumpframe_rx_init(rx);
+    if (len == 0) return 0; // zero bytes between frames
+    if (overflow) return -1;
+    int n = dumpframe_cobs_decode(rx->buf, len, rx->buf);
+    if (n <= DUMPFRAME_CRC_LEN || crc16(rx->buf, (size_t)n) != 0) return -1;
+    return n - DUMPFRAME_CRC_LEN;
+}
+
+/**
+ * Stores a 16 bit field, LSB first.
+ *
+ * @param dst   Pointer to 2 bytes.
+ * @param value Value to store.
+ */
+void dumpframe_put_u16(uint8_t *dst, uint16_t value) {
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+/**
+ * Stores a 32 bit field, LSB first.
+ *
+ * @param dst   Pointer to 4 bytes.
+ * @param value Value to store.
+ */
+void dumpframe_put_u32(uint8_t *dst, uint32_t value) {
+    for (int i = 0; i < 4; i++) dst[i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * Loads a 16 bit field, LSB first.
+ *
+ * @param src Pointer to 2 bytes.
+ * @return The value.
+ */
+uint16_t dumpframe_get_u16(const uint8_t *src) {
+    return (uint16_t)(src[0] | src[1] << 8);
+}
+
+/**
+ * Loads a 32 bit field, LSB first.
+ *
+ * @param src Pointer to 4 bytes.
+ * @return The value.
+ */
+uint32_t dumpframe_get_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
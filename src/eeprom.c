@@ -1,13 +1,28 @@
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#include "hardware/irq.h"
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
+#include "metrics.h"
+#include "profiler.h"
+#include "breadcrumb.h"
+#include "supervisor.h"
+#include "i2cdma.h"
+#include "eeprom.h"
 
 
-#define EEPROM_ADDRESS 0x50
+#define EEPROM_DEADLINE_MS 50 // longest a transfer may take, including the wait for the previous write cycle
+#define EEPROM_TRANSFER_TIMEOUT_US 10000 // a 64 byte page takes under 1 ms at 1 MHz, more means the bus is stuck
+#define EEPROM_HEADER_MAX 2 // address bytes of the largest chips
 
+static i2c_inst_t *eeprom_i2c = i2c0;
+static blockdev chip_devs[BLOCKDEV_MAX_PARTS];
+static blockdev_concat chip_cat;
+static blockdev storage; // every chip, one after another
 static uint64_t write_cycle_max = 0;
-static absolute_time_t write_init_time;
+static volatile uint64_t write_done_us = 0; // set by the I2C interrupt when a write ends
+static volatile bool write_failed = false;
 
 /**
  * Checks if the EEPROM write cycle duration has exceeded the maximum allowed time.
@@ -15,7 +30,7 @@ static absolute_time_t write_init_time;
  * @return true if the EEPROM write cycle duration exceeds the maximum, otherwise false.
  */
 static inline bool eeprom_write_cycle_check() {
-    if (absolute_time_diff_us(write_init_time, get_absolute_time()) > write_cycle_max) {
+    if (time_us_64() - write_done_us > write_cycle_max) {
         return true; // Return true if EEPROM write cycle duration exceeds the maximum
     }
     return false; // Return false if EEPROM write cycle duration is within the allowed limit
@@ -27,21 +42,143 @@ static inline bool eeprom_write_cycle_check() {
  */
 static inline void eeprom_write_cycle_block() {
     if (!eeprom_write_cycle_check()) { // Check if EEPROM write cycle duration exceeds the maximum
-        sleep_until(delayed_by_us(write_init_time, write_cycle_max)); // Sleep until EEPROM write cycle is within allowed limit
+        PROFILE_BEGIN(PROF_EEPROM_WAIT);
+        sleep_until(from_us_since_boot(write_done_us + write_cycle_max)); // Sleep until EEPROM write cycle is within allowed limit
+        PROFILE_END(PROF_EEPROM_WAIT);
     }
 }
 
 /**
- * Initializes the EEPROM module using the specified I2C interface, baud rate, and maximum write cycle duration.
+ * Ends a write in the background, the EEPROM starts its write cycle on the stop. Runs in the I2C interrupt.
+ *
+ * @param ok  true if the EEPROM acknowledged every byte.
+ * @param arg Unused.
+ */
+static void eeprom_write_done(bool ok, void *arg) {
+    write_done_us = time_us_64();
+    if (!ok) write_failed = true;
+}
+
+/**
+ * Waits for the write still running in the background, then for the EEPROM's write cycle, so the bus and the
+ * EEPROM are free for the next transfer. A failed write is counted here.
+ */
+static void eeprom_wait_ready() {
+    if (i2cdma_busy()) {
+        PROFILE_BEGIN(PROF_EEPROM_WAIT);
+        if (!i2cdma_wait(EEPROM_TRANSFER_TIMEOUT_US)) write_failed = true;
+        PROFILE_END(PROF_EEPROM_WAIT);
+    }
+    if (write_failed) {
+        metrics_count(METRIC_I2C_ERRORS);
+        write_failed = false;
+    }
+    eeprom_write_cycle_block(); // Ensure EEPROM write cycle duration is within limits
+}
+
+/**
+ * Fills the address header sent before every read and write. Chips with more memory than their address bytes
+ * reach take the rest of the address in the low bits of the I2C address, the 24C16 and the 24M01 for example.
+ *
+ * @param chip    Pointer to the chip.
+ * @param address The address in the chip.
+ * @param header  Pointer to chip->address_bytes bytes.
+ * @return I2C address to use.
+ */
+static uint8_t eeprom_address_header(const eeprom_chip *chip, uint32_t address, uint8_t *header) {
+    for (int i = 0; i < chip->address_bytes; i++) {
+        header[i] = (uint8_t)(address >> (8 * (chip->address_bytes - 1 - i))); // most significant byte first
+    }
+    return chip->i2c_address | (uint8_t)(address >> (8 * chip->address_bytes));
+}
+
+/**
+ * Starts writing to a chip. The data is copied into the DMA driver as the write starts, so it returns without
+ * waiting for the bus and the caller's buffer is free right away.
+ *
+ * @param dev     Pointer to the chip's block device.
+ * @param address The starting address in the chip.
+ * @param src     Pointer to the data.
+ * @param size    Size of the data, within one page.
+ * @return false if the write couldn't be started.
+ */
+static bool eeprom_write(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size) {
+    const eeprom_chip *chip = dev->ctx;
+    uint8_t header[EEPROM_HEADER_MAX];
+    uint8_t i2c_address = eeprom_address_header(chip, address, header);
+    i2cdma_segment segments[2] = {{header, chip->address_bytes}, {src, size}};
+
+    uint32_t start = time_us_32();
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_EEPROM_WRITE);
+    supervisor_start(TASK_EEPROM, EEPROM_DEADLINE_MS);
+    eeprom_wait_ready();
+
+    // the write cycle is timed from the stop, the interrupt sets write_done_us then
+    bool started = i2cdma_write(i2c_address, segments, 2, eeprom_write_done, NULL);
+    if (!started) metrics_count(METRIC_I2C_ERRORS);
+
+    metrics_observe(METRIC_EEPROM_WRITE_US, time_us_32() - start);
+    supervisor_stop(TASK_EEPROM);
+    breadcrumb_leave(before);
+    return started;
+}
+
+/**
+ * Reads from a chip. The core sleeps while the DMA moves the data. Reads are split where the address bytes roll
+ * over, chips don't agree on where a read that goes past that ends up.
+ *
+ * @param dev     Pointer to the chip's block device.
+ * @param address The starting address in the chip.
+ * @param dst     Pointer to the destination buffer.
+ * @param size    Size of the data to read.
+ * @return false if the chip didn't answer.
+ */
+static bool eeprom_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size) {
+    const eeprom_chip *chip = dev->ctx;
+    uint32_t block = 1u << (8 * chip->address_bytes);
+    bool ok = true;
+
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_EEPROM_READ);
+    supervisor_start(TASK_EEPROM, EEPROM_DEADLINE_MS);
+    eeprom_wait_ready();
+
+    while (ok && size > 0) {
+        size_t chunk = block - address % block;
+        if (chunk > size) chunk = size;
+        uint8_t header[EEPROM_HEADER_MAX];
+        uint8_t i2c_address = eeprom_address_header(chip, address, header);
+        ok = i2cdma_read(i2c_address, header, chip->address_bytes, dst, chunk, NULL, NULL) &&
+             i2cdma_wait(EEPROM_TRANSFER_TIMEOUT_US);
+        address += chunk;
+        dst += chunk;
+        size -= chunk;
+    }
+    if (!ok) metrics_count(METRIC_I2C_ERRORS);
+    supervisor_stop(TASK_EEPROM);
+    breadcrumb_leave(before);
+    return ok;
+}
+
+static const blockdev_ops eeprom_ops = {
+    .read = eeprom_read,
+    .program = eeprom_write,
+    .erase = NULL // writes in place
+};
+
+/**
+ * Initializes the EEPROM module using the specified I2C interface, pins, baud rate, and maximum write cycle duration.
  *
  * @param i2c              Pointer to the I2C interface (i2c_inst_t) to be used for EEPROM communication.
+ * @param sda_pin          SDA pin of the I2C interface.
+ * @param scl_pin          SCL pin of the I2C interface.
  * @param baud             Baud rate for the I2C communication.
  * @param write_cycle_max_ms Maximum allowed duration for EEPROM write cycles in milliseconds.
+ * @param chips            Pointer to the chips on the bus, in the order their memory is used. Has to stay valid.
+ * @param chip_count       Number of chips, 1 to BLOCKDEV_MAX_PARTS.
+ * @return false if the chips can't be used together, they need the same page size.
  */
-void eeprom_init_i2c(i2c_inst_t *i2c, uint baud, uint32_t write_cycle_max_ms) {
-    // Select appropriate pins based on the I2C interface
-    uint sda_pin = (i2c == i2c0) ? 16 : 19;
-    uint scl_pin = (i2c == i2c0) ? 17 : 20;
+bool eeprom_init_i2c(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baud, uint32_t write_cycle_max_ms, const eeprom_chip *chips, uint8_t chip_count) {
+    eeprom_i2c = i2c;
 
     // Set pin functions and directions for I2C communication
     gpio_set_function(sda_pin, GPIO_FUNC_I2C);
@@ -52,95 +189,150 @@ void eeprom_init_i2c(i2c_inst_t *i2c, uint baud, uint32_t write_cycle_max_ms) {
     // Initialize I2C interface with the specified baud rate
     i2c_init(i2c, baud);
 
+    i2cdma_init(i2c); // reads and writes are moved by DMA
+
     // Set the maximum allowed EEPROM write cycle duration in microseconds
     write_cycle_max = (uint64_t) write_cycle_max_ms * 1000;
 
-    // Initialize the write initiation time to an initial value
-    write_init_time = nil_time;
-}
-
-/**
- * Writes the specified EEPROM address using the I2C interface after ensuring the EEPROM write cycle duration is within limits.
- *
- * @param address The address to be written to the EEPROM.
- */
-void eeprom_write_address(uint16_t address) {
-    eeprom_write_cycle_block(); // Ensure EEPROM write cycle duration is within limits
+    // No write cycle running yet
+    write_done_us = 0;
 
-    // Prepare address data and write to the EEPROM via I2C
-    uint8_t out[2] = {address >> 4, address};
-    i2c_write_blocking(i2c0, EEPROM_ADDRESS, out, 2, true);
+    if (chip_count == 0 || chip_count > BLOCKDEV_MAX_PARTS) return false;
+    for (uint8_t i = 0; i < chip_count; i++) {
+        chip_devs[i] = (blockdev){
+            .ops = &eeprom_ops,
+            .ctx = &chips[i],
+            .size = chips[i].size,
+            .page_size = chips[i].page_size,
+            .erase_size = 0
+        };
+    }
+    return blockdev_concat_init(&storage, &chip_cat, chip_devs, chip_count);
 }
 
 /**
- * Writes a byte of data to the specified EEPROM address using the I2C interface after ensuring the EEPROM write cycle duration is within limits.
+ * Writes a byte of data to the specified EEPROM address. Returns once the write has started.
  *
  * @param address The address in the EEPROM where the byte will be written.
  * @param c       The byte of data to be written.
  */
-void eeprom_write_byte(uint16_t address, char c) {
-    // Prepare data (address and byte) to write to the EEPROM via I2C
-    uint8_t out[3] = {address >> 4, address, c};
-
-    eeprom_write_cycle_block(); // Ensure EEPROM write cycle duration is within limits
-
-    // Write data (address and byte) to the EEPROM through I2C communication
-    i2c_write_blocking(i2c0, EEPROM_ADDRESS, out, 3, false);
-
-    write_init_time = get_absolute_time(); // Update the write initiation time
+void eeprom_write_byte(uint32_t address, char c) {
+    blockdev_write(&storage, address, (const uint8_t *)&c, 1);
 }
 
 /**
- * Writes a page of data to the specified EEPROM address using the I2C interface after ensuring the EEPROM write cycle duration is within limits.
+ * Writes data to the specified EEPROM address, a chip page at a time. Returns once the last page has started,
+ * the EEPROM is waited for by the next transfer.
  *
- * @param address The starting address in the EEPROM where the page will be written.
+ * @param address The starting address in the EEPROM where the data will be written.
  * @param src     Pointer to the source data to be written to the EEPROM.
- * @param size    Size of the data (page size) to be written.
+ * @param size    Size of the data to be written, may cross pages and chips.
  */
-void eeprom_write_page(uint16_t address, uint8_t *src, size_t size) {
-    // Prepare data (address and source data) to write a page to the EEPROM via I2C
-    uint8_t out[size + 2];
-    out[0] = address >> 4; // Upper bits of the address
-    out[1] = address; // Lower bits of the address
-    for (int i = 0; i < size; i++) {
-        out[i + 2] = src[i]; // Copy source data into the output array
-    }
-
-    eeprom_write_cycle_block(); // Ensure EEPROM write cycle duration is within limits
-
-    // Write the page of data to the EEPROM through I2C communication
-    i2c_write_blocking(i2c0, EEPROM_ADDRESS, out, size + 2, false);
-
-    write_init_time = get_absolute_time(); // Update the write initiation time
+void eeprom_write_page(uint32_t address, uint8_t *src, size_t size) {
+    blockdev_write(&storage, address, src, size);
 }
 
 /**
- * Reads a byte of data from the specified EEPROM address using the I2C interface.
+ * Reads a byte of data from the specified EEPROM address.
  *
  * @param address The address in the EEPROM from where the byte will be read.
  * @return The byte of data read from the EEPROM.
  */
-char eeprom_read_byte(uint16_t address) {
-    char c = 0; // Initialize the variable to store the read byte
+char eeprom_read_byte(uint32_t address) {
+    uint8_t c = 0; // Initialize the variable to store the read byte
+    blockdev_read(&storage, address, &c, 1);
+    return c; // Return the byte of data read from the EEPROM
+}
 
-    eeprom_write_address(address); // Set the address to read from in the EEPROM
+/**
+ * Reads data from the specified EEPROM address into the provided destination buffer.
+ *
+ * @param address The starting address in the EEPROM from where the data will be read.
+ * @param dst     Pointer to the destination buffer to store the read data.
+ * @param size    Size of the data to be read, may cross pages and chips.
+ */
+void eeprom_read_page(uint32_t address, uint8_t *dst, size_t size) {
+    blockdev_read(&storage, address, dst, size);
+}
 
-    // Read a byte of data from the EEPROM via I2C communication
-    i2c_read_blocking(i2c0, EEPROM_ADDRESS, &c, 1, false);
+/**
+ * Gets the storage of all EEPROM chips together.
+ *
+ * @return Size in bytes.
+ */
+uint32_t eeprom_size() {
+    return storage.size;
+}
 
-    return c; // Return the byte of data read from the EEPROM
+#ifdef EEPROM_BENCH_ENABLED
+#define EEPROM_BENCH_PAGE 64
+
+/**
+ * Prints the throughput and the CPU use of a run of transfers.
+ *
+ * @param name    Name of the run.
+ * @param bytes   Bytes moved.
+ * @param wall_us Time the run took.
+ * @param cpu_us  CPU time the run used.
+ */
+static void eeprom_bench_report(const char *name, uint32_t bytes, uint32_t wall_us, uint32_t cpu_us) {
+    if (wall_us == 0) wall_us = 1;
+    printf("%-14s %5lu B %7lu us %7lu B/s CPU busy %3lu %%\n", name, (unsigned long)bytes, (unsigned long)wall_us,
+           (unsigned long)((uint64_t)bytes * 1000000 / wall_us), (unsigned long)((uint64_t)cpu_us * 100 / wall_us));
 }
 
 /**
- * Reads a page of data from the specified EEPROM address into the provided destination buffer using the I2C interface.
+ * Compares the blocking SDK transfers with the DMA ones: reads an area in 64 byte pages both ways, then writes
+ * its first page back with what it already holds, so nothing changes. The blocking transfers keep the CPU busy
+ * all the time, the DMA ones only while they are set up and ended. Built with -DEEPROM_BENCH=ON.
  *
- * @param address The starting address in the EEPROM from where the page will be read.
- * @param dst     Pointer to the destination buffer to store the read data.
- * @param size    Size of the data (page size) to be read.
+ * @param address First address of the area on the first chip, on a page boundary.
+ * @param size    Size of the area, a multiple of 64 bytes.
  */
-void eeprom_read_page(uint16_t address, uint8_t *dst, size_t size) {
-    eeprom_write_address(address); // Set the address to read from in the EEPROM
+void eeprom_benchmark(uint16_t address, uint16_t size) {
+    const eeprom_chip *chip = chip_devs[0].ctx;
+    uint8_t page[EEPROM_BENCH_PAGE];
+    uint8_t out[EEPROM_HEADER_MAX + EEPROM_BENCH_PAGE]; // address header and page, for the blocking transfers
+    eeprom_wait_ready();
+    uint irq = I2C0_IRQ + i2c_hw_index(eeprom_i2c);
+    irq_set_enabled(irq, false); // the SDK waits for the stop itself, the DMA driver's interrupt would take it
+
+    uint32_t start = time_us_32();
+    for (uint16_t a = address; a < address + size; a += EEPROM_BENCH_PAGE) {
+        uint8_t i2c_address = eeprom_address_header(chip, a, out);
+        i2c_write_blocking(eeprom_i2c, i2c_address, out, chip->address_bytes, true);
+        i2c_read_blocking(eeprom_i2c, i2c_address, page, EEPROM_BENCH_PAGE, false);
+    }
+    uint32_t wall = time_us_32() - start;
+    eeprom_bench_report("read blocking", size, wall, wall);
+    irq_set_enabled(irq, true);
+
+    uint32_t cpu = i2cdma_cpu_us();
+    start = time_us_32();
+    for (uint16_t a = address; a < address + size; a += EEPROM_BENCH_PAGE) {
+        uint8_t i2c_address = eeprom_address_header(chip, a, out);
+        i2cdma_read(i2c_address, out, chip->address_bytes, page, EEPROM_BENCH_PAGE, NULL, NULL);
+        i2cdma_wait(EEPROM_TRANSFER_TIMEOUT_US);
+    }
+    eeprom_bench_report("read DMA", size, time_us_32() - start, i2cdma_cpu_us() - cpu);
+
+    eeprom_read(&chip_devs[0], address, page, EEPROM_BENCH_PAGE);
+    uint8_t i2c_address = eeprom_address_header(chip, address, out);
+    memcpy(&out[chip->address_bytes], page, EEPROM_BENCH_PAGE);
+    eeprom_write_cycle_block();
+    irq_set_enabled(irq, false);
+    start = time_us_32();
+    i2c_write_blocking(eeprom_i2c, i2c_address, out, chip->address_bytes + EEPROM_BENCH_PAGE, false);
+    wall = time_us_32() - start;
+    write_done_us = time_us_64();
+    irq_set_enabled(irq, true);
+    eeprom_bench_report("write blocking", EEPROM_BENCH_PAGE, wall, wall);
 
-    // Read a page of data from the EEPROM into the provided destination buffer via I2C communication
-    i2c_read_blocking(i2c0, EEPROM_ADDRESS, dst, size, false);
+    eeprom_wait_ready();
+    cpu = i2cdma_cpu_us();
+    start = time_us_32();
+    eeprom_write(&chip_devs[0], address, page, EEPROM_BENCH_PAGE);
+    i2cdma_wait(EEPROM_TRANSFER_TIMEOUT_US);
+    eeprom_bench_report("write DMA", EEPROM_BENCH_PAGE, time_us_32() - start, i2cdma_cpu_us() - cpu);
 }
+#endif
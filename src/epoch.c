@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "epoch.h"
+
+#define EPOCH_SECONDS_PER_DAY 86400u
+
+/**
+ * Stores a word in the record, LSB first.
+ *
+ * @param dst   Pointer to 4 bytes.
+ * @param value Word to store.
+ */
+static void epoch_put_u32(uint8_t *dst, uint32_t value) {
+    for (int i = 0; i < 4; i++) dst[i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * Loads a word from the record, LSB first.
+ *
+ * @param src Pointer to 4 bytes.
+ * @return The word.
+ */
+static uint32_t epoch_get_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+/**
+ * Initializes the epoch of a device that has never booted, the first boot starts at device time 1.
+ *
+ * @param e Pointer to the epoch.
+ */
+void epoch_init(epoch *e) {
+    memset(e, 0, sizeof(*e));
+}
+
+/**
+ * Starts a new boot after the end of the previous one. The previous boot ran at least until its newest log and
+ * for as long as its breadcrumb shows, the time it was off isn't known.
+ *
+ * @param e              Pointer to the epoch read from EEPROM, or a new one.
+ * @param newest_s       Device time of the newest log, 0 if there is none.
+ * @param prev_uptime_ms How long the previous boot is known to have run, 0 if unknown.
+ */
+void epoch_start_boot(epoch *e, uint32_t newest_s, uint32_t prev_uptime_ms) {
+    uint32_t end = e->boot_s + prev_uptime_ms / 1000;
+    if (newest_s > end) end = newest_s;
+    e->prev_boot_s = e->boot_s;
+    e->boot_s = end + 1;
+    e->boot_count++;
+    e->flags &= ~EPOCH_BOOT_SYNCED; // the time the device was off is unknown until the next sync
+}
+
+/**
+ * Converts the time since this boot to device time.
+ *
+ * @param e       Pointer to the epoch.
+ * @param time_ms Milliseconds since boot.
+ * @return Device time in seconds.
+ */
+uint32_t epoch_now(const epoch *e, uint32_t time_ms) {
+    return e->boot_s + time_ms / 1000;
+}
+
+/**
+ * Converts a time since the previous boot to device time, for the logs about what the previous boot was doing.
+ *
+ * @param e       Pointer to the epoch.
+ * @param time_ms Milliseconds since the previous boot.
+ * @return Device time in seconds.
+ */
+uint32_t epoch_previous_boot(const epoch *e, uint32_t time_ms) {
+    return e->prev_boot_s + time_ms / 1000;
+}
+
+/**
+ * Syncs the device time to the network time. The device time jumps forward to the unix time if it is behind,
+ * otherwise it stays where it is and the offset to the unix time is kept.
+ *
+ * @param e       Pointer to the epoch.
+ * @param unix_s  Seconds since 1970-01-01 UTC, ignored if before EPOCH_UNIX_MIN.
+ * @param time_ms Milliseconds since boot.
+ * @return Seconds the device time jumped forward.
+ */
+uint32_t epoch_sync(epoch *e, uint32_t unix_s, uint32_t time_ms) {
+    if (unix_s < EPOCH_UNIX_MIN) return 0;
+    uint32_t now = epoch_now(e, time_ms);
+    uint32_t jump = 0;
+    if (unix_s > now) {
+        jump = unix_s - now;
+        e->boot_s += jump;
+    }
+    e->unix_offset_s = (int32_t)(unix_s - epoch_now(e, time_ms));
+    e->flags |= EPOCH_SYNCED | EPOCH_BOOT_SYNCED;
+    return jump;
+}
+
+/**
+ * Checks if the device time of this boot is a unix time.
+ *
+ * @param e Pointer to the epoch.
+ * @return true once this boot has synced to the network time.
+ */
+bool epoch_boot_synced(const epoch *e) {
+    return (e->flags & EPOCH_BOOT_SYNCED) != 0;
+}
+
+/**
+ * Converts days since 1970-01-01 to a civil date using integer math only.
+ *
+ * @param z     Days since the unix epoch.
+ * @param year  Pointer to where the year is stored.
+ * @param month Pointer to where the month 1-12 is stored.
+ * @param day   Pointer to where the day of month 1-31 is stored.
+ */
+void epoch_civil_from_days(int32_t z, int32_t *year, uint32_t *month, uint32_t *day) {
+    z += 719468;
+    int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = (int32_t)yoe + era * 400 + (*month <= 2);
+}
+
+/**
+ * Writes a device time as a UTC date if it is a unix time, and as seconds otherwise.
+ *
+ * @param dst      Pointer to the buffer for the text.
+ * @param size     Size of the buffer.
+ * @param device_s Device time in seconds.
+ * @param utc      true if the time is from a boot that had synced when it was taken.
+ * @return Length of the text, as snprintf().
+ */
+int epoch_format(char *dst, size_t size, uint32_t device_s, bool utc) {
+    if (!utc || device_s < EPOCH_UNIX_MIN) return snprintf(dst, size, "device time %lu s", (unsigned long)device_s);
+    int32_t year;
+    uint32_t month;
+    uint32_t day;
+    uint32_t secs = device_s % EPOCH_SECONDS_PER_DAY;
+    epoch_civil_from_days((int32_t)(device_s / EPOCH_SECONDS_PER_DAY), &year, &month, &day);
+    return snprintf(dst, size, "%04ld-%02lu-%02lu %02lu:%02lu:%02lu UTC", (long)year, (unsigned long)month,
+                    (unsigned long)day, (unsigned long)(secs / 3600), (unsigned long)(secs / 60 % 60),
+                    (unsigned long)(secs % 60));
+}
+
+/**
+ * Writes the epoch in its EEPROM record format.
+ *
+ * @param e   Pointer to the epoch.
+ * @param dst Pointer to EPOCH_RECORD_LEN bytes.
+ */
+void epoch_encode(const epoch *e, uint8_t *dst) {
+    dst[0] = (uint8_t)(e->boot_count & 0xFF);
+    dst[1] = (uint8_t)(e->boot_count >> 8);
+    epoch_put_u32(dst + 2, e->boot_s);
+    epoch_put_u32(dst + 6, (uint32_t)e->unix_offset_s);
+    dst[10] = e->flags;
+}
+
+/**
+ * Reads an epoch from its EEPROM record format.
+ *
+ * @param e   Pointer to the epoch, only changed if the record is valid.
+ * @param src Pointer to EPOCH_RECORD_LEN bytes.
+ * @return false if the record holds values an epoch can't have.
+ */
+bool epoch_decode(epoch *e, const uint8_t *src) {
+    if ((src[10] & ~(EPOCH_SYNCED | EPOCH_BOOT_SYNCED)) != 0 || (int32_t)epoch_get_u32(src + 6) > 0) return false;
+    e->boot_count = (uint16_t)(src[0] | (src[1] << 8));
+    e->boot_s = epoch_get_u32(src + 2);
+    e->prev_boot_s = e->boot_s;
+    e->unix_offset_s = (int32_t)epoch_get_u32(src + 6);
+    e->flags = src[10];
+    return true;
+}
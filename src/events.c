@@ -0,0 +1,121 @@
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+#include "events.h"
+
+#define EVENT_QUEUE_LEN 16 // must be a power of two
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_LEN - 1)
+
+static event queue[EVENT_QUEUE_LEN];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+
+static volatile alarm_id_t wake_alarm = 0;
+static uint32_t max_latency_us = 0;
+static volatile uint32_t overflow_count = 0;
+
+/**
+ * Initializes the event queue.
+ */
+void events_init(void) {
+    queue_head = 0;
+    queue_tail = 0;
+    wake_alarm = 0;
+    max_latency_us = 0;
+    overflow_count = 0;
+}
+
+/**
+ * Posts an event to the queue and wakes the core if it is sleeping in events_wait_ms().
+ * Safe to call from interrupt handlers.
+ *
+ * @param type Type of the event.
+ * @param data Event specific data.
+ * @return true if the event was queued, false if the queue was full.
+ */
+bool events_post(event_type type, uint32_t data) {
+    bool queued = false;
+    uint32_t status = save_and_disable_interrupts(); // events are posted from irqs with different priorities
+    uint8_t next = (queue_head + 1) & EVENT_QUEUE_MASK;
+    if (next != queue_tail) {
+        queue[queue_head].type = type;
+        queue[queue_head].data = data;
+        queue[queue_head].timestamp_us = time_us_32();
+        queue_head = next;
+        queued = true;
+    } else {
+        overflow_count++;
+    }
+    restore_interrupts(status);
+    __sev(); // make sure a pending __wfe() returns even if the post raced with going to sleep
+    return queued;
+}
+
+/**
+ * Gets the oldest event from the queue and updates the wake-up latency statistics.
+ *
+ * @param ev Pointer to where the event will be stored.
+ * @return true if an event was available, false otherwise.
+ */
+bool events_get(event *ev) {
+    if (queue_tail == queue_head) return false;
+    *ev = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & EVENT_QUEUE_MASK;
+
+    uint32_t latency = time_us_32() - ev->timestamp_us; // time from irq to the main loop seeing the event
+    if (latency > max_latency_us) max_latency_us = latency;
+    return true;
+}
+
+/**
+ * Checks if there are events waiting in the queue.
+ *
+ * @return true if the queue is not empty.
+ */
+bool events_pending(void) {
+    return queue_tail != queue_head;
+}
+
+static int64_t events_alarm_callback(alarm_id_t id, void *user_data) {
+    wake_alarm = 0;
+    events_post(EVENT_TIMER, 0);
+    return 0; // one shot
+}
+
+/**
+ * Sleeps with __wfe() until an event is posted or the timeout expires.
+ * The timeout is implemented with a hardware alarm that posts an EVENT_TIMER, so nothing polls while sleeping.
+ *
+ * @param timeout_ms Maximum time to sleep in milliseconds. 0 returns immediately.
+ */
+void events_wait_ms(uint32_t timeout_ms) {
+    if (timeout_ms == 0 || events_pending()) return;
+
+    if (wake_alarm > 0) cancel_alarm(wake_alarm);
+    alarm_id_t id = add_alarm_in_ms(timeout_ms, events_alarm_callback, NULL, true);
+    wake_alarm = (id > 0) ? id : 0;
+    if (id < 0) return; // no alarm slots, fall back to polling instead of sleeping forever
+
+    while (!events_pending()) {
+        __wfe();
+    }
+}
+
+/**
+ * Gets the longest time an event waited between being posted and being read by the main loop.
+ *
+ * @return Maximum wake-up latency in microseconds since boot.
+ */
+uint32_t events_get_max_latency_us(void) {
+    return max_latency_us;
+}
+
+/**
+ * Gets the number of events dropped because the queue was full.
+ *
+ * @return Overflow count since boot.
+ */
+uint32_t events_get_overflow_count(void) {
+    return overflow_count;
+}
@@ -0,0 +1,92 @@
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include <string.h>
+
+#include "flashdev.h"
+#include "supervisor.h"
+
+#define FLASH_ERASE_MAX_MS 500 // datasheet worst case for a 4 KB sector erase is 400 ms
+
+extern char __flash_binary_end; // from the linker script
+
+/**
+ * Reads from the flash through the XIP window.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to read.
+ * @param dst     Pointer to the buffer to read into.
+ * @param size    Bytes to read.
+ * @return Always true.
+ */
+static bool flashdev_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size) {
+    uint32_t offset = (uint32_t)(uintptr_t)dev->ctx;
+    memcpy(dst, (const uint8_t *)(uintptr_t)(XIP_BASE + offset + address), size);
+    return true;
+}
+
+/**
+ * Programs part of a flash page. The flash only programs whole pages, the rest of the page is sent as 0xFF,
+ * which leaves those bytes as they are.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to program.
+ * @param src     Pointer to the data.
+ * @param size    Bytes to program, all in one page.
+ * @return Always true.
+ */
+static bool flashdev_program(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size) {
+    uint32_t offset = (uint32_t)(uintptr_t)dev->ctx + address;
+    uint32_t page = offset - offset % FLASH_PAGE_SIZE;
+    uint8_t buffer[FLASH_PAGE_SIZE];
+    memset(buffer, 0xFF, sizeof(buffer));
+    memcpy(buffer + (offset - page), src, size);
+
+    uint32_t status = save_and_disable_interrupts();
+    flash_range_program(page, buffer, FLASH_PAGE_SIZE);
+    restore_interrupts(status);
+    return true;
+}
+
+/**
+ * Erases a 4 KB sector. The watchdog can't be fed while interrupts are off, it gets the longest erase time.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte of the sector.
+ * @return Always true.
+ */
+static bool flashdev_erase(const blockdev *dev, uint32_t address) {
+    uint32_t offset = (uint32_t)(uintptr_t)dev->ctx + address;
+    supervisor_suspend(FLASH_ERASE_MAX_MS);
+    uint32_t status = save_and_disable_interrupts();
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(status);
+    supervisor_resume();
+    return true;
+}
+
+static const blockdev_ops flash_ops = {
+    .read = flashdev_read,
+    .program = flashdev_program,
+    .erase = flashdev_erase
+};
+
+/**
+ * Sets up the last bytes of the flash as a block device.
+ *
+ * @param dev  Pointer to the device to set up.
+ * @param size Bytes to use, a multiple of the sector size.
+ * @return false if the size isn't whole sectors or the region would overlap the firmware.
+ */
+bool flashdev_init(blockdev *dev, uint32_t size) {
+    if (size == 0 || size % FLASH_SECTOR_SIZE != 0 || size > PICO_FLASH_SIZE_BYTES) return false;
+    uint32_t offset = PICO_FLASH_SIZE_BYTES - size;
+    if ((uintptr_t)&__flash_binary_end - XIP_BASE > offset) return false;
+
+    dev->ops = &flash_ops;
+    dev->ctx = (const void *)(uintptr_t)offset; // offset of the region in the flash
+    dev->size = size;
+    dev->page_size = FLASH_PAGE_SIZE;
+    dev->erase_size = FLASH_SECTOR_SIZE;
+    return true;
+}
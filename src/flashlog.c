@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "flashlog.h"
+
+#define FLASHLOG_MAGIC 0x474F4C50u // "PLOG"
+#define FLASHLOG_UNOPENED 0xFFFFFFFFu // sequence of an erased sector that hasn't been written to yet
+
+// sector header, little-endian words
+#define HEADER_MAGIC 0
+#define HEADER_ERASE_COUNT 4
+#define HEADER_SEQUENCE 8
+
+/**
+ * Stores a word in a header, LSB first.
+ *
+ * @param dst   Pointer to 4 bytes.
+ * @param value Word to store.
+ */
+static void flashlog_put_u32(uint8_t *dst, uint32_t value) {
+    for (int i = 0; i < 4; i++) dst[i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * Loads a word from a header, LSB first.
+ *
+ * @param src Pointer to 4 bytes.
+ * @return The word.
+ */
+static uint32_t flashlog_get_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+/**
+ * Calculates the address of a sector.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @return Address of the sector's header.
+ */
+static uint32_t flashlog_sector_address(const flashlog *fl, uint16_t sector) {
+    return (uint32_t)sector * fl->dev->erase_size;
+}
+
+/**
+ * Calculates the address of a record.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @param slot   Record in the sector.
+ * @return Address of the record's first byte.
+ */
+static uint32_t flashlog_record_address(const flashlog *fl, uint16_t sector, uint16_t slot) {
+    return flashlog_sector_address(fl, sector) + FLASHLOG_HEADER_LEN + (uint32_t)slot * FLASHLOG_RECORD_LEN;
+}
+
+/**
+ * Reads the header of a sector.
+ *
+ * @param fl          Pointer to the log.
+ * @param sector      Sector number.
+ * @param erase_count Pointer to where the erase count is stored.
+ * @param sequence    Pointer to where the sequence number is stored, FLASHLOG_UNOPENED if the sector is unused.
+ * @return false if the sector has no valid header.
+ */
+static bool flashlog_read_header(const flashlog *fl, uint16_t sector, uint32_t *erase_count, uint32_t *sequence) {
+    uint8_t header[FLASHLOG_HEADER_LEN];
+    if (!blockdev_read(fl->dev, flashlog_sector_address(fl, sector), header, FLASHLOG_HEADER_LEN)) return false;
+    if (flashlog_get_u32(header + HEADER_MAGIC) != FLASHLOG_MAGIC) return false;
+    *erase_count = flashlog_get_u32(header + HEADER_ERASE_COUNT);
+    *sequence = flashlog_get_u32(header + HEADER_SEQUENCE);
+    return true;
+}
+
+/**
+ * Checks if a record has been written. Records are written in order, so a sector is written up to its first
+ * erased record. A record torn by a power cut counts as written and fails its CRC when read.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @param slot   Record in the sector.
+ * @return true if any byte of the record is programmed, or the record couldn't be read.
+ */
+static bool flashlog_slot_used(const flashlog *fl, uint16_t sector, uint16_t slot) {
+    uint8_t record[FLASHLOG_RECORD_LEN];
+    if (!blockdev_read(fl->dev, flashlog_record_address(fl, sector, slot), record, FLASHLOG_RECORD_LEN)) return true;
+    for (int i = 0; i < FLASHLOG_RECORD_LEN; i++) {
+        if (record[i] != 0xFF) return true;
+    }
+    return false;
+}
+
+/**
+ * Erases a sector and writes a header carrying the erase count on, the sector can then be opened without waiting
+ * for an erase.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @return false if the erase or the header write failed.
+ */
+static bool flashlog_prepare(flashlog *fl, uint16_t sector) {
+    uint32_t erase_count;
+    uint32_t sequence;
+    if (!flashlog_read_header(fl, sector, &erase_count, &sequence)) erase_count = 0; // new or torn, count from 0
+
+    if (!blockdev_erase(fl->dev, flashlog_sector_address(fl, sector))) return false;
+    fl->erases++;
+    uint8_t header[HEADER_SEQUENCE];
+    flashlog_put_u32(header + HEADER_MAGIC, FLASHLOG_MAGIC);
+    flashlog_put_u32(header + HEADER_ERASE_COUNT, erase_count + 1);
+    return blockdev_write(fl->dev, flashlog_sector_address(fl, sector), header, sizeof(header));
+}
+
+/**
+ * Makes a prepared sector the one being written by giving it the next sequence number.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @return false if the write failed.
+ */
+static bool flashlog_open(flashlog *fl, uint16_t sector) {
+    uint8_t sequence[4];
+    flashlog_put_u32(sequence, fl->sequence + 1);
+    if (!blockdev_write(fl->dev, flashlog_sector_address(fl, sector) + HEADER_SEQUENCE, sequence, sizeof(sequence))) {
+        return false;
+    }
+    fl->active = sector;
+    fl->slot = 0;
+    fl->sequence++;
+    fl->ahead_ready = false;
+    return true;
+}
+
+/**
+ * Checks if the sector after the active one is prepared and not opened yet.
+ *
+ * @param fl Pointer to the log.
+ * @return true if the next sector can be opened right away.
+ */
+static bool flashlog_next_ready(const flashlog *fl) {
+    uint32_t erase_count;
+    uint32_t sequence;
+    uint16_t next = (fl->active + 1) % fl->sectors;
+    return flashlog_read_header(fl, next, &erase_count, &sequence) && sequence == FLASHLOG_UNOPENED &&
+           !flashlog_slot_used(fl, next, 0);
+}
+
+/**
+ * Finds where the logs left off: the active sector has the highest sequence number, and the next record goes to
+ * its first erased slot, found with a binary search. Only the sector headers and a few records are read.
+ * Storage without a valid sector starts over from the first sector.
+ *
+ * @param fl  Pointer to the log to set up.
+ * @param dev Pointer to the device, with an erase size. Has to live as long as the log.
+ * @return false if the device can't hold the logs or couldn't be written.
+ */
+bool flashlog_mount(flashlog *fl, const blockdev *dev) {
+    memset(fl, 0, sizeof(*fl));
+    fl->dev = dev;
+    if (dev->erase_size <= FLASHLOG_HEADER_LEN || dev->page_size % FLASHLOG_RECORD_LEN != 0) return false;
+    fl->per_sector = (dev->erase_size - FLASHLOG_HEADER_LEN) / FLASHLOG_RECORD_LEN;
+    uint32_t sectors = dev->size / dev->erase_size;
+    if (sectors > FLASHLOG_MAX_RECORDS / fl->per_sector) sectors = FLASHLOG_MAX_RECORDS / fl->per_sector;
+    if (sectors < 2) return false; // one to write and one to erase ahead
+    fl->sectors = (uint16_t)sectors;
+
+    bool found = false;
+    for (uint16_t s = 0; s < fl->sectors; s++) {
+        uint32_t erase_count;
+        uint32_t sequence;
+        if (!flashlog_read_header(fl, s, &erase_count, &sequence) || sequence == FLASHLOG_UNOPENED) continue;
+        if (!found || sequence > fl->sequence) {
+            fl->active = s;
+            fl->sequence = sequence;
+            found = true;
+        }
+    }
+    if (!found) {
+        fl->sequence = 0;
+        return flashlog_prepare(fl, 0) && flashlog_open(fl, 0);
+    }
+
+    uint16_t low = 0;
+    uint16_t high = fl->per_sector; // the first erased slot is in [low, high], high if the sector is full
+    while (low < high) {
+        uint16_t mid = low + (high - low) / 2;
+        if (flashlog_slot_used(fl, fl->active, mid)) low = mid + 1;
+        else high = mid;
+    }
+    fl->slot = low;
+    fl->ahead_ready = flashlog_next_ready(fl);
+    return true;
+}
+
+/**
+ * Appends a record. When the active sector is full the next one is opened, and erased first if
+ * flashlog_maintain() hasn't done it already.
+ *
+ * @param fl     Pointer to the log.
+ * @param record Pointer to FLASHLOG_RECORD_LEN bytes, not all 0xFF.
+ * @return false if the flash couldn't be written, the slot is skipped then.
+ */
+bool flashlog_append(flashlog *fl, const uint8_t *record) {
+    if (fl->slot >= fl->per_sector) {
+        uint16_t next = (fl->active + 1) % fl->sectors;
+        if (!fl->ahead_ready && !flashlog_prepare(fl, next)) return false;
+        if (!flashlog_open(fl, next)) return false;
+    }
+    // a failed write may have programmed some bits, the slot can't be written again until its sector is erased
+    uint16_t slot = fl->slot++;
+    return blockdev_write(fl->dev, flashlog_record_address(fl, fl->active, slot), record, FLASHLOG_RECORD_LEN);
+}
+
+/**
+ * Reads a record by its index, the index of the first record of sector n is n times the records in a sector.
+ *
+ * @param fl     Pointer to the log.
+ * @param index  Index of the record.
+ * @param record Pointer to FLASHLOG_RECORD_LEN bytes to read into.
+ * @return false if the index is out of range, or the record's sector is erased or has no valid header.
+ */
+bool flashlog_read(const flashlog *fl, int index, uint8_t *record) {
+    if (index < 0 || index >= flashlog_capacity(fl)) return false;
+    uint16_t sector = index / fl->per_sector;
+    uint16_t slot = index % fl->per_sector;
+    uint32_t erase_count;
+    uint32_t sequence;
+    if (!flashlog_read_header(fl, sector, &erase_count, &sequence) || sequence == FLASHLOG_UNOPENED) return false;
+    return blockdev_read(fl->dev, flashlog_record_address(fl, sector, slot), record, FLASHLOG_RECORD_LEN);
+}
+
+/**
+ * Gets the index the next record goes to. Records from there to the end of the sector are erased, the oldest
+ * records come after them.
+ *
+ * @param fl Pointer to the log.
+ * @return Index of the next record.
+ */
+int flashlog_head(const flashlog *fl) {
+    return ((int)fl->active * fl->per_sector + fl->slot) % flashlog_capacity(fl);
+}
+
+/**
+ * Gets the number of record slots.
+ *
+ * @param fl Pointer to the log.
+ * @return Records in all sectors.
+ */
+int flashlog_capacity(const flashlog *fl) {
+    return (int)fl->sectors * fl->per_sector;
+}
+
+/**
+ * Erases the sector after the active one ahead of time, so an append never waits for an erase. Waits until the
+ * active sector is half full, the oldest records are kept as long as possible. Call when the erase does no harm,
+ * the flash can't be read while it runs.
+ *
+ * @param fl Pointer to the log.
+ * @return true if a sector was erased.
+ */
+bool flashlog_maintain(flashlog *fl) {
+    if (fl->ahead_ready || fl->slot < fl->per_sector / 2) return false;
+    uint16_t next = (fl->active + 1) % fl->sectors;
+    if (!flashlog_prepare(fl, next)) return false;
+    fl->ahead_ready = true;
+    return true;
+}
+
+/**
+ * Erases every record and starts over from the first sector. Erase counts are kept.
+ *
+ * @param fl Pointer to the log.
+ * @return false if a sector couldn't be erased.
+ */
+bool flashlog_format(flashlog *fl) {
+    for (uint16_t s = 0; s < fl->sectors; s++) {
+        if (!flashlog_prepare(fl, s)) return false;
+    }
+    fl->sequence = 0;
+    if (!flashlog_open(fl, 0)) return false;
+    fl->ahead_ready = true; // every sector is prepared
+    return true;
+}
+
+/**
+ * Gets how many times a sector has been erased, to check that wear is even.
+ *
+ * @param fl     Pointer to the log.
+ * @param sector Sector number.
+ * @param count  Pointer to where the erase count is stored.
+ * @return false if the sector has no valid header.
+ */
+bool flashlog_erase_count(const flashlog *fl, uint16_t sector, uint32_t *count) {
+    uint32_t sequence;
+    return sector < fl->sectors && flashlog_read_header(fl, sector, count, &sequence);
+}
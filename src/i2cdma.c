@@ -0,0 +1,273 @@
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include <stdbool.h>
+
+#include "i2cdma.h"
+
+// command words the read channels send over and over, a read of n bytes takes n of them
+static const uint16_t read_cmd = I2C_IC_DATA_CMD_CMD_BITS;
+static const uint16_t read_stop_cmd = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+
+#define I2CDMA_ABORT_US 1000 // a byte at 100 kHz and the stop after it, with room to spare
+
+static i2c_inst_t *bus = NULL;
+static uint tx_chan;   // header or gathered write, from cmd
+static uint read_chan; // read commands but the last one
+static uint stop_chan; // last read command with a stop
+static uint rx_chan;   // received bytes to the caller's buffer
+static uint16_t cmd[I2CDMA_MAX_WRITE];
+
+static volatile bool busy = false;
+static volatile bool failed = false;
+static volatile bool reading = false;
+static i2cdma_callback callback = NULL;
+static void *callback_arg = NULL;
+static uint32_t setup_us = 0;        // time spent setting transfers up
+static volatile uint32_t irq_us = 0; // and ending them, kept apart so the interrupt never races the setup
+
+/**
+ * Sets the address of the device to talk to. The I2C peripheral only takes a new target while it is disabled.
+ *
+ * @param addr 7 bit I2C address.
+ */
+static void i2cdma_set_target(uint8_t addr) {
+    i2c_hw_t *hw = i2c_get_hw(bus);
+    if (hw->tar == addr) return;
+    hw->enable = 0;
+    hw->tar = addr;
+    hw->enable = 1;
+}
+
+/**
+ * Stops every channel of the transfer, used after the device didn't acknowledge.
+ */
+static void i2cdma_abort_channels(void) {
+    dma_channel_abort(tx_chan);
+    dma_channel_abort(read_chan);
+    dma_channel_abort(stop_chan);
+    dma_channel_abort(rx_chan);
+}
+
+/**
+ * Stops the peripheral's side of a transfer that didn't end in time. The abort flushes the TX FIFO and sends a stop
+ * after the byte on the bus. If the bus is stuck and the abort doesn't finish, the peripheral is disabled and enabled
+ * again instead. Then the abort is cleared and the bytes left in the RX FIFO are dropped, so the next transfer starts
+ * clean.
+ */
+static void i2cdma_abort_bus(void) {
+    i2c_hw_t *hw = i2c_get_hw(bus);
+    uint32_t start = time_us_32();
+    hw->enable = I2C_IC_ENABLE_ENABLE_BITS | I2C_IC_ENABLE_ABORT_BITS; // the bit clears when the abort is done
+    while ((hw->enable & I2C_IC_ENABLE_ABORT_BITS) && time_us_32() - start < I2CDMA_ABORT_US) tight_loop_contents();
+    if (hw->enable & I2C_IC_ENABLE_ABORT_BITS) {
+        hw->enable = 0;
+        start = time_us_32();
+        while ((hw->enable_status & I2C_IC_ENABLE_STATUS_IC_EN_BITS) && time_us_32() - start < I2CDMA_ABORT_US) {
+            tight_loop_contents();
+        }
+        hw->enable = I2C_IC_ENABLE_ENABLE_BITS;
+    }
+    (void)hw->clr_tx_abrt;
+    while (hw->rxflr) (void)hw->data_cmd;
+    (void)hw->clr_intr;
+}
+
+/**
+ * Ends a transfer on the stop condition. A transfer the device didn't acknowledge is aborted by the peripheral,
+ * which flushes its FIFO and then sends a stop as well.
+ */
+static void i2cdma_irq_handler(void) {
+    uint32_t start = time_us_32();
+    i2c_hw_t *hw = i2c_get_hw(bus);
+    uint32_t status = hw->raw_intr_stat;
+    if (!busy) { // left over from a transfer made without the driver
+        (void)hw->clr_intr;
+        return;
+    }
+
+    if (status & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        (void)hw->clr_tx_abrt;
+        i2cdma_abort_channels();
+        failed = true;
+    }
+    if (status & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        // the last byte is in the FIFO before the stop, its DMA transfer is a few cycles away at most
+        if (reading && !failed) while (dma_channel_is_busy(rx_chan)) tight_loop_contents();
+        busy = false;
+        if (callback) callback(!failed, callback_arg);
+    }
+    irq_us += time_us_32() - start;
+}
+
+/**
+ * Claims the DMA channels and sets up the interrupt that ends transfers. The I2C interface has to be initialized
+ * with i2c_init() first.
+ *
+ * @param i2c Pointer to the I2C interface.
+ */
+void i2cdma_init(i2c_inst_t *i2c) {
+    bus = i2c;
+    tx_chan = dma_claim_unused_channel(true);
+    read_chan = dma_claim_unused_channel(true);
+    stop_chan = dma_claim_unused_channel(true);
+    rx_chan = dma_claim_unused_channel(true);
+
+    i2c_hw_t *hw = i2c_get_hw(i2c);
+    hw->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS;
+    hw->dma_tdlr = 4; // keep the TX FIFO topped up, it is 16 deep
+    hw->dma_rdlr = 0; // every received byte
+    hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+
+    uint irq = I2C0_IRQ + i2c_hw_index(i2c);
+    irq_set_exclusive_handler(irq, i2cdma_irq_handler);
+    irq_set_enabled(irq, true);
+}
+
+/**
+ * Gets a TX channel configuration that paces 16 bit command words to the I2C peripheral.
+ *
+ * @param chan      DMA channel.
+ * @param increment true to step through a buffer, false to send the same word every time.
+ * @return Channel configuration.
+ */
+static dma_channel_config i2cdma_tx_config(uint chan, bool increment) {
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, increment);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_get_dreq(bus, true));
+    return c;
+}
+
+/**
+ * Starts a transfer: clears what is left of the previous one and remembers who to call when it ends.
+ *
+ * @param addr 7 bit I2C address.
+ * @param done Function called when the transfer ends, NULL for none.
+ * @param arg  Argument for the function.
+ * @param read true for a read.
+ */
+static void i2cdma_begin(uint8_t addr, i2cdma_callback done, void *arg, bool read) {
+    i2cdma_set_target(addr);
+    (void)i2c_get_hw(bus)->clr_intr;
+    callback = done;
+    callback_arg = arg;
+    failed = false;
+    reading = read;
+    busy = true;
+}
+
+/**
+ * Starts writing segments to a device as one transfer that ends with a stop. Returns as soon as the transfer has
+ * started, the segments can be reused right away.
+ *
+ * @param addr     7 bit I2C address.
+ * @param segments Pointer to the segments, sent in order without a break.
+ * @param count    Number of segments.
+ * @param done     Function called when the transfer ends, NULL for none.
+ * @param arg      Argument for the function.
+ * @return false if a transfer is still running, or if there is nothing to write or too much.
+ */
+bool i2cdma_write(uint8_t addr, const i2cdma_segment *segments, uint8_t count, i2cdma_callback done, void *arg) {
+    uint32_t start = time_us_32();
+    if (busy) return false;
+    size_t len = 0;
+    for (uint8_t s = 0; s < count; s++) {
+        if (len + segments[s].len > I2CDMA_MAX_WRITE) return false;
+        for (size_t i = 0; i < segments[s].len; i++) cmd[len++] = segments[s].data[i];
+    }
+    if (len == 0) return false;
+    cmd[len - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+
+    i2cdma_begin(addr, done, arg, false);
+    dma_channel_config c = i2cdma_tx_config(tx_chan, true);
+    dma_channel_configure(tx_chan, &c, &i2c_get_hw(bus)->data_cmd, cmd, len, true);
+    setup_us += time_us_32() - start;
+    return true;
+}
+
+/**
+ * Starts reading from a device: writes the header, usually the address to read from, then reads into the buffer
+ * after a restart. Three TX channels chained together send the header and one read command per byte, so no
+ * command buffer the size of the read is needed.
+ *
+ * @param addr       7 bit I2C address.
+ * @param header     Pointer to the bytes to write first.
+ * @param header_len Number of header bytes, 1 or more.
+ * @param dst        Pointer to the buffer to read into, has to stay valid until the transfer ends.
+ * @param len        Number of bytes to read, 1 or more.
+ * @param done       Function called when the transfer ends, NULL for none.
+ * @param arg        Argument for the function.
+ * @return false if a transfer is still running or the lengths are out of range.
+ */
+bool i2cdma_read(uint8_t addr, const uint8_t *header, size_t header_len, uint8_t *dst, size_t len, i2cdma_callback done, void *arg) {
+    uint32_t start = time_us_32();
+    if (busy || header_len == 0 || header_len > I2CDMA_MAX_WRITE || len == 0) return false;
+    for (size_t i = 0; i < header_len; i++) cmd[i] = header[i];
+
+    i2cdma_begin(addr, done, arg, true);
+    volatile void *data_cmd = &i2c_get_hw(bus)->data_cmd;
+
+    dma_channel_config c = dma_channel_get_default_config(rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, i2c_get_dreq(bus, false));
+    dma_channel_configure(rx_chan, &c, dst, data_cmd, len, true);
+
+    // the direction change after the header makes the peripheral send the restart
+    c = i2cdma_tx_config(stop_chan, false);
+    dma_channel_configure(stop_chan, &c, data_cmd, &read_stop_cmd, 1, false);
+    c = i2cdma_tx_config(read_chan, false);
+    channel_config_set_chain_to(&c, stop_chan);
+    dma_channel_configure(read_chan, &c, data_cmd, &read_cmd, len - 1, false);
+    c = i2cdma_tx_config(tx_chan, true);
+    channel_config_set_chain_to(&c, len > 1 ? read_chan : stop_chan);
+    dma_channel_configure(tx_chan, &c, data_cmd, cmd, header_len, true);
+    setup_us += time_us_32() - start;
+    return true;
+}
+
+/**
+ * Checks if a transfer is running.
+ *
+ * @return true until the transfer has ended.
+ */
+bool i2cdma_busy(void) {
+    return busy;
+}
+
+/**
+ * Waits for the running transfer to end. The core sleeps until an interrupt, so other interrupts are still
+ * handled while it waits. A transfer that doesn't end in time is aborted, the DMA channels and the peripheral both.
+ *
+ * @param timeout_us Longest time to wait.
+ * @return true if there was no transfer or it ended with every byte acknowledged.
+ */
+bool i2cdma_wait(uint32_t timeout_us) {
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    while (busy) {
+        if (best_effort_wfe_or_timeout(deadline)) {
+            if (!busy) break;
+            busy = false; // the interrupt of the abort only clears it now
+            failed = true;
+            i2cdma_abort_channels();
+            i2cdma_abort_bus();
+            break;
+        }
+    }
+    return !failed;
+}
+
+/**
+ * Gets the CPU time spent on transfers since boot: setting them up and the interrupts that end them. Compared to
+ * the time the transfers took, it shows how much of the CPU the bus still uses.
+ *
+ * @return Time in microseconds, wraps around.
+ */
+uint32_t i2cdma_cpu_us(void) {
+    return setup_us + irq_us;
+}
@@ -1,12 +1,9 @@
 #include "pico/stdlib.h"
 #include "hardware/pwm.h"
 #include "led.h"
+#include "board.h"
 #include <stdio.h>
 
-#define LED1 20
-#define LED2 21
-#define LED3 22
-
 #define BRIGHTNESS 100
 
 #define WAIT_TOGGLE_DELAY_MS 500
@@ -17,6 +14,7 @@
 static uint led_array[3] = {LED1, LED2, LED3};
 static bool led_on_off = false;
 static uint32_t led_time = 0;
+static uint32_t led_delay = 0;
 static uint stage = 0;
 
 /**
@@ -24,11 +22,11 @@ static uint stage = 0;
  */
 void led_init(void) {
     for (int i = 0; i < 3; i++) {
-        gpio_set_function(LED3 - i, GPIO_FUNC_PWM); // Set LED pins for PWM functionality
-        gpio_set_dir(LED3 - i, GPIO_OUT); // Set LED pins as outputs
+        gpio_set_function(led_array[i], GPIO_FUNC_PWM); // Set LED pins for PWM functionality
+        gpio_set_dir(led_array[i], GPIO_OUT); // Set LED pins as outputs
 
-        uint slice = pwm_gpio_to_slice_num(LED3 - i); // Get PWM slice for LED
-        uint chan = pwm_gpio_to_channel(LED3 - i); // Get PWM channel for LED
+        uint slice = pwm_gpio_to_slice_num(led_array[i]); // Get PWM slice for LED
+        uint chan = pwm_gpio_to_channel(led_array[i]); // Get PWM channel for LED
 
         pwm_set_enabled(slice, false); // Disable PWM initially
         pwm_config conf = pwm_get_default_config(); // Get default PWM configuration
@@ -137,9 +135,22 @@ void led_sequence_toggler(void) {
  * @return true if the delay has passed since the last LED action, false otherwise.
  */
 bool led_timer(uint32_t time, uint32_t delay) {
+    led_delay = delay;
     if (time - led_time > delay) {
         led_time = time;
         return true; // Return true when the delay has passed
     }
     return false; // Return false when the delay hasn't passed
 }
+
+/**
+ * Calculates how long the caller can sleep before the last used LED pattern needs to toggle again.
+ *
+ * @param time The current time.
+ * @return Milliseconds until led_timer() will return true for the last used delay.
+ */
+uint32_t led_get_wake_ms(uint32_t time) {
+    uint32_t elapsed = time - led_time;
+    if (elapsed > led_delay) return 0;
+    return led_delay - elapsed + 1; // led_timer needs strictly more than the delay
+}
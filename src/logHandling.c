@@ -7,67 +7,50 @@
 #include "string.h"
 #include "logHandling.h"
 #include "lora.h"
-#include "ring_buffer.h"
+#include "logqueue.h"
+#include "logframe.h"
+#include "airtime.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "breadcrumb.h"
+#ifdef FLASH_LOG_ENABLED
+#include "hardware/flash.h"
+#include "board.h"
+#include "flashdev.h"
+#include "flashlog.h"
+#endif
 
 #define CRC_LEN 2
-#define LOG_LEN 6                     // Does not include CRC
-#define LOG_ARR_LEN LOG_LEN + CRC_LEN // Includes CRC
 
-#define DISPENSER_STATE_LEN 6                                 // Does not include CRC
+#define DISPENSER_STATE_LEN 10                                // Does not include CRC
 #define DISPENSER_STATE_ARR_LEN DISPENSER_STATE_LEN + CRC_LEN // Includes CRC
 
 #define REBOOT_STATUS_ADDR LOG_END_ADDR + LOG_SIZE
+// one status record per carousel, all of them fit in the page before the schedule
+#define CAROUSEL_STATUS_ADDR(carousel) (REBOOT_STATUS_ADDR + (carousel) * (DISPENSER_STATE_ARR_LEN))
 
 #define LOG_START_ADDR 0
 #define LOG_END_ADDR 2048
 #define LOG_SIZE 8
-#define MAX_LOGS LOG_END_ADDR / LOG_SIZE
-
-const char *logMessages[] = {
-    "Shutdown while motor was idle",
-    "Watchdog caused reboot",
-    "Dispensing pill 1",
-    "Dispensing pill 2",
-    "Dispensing pill 3",
-    "Dispensing pill 4",
-    "Dispensing pill 5",
-    "Dispensing pill 6",
-    "Dispensing pill 7",
-    "Doing half calibration",
-    "Doing full calibration",
-    "Dispensing button pressed",
-    "pill dispensed",
-    "pill drop not detected",
-    "Pill dispenser is empty",
-    "Calibration finished",
-    "Reboot during pill 1 dispensing",
-    "Reboot during pill 2 dispensing",
-    "Reboot during pill 3 dispensing",
-    "Reboot during pill 4 dispensing",
-    "Reboot during pill 5 dispensing",
-    "Reboot during pill 6 dispensing",
-    "Reboot during pill 7 dispensing",
-    "Reboot during half calibration",
-    "Reboot during full calibration",
-    "Gremlins in the code",
-    "Failed to read pill dispenser status from EEPROM",
-    "Boot Finished"
-    };
+#define LOW_LOGS (LOG_END_ADDR / LOG_SIZE) // logs before the records
+#define RECORDS_END_ADDR 4096 // status, schedule, wheel, calibration and device time records, logs carry on after them
+#define LOG_MAX_COUNT 0xFFFF // log indexes are 16 bit in export frames
+#define LOG_SCAN_CHUNK 256   // bytes of logs read or zeroed at once
 
-uint16_t crc16(const uint8_t *data, size_t length)
-{
-    uint8_t x;
-    uint16_t crc = 0xFFFF;
+#define WHEEL_ADDR 2176 // first 64 byte page after the dose schedule
+#define WHEEL_ARR_LEN WHEEL_RECORD_LEN + CRC_LEN
 
-    while (length--)
-    {
-        x = crc >> 8 ^ *data++;
-        x ^= x >> 4;
-        crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x << 5)) ^ ((uint16_t)x);
-    }
+#define CALIB_CACHE_ADDR 2240 // one 64 byte page per carousel after the wheel
+#define CALIB_CACHE_PAGE 64
+#define CALIB_CACHE_ARR_LEN CALIBCACHE_RECORD_LEN + CRC_LEN
 
-    return crc;
-}
+#define EPOCH_ADDR 2496 // first 64 byte page after the calibration caches
+#define EPOCH_ARR_LEN EPOCH_RECORD_LEN + CRC_LEN
+
+#define EXPORT_FRAME_LEN 51 // smallest LoRaWAN payload limit (EU868 DR0)
+#define EXPORT_BATCH 32     // more logs than fit in one frame
+
+#define STRING_LEN 200
 
 /**
  * Appends CRC to the given base 8 array and updates the array length.
@@ -119,56 +102,232 @@ bool verifyDataIntegrity(uint8_t *base8Array, int *arrayLen)
     }
 }
 
+static epoch device_epoch; // started by reboot_sequence(), log timestamps are device times from it
+
+#ifdef FLASH_LOG_ENABLED
+static blockdev flash_dev;
+static flashlog flash_log;
+static bool flash_mount_tried = false;
+static bool flash_mounted = false;
+
+/**
+ * Gets the flash log, mounting it the first time. The logs stay in the EEPROM if the flash can't be used.
+ *
+ * @return Pointer to the flash log, NULL if the logs are in the EEPROM.
+ */
+static flashlog *logFlash()
+{
+    if (!flash_mount_tried)
+    {
+        flash_mount_tried = true;
+        flash_mounted = flashdev_init(&flash_dev, FLASH_LOG_SECTORS * FLASH_SECTOR_SIZE) &&
+                        flashlog_mount(&flash_log, &flash_dev);
+        if (!flash_mounted)
+        {
+            printf("Flash log unavailable, logging to EEPROM.\n");
+        }
+    }
+    return flash_mounted ? &flash_log : NULL;
+}
+#endif
+
+/**
+ * Gets the number of logs the storage holds. The EEPROM has the ones before the records, then as many as fit
+ * after them.
+ *
+ * @return Number of logs.
+ */
+static int logCapacity()
+{
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
+    {
+        return flashlog_capacity(logFlash());
+    }
+#endif
+    uint32_t size = eeprom_size();
+    int logs = LOW_LOGS;
+    if (size > RECORDS_END_ADDR)
+    {
+        logs += (size - RECORDS_END_ADDR) / LOG_SIZE;
+    }
+    return logs < LOG_MAX_COUNT ? logs : LOG_MAX_COUNT;
+}
+
+/**
+ * Calculates the EEPROM address of a log, skipping the records.
+ *
+ * @param index Index of the log entry.
+ * @return Address of the log's first byte.
+ */
+static uint32_t logAddress(int index)
+{
+    if (index < LOW_LOGS)
+    {
+        return LOG_START_ADDR + index * LOG_SIZE;
+    }
+    return RECORDS_END_ADDR + (uint32_t)(index - LOW_LOGS) * LOG_SIZE;
+}
+
+/**
+ * Calculates how many logs from an index can be read or written at once. A run stops at the end of the logs and
+ * where the logs jump over the records.
+ *
+ * @param index First log of the run.
+ * @param logs  Number of logs.
+ * @return Logs in the run, at most LOG_SCAN_CHUNK bytes of them.
+ */
+static int logRun(int index, int logs)
+{
+    int run = LOG_SCAN_CHUNK / LOG_SIZE;
+    int end = index < LOW_LOGS ? LOW_LOGS : logs;
+    if (end > logs) end = logs;
+    return end - index < run ? end - index : run;
+}
+
+/**
+ * Writes the device time epoch to EEPROM with a CRC.
+ *
+ * @param e Pointer to the epoch.
+ */
+static void updateEpoch(const epoch *e)
+{
+    uint8_t array[EPOCH_ARR_LEN];
+    int len = EPOCH_RECORD_LEN;
+    epoch_encode(e, array);
+    enterLogToEeprom(array, &len, EPOCH_ADDR);
+}
+
+/**
+ * Reads the device time epoch from EEPROM. The epoch is left unchanged if the record is missing or corrupted.
+ *
+ * @param e Pointer to the epoch to update.
+ * @return true if a valid record was read.
+ */
+static bool readEpoch(epoch *e)
+{
+    uint8_t array[EPOCH_ARR_LEN];
+    eeprom_read_page(EPOCH_ADDR, array, EPOCH_ARR_LEN);
+    int len = EPOCH_ARR_LEN;
+    if (!verifyDataIntegrity(array, &len)) return false;
+    return epoch_decode(e, array);
+}
+
+/**
+ * Finds the device time of the newest log, going back from the first unused log over the slots with values.
+ *
+ * @param unused Index of the first unused log.
+ * @return Device time of the newest log, 0 if it can't be read or was written before there was a device time.
+ */
+static uint32_t newestLogTime(int unused)
+{
+    int logs = logCapacity();
+    for (int back = 1; back <= LOGRECORD_MAX_SLOTS && back < logs; back++)
+    {
+        logrecord record;
+        int slots;
+        if (readLogRecord((unused - back + logs) % logs, &record, &slots))
+        {
+            return record.since_boot ? 0 : record.time_s;
+        }
+    }
+    return 0;
+}
+
 /**
  * Manages the reboot sequence:
- * - Reads previous status from EEPROM
  * - Finds an available log for recording
+ * - Starts the device time of this boot after the newest log
  * - Writes reboot causes to logs
+ * - Reads the previous status of carousel 0 from EEPROM and logs what it was doing
  * - Records a boot message upon sequence completion.
  *
- * @param ptrToStruct    Pointer to the DeviceStatus struct to be updated with reboot sequence details.
+ * @param ptrToStruct    Pointer to the DeviceStatus struct of carousel 0 to be updated with reboot sequence details.
  * @param bootTimestamp  Boot timestamp for log recording purposes.
+ * @param queue          Pointer to the queue of logs waiting to be sent.
  */
-void reboot_sequence(struct DeviceStatus *ptrToStruct, const uint32_t bootTimestamp, ring_buffer *rb)
+void reboot_sequence(struct DeviceStatus *ptrToStruct, const uint32_t bootTimestamp, log_queue *queue)
 {
-    // Find the first available log, empties all logs if all are full.
+    // Find the log after the newest one.
     ptrToStruct->unusedLogIndex = findFirstAvailableLog();
 
-    // If unable to read pill dispenser status, reset related fields and log the issue.
-    if (readPillDispenserStatus(ptrToStruct) == false)
+    // The previous boot ran at least until its newest log, and until its last activity started.
+    breadcrumb crumb;
+    bool crumbValid = breadcrumb_get_previous(&crumb);
+    if (!readEpoch(&device_epoch))
     {
-        ptrToStruct->pillDispenseState = 0;
-        ptrToStruct->rebootStatusCode = 0;
-        ptrToStruct->prevCalibStepCount = 0;
-        ptrToStruct->prevCalibEdgeCount = 0;
-        logger_log(ptrToStruct, LOG_GREMLINS, bootTimestamp, rb);
+        epoch_init(&device_epoch);
     }
+    epoch_start_boot(&device_epoch, newestLogTime(ptrToStruct->unusedLogIndex), crumbValid ? crumb.time_ms : 0);
+    updateEpoch(&device_epoch);
 
     // Write reboot cause to log if watchdog caused reboot.
-    uint8_t logArray[LOG_ARR_LEN];
     if (watchdog_caused_reboot() == true)
     {
-        logger_log(ptrToStruct, LOG_WATCHDOG_REBOOT, bootTimestamp, rb);
+        logger_log(ptrToStruct, LOG_WATCHDOG_REBOOT, bootTimestamp, queue);
+
+        // Log where the firmware was stuck, timestamp is when that activity started in the previous boot.
+        if (crumbValid)
+        {
+            logrecord record = {
+                .code = LOG_WATCHDOG_STALL_MAIN_LOOP + crumb.activity,
+                .location = 0,
+                .time_s = epoch_previous_boot(&device_epoch, crumb.time_ms),
+                .field_count = 1,
+                .fields = {crumb.state}
+            };
+            logger_log_record(ptrToStruct, &record, crumb.time_ms, queue);
+            printf("Watchdog stall in %s, state %u, %u ms after boot.\n",
+                   breadcrumb_activity_name(crumb.activity), crumb.state, crumb.time_ms);
+        }
+    }
+
+    ptrToStruct->carousel = 0;
+    restoreCarouselStatus(ptrToStruct, ptrToStruct, bootTimestamp, queue);
+}
+
+/**
+ * Reads the previous status of a carousel from EEPROM and logs what the carousel was doing when the device went down.
+ * reboot_sequence() does this for carousel 0, call it for the other carousels after that.
+ *
+ * @param carousel       Pointer to the status to restore, its carousel field picks the EEPROM record.
+ * @param logDev         Pointer to the status of carousel 0, which keeps the log index.
+ * @param bootTimestamp  Boot timestamp for log recording purposes.
+ * @param queue          Pointer to the queue of logs waiting to be sent.
+ */
+void restoreCarouselStatus(DeviceStatus *carousel, DeviceStatus *logDev, const uint32_t bootTimestamp, log_queue *queue)
+{
+    uint8_t location = LOG_LOCATION(carousel->carousel, 0);
+
+    // If unable to read pill dispenser status, reset related fields and log the issue.
+    if (readPillDispenserStatus(carousel) == false)
+    {
+        carousel->pillDispenseState = 0;
+        carousel->rebootStatusCode = 0;
+        carousel->prevCalibStepCount = 0;
+        carousel->prevCalibEdgeCount = 0;
+        carousel->lastDoseTime = 0;
+        logger_log_compartment(logDev, LOG_GREMLINS, location, bootTimestamp, queue);
     }
 
     // Log specific reboot causes based on the reboot status code.
-    switch (ptrToStruct->rebootStatusCode)
+    switch (carousel->rebootStatusCode)
     {
     case IDLE:
-        logger_log(ptrToStruct, LOG_IDLE, bootTimestamp, rb);
+        logger_log_compartment(logDev, LOG_IDLE, location, bootTimestamp, queue);
         break;
     case DISPENSING:
-        logger_log(ptrToStruct, LOG_DISPENSE1_ERROR + ptrToStruct->pillDispenseState, bootTimestamp, rb);
+        logger_log_compartment(logDev, LOG_DISPENSE_ERROR, LOG_LOCATION(carousel->carousel, carousel->pillDispenseState + 1), bootTimestamp, queue);
         break;
     case FULL_CALIBRATION:
-        logger_log(ptrToStruct, LOG_FULL_CALIBRATION_ERROR, bootTimestamp, rb);
+        logger_log_compartment(logDev, LOG_FULL_CALIBRATION_ERROR, location, bootTimestamp, queue);
         break;
     case HALF_CALIBRATION:
-        logger_log(ptrToStruct, LOG_HALF_CALIBRATION_ERROR, bootTimestamp, rb);
+        logger_log_compartment(logDev, LOG_HALF_CALIBRATION_ERROR, location, bootTimestamp, queue);
         break;
     default:
         // Log a generic error and provide a message indicating potential issues.
-        logger_log(ptrToStruct, LOG_GREMLINS, bootTimestamp, rb);
+        logger_log_compartment(logDev, LOG_GREMLINS, location, bootTimestamp, queue);
         printf("There's gremlins in the code.\n");
         break;
     }
@@ -194,43 +353,28 @@ void enterLogToEeprom(uint8_t *base8Array, int *arrayLen, int logAddr)
 }
 
 /**
- * Marks all logs in the EEPROM as not in use by setting the first byte of each log to 0.
+ * Marks all logs in the EEPROM as not in use by zeroing them, a page at a time.
  * This action prepares logs for reuse or indicates their availability for new data.
+ * Flash logs are erased instead.
  */
 void zeroAllLogs()
 {
-    int count = 0;
-    uint16_t logAddr = 0;
-
-    // Iterate through logs and mark them as not in use by setting the first byte to 0
-    while (count < MAX_LOGS)
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
     {
-        eeprom_write_byte(logAddr, 0); // Write 0 to indicate log not in use
-        logAddr += LOG_SIZE;
-        count++;
+        flashlog_format(logFlash()); // erased flash reads as no logs
+        return;
     }
-}
+#endif
+    uint8_t zeros[LOG_SCAN_CHUNK] = {0};
+    int logs = logCapacity();
 
-/**
- * Fills a log array with specified message code and timestamp data, ensuring a minimum length of 8.
- *
- * @param array        Pointer to the array to be filled with log information.
- * @param messageCode  Message code to store in the log array.
- * @param timestamp    Timestamp to store in the log array.
- * @return             The length of the filled log array.
- */
-int createLogArray(uint8_t *array, int messageCode, uint32_t timestamp)
-{
-    array[LOG_USE_STATUS] = 1;           // Mark log as in use
-    array[MESSAGE_CODE] = messageCode;   // Store the message code
-
-    // Store timestamp bytes in little-endian format
-    array[TIMESTAMP_LSB] = (uint8_t)(timestamp & 0xFF);         // LSB of timestamp
-    array[TIMESTAMP_MSB2] = (uint8_t)((timestamp >> 8) & 0xFF);
-    array[TIMESTAMP_MSB1] = (uint8_t)((timestamp >> 16) & 0xFF);
-    array[TIMESTAMP_MSB] = (uint8_t)((timestamp >> 24) & 0xFF); // MSB of timestamp
-
-    return LOG_LEN; // Return the length of the filled log array (LOG_LEN)
+    for (int index = 0; index < logs;)
+    {
+        int run = logRun(index, logs);
+        eeprom_write_page(logAddress(index), zeros, run * LOG_SIZE); // 0 indicates log not in use
+        index += run;
+    }
 }
 
 /**
@@ -242,9 +386,10 @@ int createLogArray(uint8_t *array, int messageCode, uint32_t timestamp)
  * @param rebootStatusCode     Reboot status code to store in the log array.
  * @param prevCalibStepCount   Previous calibration step count to store in the log array.
  * @param calibEdgeCount       Calibration edge count to store in the log array.
- * @return                     The length of the filled log array (4).
+ * @param lastDoseTime         Unix time of the last scheduled dose to store in the log array.
+ * @return                     The length of the filled log array (DISPENSER_STATE_LEN).
  */
-int createPillDispenserStatusLogArray(uint8_t *array, uint8_t pillDispenseState, uint8_t rebootStatusCode, uint16_t prevCalibStepCount, uint16_t calibEdgeCount)
+int createPillDispenserStatusLogArray(uint8_t *array, uint8_t pillDispenseState, uint8_t rebootStatusCode, uint16_t prevCalibStepCount, uint16_t calibEdgeCount, uint32_t lastDoseTime)
 {
     array[PILL_DISPENSE_STATE] = pillDispenseState;                                 // Store pill dispenser state
     array[REBOOT_STATUS_CODE] = rebootStatusCode;                                   // Store reboot status code
@@ -252,30 +397,35 @@ int createPillDispenserStatusLogArray(uint8_t *array, uint8_t pillDispenseState,
     array[PREV_CALIB_STEP_COUNT_MSB] = (uint8_t)((prevCalibStepCount >> 8) & 0xFF); // Store MSB of prevCalibStepCount
     array[PREV_CALIB_EDGE_COUNT_LSB] = (uint8_t)(calibEdgeCount & 0xFF);            // Store LSB of calibEdgeCount
     array[PREV_CALIB_EDGE_COUNT_MSB] = (uint8_t)((calibEdgeCount >> 8) & 0xFF);     // Store MSB of calibEdgeCount
+    array[LAST_DOSE_TIME_LSB] = (uint8_t)(lastDoseTime & 0xFF);                      // Store lastDoseTime, LSB first
+    array[LAST_DOSE_TIME_LSB1] = (uint8_t)((lastDoseTime >> 8) & 0xFF);
+    array[LAST_DOSE_TIME_LSB2] = (uint8_t)((lastDoseTime >> 16) & 0xFF);
+    array[LAST_DOSE_TIME_MSB] = (uint8_t)((lastDoseTime >> 24) & 0xFF);
     return DISPENSER_STATE_LEN;                                                     // Return the length of the filled log array
 }
 
 /**
- * Updates the pill dispenser status in EEPROM based on the provided struct.
+ * Updates the pill dispenser status in EEPROM based on the provided struct, in the record of its carousel.
  *
  * @param ptrToStruct Pointer to the struct containing the updated pill dispenser status.
  */
 void updatePillDispenserStatus(DeviceStatus *ptrToStruct)
 {
-    uint8_t array[LOG_ARR_LEN]; // Buffer to hold the log array
+    uint8_t array[DISPENSER_STATE_ARR_LEN]; // Buffer to hold the log array
     
     // Create a log array based on the provided status information
     int arrayLen = createPillDispenserStatusLogArray(array, ptrToStruct->pillDispenseState,
                                                      ptrToStruct->rebootStatusCode,
                                                      ptrToStruct->prevCalibStepCount,
-                                                     ptrToStruct->prevCalibEdgeCount);
+                                                     ptrToStruct->prevCalibEdgeCount,
+                                                     ptrToStruct->lastDoseTime);
     
     // Write the log array to EEPROM at the designated address for pill dispenser status
-    enterLogToEeprom(array, &arrayLen, REBOOT_STATUS_ADDR);
+    enterLogToEeprom(array, &arrayLen, CAROUSEL_STATUS_ADDR(ptrToStruct->carousel));
 }
 
 /**
- * Reads the previous pill dispenser status from EEPROM and updates the provided struct.
+ * Reads the previous pill dispenser status of the struct's carousel from EEPROM and updates the provided struct.
  * Performs an EEPROM CRC check and returns true if the check succeeds, false otherwise.
  *
  * @param ptrToStruct Pointer to the struct to update with the pill dispenser status.
@@ -284,10 +434,10 @@ void updatePillDispenserStatus(DeviceStatus *ptrToStruct)
 bool readPillDispenserStatus(DeviceStatus *ptrToStruct)
 {
     bool eepromReadSuccess = true;   // Initialize EEPROM read status as successful
-    uint8_t valuesRead[LOG_ARR_LEN]; // Buffer to hold EEPROM values
+    uint8_t valuesRead[DISPENSER_STATE_ARR_LEN]; // Buffer to hold EEPROM values
 
     // Read EEPROM values into the array.
-    eeprom_read_page(REBOOT_STATUS_ADDR, valuesRead, DISPENSER_STATE_ARR_LEN);
+    eeprom_read_page(CAROUSEL_STATUS_ADDR(ptrToStruct->carousel), valuesRead, DISPENSER_STATE_ARR_LEN);
 
     // Verify data integrity.
     int len = DISPENSER_STATE_ARR_LEN;
@@ -300,6 +450,10 @@ bool readPillDispenserStatus(DeviceStatus *ptrToStruct)
         ptrToStruct->prevCalibStepCount |= (uint16_t)valuesRead[PREV_CALIB_STEP_COUNT_LSB];     // Extract LSB
         ptrToStruct->prevCalibEdgeCount = (uint16_t)valuesRead[PREV_CALIB_EDGE_COUNT_MSB] << 8; // Extract MSB
         ptrToStruct->prevCalibEdgeCount |= (uint16_t)valuesRead[PREV_CALIB_EDGE_COUNT_LSB];     // Extract LSB
+        ptrToStruct->lastDoseTime = (uint32_t)valuesRead[LAST_DOSE_TIME_MSB] << 24 |
+                                    (uint32_t)valuesRead[LAST_DOSE_TIME_LSB2] << 16 |
+                                    (uint32_t)valuesRead[LAST_DOSE_TIME_LSB1] << 8 |
+                                    (uint32_t)valuesRead[LAST_DOSE_TIME_LSB];
     }
     else
     {
@@ -310,30 +464,99 @@ bool readPillDispenserStatus(DeviceStatus *ptrToStruct)
 }
 
 /**
- * Finds the first available log entry in EEPROM.
- * If an available log entry is found, returns its index.
- * If all log entries are full, empties all logs and returns the index of the first log.
+ * Writes the calibration history of a carousel to EEPROM with a CRC.
+ *
+ * @param carousel Carousel number.
+ * @param c        Pointer to the calibration history.
+ */
+void updateCalibrationCache(uint8_t carousel, const calib_cache *c)
+{
+    uint8_t array[CALIB_CACHE_ARR_LEN];
+    int len = CALIBCACHE_RECORD_LEN;
+    calibcache_encode(c, array);
+    enterLogToEeprom(array, &len, CALIB_CACHE_ADDR + carousel * CALIB_CACHE_PAGE);
+}
+
+/**
+ * Reads the calibration history of a carousel from EEPROM. The history is left unchanged if the record is missing
+ * or corrupted.
+ *
+ * @param carousel Carousel number.
+ * @param c        Pointer to the calibration history to update.
+ * @return true if a valid record was read.
+ */
+bool readCalibrationCache(uint8_t carousel, calib_cache *c)
+{
+    uint8_t array[CALIB_CACHE_ARR_LEN];
+    eeprom_read_page(CALIB_CACHE_ADDR + carousel * CALIB_CACHE_PAGE, array, CALIB_CACHE_ARR_LEN);
+    int len = CALIB_CACHE_ARR_LEN;
+    if (!verifyDataIntegrity(array, &len)) return false;
+    return calibcache_decode(c, array);
+}
+
+/**
+ * Writes the pill wheel geometry to EEPROM with a CRC.
+ *
+ * @param w Pointer to the wheel geometry.
+ */
+void updateWheelConfig(const wheel *w)
+{
+    uint8_t array[WHEEL_ARR_LEN];
+    int len = WHEEL_RECORD_LEN;
+    wheel_encode(w, array);
+    enterLogToEeprom(array, &len, WHEEL_ADDR);
+}
+
+/**
+ * Reads the pill wheel geometry from EEPROM. The wheel is left unchanged if the record is missing or corrupted.
+ *
+ * @param w Pointer to the wheel geometry to update.
+ * @return true if a valid record was read.
+ */
+bool readWheelConfig(wheel *w)
+{
+    uint8_t array[WHEEL_ARR_LEN];
+    eeprom_read_page(WHEEL_ADDR, array, WHEEL_ARR_LEN);
+    int len = WHEEL_ARR_LEN;
+    if (!verifyDataIntegrity(array, &len)) return false;
+    return wheel_decode(w, array);
+}
+
+/**
+ * Finds the first available log entry in EEPROM, reading the logs a chunk at a time.
+ * The logs are a ring and the log after the newest one is always kept unused, so this is where the next log goes.
+ * If no log is unused the EEPROM is new or held something else, the logs start over from the first one.
+ * Flash logs know where they left off from mounting.
  *
- * @return The index of the first available log entry if found, else returns 0 after clearing all logs.
+ * @return The index of the first available log entry if found, else 0.
  */
 int findFirstAvailableLog()
 {
-    int count = 0;        // Initialize counter
-    uint16_t logAddr = 0; // Initialize EEPROM address
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
+    {
+        return flashlog_head(logFlash());
+    }
+#endif
+    uint8_t chunk[LOG_SCAN_CHUNK];
+    int logs = logCapacity();
 
-    // Find the first available log entry
-    while (count < MAX_LOGS)
+    for (int index = 0; index < logs;)
     {
-        if (eeprom_read_byte(logAddr) == 0)
+        int run = logRun(index, logs);
+        eeprom_read_page(logAddress(index), chunk, run * LOG_SIZE);
+        for (int i = 0; i < run; i++)
         {
-            return count; // Return index if an available log entry is found (adding 1 for 1-based indexing)
+            if (chunk[i * LOG_SIZE] == 0)
+            {
+                return index + i; // Return index if an available log entry is found
+            }
         }
-        logAddr += LOG_SIZE; // Move to the next log entry
-        count++;
+        index += run;
     }
 
-    zeroAllLogs(); // Clear all logs if all entries are full
-    return 0;      // Return 0 after clearing logs
+    eeprom_write_byte(logAddress(0), 0); // Mark the first log unused so the next boot finds it
+    return 0;
 }
 
 /**
@@ -348,24 +571,91 @@ uint32_t getTimestampSinceBoot(const uint64_t bootTimestamp)
     return (uint32_t)((time_us_64() - bootTimestamp) / 1000000);
 }
 
+/**
+ * Writes the slots of a record to the logs in EEPROM from an index and marks the log after them unused, the oldest
+ * logs are overwritten. The slots are written a run at a time, a run stops where the logs jump over the records
+ * or wrap around. The mark goes in the same write as the last run unless the logs jump or wrap there.
+ *
+ * @param index First log to write.
+ * @param slots Pointer to the slots, with room for one more byte after them.
+ * @param count Number of slots.
+ */
+static void writeLogSlots(int index, uint8_t *slots, int count)
+{
+    int logs = logCapacity();
+    slots[count * LOG_SIZE] = 0; // 0 indicates log not in use
+
+    for (int done = 0; done < count;)
+    {
+        int run = logRun(index, logs);
+        if (run > count - done) run = count - done;
+        int next = (index + run) % logs;
+        size_t bytes = run * LOG_SIZE;
+        bool last = done + run == count;
+        if (last && logAddress(next) == logAddress(index) + bytes)
+        {
+            bytes++; // the mark follows the record
+        }
+        eeprom_write_page(logAddress(index), slots + done * LOG_SIZE, bytes);
+        if (last && bytes == (size_t)run * LOG_SIZE)
+        {
+            eeprom_write_byte(logAddress(next), 0);
+        }
+        done += run;
+        index = next;
+    }
+}
+
 /**
  * Writes a log entry to EEPROM using information from the device status structure.
  *
  * @param pillDispenserStatusStruct Pointer to the device status structure.
  * @param messageCode               Message code indicating the type of log entry.
- * @param bootTimestamp             Boot timestamp representing the time when the log was created.
+ * @param compartment               Compartment the log is about, 0 for none.
+ * @param bootTimestamp             Time since boot in milliseconds when the log was created, stored as device time.
+ */
+void pushLogToEeprom(DeviceStatus *pillDispenserStatusStruct, log_number messageCode, uint8_t compartment, uint32_t bootTimestamp)
+{
+    logrecord record = {
+        .code = messageCode,
+        .location = compartment,
+        .time_s = epoch_now(&device_epoch, bootTimestamp),
+        .field_count = 0
+    };
+    pushRecordToEeprom(pillDispenserStatusStruct, &record);
+}
+
+/**
+ * Writes a log record with its values to the logs, one slot for the log and more for the values (see logrecord.h).
+ *
+ * @param pillDispenserStatusStruct Pointer to the device status structure, its unused log index is moved past the record.
+ * @param record                    Pointer to the record.
  */
-void pushLogToEeprom(DeviceStatus *pillDispenserStatusStruct, log_number messageCode, uint32_t bootTimestamp)
+void pushRecordToEeprom(DeviceStatus *pillDispenserStatusStruct, const logrecord *record)
 {
-    uint8_t logArray[LOG_LEN]; // Buffer to hold log data
-    // Create a log array with the provided message code and boot timestamp
-    int arrayLen = createLogArray(logArray, messageCode, bootTimestamp);
+    uint8_t slots[LOGRECORD_MAX_SLOTS * LOG_SIZE + 1]; // and the use status of the next log
+    int count = logrecord_encode(record, slots);
 
-    // Write the log array to EEPROM at the appropriate index based on the log size and unused log index
-    enterLogToEeprom(logArray, &arrayLen, (pillDispenserStatusStruct->unusedLogIndex * LOG_SIZE));
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
+    {
+        // Flash logs are appended to erased flash, the log after them is already unused
+        for (int i = 0; i < count; i++)
+        {
+            if (!flashlog_append(logFlash(), slots + i * LOG_SIZE)) metrics_count(METRIC_FLASH_LOG_ERRORS);
+        }
+        pillDispenserStatusStruct->unusedLogIndex = flashlog_head(logFlash());
+        return;
+    }
+#endif
+
+    writeLogSlots(pillDispenserStatusStruct->unusedLogIndex, slots, count);
 
     // Update the unused log index in the device status structure
-    updateUnusedLogIndex(pillDispenserStatusStruct);
+    for (int i = 0; i < count; i++)
+    {
+        updateUnusedLogIndex(pillDispenserStatusStruct);
+    }
 }
 
 /**
@@ -375,41 +665,140 @@ void pushLogToEeprom(DeviceStatus *pillDispenserStatusStruct, log_number message
  */
 void updateUnusedLogIndex(struct DeviceStatus *pillDispenserStatusStruct)
 {
-    if (pillDispenserStatusStruct->unusedLogIndex < MAX_LOGS - 1)
+    // Increment the unused log index, back to the first log after the last one
+    pillDispenserStatusStruct->unusedLogIndex = (pillDispenserStatusStruct->unusedLogIndex + 1) % logCapacity();
+}
+
+/**
+ * Reads log slots from an index on, wrapping around after the last one. Slots that can't be read are zeroed,
+ * like unused logs.
+ *
+ * @param index First log to read.
+ * @param dst   Pointer to room for the slots.
+ * @param count Number of slots, at most the number of logs.
+ */
+static void readLogSlots(int index, uint8_t *dst, int count)
+{
+    int logs = logCapacity();
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
     {
-        pillDispenserStatusStruct->unusedLogIndex++; // Increment the unused log index
+        for (int i = 0; i < count; i++)
+        {
+            if (!flashlog_read(logFlash(), (index + i) % logs, dst + i * LOG_SIZE))
+            {
+                memset(dst + i * LOG_SIZE, 0, LOG_SIZE); // erased flash
+            }
+        }
+        return;
     }
-    else
+#endif
+    for (int done = 0; done < count;)
+    {
+        int run = logRun(index, logs);
+        if (run > count - done) run = count - done;
+        eeprom_read_page(logAddress(index), dst + done * LOG_SIZE, run * LOG_SIZE);
+        done += run;
+        index = (index + run) % logs;
+    }
+}
+
+/**
+ * Reads one log entry from EEPROM and checks it. Only the log itself is read, not its values.
+ *
+ * @param index       Index of the log entry.
+ * @param messageCode Pointer to where the message code is stored.
+ * @param compartment Pointer to where the compartment is stored, 0 for logs without one.
+ * @param timestamp   Pointer to where the device time in seconds is stored, seconds since boot for logs written
+ *                    by older firmware.
+ * @return true if the log entry is in use and its CRC matches, false otherwise. False for the slots that hold
+ *         the values of the log before them.
+ */
+bool readLogFromEeprom(int index, uint8_t *messageCode, uint8_t *compartment, uint32_t *timestamp)
+{
+    if (index < 0 || index >= logCapacity())
+    {
+        return false;
+    }
+    uint8_t logData[LOG_SIZE]; // Buffer to hold log data
+    logrecord record;
+
+    readLogSlots(index, logData, 1);
+    if (logrecord_decode(logData, 1, &record) == 0)
+    {
+        return false;
+    }
+    *messageCode = record.code;
+    *compartment = record.location;
+    *timestamp = record.time_s;
+    return true;
+}
+
+/**
+ * Reads a log record with its values.
+ *
+ * @param index  Index of the log entry.
+ * @param record Pointer to where the record is stored.
+ * @param slots  Pointer to where the number of slots the record takes is stored, 1 if the log isn't valid.
+ * @return true if the log entry is in use and its CRC matches. A record whose values don't check out is read
+ *         without them.
+ */
+bool readLogRecord(int index, logrecord *record, int *slots)
+{
+    int logs = logCapacity();
+    *slots = 1;
+    if (index < 0 || index >= logs)
     {
-        zeroAllLogs();                                 // Reset all logs when the unused log index reaches the maximum limit
-        pillDispenserStatusStruct->unusedLogIndex = 0; // Reset unused log index to 0
+        return false;
     }
+    uint8_t data[LOGRECORD_MAX_SLOTS * LOG_SIZE];
+    int count = logs < LOGRECORD_MAX_SLOTS ? logs : LOGRECORD_MAX_SLOTS;
+    readLogSlots(index, data, count);
+    int used = logrecord_decode(data, count, record);
+    if (used == 0)
+    {
+        return false;
+    }
+    *slots = used;
+    return true;
 }
 
 /**
- * Prints valid logs stored in EEPROM by reading and interpreting log data.
+ * Prints valid logs stored in EEPROM by reading and interpreting log data, oldest first, with their values.
  */
 void printValidLogs()
 {
-    for (int i = 0; i < MAX_LOGS; i++)
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_LOG_DUMP);
+    int logs = logCapacity();
+    int unused = findFirstAvailableLog();
+    bool utc = false; // logs before the first boot start read can't be told from an unsynced boot
+    for (int n = 1; n < logs; n++)
     {
-        uint16_t logAddr = i * LOG_SIZE; // Calculate the EEPROM address for the log entry
-        uint8_t logData[LOG_ARR_LEN];        // Buffer to hold log data
-
-        eeprom_read_page(logAddr, logData, LOG_ARR_LEN); // Read log data from EEPROM
-        
-        int tmp_log_array_length = LOG_ARR_LEN;
-        if (logData[LOG_USE_STATUS] == 1 && verifyDataIntegrity(logData, &tmp_log_array_length) == true)
-        {                                     // Check if the log entry is valid (non-zero message code)
-            uint8_t messageCode = logData[MESSAGE_CODE]; // Extract the message code
-            uint32_t timestamp = (logData[TIMESTAMP_MSB] << 24) | (logData[TIMESTAMP_MSB1] << 16) | (logData[TIMESTAMP_MSB2] << 8) | logData[TIMESTAMP_LSB];
-            uint16_t timestamp_s = timestamp / 1000;
-            // Construct timestamp from individual bytes
-
-            printf("%d: %s %u seconds after last boot.\n", i, logMessages[messageCode], timestamp_s);
+        int i = (unused + n) % logs; // the oldest log is the one after the unused one
+        logrecord record;
+        int slots;
+        if (readLogRecord(i, &record, &slots))
+        {
+            utc = logTimeIsUtc(utc, record.code);
+            char text[STRING_LEN];
+            char values[STRING_LEN];
+            formatLogMessage(text, sizeof(text), record.code, record.location);
+            logrecord_format_fields(values, sizeof(values), &record);
             // Print the log message corresponding to the message code and the timestamp
+            if (record.since_boot)
+            {
+                printf("%d: %s%s %lu seconds after boot.\n", i, text, values, (unsigned long)record.time_s);
+            }
+            else
+            {
+                char when[32];
+                epoch_format(when, sizeof(when), record.time_s, utc);
+                printf("%d: %s%s at %s.\n", i, text, values, when);
+            }
+            n += slots - 1; // the values are in the slots after the log
         }
     }
+    breadcrumb_leave(before);
 }
 
 /**
@@ -432,53 +821,401 @@ bool isValueInArray(int value, int *array, int size)
     return false; // Value not found in the array
 }
 
+#define LORA_RETRY_MS 2000       // wait after the modem refused a message
+#define LORA_MODEM_BUSY_MS 3000   // modem is busy with the RX1 and RX2 windows after an uplink
+#define LORA_DUTY_CYCLE_DIV 100   // 1 % duty cycle on the EU868 default channels
+#define LORA_BUDGET_MS 30000      // fair use policy of the network, 30 s of airtime a day
+#define LORA_BUDGET_PERIOD_MS 86400000
+#define LORA_DEFAULT_SF 12        // assumed until the modem tells the real one
+
+// log export in progress, sent in packed frames when there are no new logs to send
+static bool export_active = false;
+static logframe_cursor export_cursor; // log slots still to send, wraps at the end of the logs
+static uint8_t export_frame_number = 0;
+static uint8_t export_frame[EXPORT_FRAME_LEN];
+static int export_frame_len = 0;  // 0 when the next frame hasn't been built yet
+static int export_frame_logs = 0; // log slots in the built frame
+
+static uint8_t telemetry_frame[EXPORT_FRAME_LEN];
+static int telemetry_len = 0; // 0 when no telemetry is waiting
+
+/**
+ * Gets the queue priority of a log message. Errors the user has to act on are critical,
+ * progress of a dispense cycle is low. Keep fewer critical logs than LOGQUEUE_LEN, so a queue full of critical logs
+ * always has two of the same log that can be merged to make room for a new one.
+ *
+ * @param num Log number.
+ * @return Priority of the log.
+ */
+static log_priority logger_priority(int num) {
+    switch (num) {
+    case LOG_WATCHDOG_REBOOT:
+    case LOG_PILL_ERROR:
+    case LOG_DISPENSER_EMPTY:
+    case LOG_DISPENSE_ERROR:
+    case LOG_HALF_CALIBRATION_ERROR:
+    case LOG_FULL_CALIBRATION_ERROR:
+    case LOG_GREMLINS:
+    case LOG_DISPENSER_STATUS_READ_ERROR:
+    case LOG_DOSE_MISSED:
+    case LOG_WATCHDOG_STALL_MAIN_LOOP:
+    case LOG_WATCHDOG_STALL_SLEEP:
+    case LOG_WATCHDOG_STALL_STATE_MACHINE:
+    case LOG_WATCHDOG_STALL_EEPROM_WRITE:
+    case LOG_WATCHDOG_STALL_EEPROM_READ:
+    case LOG_WATCHDOG_STALL_LORA_WRITE:
+    case LOG_WATCHDOG_STALL_LORA_READ:
+    case LOG_WATCHDOG_STALL_LOG_DUMP:
+        return LOG_PRIORITY_CRITICAL;
+    case LOG_DISPENSE:
+    case LOG_PILL_DISPENSED:
+        return LOG_PRIORITY_LOW;
+    default:
+        return LOG_PRIORITY_NORMAL;
+    }
+}
+
+/**
+ * Gets the coalescing group of a log message. A run of dispensing pill n logs is sent as the last one
+ * with a count, and so is a run of pill dispensed logs.
+ *
+ * @param num      Log number.
+ * @param location Location of the log, see LOG_LOCATION.
+ * @return Coalesce key or LOGQUEUE_NO_COALESCE.
+ */
+static int16_t logger_coalesce_key(int num, uint8_t location) {
+    int16_t carousel = (int16_t)(location >> LOG_CAROUSEL_SHIFT) << 8; // each carousel's runs are merged on their own
+    if (num == LOG_DISPENSE) return carousel | LOG_DISPENSE;
+    if (num == LOG_PILL_DISPENSED) return carousel | LOG_PILL_DISPENSED;
+    return LOGQUEUE_NO_COALESCE;
+}
+
+static inline airtime_priority logger_airtime_priority(const log_entry *entry) {
+    return (entry->priority == LOG_PRIORITY_CRITICAL) ? AIRTIME_CRITICAL : AIRTIME_ROUTINE;
+}
+
 /**
  * Logs device status and triggers a message transmission via LoRa.
  *
  * @param dev      Pointer to the device status structure.
  * @param num      Log number indicating the type of log entry.
  * @param time_ms  Timestamp representing the time when the log was created in milliseconds.
+ * @param queue    Pointer to the queue of logs waiting to be sent.
+ */
+void logger_log(DeviceStatus *dev, log_number num, uint32_t time_ms, log_queue *queue) {
+    logger_log_compartment(dev, num, 0, time_ms, queue);
+}
+
+/**
+ * Logs device status with the compartment the log is about, for the dispensing logs, and the carousel.
+ *
+ * @param dev         Pointer to the device status structure.
+ * @param num         Log number indicating the type of log entry.
+ * @param compartment Location from LOG_LOCATION, compartment 1 is the first compartment after the calibration hole.
+ * @param time_ms     Timestamp representing the time when the log was created in milliseconds.
+ * @param queue       Pointer to the queue of logs waiting to be sent.
+ */
+void logger_log_compartment(DeviceStatus *dev, log_number num, uint8_t compartment, uint32_t time_ms, log_queue *queue) {
+    logger_log_values(dev, num, compartment, time_ms, NULL, 0, queue);
+}
+
+/**
+ * Logs device status with values, step counts or times for example, named by the schema of the log number
+ * (see logrecord.c). The values are stored with the log but not sent over LoRa.
+ *
+ * @param dev         Pointer to the device status structure.
+ * @param num         Log number indicating the type of log entry.
+ * @param compartment Location from LOG_LOCATION.
+ * @param time_ms     Timestamp representing the time when the log was created in milliseconds.
+ * @param values      Pointer to the values, NULL if count is 0.
+ * @param count       Number of values, at most LOGRECORD_MAX_FIELDS are stored.
+ * @param queue       Pointer to the queue of logs waiting to be sent.
+ */
+void logger_log_values(DeviceStatus *dev, log_number num, uint8_t compartment, uint32_t time_ms,
+                       const int32_t *values, uint8_t count, log_queue *queue) {
+    logrecord record = {.code = num, .location = compartment, .time_s = epoch_now(&device_epoch, time_ms), .field_count = 0};
+    for (uint8_t i = 0; i < count && i < LOGRECORD_MAX_FIELDS; i++) {
+        record.fields[record.field_count++] = values[i];
+    }
+    logger_log_record(dev, &record, time_ms, queue);
+}
+
+/**
+ * Logs a record that already has its device time, for logs about the previous boot.
+ *
+ * @param dev     Pointer to the device status structure.
+ * @param record  Pointer to the record.
+ * @param time_ms Time since boot in milliseconds the log is queued with, for the LoRa text.
+ * @param queue   Pointer to the queue of logs waiting to be sent.
  */
-void logger_log(DeviceStatus *dev, log_number num, uint32_t time_ms, ring_buffer *rb) {
-    pushLogToEeprom(dev, num, time_ms); // Store log in EEPROM
-    // lora_message(logMessages[num]);     // Trigger LoRa message transmission
-    logdata data = {num, time_ms};
-    rb_put(rb, data);
+void logger_log_record(DeviceStatus *dev, const logrecord *record, uint32_t time_ms, log_queue *queue) {
+    PROFILE_BEGIN(PROF_LOG_WRITE);
+    pushRecordToEeprom(dev, record); // Store log in EEPROM
+    PROFILE_END(PROF_LOG_WRITE);
+    logqueue_put(queue, record->code, record->location, time_ms, logger_priority(record->code),
+                 logger_coalesce_key(record->code, record->location));
 }
 
-static logdata current = {NOSEND, 0};
-static uint32_t lora_timeout_time = 0;
+/**
+ * Checks if the device time of this boot is a unix time. Boot finished logs carry it.
+ *
+ * @return true once this boot has synced to the network time.
+ */
+bool logger_boot_synced(void) {
+    return epoch_boot_synced(&device_epoch);
+}
 
-void logger_try_send_lora(ring_buffer *rb, uint32_t time_ms) {
-    if (current.num == NOSEND) {
-        if (!rb_empty(rb)) {
-            current = rb_get(rb);
+/**
+ * Gets the number of this boot, counted in the device time epoch. Boot finished logs carry it.
+ *
+ * @return Boots since the epoch was created, 1 for the first.
+ */
+uint16_t logger_boot_count(void) {
+    return device_epoch.boot_count;
+}
+
+/**
+ * Syncs the device time to the network time, stores the epoch and logs how far the device time jumped. Logs after
+ * this are stamped with unix time.
+ *
+ * @param dev     Pointer to the device status structure.
+ * @param unix_s  Seconds since 1970-01-01 UTC.
+ * @param time_ms Time since boot in milliseconds.
+ * @param queue   Pointer to the queue of logs waiting to be sent.
+ */
+void logger_sync_time(DeviceStatus *dev, uint32_t unix_s, uint32_t time_ms, log_queue *queue) {
+    int32_t values[3];
+    values[0] = (int32_t)epoch_sync(&device_epoch, unix_s, time_ms);
+    values[1] = device_epoch.unix_offset_s;
+    values[2] = epoch_boot_synced(&device_epoch);
+    updateEpoch(&device_epoch);
+    logger_log_values(dev, LOG_TIME_SYNCED, 0, time_ms, values, 3, queue);
+}
+
+/**
+ * Sets up the airtime scheduler for the uplinks. Call after lora_init().
+ *
+ * @param spreading_factor Spreading factor the modem joined with, 0 if unknown.
+ * @param time_ms          Current time in milliseconds.
+ */
+void logger_init_airtime(int spreading_factor, uint32_t time_ms) {
+    airtime_config config = {
+        .spreading_factor = LORA_DEFAULT_SF,
+        .bandwidth_khz = 125,
+        .duty_cycle_div = LORA_DUTY_CYCLE_DIV,
+        .budget_ms = LORA_BUDGET_MS,
+        .budget_period_ms = LORA_BUDGET_PERIOD_MS,
+        .modem_busy_ms = LORA_MODEM_BUSY_MS,
+        .retry_ms = LORA_RETRY_MS
+    };
+    airtime_init(&config, time_ms);
+    airtime_set_spreading_factor(spreading_factor);
+}
+
+/**
+ * Formats a log into the text sent over LoRa.
+ *
+ * @param str   Pointer to a buffer of STRING_LEN characters.
+ * @param entry The log to format, merged logs get their count appended.
+ * @return Length of the text.
+ */
+static int logger_format(char *str, const log_entry *entry) {
+    int len = sprintf(str, "%u - ", entry->timestamp / 1000);
+    len += formatLogMessage(str + len, STRING_LEN - len, entry->num, entry->compartment);
+    if (entry->count > 1) {
+        len += sprintf(str + len, " x%u", entry->count);
+    }
+    return len;
+}
+
+/**
+ * Builds the next export frame from the log slots at the export cursor. A log's value slots are skipped, the frame
+ * only counts them.
+ */
+static void logger_build_export_frame(void) {
+    logframe_record records[EXPORT_BATCH];
+    int first = export_cursor.next;
+    int run = logframe_cursor_run(&export_cursor, EXPORT_BATCH);
+    int count = 0;
+
+    for (int i = 0; i < run; count++) {
+        logrecord record;
+        int slots;
+        if (readLogRecord((first + i) % logCapacity(), &record, &slots)) {
+            records[count].code = record.code;
+            records[count].compartment = record.location;
+            records[count].timestamp_s = record.time_s;
         } else {
-            logdata aaa = {NOSEND, 0};
-            current = aaa;
+            records[count].code = LOGFRAME_INVALID_CODE;
+            records[count].compartment = 0;
+            records[count].timestamp_s = 0;
         }
-        return;
+        records[count].slots = (uint8_t)slots;
+        i += slots;
     }
-    #define LORA_TIMEOUT 2000
-    if (time_ms - lora_timeout_time < LORA_TIMEOUT) {
-        return;
+    export_frame_len = logframe_encode(export_frame, EXPORT_FRAME_LEN, export_frame_number, (uint16_t)first,
+                                       records, count, &export_frame_logs);
+    if (export_frame_logs >= export_cursor.left) logframe_mark_last(export_frame);
+}
+
+/**
+ * Sends a binary frame and tells the airtime scheduler how it went.
+ *
+ * @param frame   Pointer to the frame.
+ * @param len     Length of the frame.
+ * @param time_ms Current time in milliseconds.
+ * @return true if the modem took the frame.
+ */
+static bool logger_send_hex(const uint8_t *frame, int len, uint32_t time_ms) {
+    if (lora_message_hex(frame, len)) {
+        airtime_sent(len, time_ms);
+        metrics_count(METRIC_LORA_SENT);
+        return true;
+    }
+    airtime_failed(time_ms);
+    metrics_count(METRIC_LORA_RETRIES);
+    return false;
+}
+
+/**
+ * Sends the next export frame. The frame is kept and sent again on the next call if the modem doesn't take it.
+ *
+ * @param time_ms Current time in milliseconds.
+ */
+static void logger_send_export_frame(uint32_t time_ms) {
+    if (logger_send_hex(export_frame, export_frame_len, time_ms)) {
+        bool last = export_frame_logs >= export_cursor.left;
+        logframe_cursor_advance(&export_cursor, export_frame_logs);
+        export_frame_number++;
+        export_frame_len = 0;
+        if (last) export_active = false;
     }
-    lora_timeout_time = time_ms;
-    #define STRING_LEN 200
-    char tmp_str[STRING_LEN];
-    sprintf(tmp_str, "%u - %s", current.timestamp / 1000, logMessages[current.num]);
-    if (lora_message(tmp_str)) {
-        if (!rb_empty(rb)) {
-            current = rb_get(rb);
+}
+
+/**
+ * Sends the most important waiting log over LoRa when the airtime scheduler allows it.
+ * Critical logs go first, then routine ones and telemetry, and log export frames use what is left.
+ *
+ * @param queue   Pointer to the queue of logs waiting to be sent.
+ * @param time_ms Current time in milliseconds.
+ */
+void logger_try_send_lora(log_queue *queue, uint32_t time_ms) {
+    log_entry next;
+    if (logqueue_peek(queue, &next)) {
+        char tmp_str[STRING_LEN];
+        int len = logger_format(tmp_str, &next);
+        if (airtime_wait_ms(logger_airtime_priority(&next), len, time_ms) > 0) return;
+        if (lora_message(tmp_str)) {
+            logqueue_pop(queue, NULL);
+            airtime_sent(len, time_ms);
+            metrics_count(METRIC_LORA_SENT);
+            metrics_observe(METRIC_LORA_LATENCY_MS, time_ms - next.timestamp);
         } else {
-            logdata aaa = {NOSEND, 0};
-            current = aaa;
+            airtime_failed(time_ms);
+            metrics_count(METRIC_LORA_RETRIES);
         }
+        return;
     }
-} 
+    if (telemetry_len > 0) {
+        if (airtime_wait_ms(AIRTIME_ROUTINE, telemetry_len, time_ms) == 0 && logger_send_hex(telemetry_frame, telemetry_len, time_ms)) {
+            telemetry_len = 0;
+        }
+        return;
+    }
+    if (!export_active) return;
+    if (export_frame_len == 0) logger_build_export_frame();
+    if (airtime_wait_ms(AIRTIME_BULK, export_frame_len, time_ms) == 0) logger_send_export_frame(time_ms);
+}
+
+/**
+ * Calculates how long the main loop can sleep before logger_try_send_lora() has work to do.
+ *
+ * @param queue   Pointer to the queue of logs waiting to be sent.
+ * @param time_ms Current time in milliseconds.
+ * @return Milliseconds until the next send attempt, UINT32_MAX if nothing is waiting to be sent.
+ */
+uint32_t logger_get_wake_ms(log_queue *queue, uint32_t time_ms) {
+    log_entry next;
+    if (logqueue_peek(queue, &next)) {
+        char tmp_str[STRING_LEN];
+        return airtime_wait_ms(logger_airtime_priority(&next), logger_format(tmp_str, &next), time_ms);
+    }
+    if (telemetry_len > 0) return airtime_wait_ms(AIRTIME_ROUTINE, telemetry_len, time_ms);
+    if (!export_active) return UINT32_MAX;
+    if (export_frame_len == 0) return 0; // frame gets built on the next try
+    return airtime_wait_ms(AIRTIME_BULK, export_frame_len, time_ms);
+}
+
+/**
+ * Starts sending the stored logs from a given index up to the newest one in packed frames (see logframe.h).
+ * The logs are a ring, so a first index past the unused one wraps around the end of the logs to it.
+ * Restarts from the beginning if an export is already running.
+ * If there are no logs from that index on, a single empty frame flagged as last is sent.
+ *
+ * @param first          Index of the first log to send.
+ * @param unusedLogIndex Index of the log the program will use next, the export stops before it.
+ */
+void logger_start_export(uint16_t first, int unusedLogIndex)
+{
+    logframe_cursor_start(&export_cursor, first, unusedLogIndex, logCapacity());
+    export_frame_number = 0;
+    export_frame_len = 0;
+    export_active = true;
+}
+
+/**
+ * Takes a snapshot of the runtime metrics and queues it as a telemetry uplink (see metrics.c).
+ * Replaces telemetry that hasn't been sent yet.
+ */
+void logger_queue_telemetry(void)
+{
+    metrics_snapshot snapshot;
+    metrics_take_snapshot(&snapshot);
+    int len = metrics_encode(&snapshot, telemetry_frame, EXPORT_FRAME_LEN);
+    telemetry_len = (len > 0) ? len : 0;
+}
+
+/**
+ * Checks if a log export is still being sent.
+ *
+ * @return true if there are export frames left to send.
+ */
+bool logger_export_active(void)
+{
+    return export_active;
+}
+
+/**
+ * Erases the flash sector the logs go to next while the device is idle, so writing a log never waits for an erase.
+ * Nothing to do when the logs are in the EEPROM.
+ */
+void logger_maintain_storage(void)
+{
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
+    {
+        flashlog_maintain(logFlash());
+    }
+#endif
+}
+
+/**
+ * Gets the flash the logs are kept in, for reading it raw.
+ *
+ * @return Pointer to the flash, NULL if the logs are in the EEPROM.
+ */
+const blockdev *logger_flash_storage(void)
+{
+#ifdef FLASH_LOG_ENABLED
+    if (logFlash() != NULL)
+    {
+        return &flash_dev;
+    }
+#endif
+    return NULL;
+}
 
-#define LOG_RBUF_SIZE 20
-void init_logger(ring_buffer *rb, logdata *buffer, int len) {
-    rb_init(rb, buffer, len);
+void init_logger(log_queue *queue) {
+    logqueue_init(queue);
 
 }
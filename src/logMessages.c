@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "logHandling.h"
+
+// Kept out of logHandling.c so the host tools can print the messages too.
+const char *logMessages[] = {
+    "Shutdown while motor was idle",
+    "Watchdog caused reboot",
+    "Dispensing pill 1",
+    "Dispensing pill 2",
+    "Dispensing pill 3",
+    "Dispensing pill 4",
+    "Dispensing pill 5",
+    "Dispensing pill 6",
+    "Dispensing pill 7",
+    "Doing half calibration",
+    "Doing full calibration",
+    "Dispensing button pressed",
+    "pill dispensed",
+    "pill drop not detected",
+    "Pill dispenser is empty",
+    "Calibration finished",
+    "Reboot during pill 1 dispensing",
+    "Reboot during pill 2 dispensing",
+    "Reboot during pill 3 dispensing",
+    "Reboot during pill 4 dispensing",
+    "Reboot during pill 5 dispensing",
+    "Reboot during pill 6 dispensing",
+    "Reboot during pill 7 dispensing",
+    "Reboot during half calibration",
+    "Reboot during full calibration",
+    "Gremlins in the code",
+    "Failed to read pill dispenser status from EEPROM",
+    "Boot Finished",
+    "Scheduled dose started",
+    "Scheduled dose missed",
+    "Remote command received",
+    "Remote command rejected",
+    "Watchdog stall in main loop",
+    "Watchdog stall while sleeping",
+    "Watchdog stall in state machine",
+    "Watchdog stall in EEPROM write",
+    "Watchdog stall in EEPROM read",
+    "Watchdog stall in LoRa write",
+    "Watchdog stall in LoRa read",
+    "Watchdog stall in log dump",
+    "Dispensing pill %u",
+    "Reboot during pill %u dispensing",
+    "Calibration restored without turning",
+    "Time synced from the network"
+    };
+
+/**
+ * Checks if a message code has a compartment number in its text.
+ *
+ * @param messageCode Message code.
+ * @return true for the dispensing logs that store the compartment.
+ */
+bool logHasCompartment(uint8_t messageCode)
+{
+    return messageCode == LOG_DISPENSE || messageCode == LOG_DISPENSE_ERROR;
+}
+
+/**
+ * Follows whether the timestamps of logs read oldest first are unix times. A boot starts with device time that is
+ * only a unix time again after code 43, so the logs reboot_sequence() writes and the boot finished log end it.
+ * Readers start with false, a stall log or a log read right after the start of a boot is never taken for UTC.
+ *
+ * @param utcBefore   true if the log before was stamped with unix time.
+ * @param messageCode Message code of the log.
+ * @return true if this log is stamped with unix time.
+ */
+bool logTimeIsUtc(bool utcBefore, uint8_t messageCode)
+{
+    switch (messageCode)
+    {
+    case LOG_TIME_SYNCED:
+        return true;
+    case LOG_IDLE:
+    case LOG_WATCHDOG_REBOOT:
+    case LOG_HALF_CALIBRATION_ERROR:
+    case LOG_FULL_CALIBRATION_ERROR:
+    case LOG_GREMLINS:
+    case LOG_DISPENSER_STATUS_READ_ERROR:
+    case LOG_BOOTFINISHED:
+    case LOG_DISPENSE_ERROR:
+        return false;
+    default:
+        if (messageCode >= LOG_DISPENSE1_ERROR && messageCode <= LOG_DISPENSE7_ERROR) return false;
+        if (messageCode >= LOG_WATCHDOG_STALL_MAIN_LOOP && messageCode <= LOG_WATCHDOG_STALL_LOG_DUMP) return false;
+        return utcBefore;
+    }
+}
+
+/**
+ * Writes the text of a log message, with the compartment number filled in for the messages that have one.
+ * Logs of carousels other than the first start with the carousel number.
+ *
+ * @param dst         Pointer to the buffer for the text.
+ * @param size        Size of the buffer.
+ * @param messageCode Message code.
+ * @param compartment Location stored with the log, see LOG_LOCATION.
+ * @return Length of the text, as snprintf().
+ */
+int formatLogMessage(char *dst, size_t size, uint8_t messageCode, uint8_t compartment)
+{
+    uint8_t carousel = compartment >> LOG_CAROUSEL_SHIFT;
+    int len = 0;
+    if (carousel > 0) {
+        len = snprintf(dst, size, "Carousel %u: ", carousel + 1);
+        if (len < 0 || (size_t)len >= size) return len;
+    }
+    if (messageCode >= NOSEND) return len + snprintf(dst + len, size - len, "Unknown message code %u", messageCode);
+    if (logHasCompartment(messageCode)) return len + snprintf(dst + len, size - len, logMessages[messageCode], compartment & LOG_COMPARTMENT_MASK);
+    return len + snprintf(dst + len, size - len, "%s", logMessages[messageCode]);
+}
@@ -0,0 +1,155 @@
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include <stdio.h>
+
+#include "logdump.h"
+#include "dumpframe.h"
+#include "eeprom.h"
+#include "logHandling.h"
+#include "events.h"
+#include "breadcrumb.h"
+
+#define DUMP_IDLE_MS 5000 // a session the host has been quiet in this long is closed
+#define DUMP_RX_MAX 64    // bytes read in one poll, a READ frame is 10
+
+static dumpframe_rx rx;
+static bool session_active = false;
+static uint32_t session_ms = 0; // time of the last frame from the host
+static uint8_t frame[DUMPFRAME_MAX_LEN];
+static const DeviceStatus *dump_log_dev; // status of carousel 0, has the index of the next log
+
+/**
+ * Wakes the main loop when bytes arrive on the stdio UART. Called from the UART interrupt.
+ *
+ * @param param Unused.
+ */
+static void logdump_chars_available(void *param) {
+    (void)param;
+    events_post(EVENT_SERIAL_RX, 0);
+}
+
+/**
+ * Sends a frame on the stdio UART. Raw, so newlines in the frame aren't turned into CR LF.
+ *
+ * @param payload Pointer to the type byte and the fields.
+ * @param len     Length of the payload.
+ */
+static void logdump_send(const uint8_t *payload, size_t len) {
+    size_t n = dumpframe_encode(frame, payload, len);
+    for (size_t i = 0; i < n; i++) putchar_raw(frame[i]);
+}
+
+/**
+ * Sends the sizes of the dump, who it is from and where the logs are, so the host can tell if a dump it started
+ * earlier is still the same.
+ */
+static void logdump_send_hello(void) {
+    uint8_t payload[DUMPFRAME_HELLO_LEN];
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    const blockdev *flash = logger_flash_storage();
+    payload[0] = DUMPFRAME_HELLO;
+    payload[1] = DUMPFRAME_VERSION;
+    for (int i = 0; i < DUMPFRAME_BOARD_ID_LEN; i++) payload[2 + i] = id.id[i];
+    dumpframe_put_u32(payload + 2 + DUMPFRAME_BOARD_ID_LEN, eeprom_size());
+    dumpframe_put_u32(payload + 6 + DUMPFRAME_BOARD_ID_LEN, flash != NULL ? flash->size : 0);
+    dumpframe_put_u16(payload + 10 + DUMPFRAME_BOARD_ID_LEN, DUMPFRAME_CHUNK);
+    dumpframe_put_u16(payload + 12 + DUMPFRAME_BOARD_ID_LEN, logger_boot_count());
+    dumpframe_put_u16(payload + 14 + DUMPFRAME_BOARD_ID_LEN, (uint16_t)dump_log_dev->unusedLogIndex);
+    logdump_send(payload, sizeof(payload));
+}
+
+/**
+ * Reads a chunk of the dump and sends it. The EEPROM comes first, the flash log after it.
+ *
+ * @param offset Offset of the chunk in the dump.
+ * @param len    Bytes asked for, less are sent at the end of the EEPROM or the flash log.
+ */
+static void logdump_send_chunk(uint32_t offset, uint16_t len) {
+    uint8_t payload[DUMPFRAME_MAX_PAYLOAD];
+    uint8_t *data = payload + DUMPFRAME_DATA_HEADER_LEN;
+    uint32_t eeprom = eeprom_size();
+    const blockdev *flash = logger_flash_storage();
+    bool ok = len > 0;
+    if (len > DUMPFRAME_CHUNK) len = DUMPFRAME_CHUNK;
+
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_LOG_DUMP);
+    if (ok && offset < eeprom) {
+        if (len > eeprom - offset) len = eeprom - offset;
+        eeprom_read_page(offset, data, len);
+    } else if (ok && flash != NULL && offset - eeprom < flash->size) {
+        if (len > flash->size - (offset - eeprom)) len = flash->size - (offset - eeprom);
+        ok = blockdev_read(flash, offset - eeprom, data, len);
+    } else {
+        ok = false;
+    }
+
+    payload[0] = ok ? DUMPFRAME_DATA : DUMPFRAME_ERROR;
+    dumpframe_put_u32(payload + 1, offset);
+    logdump_send(payload, ok ? DUMPFRAME_DATA_HEADER_LEN + len : DUMPFRAME_DATA_HEADER_LEN);
+    breadcrumb_leave(before);
+}
+
+/**
+ * Answers a frame from the host. Reads are only answered in an open session, so stray bytes can't start a dump.
+ *
+ * @param payload Pointer to the frame's type byte and fields.
+ * @param len     Length of the payload.
+ * @param time_ms Time since boot in ms.
+ */
+static void logdump_handle(const uint8_t *payload, int len, uint32_t time_ms) {
+    switch (payload[0]) {
+    case DUMPFRAME_START:
+        logdump_start(time_ms);
+        break;
+    case DUMPFRAME_READ:
+        if (!session_active || len < DUMPFRAME_READ_LEN) break;
+        session_ms = time_ms;
+        logdump_send_chunk(dumpframe_get_u32(payload + 1), dumpframe_get_u16(payload + 5));
+        break;
+    case DUMPFRAME_END:
+        session_active = false;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Starts listening for frames from the host.
+ *
+ * @param log_dev Pointer to the status of carousel 0, after reboot_sequence() has found the next log.
+ */
+void logdump_init(const DeviceStatus *log_dev) {
+    dump_log_dev = log_dev;
+    dumpframe_rx_init(&rx);
+    session_active = false;
+    stdio_set_chars_available_callback(logdump_chars_available, NULL);
+}
+
+/**
+ * Opens a session and tells the host the sizes of the dump. A host that is waiting for a device starts reading.
+ *
+ * @param time_ms Time since boot in ms.
+ */
+void logdump_start(uint32_t time_ms) {
+    session_active = true;
+    session_ms = time_ms;
+    logdump_send_hello();
+}
+
+/**
+ * Reads the bytes received since the last call and answers the frames they complete. Closes a session the host has
+ * left.
+ *
+ * @param time_ms Time since boot in ms.
+ */
+void logdump_poll(uint32_t time_ms) {
+    for (int i = 0; i < DUMP_RX_MAX; i++) {
+        int c = getchar_timeout_us(0);
+        if (c == PICO_ERROR_TIMEOUT) break;
+        int len = dumpframe_rx_feed(&rx, (uint8_t)c);
+        if (len > 0) logdump_handle(rx.buf, len, time_ms);
+    }
+    if (session_active && time_ms - session_ms >= DUMP_IDLE_MS) session_active = false;
+}
@@ -0,0 +1,330 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "logframe.h"
+
+#define NIBBLE_ESCAPE 0xF
+#define VARINT_MAX_LEN 5
+
+/**
+ * Gets the number of nibbles a log takes in the code stream.
+ *
+ * @param rec Pointer to the log.
+ * @return 1, 3, 4, 5 or 6.
+ */
+static inline int logframe_code_nibbles(const logframe_record *rec) {
+    if (rec->code == LOGFRAME_INVALID_CODE) return 3;
+    int nibbles = (rec->compartment != 0 || rec->slots > 1 || rec->code >= NIBBLE_ESCAPE) ? 3 : 1;
+    if (rec->compartment != 0) nibbles += 2;
+    if (rec->slots > 1) nibbles += 1;
+    return nibbles;
+}
+
+/**
+ * Gets the number of log slots a log takes in a frame.
+ *
+ * @param rec Pointer to the log.
+ * @return 1 to LOGFRAME_MAX_SLOTS.
+ */
+static inline int logframe_record_slots(const logframe_record *rec) {
+    if (rec->code == LOGFRAME_INVALID_CODE || rec->slots < 1) return 1;
+    return rec->slots < LOGFRAME_MAX_SLOTS ? rec->slots : LOGFRAME_MAX_SLOTS;
+}
+
+/**
+ * Writes a nibble to a nibble stream, high nibble first.
+ *
+ * @param buf  Pointer to the stream.
+ * @param pos  Nibble position to write.
+ * @param val  Value 0-15.
+ */
+static void logframe_put_nibble(uint8_t *buf, int pos, uint8_t val) {
+    if (pos & 1) {
+        buf[pos >> 1] |= val & 0x0F;
+    } else {
+        buf[pos >> 1] = (uint8_t)(val << 4);
+    }
+}
+
+static inline uint8_t logframe_get_nibble(const uint8_t *buf, int pos) {
+    return (pos & 1) ? (buf[pos >> 1] & 0x0F) : (buf[pos >> 1] >> 4);
+}
+
+static inline uint32_t logframe_zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t logframe_unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/**
+ * Gets the number of bytes a varint takes.
+ *
+ * @param v Value to encode.
+ * @return 1-5.
+ */
+int logframe_varint_len(uint32_t v) {
+    int len = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * Writes a varint, 7 bits per byte with the lowest bits first and the top bit set on all but the last byte.
+ *
+ * @param buf Pointer to where the varint is written, needs room for logframe_varint_len(v) bytes.
+ * @param v   Value to encode.
+ * @return Number of bytes written.
+ */
+int logframe_put_varint(uint8_t *buf, uint32_t v) {
+    int len = 0;
+    while (v >= 0x80) {
+        buf[len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    buf[len++] = (uint8_t)v;
+    return len;
+}
+
+/**
+ * Reads a varint.
+ *
+ * @param buf Pointer to the varint.
+ * @param end Pointer one past the end of the data.
+ * @param v   Pointer to where the value is stored.
+ * @return Number of bytes read, -1 if the varint runs past end or is too long.
+ */
+int logframe_get_varint(const uint8_t *buf, const uint8_t *end, uint32_t *v) {
+    uint32_t value = 0;
+    int len = 0;
+    do {
+        if (buf + len >= end || len >= VARINT_MAX_LEN) return -1;
+        value |= (uint32_t)(buf[len] & 0x7F) << (7 * len);
+    } while (buf[len++] & 0x80);
+    *v = value;
+    return len;
+}
+
+/**
+ * Encodes as many logs as fit into one frame.
+ *
+ * @param frame        Pointer to the frame buffer.
+ * @param max_len      Size of the frame buffer, the LoRa payload limit.
+ * @param frame_number Number of this frame in the export.
+ * @param first_index  Log slot index of records[0].
+ * @param records      Pointer to the logs, invalid slots have code LOGFRAME_INVALID_CODE. Codes must be below
+ *                     LOGFRAME_VALUES_FLAG. A log's value slots follow it in the slots, not in records.
+ * @param count        Number of logs available.
+ * @param encoded      Pointer to where the number of log slots the logs that fit take is stored.
+ * @return Length of the frame in bytes, -1 if max_len can't hold a header.
+ */
+int logframe_encode(uint8_t *frame, int max_len, uint8_t frame_number, uint16_t first_index,
+                    const logframe_record *records, int count, int *encoded) {
+    if (max_len < LOGFRAME_HEADER_LEN) return -1;
+    if (count > LOGFRAME_MAX_RECORDS) count = LOGFRAME_MAX_RECORDS;
+
+    // first pass: find how many logs fit
+    int nibbles = 0;
+    int delta_bytes = 0;
+    int n = 0;
+    int slots = 0;
+    bool have_base = false;
+    uint32_t prev_tick = 0;
+    uint32_t base_s = 0;
+    for (; n < count; n++) {
+        int rec_nibbles = logframe_code_nibbles(&records[n]);
+        int rec_slots = logframe_record_slots(&records[n]);
+        if (slots + rec_slots > LOGFRAME_MAX_RECORDS) break;
+        int rec_bytes = 0;
+        uint32_t tick = records[n].timestamp_s;
+        if (records[n].code != LOGFRAME_INVALID_CODE && have_base) {
+            rec_bytes = logframe_varint_len(logframe_zigzag((int32_t)(tick - prev_tick)));
+        }
+        if (LOGFRAME_HEADER_LEN + (nibbles + rec_nibbles + 1) / 2 + delta_bytes + rec_bytes > max_len) break;
+        nibbles += rec_nibbles;
+        delta_bytes += rec_bytes;
+        slots += rec_slots;
+        if (records[n].code != LOGFRAME_INVALID_CODE) {
+            if (!have_base) base_s = records[n].timestamp_s;
+            have_base = true;
+            prev_tick = tick;
+        }
+    }
+
+    frame[0] = LOGFRAME_TYPE;
+    frame[1] = frame_number;
+    frame[2] = (uint8_t)(first_index & 0xFF);
+    frame[3] = (uint8_t)(first_index >> 8);
+    frame[4] = (uint8_t)slots;
+    frame[5] = 0;
+    frame[6] = (uint8_t)(base_s & 0xFF);
+    frame[7] = (uint8_t)((base_s >> 8) & 0xFF);
+    frame[8] = (uint8_t)((base_s >> 16) & 0xFF);
+    frame[9] = (uint8_t)((base_s >> 24) & 0xFF);
+
+    // second pass: write codes and deltas
+    uint8_t *codes = frame + LOGFRAME_HEADER_LEN;
+    uint8_t *deltas = codes + (nibbles + 1) / 2;
+    int pos = 0;
+    int len = 0;
+    have_base = false;
+    for (int i = 0; i < n; i++) {
+        uint8_t code = records[i].code;
+        int rec_slots = logframe_record_slots(&records[i]);
+        if (logframe_code_nibbles(&records[i]) == 1) {
+            logframe_put_nibble(codes, pos++, code);
+        } else {
+            uint8_t flagged = code;
+            if (code != LOGFRAME_INVALID_CODE && records[i].compartment != 0) flagged |= LOGFRAME_COMPARTMENT_FLAG;
+            if (rec_slots > 1) flagged |= LOGFRAME_VALUES_FLAG;
+            logframe_put_nibble(codes, pos++, NIBBLE_ESCAPE);
+            logframe_put_nibble(codes, pos++, flagged >> 4);
+            logframe_put_nibble(codes, pos++, flagged & 0x0F);
+            if ((flagged & LOGFRAME_COMPARTMENT_FLAG) && code != LOGFRAME_INVALID_CODE) {
+                logframe_put_nibble(codes, pos++, records[i].compartment >> 4);
+                logframe_put_nibble(codes, pos++, records[i].compartment & 0x0F);
+            }
+            if (rec_slots > 1) logframe_put_nibble(codes, pos++, (uint8_t)(rec_slots - 1));
+        }
+        if (code == LOGFRAME_INVALID_CODE) continue;
+        uint32_t tick = records[i].timestamp_s;
+        if (have_base) len += logframe_put_varint(deltas + len, logframe_zigzag((int32_t)(tick - prev_tick)));
+        have_base = true;
+        prev_tick = tick;
+    }
+
+    *encoded = slots;
+    return LOGFRAME_HEADER_LEN + (nibbles + 1) / 2 + delta_bytes;
+}
+
+/**
+ * Flags a frame as the last one of an export.
+ *
+ * @param frame Pointer to an encoded frame.
+ */
+void logframe_mark_last(uint8_t *frame) {
+    frame[5] |= LOGFRAME_FLAG_LAST;
+}
+
+/**
+ * Decodes a frame. Timestamps after the first are rebuilt from the deltas. Frames from older firmware are decoded
+ * with their timestamps in seconds since boot.
+ *
+ * @param frame       Pointer to the frame.
+ * @param len         Length of the frame.
+ * @param hdr         Pointer to where the header is stored.
+ * @param records     Pointer to where the logs are stored, a log's value slots are counted in its slots.
+ * @param max_records Room in records.
+ * @return Number of logs decoded, less than hdr->count if some take value slots. -1 if the frame is malformed.
+ */
+int logframe_decode(const uint8_t *frame, int len, logframe_header *hdr, logframe_record *records, int max_records) {
+    if (len < LOGFRAME_HEADER_LEN || (frame[0] != LOGFRAME_TYPE && frame[0] != LOGFRAME_TYPE_BOOT_MS)) return -1;
+    hdr->since_boot = frame[0] == LOGFRAME_TYPE_BOOT_MS;
+    hdr->frame_number = frame[1];
+    hdr->first_index = (uint16_t)(frame[2] | (frame[3] << 8));
+    hdr->count = frame[4];
+    hdr->flags = frame[5];
+    hdr->base_s = (uint32_t)frame[6] | ((uint32_t)frame[7] << 8) | ((uint32_t)frame[8] << 16) | ((uint32_t)frame[9] << 24);
+    if (hdr->since_boot) hdr->base_s /= 1000;
+
+    const uint8_t *codes = frame + LOGFRAME_HEADER_LEN;
+    int code_nibbles_max = (len - LOGFRAME_HEADER_LEN) * 2;
+    int pos = 0;
+    int logs = 0;
+    for (int slots = 0; slots < hdr->count; slots += records[logs++].slots) {
+        if (pos >= code_nibbles_max || logs >= max_records) return -1;
+        uint8_t code = logframe_get_nibble(codes, pos++);
+        uint8_t compartment = 0;
+        uint8_t rec_slots = 1;
+        if (code == NIBBLE_ESCAPE) {
+            if (pos + 2 > code_nibbles_max) return -1;
+            code = (uint8_t)(logframe_get_nibble(codes, pos) << 4 | logframe_get_nibble(codes, pos + 1));
+            pos += 2;
+            if (code != LOGFRAME_INVALID_CODE && (code & LOGFRAME_COMPARTMENT_FLAG)) {
+                if (pos + 2 > code_nibbles_max) return -1;
+                code &= (uint8_t)~LOGFRAME_COMPARTMENT_FLAG;
+                compartment = (uint8_t)(logframe_get_nibble(codes, pos) << 4 | logframe_get_nibble(codes, pos + 1));
+                pos += 2;
+            }
+            if (code != LOGFRAME_INVALID_CODE && (code & LOGFRAME_VALUES_FLAG)) {
+                if (pos + 1 > code_nibbles_max) return -1;
+                code &= (uint8_t)~LOGFRAME_VALUES_FLAG;
+                rec_slots += logframe_get_nibble(codes, pos++);
+            }
+        }
+        records[logs].code = code;
+        records[logs].compartment = compartment;
+        records[logs].slots = rec_slots;
+    }
+
+    const uint8_t *p = codes + (pos + 1) / 2;
+    const uint8_t *end = frame + len;
+    bool have_base = false;
+    uint32_t tick = 0;
+    for (int i = 0; i < logs; i++) {
+        if (records[i].code == LOGFRAME_INVALID_CODE) {
+            records[i].timestamp_s = 0;
+            continue;
+        }
+        if (!have_base) {
+            records[i].timestamp_s = hdr->base_s;
+            tick = hdr->base_s;
+            have_base = true;
+            continue;
+        }
+        uint32_t v;
+        int n = logframe_get_varint(p, end, &v);
+        if (n < 0) return -1;
+        p += n;
+        tick += (uint32_t)logframe_unzigzag(v);
+        records[i].timestamp_s = tick;
+    }
+    return logs;
+}
+
+/**
+ * Starts a walk over the log slots from a first slot up to, not including, the unused one.
+ *
+ * @param c        Pointer to the cursor.
+ * @param first    Index of the first log slot to send. Slots after the unused one are older and wrap around to it.
+ * @param unused   Index of the log slot the program will use next.
+ * @param capacity Number of log slots in the ring.
+ */
+void logframe_cursor_start(logframe_cursor *c, int first, int unused, int capacity) {
+    c->capacity = capacity;
+    c->next = (unused >= 0 && unused < capacity) ? unused : 0;
+    c->left = 0;
+    if (first < 0 || first >= capacity || c->next != unused) return; // nothing to send, one empty frame
+    c->next = first;
+    c->left = (unused - first + capacity) % capacity;
+}
+
+/**
+ * Gets how many slots from the cursor can go in the next frame, they stop at the end of the ring.
+ *
+ * @param c   Pointer to the cursor.
+ * @param max Most slots wanted.
+ * @return Number of consecutive slots, 0 when the walk is done.
+ */
+int logframe_cursor_run(const logframe_cursor *c, int max) {
+    int run = c->left;
+    if (run > c->capacity - c->next) run = c->capacity - c->next;
+    return run < max ? run : max;
+}
+
+/**
+ * Moves the cursor past slots that were sent.
+ *
+ * @param c     Pointer to the cursor.
+ * @param slots Number of slots sent, at most what logframe_cursor_run() gave.
+ */
+void logframe_cursor_advance(logframe_cursor *c, int slots) {
+    if (slots > c->left) slots = c->left;
+    c->left -= slots;
+    c->next = (c->next + slots) % c->capacity;
+}
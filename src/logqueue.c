@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "logqueue.h"
+
+/**
+ * Finds the entry that is sent next: the oldest one of the highest priority.
+ *
+ * @param q Pointer to the queue.
+ * @return Index of the entry, -1 if the queue is empty.
+ */
+static int logqueue_find_next(const log_queue *q) {
+    int best = -1;
+    for (int i = 0; i < q->len; i++) {
+        if (best < 0 || q->entries[i].priority < q->entries[best].priority) best = i;
+    }
+    return best;
+}
+
+/**
+ * Finds the entry to push out for a new log: the oldest one of the lowest priority below the new log's.
+ *
+ * @param q        Pointer to the queue.
+ * @param priority Priority of the new log.
+ * @return Index of the entry, -1 if every entry is at least as important as the new log.
+ */
+static int logqueue_find_victim(const log_queue *q, log_priority priority) {
+    int victim = -1;
+    for (int i = 0; i < q->len; i++) {
+        if (q->entries[i].priority <= priority) continue;
+        if (victim < 0 || q->entries[i].priority > q->entries[victim].priority) victim = i;
+    }
+    return victim;
+}
+
+/**
+ * Finds the critical entry a new critical log is counted into when the queue is full of critical logs: the newest
+ * one of the same log and compartment, or else the newest one of the same log.
+ *
+ * @param q           Pointer to the queue.
+ * @param num         Log number of the new log.
+ * @param compartment Compartment of the new log.
+ * @return Index of the entry, -1 if no critical entry is of the same log.
+ */
+static int logqueue_find_critical_merge(const log_queue *q, int num, uint8_t compartment) {
+    int same_log = -1;
+    for (int i = q->len - 1; i >= 0; i--) {
+        const log_entry *e = &q->entries[i];
+        if (e->priority != LOG_PRIORITY_CRITICAL || e->num != num || e->count == UINT16_MAX) continue;
+        if (e->compartment == compartment) return i;
+        if (same_log < 0) same_log = i;
+    }
+    return same_log;
+}
+
+/**
+ * Makes room for a critical log in a queue full of critical logs by merging two queued entries of the same log into
+ * the older one, which gets the newer one's compartment and time. There is always such a pair while there are
+ * fewer critical log numbers than LOGQUEUE_LEN, unless the counts of every pair would overflow.
+ *
+ * @param q Pointer to the queue.
+ * @return Index of the entry that was freed, -1 if no two entries could be merged.
+ */
+static int logqueue_merge_critical_pair(log_queue *q) {
+    for (int i = q->len - 1; i > 0; i--) {
+        const log_entry *newer = &q->entries[i];
+        if (newer->priority != LOG_PRIORITY_CRITICAL) continue;
+        for (int j = i - 1; j >= 0; j--) {
+            log_entry *older = &q->entries[j];
+            if (older->priority != LOG_PRIORITY_CRITICAL || older->num != newer->num) continue;
+            if ((uint32_t)older->count + newer->count > UINT16_MAX) continue;
+            older->compartment = newer->compartment;
+            older->timestamp = newer->timestamp;
+            older->count += newer->count;
+            q->coalesced++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void logqueue_remove(log_queue *q, int index) {
+    memmove(&q->entries[index], &q->entries[index + 1], (q->len - index - 1) * sizeof(log_entry));
+    q->len--;
+}
+
+/**
+ * Initializes an empty queue and clears its counters.
+ *
+ * @param q Pointer to the queue.
+ */
+void logqueue_init(log_queue *q) {
+    memset(q, 0, sizeof(*q));
+}
+
+/**
+ * Adds a log to the queue. If the queue already has a log with the same priority and coalesce key, and only other
+ * coalescing logs of that priority were queued after it, the two are merged into one entry that counts them.
+ * When the queue is full, the oldest log of the lowest priority below the new log's is dropped to make room. If
+ * there is none, a critical log is counted into a queued critical log of the same kind, or two queued critical logs
+ * of the same kind are merged to make room for it. Other logs are dropped. While there are fewer critical log
+ * numbers than LOGQUEUE_LEN, a full queue of critical logs always has two of the same kind, so critical logs are
+ * only dropped if their counts would overflow.
+ *
+ * @param q            Pointer to the queue.
+ * @param num          Log number.
+ * @param compartment  Compartment the log is about, 0 for none.
+ * @param timestamp    Time of the log in milliseconds.
+ * @param priority     Priority of the log.
+ * @param coalesce_key Key of the log's coalescing group or LOGQUEUE_NO_COALESCE.
+ * @return true if the log was queued or merged, false if it was dropped.
+ */
+bool logqueue_put(log_queue *q, int num, uint8_t compartment, uint32_t timestamp, log_priority priority, int16_t coalesce_key) {
+    if (coalesce_key != LOGQUEUE_NO_COALESCE) {
+        for (int i = q->len - 1; i >= 0; i--) {
+            log_entry *e = &q->entries[i];
+            if (e->priority == priority && e->coalesce_key != coalesce_key && e->coalesce_key != LOGQUEUE_NO_COALESCE) {
+                continue; // other progress logs of the same run, like pill dispensed between dispensing pill n
+            }
+            if (e->priority != priority || e->coalesce_key != coalesce_key || e->count == UINT16_MAX) break; // anything else ends the run
+            e->num = num;
+            e->compartment = compartment;
+            e->timestamp = timestamp;
+            e->count++;
+            q->coalesced++;
+            return true;
+        }
+    }
+
+    if (q->len == LOGQUEUE_LEN) {
+        int victim = logqueue_find_victim(q, priority);
+        if (victim < 0) {
+            int merge = priority == LOG_PRIORITY_CRITICAL ? logqueue_find_critical_merge(q, num, compartment) : -1;
+            if (merge >= 0) {
+                log_entry *e = &q->entries[merge];
+                e->compartment = compartment;
+                e->timestamp = timestamp;
+                e->count++;
+                q->coalesced++;
+                return true;
+            }
+            int freed = priority == LOG_PRIORITY_CRITICAL ? logqueue_merge_critical_pair(q) : -1;
+            if (freed < 0) {
+                q->dropped[priority]++;
+                return false;
+            }
+            logqueue_remove(q, freed);
+        } else {
+            q->dropped[q->entries[victim].priority]++;
+            logqueue_remove(q, victim);
+        }
+    }
+
+    log_entry *e = &q->entries[q->len++];
+    e->num = num;
+    e->compartment = compartment;
+    e->timestamp = timestamp;
+    e->count = 1;
+    e->priority = priority;
+    e->coalesce_key = coalesce_key;
+    if (q->len > q->high_water) q->high_water = q->len;
+    return true;
+}
+
+/**
+ * Gets the entry that is sent next without removing it.
+ *
+ * @param q     Pointer to the queue.
+ * @param entry Pointer to where the entry is copied.
+ * @return true if the queue had an entry.
+ */
+bool logqueue_peek(const log_queue *q, log_entry *entry) {
+    int next = logqueue_find_next(q);
+    if (next < 0) return false;
+    *entry = q->entries[next];
+    return true;
+}
+
+/**
+ * Removes the entry that is sent next.
+ *
+ * @param q     Pointer to the queue.
+ * @param entry Pointer to where the entry is copied, may be NULL.
+ * @return true if the queue had an entry.
+ */
+bool logqueue_pop(log_queue *q, log_entry *entry) {
+    int next = logqueue_find_next(q);
+    if (next < 0) return false;
+    if (entry) *entry = q->entries[next];
+    logqueue_remove(q, next);
+    return true;
+}
+
+bool logqueue_empty(const log_queue *q) {
+    return q->len == 0;
+}
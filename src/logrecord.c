@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logrecord.h"
+#include "logframe.h"
+#include "logHandling.h"
+
+#define CONTINUATION_BYTES (LOGRECORD_DATA_LEN - 1) // value stream bytes in a continuation slot
+#define VARINT_MAX_LEN 5
+#define STREAM_MAX_LEN (1 + LOGRECORD_MAX_FIELDS * VARINT_MAX_LEN)
+
+// Message codes that carry values. Add new values at the end of a schema, so older readers still find theirs.
+static const logrecord_schema schemas[] = {
+    {LOG_PILL_DISPENSED,               1, {"drop_ms"}},
+    {LOG_PILL_ERROR,                   1, {"waited_ms"}},
+    {LOG_CALIBRATION_FINISHED,         3, {"steps", "edge_steps", "time_ms"}},
+    {LOG_CALIBRATION_RESUMED,          2, {"steps", "confidence"}},
+    {LOG_REMOTE_COMMAND,               1, {"opcode"}},
+    {LOG_REMOTE_COMMAND_REJECTED,      1, {"opcode"}},
+    {LOG_WATCHDOG_STALL_MAIN_LOOP,     1, {"state"}},
+    {LOG_WATCHDOG_STALL_SLEEP,         1, {"state"}},
+    {LOG_WATCHDOG_STALL_STATE_MACHINE, 1, {"state"}},
+    {LOG_WATCHDOG_STALL_EEPROM_WRITE,  1, {"state"}},
+    {LOG_WATCHDOG_STALL_EEPROM_READ,   1, {"state"}},
+    {LOG_WATCHDOG_STALL_LORA_WRITE,    1, {"state"}},
+    {LOG_WATCHDOG_STALL_LORA_READ,     1, {"state"}},
+    {LOG_WATCHDOG_STALL_LOG_DUMP,      1, {"state"}},
+    {LOG_BOOTFINISHED,                 2, {"boot", "synced"}},
+    {LOG_TIME_SYNCED,                  3, {"jump_s", "offset_s", "synced"}},
+};
+
+uint16_t crc16(const uint8_t *data, size_t length)
+{
+    uint8_t x;
+    uint16_t crc = 0xFFFF;
+
+    while (length--)
+    {
+        x = crc >> 8 ^ *data++;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x << 5)) ^ ((uint16_t)x);
+    }
+
+    return crc;
+}
+
+static inline uint32_t logrecord_zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t logrecord_unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/**
+ * Calculates the CRC of a continuation slot, chained to the slot before it.
+ *
+ * @param prev Pointer to the previous slot.
+ * @param slot Pointer to the slot.
+ * @param len  LOGRECORD_DATA_LEN to calculate the CRC, LOGRECORD_SLOT_LEN to check it.
+ * @return The CRC, 0 when checking a slot with a matching CRC.
+ */
+static uint16_t logrecord_chain_crc(const uint8_t *prev, const uint8_t *slot, size_t len) {
+    uint8_t buf[2 + LOGRECORD_SLOT_LEN];
+    buf[0] = prev[LOGRECORD_DATA_LEN];
+    buf[1] = prev[LOGRECORD_DATA_LEN + 1];
+    memcpy(buf + 2, slot, len);
+    return crc16(buf, 2 + len);
+}
+
+/**
+ * Stores a CRC at the end of a slot, most significant byte first.
+ *
+ * @param slot Pointer to the slot.
+ * @param crc  CRC of the slot.
+ */
+static void logrecord_put_crc(uint8_t *slot, uint16_t crc) {
+    slot[LOGRECORD_DATA_LEN] = crc >> 8;
+    slot[LOGRECORD_DATA_LEN + 1] = crc & 0xFF;
+}
+
+/**
+ * Encodes a record into slots.
+ *
+ * @param r     Pointer to the record, values past LOGRECORD_MAX_FIELDS are left out. A since_boot record is stored in
+ *              ms, the way older firmware did.
+ * @param slots Pointer to room for LOGRECORD_MAX_SLOTS slots.
+ * @return Number of slots used, 1 for a record without values.
+ */
+int logrecord_encode(const logrecord *r, uint8_t *slots) {
+    uint8_t count = r->field_count < LOGRECORD_MAX_FIELDS ? r->field_count : LOGRECORD_MAX_FIELDS;
+    slots[0] = LOGRECORD_IN_USE | (uint8_t)(r->location << LOGRECORD_LOCATION_SHIFT);
+    slots[1] = (r->code & LOGRECORD_CODE_MASK) | (r->since_boot ? 0 : LOGRECORD_DEVICE_TIME) |
+               (count > 0 ? LOGRECORD_HAS_FIELDS : 0);
+    uint32_t timestamp = r->since_boot ? r->time_s * 1000 : r->time_s;
+    for (int i = 0; i < 4; i++) slots[2 + i] = (uint8_t)(timestamp >> (8 * (3 - i)));
+    logrecord_put_crc(slots, crc16(slots, LOGRECORD_DATA_LEN));
+    if (count == 0) return 1;
+
+    uint8_t stream[STREAM_MAX_LEN];
+    int len = 1;
+    for (uint8_t f = 0; f < count; f++) len += logframe_put_varint(stream + len, logrecord_zigzag(r->fields[f]));
+    stream[0] = (uint8_t)(len - 1);
+
+    int n = 1;
+    for (int pos = 0; pos < len; pos += CONTINUATION_BYTES, n++) {
+        uint8_t *slot = slots + n * LOGRECORD_SLOT_LEN;
+        int chunk = len - pos < CONTINUATION_BYTES ? len - pos : CONTINUATION_BYTES;
+        slot[0] = LOGRECORD_CONTINUATION;
+        memset(slot + 1, 0, CONTINUATION_BYTES);
+        memcpy(slot + 1, stream + pos, chunk);
+        logrecord_put_crc(slot, logrecord_chain_crc(slot - LOGRECORD_SLOT_LEN, slot, LOGRECORD_DATA_LEN));
+    }
+    return n;
+}
+
+/**
+ * Decodes a record from slots. A record whose values are missing or corrupted is decoded without them, its
+ * continuation slots are left for the caller to skip.
+ *
+ * @param slots Pointer to the slots, starting with the head slot.
+ * @param count Number of slots, LOGRECORD_MAX_SLOTS is enough for any record.
+ * @param r     Pointer to where the record is stored.
+ * @return Number of slots the record takes, 0 if the first slot isn't a head slot in use with a matching CRC.
+ */
+int logrecord_decode(const uint8_t *slots, int count, logrecord *r) {
+    if (count < 1 || (slots[0] & LOGRECORD_IN_USE) == 0 || crc16(slots, LOGRECORD_SLOT_LEN) != 0) return 0;
+    r->location = slots[0] >> LOGRECORD_LOCATION_SHIFT;
+    r->code = slots[1] & LOGRECORD_CODE_MASK;
+    uint32_t timestamp = (uint32_t)slots[2] << 24 | (uint32_t)slots[3] << 16 | (uint32_t)slots[4] << 8 | slots[5];
+    r->since_boot = (slots[1] & LOGRECORD_DEVICE_TIME) == 0;
+    r->time_s = r->since_boot ? timestamp / 1000 : timestamp;
+    r->field_count = 0;
+    if ((slots[1] & LOGRECORD_HAS_FIELDS) == 0) return 1;
+
+    uint8_t stream[(LOGRECORD_MAX_SLOTS - 1) * CONTINUATION_BYTES];
+    int len = 0;
+    int need = -1; // stream bytes of the record, known from the first continuation
+    int n = 1;
+    while (n < count && n < LOGRECORD_MAX_SLOTS && (need < 0 || len < need)) {
+        const uint8_t *slot = slots + n * LOGRECORD_SLOT_LEN;
+        if (!logrecord_is_continuation(slot) ||
+            logrecord_chain_crc(slot - LOGRECORD_SLOT_LEN, slot, LOGRECORD_SLOT_LEN) != 0) {
+            break;
+        }
+        memcpy(stream + len, slot + 1, CONTINUATION_BYTES);
+        len += CONTINUATION_BYTES;
+        if (need < 0) need = 1 + stream[0];
+        n++;
+    }
+    if (need < 0 || need > STREAM_MAX_LEN || len < need) return 1;
+
+    const uint8_t *p = stream + 1;
+    const uint8_t *end = stream + need;
+    while (p < end && r->field_count < LOGRECORD_MAX_FIELDS) {
+        uint32_t v;
+        int used = logframe_get_varint(p, end, &v);
+        if (used < 0) break;
+        r->fields[r->field_count++] = logrecord_unzigzag(v);
+        p += used;
+    }
+    return n;
+}
+
+/**
+ * Checks if a slot continues the record before it.
+ *
+ * @param slot Pointer to the slot.
+ * @return true for a continuation slot, its CRC isn't checked.
+ */
+bool logrecord_is_continuation(const uint8_t *slot) {
+    return slot[0] == LOGRECORD_CONTINUATION;
+}
+
+/**
+ * Gets the names of the values a message code carries.
+ *
+ * @param code Message code.
+ * @return Pointer to the schema, NULL if the code carries no values.
+ */
+const logrecord_schema *logrecord_schema_for(uint8_t code) {
+    for (size_t i = 0; i < sizeof(schemas) / sizeof(schemas[0]); i++) {
+        if (schemas[i].code == code) return &schemas[i];
+    }
+    return NULL;
+}
+
+/**
+ * Writes the values of a record as " name=value" pairs. Values the schema doesn't name, written by newer
+ * firmware, are written as "value<n>".
+ *
+ * @param dst  Pointer to the buffer for the text.
+ * @param size Size of the buffer.
+ * @param r    Pointer to the record.
+ * @return Length of the text, as snprintf(). 0 if the record has no values.
+ */
+int logrecord_format_fields(char *dst, size_t size, const logrecord *r) {
+    const logrecord_schema *schema = logrecord_schema_for(r->code);
+    int len = 0;
+    if (size > 0) dst[0] = '\0';
+    for (uint8_t f = 0; f < r->field_count; f++) {
+        char *at = (size_t)len < size ? dst + len : NULL; // only counts once the buffer is full
+        size_t room = at != NULL ? size - len : 0;
+        int n;
+        if (schema != NULL && f < schema->field_count) {
+            n = snprintf(at, room, " %s=%ld", schema->names[f], (long)r->fields[f]);
+        } else {
+            n = snprintf(at, room, " value%u=%ld", f, (long)r->fields[f]);
+        }
+        if (n < 0) return n;
+        len += n;
+    }
+    return len;
+}
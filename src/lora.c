@@ -1,17 +1,107 @@
 #include "hardware/uart.h"
+#include "hardware/irq.h"
 #include "pico/stdlib.h"
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
 #include "lora.h"
+#include "events.h"
+#include "profiler.h"
+#include "breadcrumb.h"
+#include "supervisor.h"
 
 #define MAX_TRIES 5
+#define RESPONSE_TIMEOUT_US 500000
+#define LORA_TRY_DEADLINE_MS 600 // one try of lora_write(), emptying the buffer and waiting for the response
+#define LORA_READ_DEADLINE_MS 300 // a full response line at 9600 baud with time to spare
 #define BAUDRATE 9600
 #define BUF_LEN 50
+#define LINE_LEN 160 // fits "+MSG: PORT: x; RX: \"...\"" with a full payload
+#define DOWNLINK_QUEUE_LEN 4 // must be a power of two
+#define DOWNLINK_QUEUE_MASK (DOWNLINK_QUEUE_LEN - 1)
 
 static uart_inst_t *uart_instance;
 static bool lora_available = false;
 
+static char line[LINE_LEN]; // modem output that hasn't ended in a newline yet
+static int line_len = 0;
+
+static lora_downlink downlinks[DOWNLINK_QUEUE_LEN];
+static uint8_t downlink_head = 0;
+static uint8_t downlink_tail = 0;
+
+/**
+ * Converts a hex digit to its value.
+ *
+ * @param c Character to convert.
+ * @return Value 0-15, or -1 if c is not a hex digit.
+ */
+static int lora_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Looks for a downlink in a line of modem output and queues it.
+ * Downlinks look like: +MSG: PORT: 1; RX: "0102AB"
+ *
+ * @param str Null-terminated line without the line ending.
+ */
+static void lora_parse_line(const char *str) {
+    if (strncmp(str, "+MSG: PORT: ", 12) != 0) return;
+    const char *rx = strstr(str, "RX: \"");
+    if (!rx) return;
+
+    uint8_t next = (downlink_head + 1) & DOWNLINK_QUEUE_MASK;
+    if (next == downlink_tail) {
+        printf("Downlink queue full, dropping downlink.\n");
+        return;
+    }
+
+    lora_downlink *dl = &downlinks[downlink_head];
+    dl->port = (uint8_t)atoi(str + 12);
+    dl->len = 0;
+    for (rx += 5; *rx != '"'; rx += 2) {
+        int hi = lora_hex_value(rx[0]);
+        int lo = (hi < 0) ? -1 : lora_hex_value(rx[1]);
+        if (lo < 0 || dl->len >= LORA_MAX_PAYLOAD) {
+            printf("Malformed downlink: %s\n", str);
+            return;
+        }
+        dl->data[dl->len++] = (uint8_t)((hi << 4) | lo);
+    }
+    downlink_head = next;
+}
+
+/**
+ * Collects modem output into lines and passes finished lines to the downlink parser.
+ *
+ * @param c Character received from the modem.
+ */
+static void lora_feed(char c) {
+    if (c == '\r' || c == '\n') {
+        if (line_len > 0) {
+            line[line_len] = '\0';
+            lora_parse_line(line);
+            line_len = 0;
+        }
+    } else if (line_len < LINE_LEN - 1) {
+        line[line_len++] = c;
+    }
+}
+
+/**
+ * UART receive interrupt. Only wakes the main loop, the data is read by lora_poll().
+ * The interrupt stays off until lora_poll() has drained the FIFO so it can't fire continuously.
+ */
+static void lora_uart_irq(void) {
+    uart_set_irq_enables(uart_instance, false, false);
+    events_post(EVENT_UART_RX, 0);
+}
+
 /**
  * Initializes LoRa communication on the specified UART with TX and RX pins.
  * Configures the LoRa module by sending a series of AT commands for setup.
@@ -28,6 +118,8 @@ bool lora_init(uart_inst_t *uart, uint TX_pin, uint RX_pin) {
 
     uart_init(uart, BAUDRATE);
     uart_instance = uart;
+    irq_set_exclusive_handler(uart == uart0 ? UART0_IRQ : UART1_IRQ, lora_uart_irq);
+    irq_set_enabled(uart == uart0 ? UART0_IRQ : UART1_IRQ, true);
 
     char buf[BUF_LEN]; // Buffer for LoRa responses
 
@@ -85,16 +177,86 @@ bool lora_message(const char *string) {
     return false;
 }
 
+/**
+ * Sends binary data via LoRa communication.
+ * Constructs and sends an AT command with the data as a hex payload.
+ *
+ * @param data Pointer to the data to be transmitted.
+ * @param len  Length of the data, at most LORA_MAX_PAYLOAD.
+ * @return true if the modem started sending, false otherwise.
+ */
+bool lora_message_hex(const uint8_t *data, int len) {
+    if (!lora_available || len > LORA_MAX_PAYLOAD) return false;
+
+    char new_str[LORA_MAX_PAYLOAD * 2 + 16]; // Buffer to construct the AT command
+    int pos = sprintf(new_str, "AT+MSGHEX=\""); // AT command header
+    for (int i = 0; i < len; i++) {
+        pos += sprintf(&new_str[pos], "%02X", data[i]);
+    }
+    strcpy(&new_str[pos], "\"\r\n"); // AT command termination
+
+    lora_write(new_str);
+    char buf[BUF_LEN];
+    lora_read_uart(buf, BUF_LEN);
+    printf("%s\n", buf);
+    return strcmp(buf, "+MSGHEX: Start") == 0;
+}
+
+/**
+ * Asks the modem which spreading factor it uses for uplinks.
+ * The modem answers with the data rate and then its details, for example "+DR: EU868 DR0 SF12 BW125K".
+ *
+ * @return Spreading factor 7 to 12, 0 if the modem didn't tell.
+ */
+int lora_get_spreading_factor(void) {
+    if (!lora_available || !lora_write("AT+DR\r\n")) return 0;
+    char buf[BUF_LEN];
+    for (int i = 0; i < 2; i++) {
+        lora_read_uart(buf, BUF_LEN);
+        char *sf = strstr(buf, "SF");
+        if (sf) {
+            int value = atoi(sf + 2);
+            return (value >= 7 && value <= 12) ? value : 0;
+        }
+    }
+    return 0;
+}
+
 /**
  * Empties the UART receive buffer for the LoRa communication.
- * Reads and discards any available data in the UART receive buffer.
- * Useful to clear out any residual data before initiating new LoRa operations.
+ * Reads all available data in the UART receive buffer so it doesn't get mixed with the next response.
+ * Downlinks in the data are still queued, everything else is discarded.
  */
 void lora_empty_buffer() {
-    // Continuously read and discard UART data while it's available within the specified time
+    // Continuously read UART data while it's available within the specified time
     while (uart_is_readable_within_us(uart_instance, 5000)) {
-        uart_getc(uart_instance); // Read and discard UART data
+        lora_feed(uart_getc(uart_instance));
+    }
+}
+
+/**
+ * Reads whatever the modem has sent without blocking and queues any downlinks.
+ * Call this from the main loop, it also re-arms the receive interrupt.
+ */
+void lora_poll(void) {
+    if (!uart_instance) return;
+    while (uart_is_readable(uart_instance)) {
+        lora_feed(uart_getc(uart_instance));
     }
+    uart_set_irq_enables(uart_instance, true, false);
+}
+
+/**
+ * Gets the oldest downlink received from the network.
+ *
+ * @param dl Pointer to where the downlink will be stored.
+ * @return true if a downlink was available, false otherwise.
+ */
+bool lora_get_downlink(lora_downlink *dl) {
+    if (downlink_tail == downlink_head) return false;
+    *dl = downlinks[downlink_tail];
+    downlink_tail = (downlink_tail + 1) & DOWNLINK_QUEUE_MASK;
+    return true;
 }
 
 /**
@@ -105,6 +267,9 @@ void lora_empty_buffer() {
  * @return The number of characters read and stored in the buffer.
  */
 int lora_read_uart(char *dst, int size) {
+    PROFILE_BEGIN(PROF_LORA_READ);
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_LORA_READ);
+    supervisor_start(TASK_LORA, LORA_READ_DEADLINE_MS);
     int read = 0;
     char c = 0;
 
@@ -117,8 +282,13 @@ int lora_read_uart(char *dst, int size) {
 
     // Replace carriage return with zero for string termination
     read -= 2; // Adjust for CR and actual terminator
+    if (read < 0) read = 0; // timed out without a full line
     dst[read] = '\0'; // Null-terminate the received string
+    lora_parse_line(dst); // the line we were waiting for might have been a downlink
     printf("Response received.\n"); // Log that a response was received
+    supervisor_stop(TASK_LORA);
+    breadcrumb_leave(before);
+    PROFILE_END(PROF_LORA_READ);
 
     return read; // Return the number of characters read and stored in the buffer
 }
@@ -130,9 +300,13 @@ int lora_read_uart(char *dst, int size) {
  * @return True if the write operation succeeds, false otherwise.
  */
 bool lora_write(char *string) {
+    PROFILE_BEGIN(PROF_LORA_WRITE);
+    breadcrumb_activity before = breadcrumb_enter(ACTIVITY_LORA_WRITE);
+    supervisor_start(TASK_LORA, LORA_TRY_DEADLINE_MS);
     lora_empty_buffer(); // Flush the UART buffer
 
     size_t size = strlen(string);
+    bool responded = false;
     for (int i = 0; i < MAX_TRIES; i++) {
         // Check if UART is ready for writing and perform write operation
         if (uart_is_writable(uart_instance)) {
@@ -140,15 +314,20 @@ bool lora_write(char *string) {
         }
 
         // Check for a response within the specified timeout
-        if (uart_is_readable_within_us(uart_instance, 500000)) {
-            return true; // Return true if a response is received
+        if (uart_is_readable_within_us(uart_instance, RESPONSE_TIMEOUT_US)) {
+            responded = true; // a response is received
+            break;
         } else if (i != 5) {
             printf("No response. Retrying...\n");
         }
+        supervisor_checkin(TASK_LORA);
     }
+    supervisor_stop(TASK_LORA);
+    breadcrumb_leave(before);
+    PROFILE_END(PROF_LORA_WRITE);
 
-    printf("Couldn't get a response.\n");
-    return false; // Return false if no response is received within the maximum attempts
+    if (!responded) printf("Couldn't get a response.\n");
+    return responded; // false if no response is received within the maximum attempts
 }
 
 /**
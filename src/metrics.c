@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "logframe.h"
+
+// Telemetry frame layout:
+//  0     METRICS_FRAME_TYPE
+//  1     number of counters
+//  2     number of histograms
+//  then  counters as varints
+//  then  per histogram: count and max as varints, p50 and p99 bucket one byte each
+
+#define METRICS_HEADER_LEN 3
+
+uint32_t metrics_counters[METRIC_COUNTER_COUNT];
+metric_hist metrics_histograms[METRIC_HISTOGRAM_COUNT];
+
+static const char *counter_names[METRIC_COUNTER_COUNT] = {
+    "i2c errors",
+    "lora sent",
+    "lora retries",
+    "log queue high water",
+    "flash log errors"
+};
+
+static const char *histogram_names[METRIC_HISTOGRAM_COUNT] = {
+    "main loop us",
+    "eeprom write us",
+    "lora latency ms",
+    "piezo latency us",
+    "calibration ms"
+};
+
+/**
+ * Finds the bucket a percentile of the observations falls in.
+ *
+ * @param h       Pointer to the histogram.
+ * @param percent Percentile 1-100.
+ * @return Bucket index, 0 if the histogram is empty.
+ */
+static uint8_t metrics_percentile_bucket(const metric_hist *h, uint32_t percent) {
+    uint64_t target = ((uint64_t)h->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= target && seen > 0) return (uint8_t)b;
+    }
+    return 0;
+}
+
+/**
+ * Clears all counters and histograms.
+ */
+void metrics_reset(void) {
+    memset(metrics_counters, 0, sizeof(metrics_counters));
+    memset(metrics_histograms, 0, sizeof(metrics_histograms));
+}
+
+/**
+ * Copies the counters and summarizes the histograms.
+ *
+ * @param s Pointer to where the snapshot is stored.
+ */
+void metrics_take_snapshot(metrics_snapshot *s) {
+    memcpy(s->counters, metrics_counters, sizeof(s->counters));
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        const metric_hist *h = &metrics_histograms[i];
+        s->histograms[i].count = h->count;
+        s->histograms[i].max = h->max;
+        s->histograms[i].p50_bucket = metrics_percentile_bucket(h, 50);
+        s->histograms[i].p99_bucket = metrics_percentile_bucket(h, 99);
+    }
+    s->counter_count = METRIC_COUNTER_COUNT;
+    s->histogram_count = METRIC_HISTOGRAM_COUNT;
+}
+
+/**
+ * Encodes a snapshot into a telemetry frame. Histograms that don't fit are left out.
+ *
+ * @param s       Pointer to the snapshot.
+ * @param frame   Pointer to the frame buffer.
+ * @param max_len Size of the frame buffer.
+ * @return Length of the frame, -1 if not even the counters fit.
+ */
+int metrics_encode(const metrics_snapshot *s, uint8_t *frame, int max_len) {
+    int len = METRICS_HEADER_LEN;
+    for (int i = 0; i < s->counter_count; i++) len += logframe_varint_len(s->counters[i]);
+    if (len > max_len) return -1;
+
+    frame[0] = METRICS_FRAME_TYPE;
+    frame[1] = s->counter_count;
+    len = METRICS_HEADER_LEN;
+    for (int i = 0; i < s->counter_count; i++) len += logframe_put_varint(&frame[len], s->counters[i]);
+
+    int h = 0;
+    for (; h < s->histogram_count; h++) {
+        const metric_summary *m = &s->histograms[h];
+        if (len + logframe_varint_len(m->count) + logframe_varint_len(m->max) + 2 > max_len) break;
+        len += logframe_put_varint(&frame[len], m->count);
+        len += logframe_put_varint(&frame[len], m->max);
+        frame[len++] = m->p50_bucket;
+        frame[len++] = m->p99_bucket;
+    }
+    frame[2] = (uint8_t)h;
+    return len;
+}
+
+/**
+ * Decodes a telemetry frame. Counters and histograms the frame doesn't have are zeroed.
+ *
+ * @param frame Pointer to the frame.
+ * @param len   Length of the frame.
+ * @param s     Pointer to where the snapshot is stored.
+ * @return true if the frame was a valid telemetry frame.
+ */
+bool metrics_decode(const uint8_t *frame, int len, metrics_snapshot *s) {
+    if (len < METRICS_HEADER_LEN || frame[0] != METRICS_FRAME_TYPE) return false;
+    memset(s, 0, sizeof(*s));
+    const uint8_t *p = frame + METRICS_HEADER_LEN;
+    const uint8_t *end = frame + len;
+    uint32_t v;
+    int n;
+
+    for (int i = 0; i < frame[1]; i++) {
+        if ((n = logframe_get_varint(p, end, &v)) < 0) return false;
+        p += n;
+        if (i < METRIC_COUNTER_COUNT) s->counters[i] = v; // newer firmware may send more, skip them
+    }
+    for (int i = 0; i < frame[2]; i++) {
+        metric_summary m;
+        if ((n = logframe_get_varint(p, end, &m.count)) < 0) return false;
+        p += n;
+        if ((n = logframe_get_varint(p, end, &m.max)) < 0) return false;
+        p += n;
+        if (p + 2 > end) return false;
+        m.p50_bucket = *p++;
+        m.p99_bucket = *p++;
+        if (i < METRIC_HISTOGRAM_COUNT) s->histograms[i] = m;
+    }
+    s->counter_count = (frame[1] < METRIC_COUNTER_COUNT) ? frame[1] : METRIC_COUNTER_COUNT;
+    s->histogram_count = (frame[2] < METRIC_HISTOGRAM_COUNT) ? frame[2] : METRIC_HISTOGRAM_COUNT;
+    return true;
+}
+
+/**
+ * Prints a snapshot. Percentiles are printed as the upper limit of their bucket.
+ *
+ * @param s Pointer to the snapshot.
+ */
+void metrics_print(const metrics_snapshot *s) {
+    for (int i = 0; i < s->counter_count; i++) {
+        printf("%s: %u\n", counter_names[i], (unsigned)s->counters[i]);
+    }
+    for (int i = 0; i < s->histogram_count; i++) {
+        const metric_summary *m = &s->histograms[i];
+        printf("%s: n=%u p50<=%u p99<=%u max=%u\n", histogram_names[i], (unsigned)m->count,
+               (unsigned)metrics_bucket_limit(m->p50_bucket), (unsigned)metrics_bucket_limit(m->p99_bucket), (unsigned)m->max);
+    }
+}
+
+/**
+ * Prints all counters and the full histograms, for the UART.
+ */
+void metrics_dump(void) {
+    metrics_snapshot s;
+    metrics_take_snapshot(&s);
+    metrics_print(&s);
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        const metric_hist *h = &metrics_histograms[i];
+        if (h->count == 0) continue;
+        printf("%s buckets:", histogram_names[i]);
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            if (h->buckets[b]) printf(" <=%u:%u", (unsigned)metrics_bucket_limit(b), (unsigned)h->buckets[b]);
+        }
+        printf("\n");
+    }
+}
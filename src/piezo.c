@@ -0,0 +1,216 @@
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+#include "piezo.h"
+#include "events.h"
+
+#define PIEZO_MIN_PULSE_US 100      // shorter pulses are motor vibration / electrical noise
+#define PIEZO_MAX_PULSE_US 20000    // longer pulses mean the line is stuck, not a hit
+#define PIEZO_BURST_GAP_US 30000    // pulses closer than this belong to the same hit (pill bouncing)
+#define PIEZO_MIN_BURST_PULSES 1    // qualified pulses needed before a burst counts as a drop
+
+#define PIEZO_QUEUE_LEN 8 // must be a power of two
+#define PIEZO_QUEUE_MASK (PIEZO_QUEUE_LEN - 1)
+
+// state of one sensor, the interrupt handler finds it by pin
+typedef struct piezo_sensor {
+    uint pin;
+
+    // pulse currently being measured
+    bool pulse_low;
+    uint32_t pulse_start_us;
+
+    // burst currently being collected
+    bool burst_open;
+    uint32_t burst_last_us;
+    piezo_event burst;
+
+    // qualified drops waiting for the main loop
+    piezo_event queue[PIEZO_QUEUE_LEN];
+    volatile uint8_t queue_head;
+    volatile uint8_t queue_tail;
+} piezo_sensor;
+
+static piezo_sensor sensors[PIEZO_MAX_SENSORS];
+static uint8_t sensor_count = 0;
+static uint32_t sensor_pin_mask = 0;
+
+static volatile uint32_t rejected_count = 0;
+static volatile uint32_t overflow_count = 0;
+
+/**
+ * Closes the burst being collected and pushes it to the drop queue if it had enough qualified pulses.
+ * Must be called with the piezo interrupt masked or from the interrupt itself.
+ *
+ * @param s Pointer to the sensor.
+ */
+static void piezo_close_burst(piezo_sensor *s) {
+    if (!s->burst_open) return;
+    s->burst_open = false;
+    if (s->burst.pulses < PIEZO_MIN_BURST_PULSES) {
+        rejected_count++;
+        return;
+    }
+    uint8_t next = (s->queue_head + 1) & PIEZO_QUEUE_MASK;
+    if (next == s->queue_tail) { // queue full, keep the oldest drops
+        overflow_count++;
+        return;
+    }
+    s->queue[s->queue_head] = s->burst;
+    s->queue_head = next;
+}
+
+/**
+ * Qualifies a finished pulse by its width and adds it to the current burst or starts a new one.
+ *
+ * @param s      Pointer to the sensor.
+ * @param now_us Timestamp of the rising edge that ended the pulse.
+ */
+static void piezo_pulse_end(piezo_sensor *s, uint32_t now_us) {
+    uint32_t width = now_us - s->pulse_start_us;
+    s->pulse_low = false;
+
+    if (width < PIEZO_MIN_PULSE_US || width > PIEZO_MAX_PULSE_US) {
+        rejected_count++; // vibration glitch or stuck line
+        return;
+    }
+
+    if (s->burst_open && (s->pulse_start_us - s->burst_last_us) > PIEZO_BURST_GAP_US) {
+        piezo_close_burst(s); // previous burst is over, this pulse is a new hit
+    }
+
+    if (!s->burst_open) {
+        s->burst_open = true;
+        s->burst.timestamp_us = s->pulse_start_us;
+        s->burst.width_us = 0;
+        s->burst.pulses = 0;
+        events_post(EVENT_PIEZO, s->pulse_start_us); // wake the main loop so it can collect the drop
+    }
+    if (s->burst.pulses < UINT8_MAX) s->burst.pulses++;
+    if (width > s->burst.width_us) s->burst.width_us = width;
+    s->burst_last_us = now_us;
+}
+
+/**
+ * Measures the pulse edges of one sensor.
+ *
+ * @param s      Pointer to the sensor.
+ * @param mask   Edges seen on the sensor's pin.
+ * @param now_us Time of the interrupt.
+ */
+static void piezo_edges(piezo_sensor *s, uint32_t mask, uint32_t now_us) {
+    if (mask & GPIO_IRQ_EDGE_RISE) {
+        if (s->pulse_low) {
+            piezo_pulse_end(s, now_us);
+        } else {
+            rejected_count++; // pulse was too short to see the falling edge on its own
+        }
+    }
+    if (mask & GPIO_IRQ_EDGE_FALL) {
+        if (!gpio_get(s->pin)) { // only start a pulse if the line is still low
+            s->pulse_low = true;
+            s->pulse_start_us = now_us;
+        } else {
+            rejected_count++;
+        }
+    }
+}
+
+/**
+ * Raw GPIO interrupt handler shared by the piezo sensors. Timestamps both edges so pulse width can be measured.
+ */
+static void piezo_handler(void) {
+    uint32_t now = time_us_32();
+    for (int i = 0; i < sensor_count; i++) {
+        piezo_sensor *s = &sensors[i];
+        uint32_t mask = gpio_get_irq_event_mask(s->pin) & (GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE);
+        if (!mask) continue; // not this sensor
+        gpio_acknowledge_irq(s->pin, mask);
+        piezo_edges(s, mask, now);
+    }
+}
+
+/**
+ * Initializes a piezo sensor pin and the edge interrupts used to measure pulse widths. Sensors are numbered in the
+ * order they are initialized.
+ *
+ * @param pin GPIO pin connected to the piezo sensor.
+ * @return Sensor number for the other calls, PIEZO_NO_SENSOR if PIEZO_MAX_SENSORS are already in use.
+ */
+uint8_t piezo_init(uint pin) {
+    if (sensor_count >= PIEZO_MAX_SENSORS) return PIEZO_NO_SENSOR;
+    uint8_t sensor = sensor_count;
+    piezo_sensor *s = &sensors[sensor];
+    s->pin = pin;
+    gpio_init(pin); // enabled, func set, dir in.
+    gpio_pull_up(pin); // pull up
+
+    // raw handler since we dont want this debounced, one handler for all the sensors' pins
+    if (sensor_pin_mask) gpio_remove_raw_irq_handler_masked(sensor_pin_mask, piezo_handler);
+    sensor_pin_mask |= 1u << pin;
+    sensor_count++;
+    gpio_add_raw_irq_handler_masked(sensor_pin_mask, piezo_handler);
+    gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true); // both edges for pulse width
+    if (!irq_is_enabled(IO_IRQ_BANK0)) irq_set_enabled(IO_IRQ_BANK0, true);
+    return sensor;
+}
+
+/**
+ * Discards all queued drops, any burst that is still being collected and a pulse that is still low, whose end
+ * would otherwise keep a stale burst from being reported. Call this right before the movement whose drop should be detected.
+ *
+ * @param sensor Sensor number from piezo_init().
+ */
+void piezo_flush(uint8_t sensor) {
+    if (sensor >= sensor_count) return;
+    piezo_sensor *s = &sensors[sensor];
+    uint32_t status = save_and_disable_interrupts();
+    s->burst_open = false;
+    s->pulse_low = false;
+    s->queue_tail = s->queue_head;
+    restore_interrupts(status);
+}
+
+/**
+ * Gets the oldest qualified drop. A burst is only reported once it has been quiet for the burst gap,
+ * so a bouncing pill produces one drop.
+ *
+ * @param sensor Sensor number from piezo_init().
+ * @param event  Pointer to where the drop will be stored.
+ * @return true if a drop was available, false otherwise.
+ */
+bool piezo_get_drop(uint8_t sensor, piezo_event *event) {
+    if (sensor >= sensor_count) return false;
+    piezo_sensor *s = &sensors[sensor];
+    uint32_t status = save_and_disable_interrupts();
+    if (s->burst_open && !s->pulse_low && (time_us_32() - s->burst_last_us) > PIEZO_BURST_GAP_US) {
+        piezo_close_burst(s);
+    }
+    bool available = s->queue_tail != s->queue_head;
+    if (available) {
+        *event = s->queue[s->queue_tail];
+        s->queue_tail = (s->queue_tail + 1) & PIEZO_QUEUE_MASK;
+    }
+    restore_interrupts(status);
+    return available;
+}
+
+/**
+ * Gets the number of pulses and bursts that did not qualify as a drop, on all sensors.
+ *
+ * @return Rejected pulse count since boot.
+ */
+uint32_t piezo_get_rejected_count(void) {
+    return rejected_count;
+}
+
+/**
+ * Gets the number of qualified drops lost because a sensor's queue was full.
+ *
+ * @return Overflow count since boot.
+ */
+uint32_t piezo_get_overflow_count(void) {
+    return overflow_count;
+}
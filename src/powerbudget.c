@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "powerbudget.h"
+
+/**
+ * Finds a motor in the waiting line.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param motor Motor number.
+ * @return Place in line, 0 is next, -1 if the motor isn't waiting.
+ */
+static int powerbudget_find(const power_budget *pb, uint8_t motor) {
+    for (int i = 0; i < pb->queued; i++) {
+        if (pb->queue[i] == motor) return i;
+    }
+    return -1;
+}
+
+/**
+ * Takes a motor out of the waiting line.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param index Place in line of the motor.
+ */
+static void powerbudget_dequeue(power_budget *pb, int index) {
+    memmove(&pb->queue[index], &pb->queue[index + 1], pb->queued - index - 1);
+    pb->queued--;
+}
+
+/**
+ * Initializes a power budget with no motors running.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param slots Number of motors allowed to run at once.
+ */
+void powerbudget_init(power_budget *pb, uint8_t slots) {
+    memset(pb, 0, sizeof(*pb));
+    pb->slots = slots;
+}
+
+/**
+ * Asks for a slot for a motor. A motor that doesn't get one is put in line and has to ask again later, it gets
+ * a slot once every motor ahead of it in line has one.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param motor Motor number, below POWERBUDGET_MAX_MOTORS.
+ * @return true if the motor holds a slot and may be started.
+ */
+bool powerbudget_acquire(power_budget *pb, uint8_t motor) {
+    if (motor >= POWERBUDGET_MAX_MOTORS) return false;
+    if (powerbudget_holds(pb, motor)) return true;
+
+    int index = powerbudget_find(pb, motor);
+    if (index < 0) {
+        index = pb->queued;
+        pb->queue[pb->queued++] = motor;
+    }
+    if (index >= pb->slots - powerbudget_running(pb)) return false; // motors ahead in line take the free slots
+
+    powerbudget_dequeue(pb, index);
+    pb->holders |= 1u << motor;
+    return true;
+}
+
+/**
+ * Gives back the slot of a stopped motor, or takes it out of line if it no longer wants one.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param motor Motor number.
+ * @return true if a slot was freed while other motors wait, they should ask again right away.
+ */
+bool powerbudget_release(power_budget *pb, uint8_t motor) {
+    if (motor >= POWERBUDGET_MAX_MOTORS) return false;
+    int index = powerbudget_find(pb, motor);
+    if (index >= 0) powerbudget_dequeue(pb, index);
+    if (!powerbudget_holds(pb, motor)) return false;
+    pb->holders &= ~(1u << motor);
+    return pb->queued > 0;
+}
+
+/**
+ * Checks if a motor holds a slot.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param motor Motor number.
+ * @return true if the motor may run.
+ */
+bool powerbudget_holds(const power_budget *pb, uint8_t motor) {
+    return motor < POWERBUDGET_MAX_MOTORS && (pb->holders & (1u << motor));
+}
+
+/**
+ * Checks if a motor is waiting in line for a slot.
+ *
+ * @param pb    Pointer to the power budget.
+ * @param motor Motor number.
+ * @return true if the motor asked and hasn't got a slot yet.
+ */
+bool powerbudget_is_waiting(const power_budget *pb, uint8_t motor) {
+    return powerbudget_find(pb, motor) >= 0;
+}
+
+/**
+ * Gets the number of motors holding a slot.
+ *
+ * @param pb Pointer to the power budget.
+ * @return Slots in use.
+ */
+uint8_t powerbudget_running(const power_budget *pb) {
+    uint8_t count = 0;
+    for (uint8_t bits = pb->holders; bits; bits &= bits - 1) count++;
+    return count;
+}
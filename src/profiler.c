@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "profiler.h"
+
+// Durations go to buckets with 4 steps per power of two, so percentiles are within 25 %.
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define PROFILER_BUCKETS (32 * SUB_BUCKETS)
+
+typedef struct profile_stats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint16_t buckets[PROFILER_BUCKETS]; // saturate at UINT16_MAX
+} profile_stats;
+
+static profiler_clock clock_us = NULL;
+static profile_stats stats[PROF_SECTION_COUNT];
+
+static const char *section_names[PROF_SECTION_COUNT] = {
+    "loop",
+    "events",
+    "downlinks",
+    "lora send",
+    "state machine",
+    "log write",
+    "eeprom wait",
+    "lora write",
+    "lora read"
+};
+
+/**
+ * Gets the bucket of a duration. Values below SUB_BUCKETS get a bucket each, above that the power of two
+ * and the next SUB_BITS bits pick the bucket.
+ *
+ * @param v Duration in microseconds.
+ * @return Bucket index.
+ */
+static int profiler_bucket(uint32_t v) {
+    if (v < SUB_BUCKETS) return (int)v;
+    int msb = 31 - __builtin_clz(v);
+    int sub = (v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/**
+ * Gets the largest duration that falls in a bucket.
+ *
+ * @param b Bucket index.
+ * @return Upper limit in microseconds.
+ */
+static uint32_t profiler_bucket_limit(int b) {
+    if (b < SUB_BUCKETS) return (uint32_t)b;
+    int msb = b / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t base = (uint64_t)1 << msb;
+    uint64_t step = base >> SUB_BITS;
+    uint64_t limit = base + step * (uint64_t)(b % SUB_BUCKETS + 1) - 1;
+    return (limit > UINT32_MAX) ? UINT32_MAX : (uint32_t)limit;
+}
+
+/**
+ * Starts the profiler and clears all sections.
+ *
+ * @param clock Function returning a free running microsecond counter.
+ */
+void profiler_init(profiler_clock clock) {
+    clock_us = clock;
+    profiler_reset();
+}
+
+uint32_t profiler_now_us(void) {
+    return clock_us ? clock_us() : 0;
+}
+
+/**
+ * Adds one run of a section.
+ *
+ * @param section     The section.
+ * @param duration_us How long the run took.
+ */
+void profiler_record(profiler_section section, uint32_t duration_us) {
+    if (!clock_us) return;
+    profile_stats *s = &stats[section];
+    if (s->count == 0 || duration_us < s->min) s->min = duration_us;
+    if (duration_us > s->max) s->max = duration_us;
+    s->count++;
+    s->total += duration_us;
+    uint16_t *bucket = &s->buckets[profiler_bucket(duration_us)];
+    if (*bucket < UINT16_MAX) (*bucket)++;
+}
+
+/**
+ * Estimates a percentile of a section's durations.
+ *
+ * @param section The section.
+ * @param percent Percentile 1-100.
+ * @return Upper limit of the bucket the percentile falls in, capped at the real maximum. 0 if the section never ran.
+ */
+uint32_t profiler_percentile_us(profiler_section section, uint32_t percent) {
+    const profile_stats *s = &stats[section];
+    uint64_t samples = 0;
+    for (int b = 0; b < PROFILER_BUCKETS; b++) samples += s->buckets[b];
+    if (samples == 0) return 0;
+
+    uint64_t target = (samples * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < PROFILER_BUCKETS; b++) {
+        seen += s->buckets[b];
+        if (seen >= target) {
+            uint32_t limit = profiler_bucket_limit(b);
+            return (limit < s->max) ? limit : s->max;
+        }
+    }
+    return s->max;
+}
+
+void profiler_reset(void) {
+    memset(stats, 0, sizeof(stats));
+}
+
+/**
+ * Prints a table of all sections that have run.
+ */
+void profiler_dump(void) {
+    printf("%-14s %8s %8s %8s %8s %8s  (us)\n", "section", "count", "min", "avg", "max", "p99");
+    for (int i = 0; i < PROF_SECTION_COUNT; i++) {
+        const profile_stats *s = &stats[i];
+        if (s->count == 0) continue;
+        printf("%-14s %8u %8u %8u %8u %8u\n", section_names[i], (unsigned)s->count, (unsigned)s->min,
+               (unsigned)(s->total / s->count), (unsigned)s->max, (unsigned)profiler_percentile_us(i, 99));
+    }
+}
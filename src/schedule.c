@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "schedule.h"
+#include "eeprom.h"
+#include "logHandling.h"
+#include "wallclock.h"
+
+#define SCHEDULE_ADDR 2112          // first 64 byte page after the dispenser status record
+#define SCHEDULE_ENTRY_LEN 3        // minute of day (2 bytes, LSB first) + pills
+#define SCHEDULE_LEN (1 + SCHEDULE_MAX_DOSES * SCHEDULE_ENTRY_LEN) // count + entries, does not include CRC
+#define SCHEDULE_ARR_LEN (SCHEDULE_LEN + 2)                         // includes CRC
+
+#define MINUTES_PER_DAY 1440
+#define SCHEDULE_LATE_LIMIT_S (2 * 3600)           // a dose this late is still dispensed, older ones are missed
+#define SCHEDULE_CATCH_UP_WINDOW_S SECONDS_PER_DAY // how far back missed doses are counted after a reboot
+
+#define NOT_PLANNED 0
+
+static dose doses[SCHEDULE_MAX_DOSES]; // sorted by minute of day
+static uint8_t dose_count = 0;
+static uint32_t last_dose_time_s = 0;
+static uint32_t next_due_s = NOT_PLANNED;
+static uint8_t next_due_index = 0;
+static uint8_t missed = 0;
+
+/**
+ * Finds the first dose time strictly after the given time.
+ *
+ * @param after_s Unix time to search from.
+ * @param index   Pointer to where the index of the found dose is stored.
+ * @return Unix time of the dose.
+ */
+static uint32_t schedule_next_after(uint32_t after_s, uint8_t *index) {
+    uint32_t day_start = after_s - (after_s % SECONDS_PER_DAY);
+    for (uint8_t i = 0; i < dose_count; i++) {
+        uint32_t t = day_start + doses[i].minute_of_day * 60u;
+        if (t > after_s) {
+            *index = i;
+            return t;
+        }
+    }
+    *index = 0;
+    return day_start + SECONDS_PER_DAY + doses[0].minute_of_day * 60u; // first dose tomorrow
+}
+
+/**
+ * Counts the planned dose as missed, and the ones after it, while they are more than the late limit in the past.
+ * A dose that waited for busy carousels isn't dispensed hours late then. The missed doses count as the last dose, so
+ * they aren't counted again by the next plan.
+ *
+ * @param now_s Current unix time.
+ */
+static void schedule_skip_late(uint32_t now_s) {
+    while (next_due_s + SCHEDULE_LATE_LIMIT_S < now_s) {
+        if (missed < UINT8_MAX) missed++;
+        last_dose_time_s = next_due_s;
+        next_due_s = schedule_next_after(next_due_s, &next_due_index);
+    }
+}
+
+/**
+ * Works out the next dose to dispense. Doses since the last one that are more than the late limit in the past are
+ * counted as missed, the newest dose inside the late limit is still dispensed.
+ *
+ * @param now_s Current unix time.
+ */
+static void schedule_plan(uint32_t now_s) {
+    uint32_t from = last_dose_time_s;
+    if (now_s > SCHEDULE_CATCH_UP_WINDOW_S && from < now_s - SCHEDULE_CATCH_UP_WINDOW_S) {
+        from = now_s - SCHEDULE_CATCH_UP_WINDOW_S; // don't walk back to 1970 after a factory reset
+    }
+    next_due_s = schedule_next_after(from, &next_due_index);
+    schedule_skip_late(now_s);
+}
+
+/**
+ * Writes the schedule table to EEPROM with a CRC.
+ */
+static void schedule_store(void) {
+    uint8_t array[SCHEDULE_ARR_LEN];
+    memset(array, 0, sizeof(array));
+    array[0] = dose_count;
+    for (int i = 0; i < dose_count; i++) {
+        uint8_t *entry = &array[1 + i * SCHEDULE_ENTRY_LEN];
+        entry[0] = (uint8_t)(doses[i].minute_of_day & 0xFF);
+        entry[1] = (uint8_t)(doses[i].minute_of_day >> 8);
+        entry[2] = doses[i].pills;
+    }
+    int len = SCHEDULE_LEN;
+    enterLogToEeprom(array, &len, SCHEDULE_ADDR);
+}
+
+/**
+ * Reads the schedule table from EEPROM. An invalid table is treated as an empty schedule.
+ *
+ * @return true if a valid table was read.
+ */
+static bool schedule_load(void) {
+    uint8_t array[SCHEDULE_ARR_LEN];
+    eeprom_read_page(SCHEDULE_ADDR, array, SCHEDULE_ARR_LEN);
+    int len = SCHEDULE_ARR_LEN;
+    dose_count = 0;
+    if (!verifyDataIntegrity(array, &len) || array[0] > SCHEDULE_MAX_DOSES) return false;
+    for (int i = 0; i < array[0]; i++) {
+        const uint8_t *entry = &array[1 + i * SCHEDULE_ENTRY_LEN];
+        doses[i].minute_of_day = (uint16_t)(entry[0] | (entry[1] << 8));
+        doses[i].pills = entry[2];
+    }
+    dose_count = array[0];
+    return true;
+}
+
+/**
+ * Loads the persisted schedule. The last dose time comes from the dispenser status record so doses missed while
+ * the device was off can be detected once the clock is valid.
+ *
+ * @param last_dose_s Unix time the last scheduled dose was started, 0 if unknown.
+ */
+void schedule_init(uint32_t last_dose_s) {
+    last_dose_time_s = last_dose_s;
+    next_due_s = NOT_PLANNED;
+    missed = 0;
+    if (!schedule_load()) printf("No valid dosing schedule in EEPROM.\n");
+}
+
+/**
+ * Replaces the schedule and stores it in EEPROM. Entries are sorted by time of day. Doses earlier than now are not
+ * counted as missed. The caller stores now as the last dose time in the dispenser status, so they aren't counted
+ * after a reboot either.
+ *
+ * @param src   Pointer to the new doses.
+ * @param count Number of doses, at most SCHEDULE_MAX_DOSES. 0 disables scheduled dosing.
+ * @param now_s Current unix time, 0 if the clock is not valid.
+ * @return true if the schedule was valid and stored.
+ */
+bool schedule_set(const dose *src, uint8_t count, uint32_t now_s) {
+    if (count > SCHEDULE_MAX_DOSES) return false;
+    for (int i = 0; i < count; i++) {
+        if (src[i].minute_of_day >= MINUTES_PER_DAY || src[i].pills == 0) return false;
+    }
+    // insertion sort, the table is tiny
+    for (int i = 0; i < count; i++) {
+        dose d = src[i];
+        int j = i;
+        while (j > 0 && doses[j - 1].minute_of_day > d.minute_of_day) {
+            doses[j] = doses[j - 1];
+            j--;
+        }
+        doses[j] = d;
+    }
+    dose_count = count;
+    if (now_s > last_dose_time_s) last_dose_time_s = now_s;
+    schedule_store();
+    schedule_replan();
+    return true;
+}
+
+/**
+ * Copies the current schedule.
+ *
+ * @param dst Pointer to room for SCHEDULE_MAX_DOSES doses.
+ * @return Number of doses copied.
+ */
+uint8_t schedule_get(dose *dst) {
+    memcpy(dst, doses, dose_count * sizeof(dose));
+    return dose_count;
+}
+
+/**
+ * Forgets the planned dose so it is worked out again on the next check. Call after the clock was set.
+ */
+void schedule_replan(void) {
+    next_due_s = NOT_PLANNED;
+}
+
+/**
+ * Checks if a scheduled dose is due. A due dose that is past the late limit because it couldn't be started is
+ * counted as missed, see schedule_take_missed(), and the next one is planned. Only compares against the planned
+ * time, so it is cheap enough to call on every loop.
+ *
+ * @param now_s Current unix time, 0 if the clock is not valid.
+ * @return true if a dose should be dispensed now.
+ */
+bool schedule_dose_due(uint32_t now_s) {
+    if (dose_count == 0 || now_s == 0) return false;
+    if (next_due_s == NOT_PLANNED) {
+        schedule_plan(now_s);
+    } else {
+        schedule_skip_late(now_s);
+    }
+    return now_s >= next_due_s;
+}
+
+/**
+ * Gets the number of pills in the dose that is due.
+ *
+ * @return Pills to dispense.
+ */
+uint8_t schedule_due_pills(void) {
+    return doses[next_due_index].pills;
+}
+
+/**
+ * Marks the due dose as started and plans the next one.
+ *
+ * @param now_s Current unix time.
+ */
+void schedule_dose_started(uint32_t now_s) {
+    last_dose_time_s = now_s;
+    next_due_s = schedule_next_after(now_s, &next_due_index);
+}
+
+/**
+ * Gets and clears the number of doses found missed since the last call. Store schedule_last_dose_s() after missed
+ * doses, so they aren't counted again after a reboot.
+ *
+ * @return Missed dose count.
+ */
+uint8_t schedule_take_missed(void) {
+    uint8_t n = missed;
+    missed = 0;
+    return n;
+}
+
+/**
+ * Gets the time of the last dose that was started or counted as missed.
+ *
+ * @return Unix time, 0 if unknown.
+ */
+uint32_t schedule_last_dose_s(void) {
+    return last_dose_time_s;
+}
+
+/**
+ * Calculates how long the main loop can sleep before the next dose is due. A dose that is due waits for the
+ * carousels to be free, which wakes the loop by itself, so then it is the time until the dose is missed.
+ *
+ * @param now_s Current unix time, 0 if the clock is not valid.
+ * @return Milliseconds until the next dose or until the due one is missed, UINT32_MAX if there is nothing to wait
+ *         for.
+ */
+uint32_t schedule_ms_until_due(uint32_t now_s) {
+    if (dose_count == 0 || now_s == 0) return UINT32_MAX;
+    if (next_due_s == NOT_PLANNED) return 0;
+    uint32_t deadline = (now_s >= next_due_s) ? next_due_s + SCHEDULE_LATE_LIMIT_S + 1 : next_due_s;
+    uint32_t left = (deadline > now_s) ? deadline - now_s : 0;
+    return (left > UINT32_MAX / 1000) ? UINT32_MAX : left * 1000;
+}
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "statemachine.h"
+
+/**
+ * Gets the parent of a state from the state table.
+ *
+ * @param table Pointer to the state machine table.
+ * @param state State whose parent is wanted.
+ * @return Parent state id or SM_NO_PARENT.
+ */
+static inline sm_state_id statemachine_parent(const sm_table *table, sm_state_id state) {
+    return table->states[state].parent;
+}
+
+/**
+ * Gets how deep a state is nested.
+ *
+ * @param table Pointer to the state machine table.
+ * @param state State to check.
+ * @return 0 for a top level state, 1 for its children and so on.
+ */
+static uint8_t statemachine_depth(const sm_table *table, sm_state_id state) {
+    uint8_t depth = 0;
+    for (state = statemachine_parent(table, state); state != SM_NO_PARENT; state = statemachine_parent(table, state)) {
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Checks if a state is the same as or nested inside another state.
+ *
+ * @param table    Pointer to the state machine table.
+ * @param ancestor The possible ancestor.
+ * @param state    The state to check.
+ * @return true if state is ancestor or one of its children.
+ */
+static bool statemachine_is_in(const sm_table *table, sm_state_id ancestor, sm_state_id state) {
+    while (state != SM_NO_PARENT) {
+        if (state == ancestor) return true;
+        state = statemachine_parent(table, state);
+    }
+    return false;
+}
+
+/**
+ * Finds the innermost state that contains both states. A transition from a state to itself leaves and
+ * re-enters the state, so in that case the parent is returned.
+ *
+ * @param table Pointer to the state machine table.
+ * @param from  The state being left.
+ * @param to    The state being entered.
+ * @return Common ancestor state id or SM_NO_PARENT.
+ */
+static sm_state_id statemachine_common_ancestor(const sm_table *table, sm_state_id from, sm_state_id to) {
+    if (from == to) return statemachine_parent(table, from);
+    for (sm_state_id s = from; s != SM_NO_PARENT; s = statemachine_parent(table, s)) {
+        if (statemachine_is_in(table, s, to)) return s;
+    }
+    return SM_NO_PARENT;
+}
+
+/**
+ * Runs entry actions from just below the common ancestor down to the target state. The states entered get the time
+ * of the tick as their entry time, the common ancestor and its parents keep theirs.
+ *
+ * @param sm  Pointer to the state machine.
+ * @param lca Common ancestor that stays active.
+ * @param to  The state being entered.
+ */
+static void statemachine_enter(state_machine *sm, sm_state_id lca, sm_state_id to) {
+    sm_state_id chain[SM_MAX_DEPTH];
+    int depth = 0;
+    for (sm_state_id s = to; s != lca && s != SM_NO_PARENT && depth < SM_MAX_DEPTH; s = statemachine_parent(sm->table, s)) {
+        chain[depth++] = s;
+    }
+    sm->state = to;
+    sm->depth = statemachine_depth(sm->table, to);
+    for (int i = 0; i < depth; i++) {
+        if (sm->depth - i < SM_MAX_DEPTH) sm->entered_ms[sm->depth - i] = sm->time_ms;
+    }
+    while (depth--) { // outermost first
+        const sm_state *st = &sm->table->states[chain[depth]];
+        if (st->entry) st->entry(sm);
+    }
+}
+
+/**
+ * Runs exit actions from the current state up to, but not including, the common ancestor.
+ *
+ * @param sm  Pointer to the state machine.
+ * @param lca Common ancestor that stays active.
+ */
+static void statemachine_exit(state_machine *sm, sm_state_id lca) {
+    for (sm_state_id s = sm->state; s != lca && s != SM_NO_PARENT; s = statemachine_parent(sm->table, s)) {
+        const sm_state *st = &sm->table->states[s];
+        if (st->exit) st->exit(sm);
+    }
+}
+
+/**
+ * Gets the time spent in one of the states in the chain of the current state.
+ *
+ * @param sm    Pointer to the state machine.
+ * @param level Nesting level of the state, 0 for the top level one.
+ * @return Milliseconds since that state was entered, as of the last tick.
+ */
+static inline uint32_t statemachine_time_in_level(const state_machine *sm, int level) {
+    if (level < 0) level = 0;
+    if (level >= SM_MAX_DEPTH) level = SM_MAX_DEPTH - 1;
+    return sm->time_ms - sm->entered_ms[level];
+}
+
+/**
+ * Takes a transition: exit actions, transition action and entry actions in that order.
+ *
+ * @param sm     Pointer to the state machine.
+ * @param action Transition action, may be NULL.
+ * @param to     The state being entered.
+ */
+static void statemachine_take(state_machine *sm, sm_action action, sm_state_id to) {
+    sm_state_id lca = statemachine_common_ancestor(sm->table, sm->state, to);
+    statemachine_exit(sm, lca);
+    if (action) action(sm);
+    statemachine_enter(sm, lca, to);
+}
+
+/**
+ * Initializes a state machine and runs the entry actions of the initial state.
+ *
+ * @param sm      Pointer to the state machine to be initialized.
+ * @param table   Pointer to the constant state and transition tables.
+ * @param initial State to start in.
+ * @param ctx     Application data passed to actions and guards through sm->ctx.
+ * @param time_ms Current time in milliseconds.
+ */
+void statemachine_init(state_machine *sm, const sm_table *table, sm_state_id initial, void *ctx, uint32_t time_ms) {
+    sm->table = table;
+    sm->ctx = ctx;
+    sm->time_ms = time_ms;
+    sm->state = SM_NO_PARENT;
+    statemachine_enter(sm, SM_NO_PARENT, initial);
+}
+
+/**
+ * Runs one step of the state machine. Transitions of the current state are tried first, then those of its parents.
+ * The first transition whose timer has expired and whose guard returns true is taken. A timer runs from when its
+ * own state was entered, so a parent's timers aren't restarted by moves between its children. If no transition is
+ * taken the during actions of the state and its parents are run, outermost first.
+ *
+ * @param sm      Pointer to the state machine.
+ * @param time_ms Current time in milliseconds.
+ * @return true if a transition was taken.
+ */
+bool statemachine_tick(state_machine *sm, uint32_t time_ms) {
+    const sm_table *table = sm->table;
+    sm->time_ms = time_ms;
+
+    int level = sm->depth;
+    for (sm_state_id s = sm->state; s != SM_NO_PARENT; s = statemachine_parent(table, s), level--) {
+        uint32_t in_state = statemachine_time_in_level(sm, level);
+        for (int i = 0; i < table->transition_count; i++) {
+            const sm_transition *t = &table->transitions[i];
+            if (t->from != s) continue;
+            if (t->after_ms != SM_NO_TIMER && in_state < t->after_ms) continue;
+            if (t->guard && !t->guard(sm)) continue;
+            statemachine_take(sm, t->action, t->to);
+            return true;
+        }
+    }
+
+    sm_state_id chain[SM_MAX_DEPTH];
+    int depth = 0;
+    for (sm_state_id s = sm->state; s != SM_NO_PARENT && depth < SM_MAX_DEPTH; s = statemachine_parent(table, s)) {
+        chain[depth++] = s;
+    }
+    while (depth--) {
+        const sm_state *st = &table->states[chain[depth]];
+        if (st->during) st->during(sm);
+    }
+    return false;
+}
+
+/**
+ * Forces a transition to a state from outside the table, running exit and entry actions.
+ * Meant for events that don't come from the state machine itself, like remote commands.
+ *
+ * @param sm Pointer to the state machine.
+ * @param to The state to go to.
+ */
+void statemachine_goto(state_machine *sm, sm_state_id to) {
+    statemachine_take(sm, NULL, to);
+}
+
+/**
+ * Gets the time spent in the current state.
+ *
+ * @param sm Pointer to the state machine.
+ * @return Milliseconds since the current state was entered, as of the last tick.
+ */
+uint32_t statemachine_time_in_state(const state_machine *sm) {
+    return statemachine_time_in_level(sm, sm->depth);
+}
+
+/**
+ * Calculates how long until the next timed transition of the current state or its parents could be taken.
+ *
+ * @param sm Pointer to the state machine.
+ * @return Milliseconds until the nearest timer expires, 0 if one already has, UINT32_MAX if there are none.
+ */
+uint32_t statemachine_next_timer_ms(const state_machine *sm) {
+    const sm_table *table = sm->table;
+    uint32_t next = UINT32_MAX;
+
+    int level = sm->depth;
+    for (sm_state_id s = sm->state; s != SM_NO_PARENT; s = statemachine_parent(table, s), level--) {
+        uint32_t in_state = statemachine_time_in_level(sm, level);
+        for (int i = 0; i < table->transition_count; i++) {
+            const sm_transition *t = &table->transitions[i];
+            if (t->from != s || t->after_ms == SM_NO_TIMER) continue;
+            uint32_t left = (in_state >= t->after_ms) ? 0 : t->after_ms - in_state;
+            if (left < next) next = left;
+        }
+    }
+    return next;
+}
+
+/**
+ * Gets the name of the current state for printing.
+ *
+ * @param sm Pointer to the state machine.
+ * @return Name of the current state.
+ */
+const char *statemachine_state_name(const state_machine *sm) {
+    return sm->table->states[sm->state].name;
+}
@@ -15,15 +15,48 @@
 #define stepper_modulo(x, y) (_remainder(x, y) + _ternary(x, y))
 #define SYS_CLK_KHZ 125000 // this is defined in picosdk but this shit is broken and wont import it... asddas.sdgagk.... 
 
+#define STEPPER_PHASES 8
+#define STEPPER_PHASE_LEN 2 // instructions per phase in stepper.pio
+#define STEPPER_PIO_COUNT 2
+
+// the program is loaded once per PIO and shared by all motors on it
+static bool program_loaded[STEPPER_PIO_COUNT] = {false, false};
+static uint program_offsets[STEPPER_PIO_COUNT];
+
+// motors the opto fork interrupt is dispatched to
+static stepper_ctx *motors[STEPPER_MAX_MOTORS];
+static uint8_t motor_count = 0;
+static uint32_t fork_pin_mask = 0;
+
+static void stepper_register(stepper_ctx *ctx);
+
+/**
+ * Loads the phase sequence for the current direction into the ISR of the motor's state machine, starting from the
+ * phase on the pins (see stepper.pio). The state machine must be disabled and its TX FIFO empty.
+ *
+ * @param ctx Pointer to the stepper context.
+ */
+static void stepper_load_sequence(stepper_ctx *ctx) {
+    uint32_t sequence = 0;
+    int step = (ctx->direction == STEPPER_CLOCKWISE) ? 1 : -1;
+    for (int i = 0; i < STEPPER_PHASES; i++) {
+        uint phase = stepper_modulo(ctx->sequence_counter + step * i, STEPPER_PHASES);
+        sequence |= (uint32_t)(ctx->program_offset + stepper_offset_phase0 + phase * STEPPER_PHASE_LEN) << (4 * i);
+    }
+    pio_sm_put(ctx->pio_instance, ctx->state_machine, sequence);
+    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_pull(false, true));
+    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_mov(pio_isr, pio_osr));
+}
+
 /**
  * Initializes a PIO state machine to control a stepper motor.
  *
  * @param ctx Pointer to the stepper context containing PIO instance, pins, and program offset.
  * @param div The clock divider value for the state machine to set the stepping speed.
  */
-static void stepper_pio_init(stepper_ctx *ctx, float div) {
-    // Get the default PIO state machine configuration for a clockwise stepper motor program
-    pio_sm_config conf = stepper_clockwise_program_get_default_config(ctx->program_offset);
+static void stepper_pio_init(stepper_ctx *ctx, stepper_clkdiv div) {
+    // Get the default PIO state machine configuration for the stepper motor program
+    pio_sm_config conf = stepper_program_get_default_config(ctx->program_offset);
     
     uint32_t pin_mask = 0x0; // Initialize pin mask for setting pins
     
@@ -41,9 +74,11 @@ static void stepper_pio_init(stepper_ctx *ctx, float div) {
     sm_config_set_sideset_pins(&conf, ctx->pins[3]);
     
     // Set the clock divider, stepping direction, and enable the state machine
-    sm_config_set_clkdiv(&conf, div); // Set the clock divider for stepping speed
+    sm_config_set_clkdiv_int_frac(&conf, div.div_int, div.div_frac); // Set the clock divider for stepping speed
     sm_config_set_out_shift(&conf, true, false, 0); // Set output shift characteristics
-    pio_sm_init(ctx->pio_instance, ctx->state_machine, ctx->program_offset, &conf); // Initialize state machine
+    sm_config_set_in_shift(&conf, true, false, 32); // Shifting right makes "in isr" rotate the phase sequence
+    pio_sm_init(ctx->pio_instance, ctx->state_machine, ctx->program_offset + stepper_offset_start, &conf); // Initialize state machine
+    stepper_load_sequence(ctx);
     pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true); // Enable the state machine
 }
 
@@ -51,15 +86,13 @@ static void stepper_pio_init(stepper_ctx *ctx, float div) {
  * Calculates the clock divider value required for a specific RPM (Rotations Per Minute)
  * to control the speed of a stepper motor.
  *
- * @param rpm Desired motor speed in RPM (Rotations Per Minute).
+ * Inlined, so constant speeds are folded to a constant divider.
+ *
+ * @param rpm_x100 Desired motor speed in hundredths of an RPM (Rotations Per Minute).
  * @return The calculated clock divider value for the given RPM.
  */
-static float stepper_calculate_clkdiv(float rpm) {
-    if (rpm > RPM_MAX) rpm = RPM_MAX; // Cap the RPM value at the maximum RPM
-    if (rpm < RPM_MIN) rpm = RPM_MIN; // Ensure the RPM value is not below the minimum RPM
-    
-    // Calculate and return the clock divider value based on the desired RPM
-    return (SYS_CLK_KHZ * 1000) / (16000 / (((1 / rpm) * 60 * 1000) / 4096));
+static inline stepper_clkdiv stepper_calculate_clkdiv(uint16_t rpm_x100) {
+    return stepper_clkdiv_for(SYS_CLK_KHZ, rpm_x100);
 }
 
 /**
@@ -80,6 +113,10 @@ stepper_ctx stepper_get_ctx(void) {
     ctx.state_machine = 0; 
     ctx.speed = 0; 
     ctx.sequence_counter = 0; 
+    ctx.calibration = STEPPER_CALIBRATION_NONE;
+    ctx.calibration_stage = false;
+    ctx.original_speed = 0;
+    ctx.resume_steps = 0;
     ctx.step_counter = 0; 
     ctx.step_max = 6000; 
     ctx.edge_steps = 0; 
@@ -92,20 +129,22 @@ stepper_ctx stepper_get_ctx(void) {
 /**
  * Initializes a stepper motor context with the provided configuration.
  * Configures the stepper pins, opto fork pin, direction, speed, and initializes the PIO state machine.
+ * Up to STEPPER_MAX_MOTORS motors can be used, each takes one state machine and they share the program on a PIO.
  *
  * @param ctx Pointer to the stepper motor context to be initialized.
  * @param pio PIO instance to control the stepper motor.
  * @param stepper_pins Array of stepper motor pins.
  * @param opto_fork_pin Pin connected to the opto fork sensor.
- * @param rpm Speed of the stepper motor in rotations per minute (RPM).
+ * @param rpm_x100 Speed of the stepper motor in hundredths of a rotation per minute (RPM), see STEPPER_RPM().
  * @param clockwise Direction of rotation (true for clockwise, false for anti-clockwise).
+ * @note The context must stay in scope as long as the program runs, the opto fork interrupt uses it.
  */
 void stepper_init(
     stepper_ctx *ctx,
     PIO pio,
     const uint *stepper_pins,
     const uint opto_fork_pin,
-    const float rpm,
+    const uint16_t rpm_x100,
     const bool clockwise
 ) {
     ctx->pio_instance = pio; // Set PIO instance
@@ -128,16 +167,19 @@ void stepper_init(
     ctx->direction = clockwise; // Set rotation direction
     ctx->state_machine = pio_claim_unused_sm(ctx->pio_instance, true); // Claim a PIO state machine
 
-    // Add the appropriate program based on the direction
-    if (clockwise) {
-        ctx->program_offset = pio_add_program(ctx->pio_instance, &stepper_clockwise_program);
-    } else {
-        ctx->program_offset = pio_add_program(ctx->pio_instance, &stepper_anticlockwise_program);
+    // Load the program the first time the PIO is used, it handles both directions
+    uint pio_index = pio_get_index(ctx->pio_instance);
+    if (!program_loaded[pio_index]) {
+        program_offsets[pio_index] = pio_add_program(ctx->pio_instance, &stepper_program);
+        program_loaded[pio_index] = true;
     }
+    ctx->program_offset = program_offsets[pio_index];
+    ctx->calibration = STEPPER_CALIBRATION_NONE;
 
-    ctx->speed = rpm; // Set motor speed
-    float div = stepper_calculate_clkdiv(rpm); // Calculate clock divider based on RPM
+    ctx->speed = rpm_x100; // Set motor speed
+    stepper_clkdiv div = stepper_calculate_clkdiv(rpm_x100); // Calculate clock divider based on RPM
     stepper_pio_init(ctx, div); // Initialize the stepper PIO
+    stepper_register(ctx); // opto fork edges of this motor go to its calibration
 }
 
 /**
@@ -148,18 +190,17 @@ void stepper_init(
  * @param steps Number of steps to turn the stepper motor.
  */
 void stepper_turn_steps(stepper_ctx *ctx, const uint16_t steps) {
-    // Construct a word to send to the PIO state machine
-    uint32_t word = ((ctx->program_offset + stepper_clockwise_offset_loop + 3 * ctx->sequence_counter) << 16) | (steps);
-    pio_sm_put_blocking(ctx->pio_instance, ctx->state_machine, word); // Send the word to the PIO state machine
-
-    // Update sequence counter to control sequence loops
-    ctx->sequence_counter = stepper_modulo(ctx->sequence_counter + steps, 8);
+    // The state machine keeps track of the phase, so only the step count is sent
+    pio_sm_put_blocking(ctx->pio_instance, ctx->state_machine, steps); // Send the word to the PIO state machine
 
     int16_t steps_to_add = steps;
     if (ctx->direction == STEPPER_ANTICLOCKWISE) {
         steps_to_add = -steps_to_add;
     }
 
+    // Update sequence counter to the phase the pins will be in after the steps
+    ctx->sequence_counter = stepper_modulo(ctx->sequence_counter + steps_to_add, STEPPER_PHASES);
+
     // Update step counter and memory based on direction and steps moved
     ctx->step_counter = stepper_modulo(ctx->step_counter + steps_to_add, ctx->step_max);
     ctx->step_memory = (ctx->step_memory << 16) | (uint16_t)steps_to_add;
@@ -178,13 +219,13 @@ void stepper_turn_one_revolution(stepper_ctx *ctx) {
  * Sets the speed of the stepper motor.
  *
  * @param ctx Pointer to the stepper motor context.
- * @param rpm Desired revolutions per minute (RPM) for the motor.
+ * @param rpm_x100 Desired speed in hundredths of a revolution per minute (RPM) for the motor.
  */
-void stepper_set_speed(stepper_ctx *ctx, const float rpm) {
+void stepper_set_speed(stepper_ctx *ctx, const uint16_t rpm_x100) {
     pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false); // Disable the state machine temporarily
-    ctx->speed = rpm; // Update the desired speed in the stepper motor context
-    float div = stepper_calculate_clkdiv(rpm); // Calculate the clock divider based on the new speed
-    pio_sm_set_clkdiv(ctx->pio_instance, ctx->state_machine, div); // Set the new clock divider
+    ctx->speed = rpm_x100; // Update the desired speed in the stepper motor context
+    stepper_clkdiv div = stepper_calculate_clkdiv(rpm_x100); // Calculate the clock divider based on the new speed
+    pio_sm_set_clkdiv_int_frac(ctx->pio_instance, ctx->state_machine, div.div_int, div.div_frac); // Set the new clock divider
     pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true); // Re-enable the state machine with the new speed
 }
 
@@ -231,29 +272,27 @@ static uint8_t stepper_get_current_step(const stepper_ctx *ctx) {
  * remaining steps in a clockwise direction, negative values in an anticlockwise direction, and 0 when idle.
  */
 static int32_t stepper_read_steps_left(const stepper_ctx *ctx) {
-    uint8_t pc = pio_sm_get_pc(ctx->pio_instance, ctx->state_machine); // Get the current program counter
-    uint8_t loop_offset = ctx->program_offset + stepper_clockwise_offset_loop;
+    uint8_t pc = pio_sm_get_pc(ctx->pio_instance, ctx->state_machine) - ctx->program_offset; // Get the current program counter
     uint32_t steps_left = 0;
 
     // Check the program counter value for different states
-    if (pc == 0 || pc == 1) {
-        // If the program counter is 0 or 1, the program hasn't pulled from the RX FIFO, so no steps executed
+    if (pc == stepper_offset_start || pc == stepper_offset_tail + 1) {
+        // Waiting for a step count, or the last step is done and X has wrapped around, so no steps left
         return 0;
-    } else if (pc == 2) {
-        // If the program counter is 2, steps to take haven't been pushed to the X register yet
-        pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_out(pio_x, 16)); // Push steps to take to the X register
-    } else if ((pc >= loop_offset)) {
-        // If the program counter is in the loop region
-        if (((pc - loop_offset) % 3) == 0) {
-            // Depending on the program counter position, it might require adding one more step
-            if (((pc - loop_offset) / 3) == stepper_modulo(ctx->sequence_counter + (ctx->direction ? 1 : -1), 8)) {
-                steps_left++; // If the PC is on the SET instruction but hasn't decremented X yet
-            }
-        }
+    } else if (pc == stepper_offset_start + 1) {
+        // The step count has been pulled but not moved to the X register yet
+        pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_mov(pio_x, pio_osr));
+    } else if (pc >= stepper_offset_next) {
+        // X has already been decremented for the phase that is about to be set
+        steps_left++;
+    } else if (pc < stepper_offset_start && (pc % STEPPER_PHASE_LEN) == 0 &&
+               pc / STEPPER_PHASE_LEN != stepper_get_current_step(ctx)) {
+        // The PC is on the SET instruction of a phase but the pins don't show it yet
+        steps_left++;
     }
 
     // Move the X register contents to the ISR, then push ISR contents to the RX FIFO
-    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_in(pio_x, 32));
+    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_mov(pio_isr, pio_x));
     pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_push(false, false));
 
     // Read the RX FIFO to determine the number of executed steps
@@ -270,18 +309,15 @@ static int32_t stepper_read_steps_left(const stepper_ctx *ctx) {
  * ensuring that any remaining steps in the execution are accounted for and removed from
  * the step counter. It adjusts the sequence counter and step counter to reflect the current
  * motor state accurately. Additionally, it clears any pending commands in the FIFO, resets
- * the state machine's program counter to 0, and re-enables the state machine for further operation.
+ * the state machine's program counter to the start, reloads the phase sequence and re-enables the state machine.
  * 
  * @param ctx Pointer to the stepper motor context.
  */
 void stepper_stop(stepper_ctx *ctx) {
     pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false); // Disable the state machine
 
-    // Adjust sequence counter based on the current step and direction
-    ctx->sequence_counter = stepper_modulo(stepper_get_current_step(ctx) + 1, 8);
-    if (ctx->direction == STEPPER_ANTICLOCKWISE) {
-        ctx->sequence_counter = stepper_modulo(7 - (ctx->sequence_counter - 1) + 1, 8);
-    }
+    // The sequence counter is the phase the pins are in
+    ctx->sequence_counter = stepper_get_current_step(ctx);
 
     // Retrieve the number of commands in the FIFO and the number of steps left in execution
     uint fifo_level = pio_sm_get_tx_fifo_level(ctx->pio_instance, ctx->state_machine);
@@ -299,8 +335,10 @@ void stepper_stop(stepper_ctx *ctx) {
     // Clear any pending commands in the FIFO
     pio_sm_clear_fifos(ctx->pio_instance, ctx->state_machine);
 
-    // Reset the state machine's program counter to 0 and re-enable the state machine
-    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_jmp(0));
+    // Reset the state machine's program counter to the start, reading the steps left used the ISR so the phase
+    // sequence is loaded again, and re-enable the state machine
+    pio_sm_exec(ctx->pio_instance, ctx->state_machine, pio_encode_jmp(ctx->program_offset + stepper_offset_start));
+    stepper_load_sequence(ctx);
     pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true);
 }
 
@@ -308,9 +346,10 @@ void stepper_stop(stepper_ctx *ctx) {
  * Sets the direction of the stepper motor and updates the associated state machine.
  * 
  * This function changes the direction of the stepper motor to the specified direction (clockwise or anticlockwise).
- * If the direction is different from the current one, it stops the motor, reconfigures the state machine's program
- * according to the new direction, and resets the sequence counter accordingly. It ensures the state machine is disabled
- * before reconfiguration to avoid any potential conflicts. Finally, it re-enables the state machine.
+ * If the direction is different from the current one, it stops the motor and loads the phase sequence of the new
+ * direction, starting from the phase the pins are in. The program is shared with the other motors on the PIO, so it
+ * is not touched. It ensures the state machine is disabled before reconfiguration to avoid any potential conflicts.
+ * Finally, it re-enables the state machine.
  * 
  * @param ctx Pointer to the stepper motor context.
  * @param clockwise Boolean indicating the direction: true for clockwise, false for anticlockwise.
@@ -321,27 +360,12 @@ void stepper_set_direction(stepper_ctx *ctx, bool clockwise) {
 
         pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false); // Disable the state machine
         ctx->direction = clockwise; // Update the direction
-
-        pio_clear_instruction_memory(ctx->pio_instance); // Clear the current program in the PIO
-
-        // Set the new program based on the direction and adjust the sequence counter
-        if (clockwise) {
-            ctx->program_offset = pio_add_program(ctx->pio_instance, &stepper_clockwise_program);
-            ctx->sequence_counter = stepper_modulo(7 - (ctx->sequence_counter - 1), 8);
-        } else {
-            ctx->program_offset = pio_add_program(ctx->pio_instance, &stepper_anticlockwise_program);
-            ctx->sequence_counter = stepper_modulo(7 - (ctx->sequence_counter - 1) + 1, 8);
-        }
+        stepper_load_sequence(ctx); // Step through the phases the other way
 
         pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true); // Re-enable the state machine
     }
 }
 
-static float original_speed;
-
-bool stage;
-static stepper_ctx *tmp_ctx = NULL;
-
 /**
  * Calibration handler function to manage stepper motor calibration based on opto fork sensor signals.
  * 
@@ -349,51 +373,119 @@ static stepper_ctx *tmp_ctx = NULL;
  * It handles the calibration process by adjusting the stepper's steps, directions, and max steps to calibrate
  * the motor's position. It stops and restarts the motor as needed and eventually sets the motor as calibrated.
  * 
- * @note The function uses a temporary context (`tmp_ctx`) that likely represents the stepper motor context.
+ * @param ctx The stepper motor being calibrated, whose opto fork pin has a pending edge.
  */
-static void calibration_handler(void) {
-    pio_sm_set_enabled(tmp_ctx->pio_instance, tmp_ctx->state_machine, false);
-    if (gpio_get_irq_event_mask(tmp_ctx->opto_fork_pin) & GPIO_IRQ_EDGE_RISE) {
-        gpio_acknowledge_irq(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE);
-        if (stage == true) { // this should happen second.
-            stepper_stop(tmp_ctx);
-            if (tmp_ctx->direction == STEPPER_CLOCKWISE) { // we are over the second edge of the "hole"
-                tmp_ctx->edge_steps = tmp_ctx->step_counter; // so we keep that for later
+static void calibration_handler(stepper_ctx *ctx) {
+    pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false);
+    if (gpio_get_irq_event_mask(ctx->opto_fork_pin) & GPIO_IRQ_EDGE_RISE) {
+        gpio_acknowledge_irq(ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE);
+        if (ctx->calibration_stage == true) { // this should happen second.
+            stepper_stop(ctx);
+            if (ctx->direction == STEPPER_CLOCKWISE) { // we are over the second edge of the "hole"
+                ctx->edge_steps = ctx->step_counter; // so we keep that for later
             } else { // the math is a bit different if the stepper is going anticlockwise
-                tmp_ctx->edge_steps = tmp_ctx->step_max - tmp_ctx->step_counter;
+                ctx->edge_steps = ctx->step_max - ctx->step_counter;
             }
-            stepper_turn_steps(tmp_ctx, tmp_ctx->step_max);
+            stepper_turn_steps(ctx, ctx->step_max);
         } else { // in case something weird happens just let the stepper run
-            pio_sm_set_enabled(tmp_ctx->pio_instance, tmp_ctx->state_machine, true);
+            pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true);
         }
         return;
-    } else if (gpio_get_irq_event_mask(tmp_ctx->opto_fork_pin) & GPIO_IRQ_EDGE_FALL) {
-        gpio_acknowledge_irq(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_FALL);
-        if (stage == false) { // this should happen first
-            stepper_stop(tmp_ctx);
-            tmp_ctx->step_counter = 0; // we are at the edge of the "hole" so step counter gets set to 0.
-            stage = true;
-            stepper_turn_steps(tmp_ctx, tmp_ctx->step_max); // set the motor in motion again.
+    } else if (gpio_get_irq_event_mask(ctx->opto_fork_pin) & GPIO_IRQ_EDGE_FALL) {
+        gpio_acknowledge_irq(ctx->opto_fork_pin, GPIO_IRQ_EDGE_FALL);
+        if (ctx->calibration_stage == false) { // this should happen first
+            stepper_stop(ctx);
+            ctx->step_counter = 0; // we are at the edge of the "hole" so step counter gets set to 0.
+            ctx->calibration_stage = true;
+            stepper_turn_steps(ctx, ctx->step_max); // set the motor in motion again.
         } else { // this is the last step in calibration
-            stepper_stop(tmp_ctx);
-            if (tmp_ctx->direction == STEPPER_CLOCKWISE) {
-                tmp_ctx->step_max = tmp_ctx->step_counter; // motor has made one whole turn so set the max steps equal to step counter
-                tmp_ctx->step_counter = tmp_ctx->step_max - (tmp_ctx->edge_steps / 2); // use the second edge to calculate where the "true" zero should be.
+            stepper_stop(ctx);
+            if (ctx->direction == STEPPER_CLOCKWISE) {
+                ctx->step_max = ctx->step_counter; // motor has made one whole turn so set the max steps equal to step counter
+                ctx->step_counter = ctx->step_max - (ctx->edge_steps / 2); // use the second edge to calculate where the "true" zero should be.
             } else { // different math for different direction
-                tmp_ctx->step_max = tmp_ctx->step_max - tmp_ctx->step_counter;
-                tmp_ctx->step_counter = tmp_ctx->edge_steps / 2; 
+                ctx->step_max = ctx->step_max - ctx->step_counter;
+                ctx->step_counter = ctx->edge_steps / 2; 
                 
             }
-            stepper_set_speed(tmp_ctx, original_speed);
-            stepper_turn_steps(tmp_ctx, tmp_ctx->edge_steps / 2); // go to "true" zero
-            tmp_ctx->stepper_calibrated = true;
-            tmp_ctx->stepper_calibrating = false;
-            gpio_set_irq_enabled(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
-            gpio_remove_raw_irq_handler(tmp_ctx->opto_fork_pin, calibration_handler);
+            stepper_set_speed(ctx, ctx->original_speed);
+            stepper_turn_steps(ctx, ctx->edge_steps / 2); // go to "true" zero
+            ctx->stepper_calibrated = true;
+            ctx->stepper_calibrating = false;
+            ctx->calibration = STEPPER_CALIBRATION_NONE;
+            gpio_set_irq_enabled(ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
         }
     } else {
-        pio_sm_set_enabled(tmp_ctx->pio_instance, tmp_ctx->state_machine, true); // incase optofork didnt call this function
+        pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true); // incase optofork didnt call this function
+    }
+}
+
+/**
+ * Handler function for half calibration using an opto fork sensor signal.
+ * 
+ * This function manages a specific phase of stepper motor calibration using opto fork sensor signals.
+ * It handles interrupts generated by the opto fork pin (both edge-fall and edge-rise) and adjusts the motor's
+ * position and calibration state accordingly. It stops and restarts the motor, sets the direction, turns back to the compartment it was at,
+ * and eventually sets the motor as calibrated.
+ * 
+ * @param ctx The stepper motor being calibrated, whose opto fork pin has a pending edge.
+ */
+static void half_calibration_handler(stepper_ctx *ctx) {
+    pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false);
+    if (gpio_get_irq_event_mask(ctx->opto_fork_pin) & GPIO_IRQ_EDGE_FALL) {
+        gpio_acknowledge_irq(ctx->opto_fork_pin, GPIO_IRQ_EDGE_FALL);
+        stepper_stop(ctx);
+        ctx->calibration_stage = true;
+        stepper_set_direction(ctx, STEPPER_CLOCKWISE);
+        stepper_turn_steps(ctx, ctx->step_max);
+    } else {
+        gpio_acknowledge_irq(ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE);
+        if (ctx->calibration_stage == true) {
+            stepper_stop(ctx);
+            ctx->step_counter = ctx->edge_steps / 2;
+            if (ctx->resume_steps != 0) {
+                stepper_turn_steps(ctx, ctx->resume_steps - ctx->step_counter);
+            }
+            ctx->stepper_calibrated = true;
+            ctx->stepper_calibrating = false;
+            ctx->calibration = STEPPER_CALIBRATION_NONE;
+            gpio_set_irq_enabled(ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
+        } else {
+            pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true);
+        }
     }
+    
+}
+
+/**
+ * Raw GPIO interrupt handler shared by all motors. Passes opto fork edges to the calibration handler of the motor
+ * the fork belongs to, other pins are left for their own handlers.
+ */
+static void stepper_fork_handler(void) {
+    for (int i = 0; i < motor_count; i++) {
+        stepper_ctx *ctx = motors[i];
+        if (ctx->calibration == STEPPER_CALIBRATION_NONE) continue;
+        if (!(gpio_get_irq_event_mask(ctx->opto_fork_pin) & (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL))) continue; // not this fork
+        if (ctx->calibration == STEPPER_CALIBRATION_FULL) {
+            calibration_handler(ctx);
+        } else {
+            half_calibration_handler(ctx);
+        }
+    }
+}
+
+/**
+ * Adds a motor to the ones the opto fork interrupt is dispatched to and installs the shared handler for its pin.
+ *
+ * @param ctx The stepper motor, must stay in scope as long as the program runs.
+ */
+static void stepper_register(stepper_ctx *ctx) {
+    if (!ctx->opto_fork_pin || motor_count >= STEPPER_MAX_MOTORS) return;
+    motors[motor_count++] = ctx;
+    if (fork_pin_mask) gpio_remove_raw_irq_handler_masked(fork_pin_mask, stepper_fork_handler);
+    fork_pin_mask |= 1u << ctx->opto_fork_pin;
+    gpio_add_raw_irq_handler_with_order_priority_masked(fork_pin_mask, stepper_fork_handler, PICO_HIGHEST_IRQ_PRIORITY);
+    if (!irq_is_enabled(IO_IRQ_BANK0)) irq_set_enabled(IO_IRQ_BANK0, true);
 }
 
 /*
@@ -405,93 +497,87 @@ void stepper_calibrate(stepper_ctx *ctx) {
     // if stepper is already calibrating we dont want to calibrate again until its not calibrating
     if (ctx->stepper_calibrating) return;
     ctx->step_max = 6000; // 6000 is a safe number we need this to be more than the actual max steps.
-    original_speed = ctx->speed;
-    stage = false;
+    ctx->original_speed = ctx->speed;
+    ctx->calibration_stage = false;
     ctx->stepper_calibrated = false;
     ctx->stepper_calibrating = true;
-    tmp_ctx = ctx; // setting the main program ctx to be used with callback.
+    ctx->calibration = STEPPER_CALIBRATION_FULL; // the opto fork interrupt is passed to calibration_handler.
     // set interrupts on opto fork pin.
-    gpio_add_raw_irq_handler_with_order_priority(ctx->opto_fork_pin, calibration_handler, PICO_HIGHEST_IRQ_PRIORITY);
     gpio_set_irq_enabled(ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
-    if (!irq_is_enabled(IO_IRQ_BANK0)) irq_set_enabled(IO_IRQ_BANK0, true);
     // set the stepper in motion and wait for interrupts
     stepper_set_speed(ctx, RPM_MAX);
     stepper_turn_steps(ctx, ctx->step_max);
 }
 
-static uint dispensed_pills;
-
-/**
- * Handler function for half calibration using an opto fork sensor signal.
- * 
- * This function manages a specific phase of stepper motor calibration using opto fork sensor signals.
- * It handles interrupts generated by the opto fork pin (both edge-fall and edge-rise) and adjusts the motor's
- * position and calibration state accordingly. It stops and restarts the motor, sets the direction, dispenses pills,
- * and eventually sets the motor as calibrated.
- * 
- * @note The function uses a temporary context (`tmp_ctx`) representing the stepper motor context.
- */
-static void half_calibration_handler(void) {
-    pio_sm_set_enabled(tmp_ctx->pio_instance, tmp_ctx->state_machine, false);
-    if (gpio_get_irq_event_mask(tmp_ctx->opto_fork_pin) & GPIO_IRQ_EDGE_FALL) {
-        gpio_acknowledge_irq(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_FALL);
-        stepper_stop(tmp_ctx);
-        stage = true;
-        stepper_set_direction(tmp_ctx, STEPPER_CLOCKWISE);
-        stepper_turn_steps(tmp_ctx, tmp_ctx->step_max);
-    } else {
-        gpio_acknowledge_irq(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE);
-        if (stage == true) {
-            stepper_stop(tmp_ctx);
-            tmp_ctx->step_counter = tmp_ctx->edge_steps / 2;
-            if (dispensed_pills != 0) {
-                stepper_turn_steps(tmp_ctx, (dispensed_pills * tmp_ctx->step_max / 8) - tmp_ctx->step_counter);
-            }
-            tmp_ctx->stepper_calibrated = true;
-            tmp_ctx->stepper_calibrating = false;
-            gpio_set_irq_enabled(tmp_ctx->opto_fork_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
-            gpio_remove_raw_irq_handler(tmp_ctx->opto_fork_pin, half_calibration_handler);
-        } else {
-            pio_sm_set_enabled(tmp_ctx->pio_instance, tmp_ctx->state_machine, true);
-        }
-    }
-    
-}
-
 /**
  * Initiates a half calibration routine for the stepper motor using an opto fork sensor signal.
  * 
  * This function sets up and triggers a half calibration process for a stepper motor using an opto fork sensor.
- * It sets various parameters required for calibration, such as step limits, edge steps, dispensed pills, and
+ * It sets various parameters required for calibration, such as step limits, edge steps, the position to return to, and
  * handles the process via an interrupt-driven mechanism with the half_calibration_handler function.
  * 
  * @param ctx             The context representing the stepper motor to be calibrated.
  * @param max_steps       The maximum steps of the motor.
  * @param edge_steps      The number of steps at the edge of the "hole" in the opto fork sensor.
- * @param pills_dispensed The number of pills dispensed during calibration.
+ * @param position_steps  Steps from the calibration position to turn to afterwards, 0 to stay there.
  * 
- * @note This function assumes a temporary context `tmp_ctx` representing the stepper motor context.
+ * @note The context must stay in scope until the calibration is done, the opto fork interrupt uses it.
  */
-void stepper_half_calibrate(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint pills_dispensed) {
+void stepper_half_calibrate(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint16_t position_steps) {
     if (ctx->stepper_calibrating) return;
     ctx->step_max = max_steps;
     ctx->edge_steps = edge_steps;
-    original_speed = ctx->speed;
-    dispensed_pills = pills_dispensed;
-    stage = false;
-    tmp_ctx = ctx;
+    ctx->original_speed = ctx->speed;
+    ctx->resume_steps = position_steps;
+    ctx->calibration_stage = false;
     ctx->stepper_calibrated = false;
     ctx->stepper_calibrating = true;
+    ctx->calibration = STEPPER_CALIBRATION_HALF;
 
-    gpio_add_raw_irq_handler_with_order_priority(ctx->opto_fork_pin, half_calibration_handler, PICO_HIGHEST_IRQ_PRIORITY);
     gpio_set_irq_enabled(ctx->opto_fork_pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
-    if (!irq_is_enabled(IO_IRQ_BANK0)) irq_set_enabled(IO_IRQ_BANK0, true);
 
     stepper_set_direction(ctx, STEPPER_ANTICLOCKWISE);
     stepper_set_speed(ctx, RPM_MAX);
     stepper_turn_steps(ctx, max_steps);
 }
 
+/**
+ * Marks the motor calibrated without turning it, from a calibration made before a clean shutdown. The motor must not
+ * have moved since, the next step then starts from the phase the rotor rests at.
+ *
+ * @param ctx            The context representing the stepper motor.
+ * @param max_steps      The maximum steps of the motor.
+ * @param edge_steps     The number of steps at the edge of the "hole" in the opto fork sensor.
+ * @param position_steps Steps from the calibration position to where the wheel rests.
+ * @param phase_offset   Phase at step 0 of the calibration, from stepper_get_phase_offset().
+ */
+void stepper_resume(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_steps, uint16_t position_steps, uint8_t phase_offset) {
+    if (ctx->stepper_calibrating || stepper_is_running(ctx)) return;
+    ctx->step_max = max_steps;
+    ctx->edge_steps = edge_steps;
+    ctx->step_counter = position_steps;
+    ctx->step_memory = 0;
+
+    pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, false);
+    ctx->sequence_counter = stepper_modulo(phase_offset + position_steps, STEPPER_PHASES);
+    stepper_load_sequence(ctx);
+    pio_sm_set_enabled(ctx->pio_instance, ctx->state_machine, true);
+
+    ctx->stepper_calibrated = true;
+}
+
+/**
+ * Gets the phase the motor is in at step 0 of its calibration. Stored with the calibration, it lets stepper_resume()
+ * put the phase sequence back in step with the rotor after a reboot. Only valid while the motor is stopped and
+ * hasn't turned a full revolution since the calibration.
+ *
+ * @param ctx The context representing the stepper motor.
+ * @return Phase offset, 0 to 7.
+ */
+uint8_t stepper_get_phase_offset(const stepper_ctx *ctx) {
+    return (uint8_t)stepper_modulo(ctx->sequence_counter - ctx->step_counter, STEPPER_PHASES);
+}
+
 /**
  * Checks if the stepper motor is currently running.
  * 
@@ -502,8 +588,8 @@ void stepper_half_calibrate(stepper_ctx *ctx, uint16_t max_steps, uint16_t edge_
  * @return True if the stepper motor is running, false otherwise.
  */
 bool stepper_is_running(const stepper_ctx *ctx) {
-    // Check if the program counter is 0 and the TX FIFO level is 0
-    return !((pio_sm_get_pc(ctx->pio_instance, ctx->state_machine) == 0) && 
+    // Check if the program counter is at the start and the TX FIFO level is 0
+    return !((pio_sm_get_pc(ctx->pio_instance, ctx->state_machine) == ctx->program_offset + stepper_offset_start) && 
              (pio_sm_get_tx_fifo_level(ctx->pio_instance, ctx->state_machine) == 0));
 }
 
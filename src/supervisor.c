@@ -0,0 +1,128 @@
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+
+#include "supervisor.h"
+
+typedef struct task_status {
+    bool live;
+    uint32_t deadline_ms; // longest allowed time between check ins
+    uint32_t checkin_ms;  // time of the last check in
+} task_status;
+
+// The main loop can't check in while it waits for these, so it isn't held to its deadline then.
+static const bool blocks_main_loop[TASK_COUNT] = {
+    [TASK_EEPROM] = true,
+    [TASK_LORA] = true
+};
+
+static volatile task_status tasks[TASK_COUNT];
+static repeating_timer_t feed_timer;
+static uint32_t watchdog_timeout_ms = 0; // 0 until supervisor_init()
+
+/**
+ * Gets the current time for check ins.
+ *
+ * @return Milliseconds since boot.
+ */
+static inline uint32_t supervisor_now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * Checks if a task has missed its deadline.
+ *
+ * @param task The task.
+ * @param now  Current time in milliseconds.
+ * @return true if the task is live and late.
+ */
+static bool supervisor_is_late(supervisor_task task, uint32_t now) {
+    return tasks[task].live && (now - tasks[task].checkin_ms) > tasks[task].deadline_ms;
+}
+
+/**
+ * Timer callback that feeds the watchdog if no live task is late. A late task stops the feeding and
+ * the watchdog resets the board within its timeout.
+ *
+ * @param rt Unused.
+ * @return true to keep the timer repeating.
+ */
+static bool supervisor_feed_callback(repeating_timer_t *rt) {
+    uint32_t now = supervisor_now_ms();
+    bool main_loop_blocked = false;
+    for (int i = 0; i < TASK_COUNT; i++) {
+        if (supervisor_is_late(i, now)) return true;
+        if (tasks[i].live && blocks_main_loop[i]) main_loop_blocked = true;
+    }
+    if (main_loop_blocked) {
+        tasks[TASK_UI].checkin_ms = now; // the main loop's deadline starts over when the blocking task is done
+    }
+    watchdog_update();
+    return true;
+}
+
+/**
+ * Starts the supervisor and the hardware watchdog. The main loop becomes a live task.
+ * Tasks started before this are supervised from now on.
+ *
+ * @param watchdog_ms    Hardware watchdog timeout, the supervisor checks the tasks four times in it.
+ * @param ui_deadline_ms Longest time the main loop may go without checking in.
+ */
+void supervisor_init(uint32_t watchdog_ms, uint32_t ui_deadline_ms) {
+    supervisor_start(TASK_UI, ui_deadline_ms);
+    watchdog_timeout_ms = watchdog_ms;
+    watchdog_enable(watchdog_ms, true);
+    add_repeating_timer_ms(watchdog_ms / 4, supervisor_feed_callback, NULL, &feed_timer);
+}
+
+/**
+ * Makes a task live. It has to check in within the deadline, and again within the deadline of every
+ * check in, until it is stopped.
+ *
+ * @param task        The task.
+ * @param deadline_ms Longest time between check ins in milliseconds.
+ */
+void supervisor_start(supervisor_task task, uint32_t deadline_ms) {
+    uint32_t status = save_and_disable_interrupts();
+    tasks[task].deadline_ms = deadline_ms;
+    tasks[task].checkin_ms = supervisor_now_ms();
+    tasks[task].live = true;
+    restore_interrupts(status);
+}
+
+/**
+ * Tells the supervisor a task is still making progress.
+ *
+ * @param task The task.
+ */
+void supervisor_checkin(supervisor_task task) {
+    tasks[task].checkin_ms = supervisor_now_ms();
+}
+
+/**
+ * Stops supervising a task until it is started again.
+ *
+ * @param task The task.
+ */
+void supervisor_stop(supervisor_task task) {
+    tasks[task].live = false;
+}
+
+/**
+ * Gives the watchdog a longer timeout for work that runs with interrupts disabled, a flash erase for example.
+ * The supervisor can't feed the watchdog then. Does nothing before supervisor_init().
+ *
+ * @param max_ms Longest the work may take.
+ */
+void supervisor_suspend(uint32_t max_ms) {
+    if (watchdog_timeout_ms == 0) return;
+    watchdog_enable(max_ms, true);
+}
+
+/**
+ * Puts the watchdog timeout back after supervisor_suspend().
+ */
+void supervisor_resume(void) {
+    if (watchdog_timeout_ms == 0) return;
+    watchdog_enable(watchdog_timeout_ms, true);
+}
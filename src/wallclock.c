@@ -0,0 +1,90 @@
+#include "pico/stdlib.h"
+#include "hardware/rtc.h"
+#include <stdio.h>
+
+#include "wallclock.h"
+#include "epoch.h"
+
+static bool clock_valid = false;
+static uint32_t sync_count = 0;
+
+/**
+ * Converts a civil date to days since 1970-01-01 using integer math only.
+ *
+ * @param y Year.
+ * @param m Month 1-12.
+ * @param d Day of month 1-31.
+ * @return Days since the unix epoch.
+ */
+static int32_t wallclock_days_from_civil(int32_t y, uint32_t m, uint32_t d) {
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);                    // [0, 399]
+    uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1; // [0, 365]
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;        // [0, 146096]
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+/**
+ * Starts the RTC. The wall clock stays invalid until wallclock_sync() is called.
+ */
+void wallclock_init(void) {
+    rtc_init();
+    clock_valid = false;
+}
+
+/**
+ * Sets the RTC from a unix timestamp, for example one received from the network.
+ *
+ * @param unix_s Seconds since 1970-01-01 UTC.
+ */
+void wallclock_sync(uint32_t unix_s) {
+    datetime_t t;
+    int32_t days = unix_s / SECONDS_PER_DAY;
+    uint32_t secs = unix_s % SECONDS_PER_DAY;
+    int32_t year;
+    uint32_t month;
+    uint32_t day;
+    epoch_civil_from_days(days, &year, &month, &day);
+    t.year = (int16_t)year;
+    t.month = (int8_t)month;
+    t.day = (int8_t)day;
+    t.dotw = (int8_t)((days + 4) % 7); // 1970-01-01 was a thursday, 0 is sunday
+    t.hour = (int8_t)(secs / 3600);
+    t.min = (int8_t)((secs / 60) % 60);
+    t.sec = (int8_t)(secs % 60);
+    if (rtc_set_datetime(&t)) {
+        clock_valid = true;
+        sync_count++;
+    }
+}
+
+/**
+ * Checks if the wall clock has been set since boot.
+ *
+ * @return true if wallclock_now() returns real time.
+ */
+bool wallclock_is_valid(void) {
+    return clock_valid;
+}
+
+/**
+ * Reads the RTC as a unix timestamp.
+ *
+ * @return Seconds since 1970-01-01 UTC, 0 if the clock has not been synced since boot.
+ */
+uint32_t wallclock_now(void) {
+    datetime_t t;
+    if (!clock_valid || !rtc_get_datetime(&t)) return 0;
+    int32_t days = wallclock_days_from_civil(t.year, t.month, t.day);
+    return (uint32_t)days * SECONDS_PER_DAY + t.hour * 3600u + t.min * 60u + t.sec;
+}
+
+/**
+ * Gets how many times the clock has been set since boot.
+ *
+ * @return Sync count.
+ */
+uint32_t wallclock_get_sync_count(void) {
+    return sync_count;
+}
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wheel.h"
+
+/**
+ * Sets up an evenly spaced wheel.
+ *
+ * @param w            Pointer to the wheel.
+ * @param compartments Number of compartments, clamped to the supported range.
+ */
+void wheel_init(wheel *w, uint8_t compartments) {
+    memset(w, 0, sizeof(*w));
+    if (compartments < WHEEL_MIN_COMPARTMENTS) compartments = WHEEL_MIN_COMPARTMENTS;
+    if (compartments > WHEEL_MAX_COMPARTMENTS) compartments = WHEEL_MAX_COMPARTMENTS;
+    w->compartments = compartments;
+}
+
+/**
+ * Changes the number of compartments and clears the offsets, they belong to the old wheel.
+ *
+ * @param w            Pointer to the wheel.
+ * @param compartments Number of compartments.
+ * @return false if the number is out of range, the wheel is not changed then.
+ */
+bool wheel_set_compartments(wheel *w, uint8_t compartments) {
+    if (compartments < WHEEL_MIN_COMPARTMENTS || compartments > WHEEL_MAX_COMPARTMENTS) return false;
+    wheel_init(w, compartments);
+    return true;
+}
+
+/**
+ * Checks that an offset keeps a compartment closer to its own nominal position than to its neighbours',
+ * so the compartments stay in order.
+ *
+ * @param w      Pointer to the wheel.
+ * @param offset Correction in 1/WHEEL_ANGLE_UNITS of a revolution.
+ * @return true if the offset is less than half the compartment spacing.
+ */
+static bool wheel_offset_valid(const wheel *w, int8_t offset) {
+    int limit = WHEEL_ANGLE_UNITS / (2 * w->compartments);
+    return offset > -limit && offset < limit;
+}
+
+/**
+ * Sets the correction of one compartment's position.
+ *
+ * @param w           Pointer to the wheel.
+ * @param compartment Compartment 1 to compartments - 1, compartment 0 is fixed by calibration.
+ * @param offset      Correction in 1/WHEEL_ANGLE_UNITS of a revolution, positive is further along the turning direction.
+ * @return false if the compartment doesn't exist or the offset is half the compartment spacing or more.
+ */
+bool wheel_set_offset(wheel *w, uint8_t compartment, int8_t offset) {
+    if (compartment == 0 || compartment >= w->compartments || !wheel_offset_valid(w, offset)) return false;
+    w->offset[compartment] = offset;
+    return true;
+}
+
+/**
+ * Gets the number of pills a full wheel holds.
+ *
+ * @param w Pointer to the wheel.
+ * @return Compartments minus the empty calibration one.
+ */
+uint8_t wheel_pills(const wheel *w) {
+    return w->compartments - 1;
+}
+
+/**
+ * Calculates where a compartment is, counted from the calibration position. Every position is worked out
+ * from the revolution on its own, so turning compartment by compartment doesn't pile up rounding errors.
+ *
+ * @param w             Pointer to the wheel.
+ * @param steps_per_rev Steps in one revolution found by calibration.
+ * @param compartment   Compartment 0 to compartments, compartments is the calibration position one revolution on.
+ * @return Steps from the calibration position.
+ */
+uint16_t wheel_position_steps(const wheel *w, uint16_t steps_per_rev, uint8_t compartment) {
+    if (compartment >= w->compartments) return steps_per_rev;
+    // position in 1/(compartments * WHEEL_ANGLE_UNITS) of a revolution, so the division is done only once
+    int64_t angle = (int64_t)compartment * WHEEL_ANGLE_UNITS + (int64_t)w->offset[compartment] * w->compartments;
+    int64_t units = (int64_t)w->compartments * WHEEL_ANGLE_UNITS;
+    int64_t steps = (angle * steps_per_rev + units / 2) / units; // rounded to the nearest step
+    if (steps < 0) steps = 0;
+    if (steps > steps_per_rev) steps = steps_per_rev;
+    return (uint16_t)steps;
+}
+
+/**
+ * Calculates the turn from a compartment to the next one.
+ *
+ * @param w             Pointer to the wheel.
+ * @param steps_per_rev Steps in one revolution found by calibration.
+ * @param from          Compartment the wheel is at.
+ * @return Steps to the next compartment.
+ */
+uint16_t wheel_turn_steps(const wheel *w, uint16_t steps_per_rev, uint8_t from) {
+    return wheel_position_steps(w, steps_per_rev, from + 1) - wheel_position_steps(w, steps_per_rev, from);
+}
+
+/**
+ * Writes the wheel in its EEPROM record format: compartments, then the offset of every possible compartment.
+ *
+ * @param w   Pointer to the wheel.
+ * @param dst Pointer to WHEEL_RECORD_LEN bytes.
+ */
+void wheel_encode(const wheel *w, uint8_t *dst) {
+    dst[0] = w->compartments;
+    for (int i = 0; i < WHEEL_MAX_COMPARTMENTS; i++) {
+        dst[1 + i] = (uint8_t)w->offset[i];
+    }
+}
+
+/**
+ * Reads a wheel from its EEPROM record format.
+ *
+ * @param w   Pointer to the wheel, only changed if the record is valid.
+ * @param src Pointer to WHEEL_RECORD_LEN bytes.
+ * @return false if the record has an unsupported number of compartments or an invalid offset.
+ */
+bool wheel_decode(wheel *w, const uint8_t *src) {
+    wheel decoded;
+    if (!wheel_set_compartments(&decoded, src[0])) return false;
+    for (int i = 1; i < decoded.compartments; i++) {
+        if (!wheel_set_offset(&decoded, i, (int8_t)src[1 + i])) return false;
+    }
+    *w = decoded;
+    return true;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "stepperdiv.h"
+
+// Checks the stepper's integer clock divider (lib/stepperdiv.h) against the float math it replaced, at every speed
+// from RPM_MIN to RPM_MAX in hundredths of an RPM.
+// The old divider was SYS_CLK_HZ / (16000 / ((60000 / rpm) / 4096)) in single precision, which the SDK truncated to
+// 16.8. The new one is exact and rounded, so it is at most 1 LSB (1/256) from the old one. Except where the float
+// math itself was more than 1 LSB off: there the new one may be 2 LSB away, and it is the old one that was wrong.
+//
+// usage: clkdivcheck [system clock in kHz]
+
+#define SYS_CLK_KHZ 125000
+
+/**
+ * The divider as the firmware used to calculate it, truncated to 16.8 the way sm_config_set_clkdiv() does.
+ *
+ * @param clk_khz  System clock in kHz.
+ * @param rpm_x100 Speed in hundredths of an RPM.
+ * @return The divider in 1/256 units.
+ */
+static int32_t clkdiv_float(uint32_t clk_khz, uint16_t rpm_x100) {
+    float rpm = rpm_x100 / 100.0f;
+    float div = (clk_khz * 1000.0f) / (16000 / (((1 / rpm) * 60 * 1000) / 4096));
+    uint16_t div_int = (uint16_t)div;
+    uint8_t div_frac = (uint8_t)((div - div_int) * (1u << 8u));
+    return div_int << 8 | div_frac;
+}
+
+int main(int argc, char **argv) {
+    uint32_t clk_khz = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : SYS_CLK_KHZ;
+    if (clk_khz == 0) {
+        fprintf(stderr, "usage: %s [system clock in kHz]\n", argv[0]);
+        return 1;
+    }
+
+    long speeds = 0, same = 0, one = 0, float_off = 0, errors = 0;
+    double worst = 0; // of the dividers that fit
+    for (uint32_t rpm_x100 = RPM_MIN; rpm_x100 <= RPM_MAX; rpm_x100++) {
+        stepper_clkdiv div = stepper_clkdiv_for(clk_khz, (uint16_t)rpm_x100);
+        int32_t new_div = div.div_int << 8 | div.div_frac;
+        int32_t old_div = clkdiv_float(clk_khz, (uint16_t)rpm_x100);
+        double exact = (double)clk_khz * 46875 / (2.0 * rpm_x100);
+        int32_t diff = abs(new_div - old_div);
+        bool old_off = fabs(old_div - exact) > 1.0;
+        speeds++;
+
+        if (exact < 0x1000000 && fabs(new_div - exact) > worst) worst = fabs(new_div - exact);
+        if (diff == 0) {
+            same++;
+        } else if (diff == 1) {
+            one++;
+        } else if (diff == 2 && old_off) {
+            float_off++;
+            printf("%u.%02u RPM: new %d, float %d, exact %.2f 1/256\n", rpm_x100 / 100, rpm_x100 % 100, new_div,
+                   old_div, exact);
+        }
+        if (exact >= 0x1000000) {
+            errors++;
+            printf("%u.%02u RPM: divider %.0f/256 doesn't fit 16.8 FAIL\n", rpm_x100 / 100, rpm_x100 % 100, exact);
+        } else if (fabs(new_div - exact) > 0.5 || diff > 2 || (diff == 2 && !old_off)) {
+            errors++;
+            printf("%u.%02u RPM: new %d, float %d, exact %.2f 1/256 FAIL\n", rpm_x100 / 100, rpm_x100 % 100,
+                   new_div, old_div, exact);
+        }
+    }
+
+    printf("%ld speeds at %u kHz: %ld same, %ld 1 LSB apart, %ld 2 LSB apart where the float math was off\n", speeds,
+           clk_khz, same, one, float_off);
+    printf("worst distance from exact: %.3f LSB\n", worst);
+    printf("%ld errors\n", errors);
+    return errors > 0 ? 1 : 0;
+}
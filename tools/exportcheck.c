@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "logframe.h"
+
+// Runs log exports (logger_start_export() in src/logHandling.c) over a model of the ring of log slots and decodes
+// the frames. Every slot from the first one asked for to the unused one must be covered once, in order, with the
+// index it has in the ring, also when the export wraps around the end of the logs. Some logs have values in the
+// slots after them, the frames count those slots without sending them.
+//
+// usage: exportcheck [exports] [seed]
+
+#define MAX_CAPACITY 600
+#define FRAME_LEN 51 // EXPORT_FRAME_LEN
+#define BATCH 32     // EXPORT_BATCH
+
+#define MAX_LOG_SLOTS 6 // LOGRECORD_MAX_SLOTS
+
+static logframe_record ring[MAX_CAPACITY]; // a value slot reads as an invalid log, like a slot that isn't a log's
+
+/**
+ * Fills the ring with logs. The slot before the unused one has the newest log and the one after it the oldest.
+ *
+ * @param capacity Number of slots.
+ * @param unused   Index of the unused slot.
+ */
+static void fill_ring(int capacity, int unused) {
+    ring[unused] = (logframe_record){LOGFRAME_INVALID_CODE, 0, 0, 1};
+    for (int n = 0; n < capacity - 1;) {
+        int i = (unused + 1 + n) % capacity; // oldest first
+        int slots = rand() % 4 == 0 ? 2 + rand() % (MAX_LOG_SLOTS - 1) : 1;
+        if (slots > capacity - 1 - n) slots = capacity - 1 - n;
+        ring[i].code = (uint8_t)(i % 40);
+        ring[i].compartment = (uint8_t)(i % 3 == 0 ? i % 8 : 0);
+        ring[i].timestamp_s = 1700000000u + (uint32_t)n * 7;
+        ring[i].slots = (uint8_t)slots;
+        if (i % 17 == 0) ring[i] = (logframe_record){LOGFRAME_INVALID_CODE, 0, 0, 1};
+        for (int v = 1; v < ring[i].slots; v++) {
+            ring[(i + v) % capacity] = (logframe_record){LOGFRAME_INVALID_CODE, 0, 0, 1};
+        }
+        n += ring[i].slots;
+    }
+}
+
+/**
+ * Exports from a first slot the way the firmware does and checks the decoded frames.
+ *
+ * @param capacity Number of slots.
+ * @param first    First slot asked for.
+ * @param unused   Index of the unused slot.
+ * @return Number of errors.
+ */
+static int check_export(int capacity, int first, int unused) {
+    logframe_cursor c;
+    logframe_cursor_start(&c, first, unused, capacity);
+    int expected = (first >= 0 && first < capacity) ? (unused - first + capacity) % capacity : 0;
+    int want = first;
+    int received = 0;
+    int frames = 0;
+    bool last = false;
+
+    while (!last) {
+        logframe_record records[BATCH];
+        int run = logframe_cursor_run(&c, BATCH);
+        int count = 0;
+        for (int i = 0; i < run; i += records[count++].slots) records[count] = ring[(c.next + i) % capacity];
+        uint8_t frame[FRAME_LEN];
+        int logs;
+        int len = logframe_encode(frame, FRAME_LEN, (uint8_t)frames, (uint16_t)c.next, records, count, &logs);
+        if (logs >= c.left) logframe_mark_last(frame);
+        logframe_cursor_advance(&c, logs);
+
+        logframe_header hdr;
+        logframe_record decoded[LOGFRAME_MAX_RECORDS];
+        int decoded_logs = logframe_decode(frame, len, &hdr, decoded, LOGFRAME_MAX_RECORDS);
+        if (decoded_logs < 0 || hdr.count != logs) {
+            printf("capacity %d first %d unused %d: frame %d doesn't decode\n", capacity, first, unused, frames);
+            return 1;
+        }
+        for (int i = 0, index = hdr.first_index; i < decoded_logs; index += decoded[i++].slots) {
+            index %= capacity;
+            if (index != want || decoded[i].slots != ring[index].slots || decoded[i].code != ring[index].code ||
+                (decoded[i].code != LOGFRAME_INVALID_CODE && decoded[i].timestamp_s != ring[index].timestamp_s)) {
+                printf("capacity %d first %d unused %d: got slot %d, expected %d\n", capacity, first, unused, index,
+                       want);
+                return 1;
+            }
+            want = (want + decoded[i].slots) % capacity;
+            received += decoded[i].slots;
+        }
+        last = hdr.flags & LOGFRAME_FLAG_LAST;
+        if (++frames > capacity + 1) {
+            printf("capacity %d first %d unused %d: export doesn't end\n", capacity, first, unused);
+            return 1;
+        }
+    }
+    if (received != expected) {
+        printf("capacity %d first %d unused %d: %d slots sent, expected %d\n", capacity, first, unused, received,
+               expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    long exports = argc > 1 ? atol(argv[1]) : 20000;
+    unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+    if (exports <= 0) {
+        fprintf(stderr, "usage: %s [exports] [seed]\n", argv[0]);
+        return 1;
+    }
+    srand(seed);
+
+    long errors = 0;
+    // the log area wrapped: the unused slot is near the start, the oldest logs are at the end of the ring
+    fill_ring(MAX_CAPACITY, 5);
+    errors += check_export(MAX_CAPACITY, 6, 5);                // everything
+    errors += check_export(MAX_CAPACITY, MAX_CAPACITY - 3, 5); // the last slots of the ring, then the first ones
+    errors += check_export(MAX_CAPACITY, 0, 5);                // only the slots after the wrap
+    errors += check_export(MAX_CAPACITY, 5, 5);                // nothing
+    errors += check_export(MAX_CAPACITY, MAX_CAPACITY, 5);     // out of range, nothing
+
+    long wrapped = 0;
+    for (long n = 0; n < exports; n++) {
+        int capacity = 2 + rand() % (MAX_CAPACITY - 1);
+        int unused = rand() % capacity;
+        int first = rand() % (capacity + 2);
+        if (first > unused && first < capacity) wrapped++;
+        fill_ring(capacity, unused);
+        errors += check_export(capacity, first, unused);
+    }
+
+    printf("%ld exports, %ld wrapped around the end of the logs\n", exports + 5, wrapped + 2);
+    printf("%ld errors\n", errors);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "blockdev.h"
+#include "flashlog.h"
+
+// Runs the flash log (src/flashlog.c) on a model of the Pico's NOR flash and reports wear and timing.
+// Programming can only clear bits and an erase sets a whole sector back to 0xFF. Every operation adds its typical
+// time to a clock, so the report shows how long appends wait and how much of it is erases.
+// Power is cut now and then, in the middle of a record, and the log is mounted again from the sector headers.
+//
+// usage: flashsim [sectors] [appends] [appends between power cuts]
+
+#define PAGE_SIZE 256
+#define SECTOR_SIZE 4096
+#define MAX_SECTORS 256
+#define PROGRAM_US 700    // page program, W25Q16 typical
+#define ERASE_US 45000    // 4 KB sector erase, W25Q16 typical
+#define READ_BYTE_NS 80   // XIP read through the cache misses, about 12 MB/s
+#define IDLE_EVERY 4      // appends between idle passes of the main loop, where flashlog_maintain() runs
+
+typedef struct nor_flash {
+    uint8_t data[MAX_SECTORS * SECTOR_SIZE];
+    uint64_t time_ns;
+    uint64_t read_bytes;
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t violations; // programs that tried to set a bit back to 1
+    int tear_after;      // bytes left to program before the power cut, -1 for none
+} nor_flash;
+
+static nor_flash flash;
+
+/**
+ * Reads from the model.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to read.
+ * @param dst     Pointer to the buffer to read into.
+ * @param size    Bytes to read.
+ * @return Always true.
+ */
+static bool nor_read(const blockdev *dev, uint32_t address, uint8_t *dst, size_t size) {
+    (void)dev;
+    memcpy(dst, flash.data + address, size);
+    flash.read_bytes += size;
+    flash.time_ns += (uint64_t)size * READ_BYTE_NS;
+    return true;
+}
+
+/**
+ * Programs part of a page in the model: bits can only go from 1 to 0. A pending power cut stops the program
+ * after the given number of bytes.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte to program.
+ * @param src     Pointer to the data.
+ * @param size    Bytes to program, all in one page.
+ * @return false if the power was cut.
+ */
+static bool nor_program(const blockdev *dev, uint32_t address, const uint8_t *src, size_t size) {
+    (void)dev;
+    flash.programs++;
+    flash.time_ns += (uint64_t)PROGRAM_US * 1000;
+    for (size_t i = 0; i < size; i++) {
+        if (flash.tear_after == 0) return false;
+        if (flash.tear_after > 0) flash.tear_after--;
+        if (src[i] & ~flash.data[address + i]) flash.violations++;
+        flash.data[address + i] &= src[i];
+    }
+    return true;
+}
+
+/**
+ * Erases a sector of the model.
+ *
+ * @param dev     Pointer to the device.
+ * @param address First byte of the sector.
+ * @return Always true.
+ */
+static bool nor_erase(const blockdev *dev, uint32_t address) {
+    (void)dev;
+    flash.erases++;
+    flash.time_ns += (uint64_t)ERASE_US * 1000;
+    memset(flash.data + address, 0xFF, SECTOR_SIZE);
+    return true;
+}
+
+static const blockdev_ops nor_ops = {
+    .read = nor_read,
+    .program = nor_program,
+    .erase = nor_erase
+};
+
+/**
+ * Fills a record the way the firmware does: in use flag, code and a counter in place of the timestamp.
+ *
+ * @param record Pointer to FLASHLOG_RECORD_LEN bytes.
+ * @param n      Counter to store.
+ */
+static void make_record(uint8_t *record, uint32_t n) {
+    record[0] = 0x01;
+    record[1] = (uint8_t)(n % 42);
+    for (int i = 0; i < 4; i++) record[2 + i] = (uint8_t)(n >> (8 * i));
+    record[6] = (uint8_t)~record[2]; // stands in for the CRC
+    record[7] = (uint8_t)~record[3];
+}
+
+/**
+ * Reads back the counter of a record.
+ *
+ * @param record Pointer to FLASHLOG_RECORD_LEN bytes.
+ * @param n      Pointer to where the counter is stored.
+ * @return false if the record is erased or torn.
+ */
+static bool record_counter(const uint8_t *record, uint32_t *n) {
+    if (record[0] != 0x01 || (uint8_t)(record[6] ^ record[2]) != 0xFF || (uint8_t)(record[7] ^ record[3]) != 0xFF) return false;
+    *n = (uint32_t)record[2] | (uint32_t)record[3] << 8 | (uint32_t)record[4] << 16 | (uint32_t)record[5] << 24;
+    return true;
+}
+
+/**
+ * Finds the newest record that reads back, going back from the head.
+ *
+ * @param fl Pointer to the log.
+ * @param n  Pointer to where its counter is stored.
+ * @return false if no record reads back.
+ */
+static bool newest_counter(const flashlog *fl, uint32_t *n) {
+    int capacity = flashlog_capacity(fl);
+    uint8_t record[FLASHLOG_RECORD_LEN];
+    for (int back = 1; back <= capacity; back++) {
+        int index = (flashlog_head(fl) - back + capacity) % capacity;
+        if (flashlog_read(fl, index, record) && record_counter(record, n)) return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    int sectors = argc > 1 ? atoi(argv[1]) : 64;
+    long appends = argc > 2 ? atol(argv[2]) : 200000;
+    long cut_every = argc > 3 ? atol(argv[3]) : 5000;
+    if (sectors < 2 || sectors > MAX_SECTORS || appends < 1 || cut_every < 1) {
+        fprintf(stderr, "usage: %s [sectors 2-%d] [appends] [appends between power cuts]\n", argv[0], MAX_SECTORS);
+        return 1;
+    }
+
+    memset(flash.data, 0x5A, sizeof(flash.data)); // whatever was in the flash before
+    flash.tear_after = -1;
+    blockdev dev = {&nor_ops, NULL, (uint32_t)sectors * SECTOR_SIZE, PAGE_SIZE, SECTOR_SIZE};
+    flashlog fl;
+    if (!flashlog_mount(&fl, &dev)) {
+        fprintf(stderr, "mount failed\n");
+        return 1;
+    }
+    printf("%d sectors, %d records each, %d records\n", fl.sectors, fl.per_sector, flashlog_capacity(&fl));
+
+    uint64_t append_ns = 0;
+    uint64_t worst_append_ns = 0;
+    uint64_t idle_ns = 0;
+    uint64_t mount_ns = 0;
+    uint64_t worst_mount_ns = 0;
+    long waited = 0; // appends that had to erase first
+    long mounts = 0;
+    long errors = 0;
+    uint32_t counter = 0;
+
+    srand(1);
+    for (long i = 0; i < appends; i++) {
+        uint8_t record[FLASHLOG_RECORD_LEN];
+        make_record(record, counter);
+        bool cut = (i + 1) % cut_every == 0;
+        if (cut) flash.tear_after = rand() % FLASHLOG_RECORD_LEN; // dies part way through the record
+
+        uint32_t erases = flash.erases;
+        uint64_t start = flash.time_ns;
+        bool ok = flashlog_append(&fl, record);
+        uint64_t took = flash.time_ns - start;
+        append_ns += took;
+        if (took > worst_append_ns) worst_append_ns = took;
+        if (flash.erases != erases) waited++;
+        if (ok) counter++;
+
+        if (cut) {
+            flash.tear_after = -1;
+            start = flash.time_ns;
+            if (!flashlog_mount(&fl, &dev)) {
+                fprintf(stderr, "mount failed after power cut %ld\n", mounts);
+                return 1;
+            }
+            took = flash.time_ns - start;
+            mount_ns += took;
+            if (took > worst_mount_ns) worst_mount_ns = took;
+            mounts++;
+            // a record torn after its last programmed byte is whole, it counts as written
+            uint32_t newest;
+            if (!ok && newest_counter(&fl, &newest) && newest == counter) counter++;
+            if (counter > 0 && (!newest_counter(&fl, &newest) || newest != counter - 1)) errors++;
+        } else if (i % IDLE_EVERY == 0) {
+            uint64_t idle_start = flash.time_ns;
+            flashlog_maintain(&fl);
+            idle_ns += flash.time_ns - idle_start;
+        }
+    }
+
+    // the newest record before the head has to be the last one written, after every power cut as well
+    uint32_t newest;
+    if (!newest_counter(&fl, &newest) || newest != counter - 1) errors++;
+
+    uint32_t min_wear = UINT32_MAX;
+    uint32_t max_wear = 0;
+    for (uint16_t s = 0; s < fl.sectors; s++) {
+        uint32_t count;
+        if (!flashlog_erase_count(&fl, s, &count)) continue;
+        if (count < min_wear) min_wear = count;
+        if (count > max_wear) max_wear = count;
+    }
+
+    printf("%ld appends, %u written, %ld power cuts\n", appends, counter, mounts);
+    printf("flash: %u programs, %u erases, %u bits programmed back to 1\n", flash.programs, flash.erases,
+           flash.violations);
+    printf("sector erases: min %u max %u\n", min_wear, max_wear);
+    printf("append: mean %.2f ms, worst %.2f ms, %ld waited for an erase\n", append_ns / 1e6 / appends,
+           worst_append_ns / 1e6, waited);
+    printf("idle erase time: %.1f s\n", idle_ns / 1e9);
+    if (mounts > 0) printf("mount: mean %.2f ms, worst %.2f ms\n", mount_ns / 1e6 / mounts, worst_mount_ns / 1e6);
+    printf("%ld errors\n", errors);
+    return (errors > 0 || flash.violations > 0) ? 1 : 0;
+}
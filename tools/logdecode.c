@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "logHandling.h"
+#include "logframe.h"
+#include "epoch.h"
+#include "metrics.h"
+
+// Reassembles and prints a log export (CMD_REQUEST_LOGS) from the uplink payloads.
+// Reads one hex payload per line from stdin or the given file, frames may arrive in any order and more than once.
+// Telemetry frames in the input are printed as they come.
+
+#define MAX_FRAMES 256
+#define MAX_FRAME_LEN 256
+#define LINE_LEN 1024
+#define TEXT_LEN 64
+
+typedef struct frame_slot {
+    bool received;
+    logframe_header hdr;
+    logframe_record records[LOGFRAME_MAX_RECORDS];
+    int logs; // decoded into records, fewer than hdr.count if some logs have values
+} frame_slot;
+
+static frame_slot frames[MAX_FRAMES];
+
+/**
+ * Converts a line of hex digits to bytes. Spaces and other separators between bytes are skipped.
+ *
+ * @param line Pointer to the text.
+ * @param out  Pointer to where the bytes are stored.
+ * @param max  Room in out.
+ * @return Number of bytes, -1 if the line has an odd digit or is too long.
+ */
+static int hex_to_bytes(const char *line, uint8_t *out, int max) {
+    int len = 0;
+    int high = -1;
+    for (; *line; line++) {
+        if (!isxdigit((unsigned char)*line)) {
+            if (high >= 0) return -1;
+            continue;
+        }
+        int v = isdigit((unsigned char)*line) ? *line - '0' : tolower((unsigned char)*line) - 'a' + 10;
+        if (high < 0) {
+            high = v;
+        } else {
+            if (len >= max) return -1;
+            out[len++] = (uint8_t)(high << 4 | v);
+            high = -1;
+        }
+    }
+    return (high >= 0) ? -1 : len;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "r");
+        if (!in) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    char line[LINE_LEN];
+    uint8_t data[MAX_FRAME_LEN];
+    int line_number = 0;
+    int last_frame = -1;
+    while (fgets(line, sizeof(line), in)) {
+        line_number++;
+        int len = hex_to_bytes(line, data, MAX_FRAME_LEN);
+        if (len == 0) continue;
+
+        metrics_snapshot snapshot;
+        if (len > 0 && metrics_decode(data, len, &snapshot)) {
+            printf("telemetry (line %d):\n", line_number);
+            metrics_print(&snapshot);
+            continue;
+        }
+
+        logframe_header hdr;
+        logframe_record records[LOGFRAME_MAX_RECORDS];
+        int logs = len < 0 ? -1 : logframe_decode(data, len, &hdr, records, LOGFRAME_MAX_RECORDS);
+        if (logs < 0) {
+            fprintf(stderr, "line %d: not a log frame, skipped\n", line_number);
+            continue;
+        }
+        frame_slot *slot = &frames[hdr.frame_number];
+        slot->received = true;
+        slot->hdr = hdr;
+        slot->logs = logs;
+        memcpy(slot->records, records, sizeof(records));
+        if (hdr.flags & LOGFRAME_FLAG_LAST) last_frame = hdr.frame_number;
+    }
+    if (in != stdin) fclose(in);
+
+    int end = (last_frame >= 0) ? last_frame + 1 : MAX_FRAMES;
+    int missing = 0;
+    int printed = 0;
+    bool utc = false; // an export can start in the middle of a boot, its sync may not be in it
+    for (int f = 0; f < end; f++) {
+        if (!frames[f].received) {
+            if (last_frame >= 0) {
+                fprintf(stderr, "frame %d missing\n", f);
+                missing++;
+            }
+            continue;
+        }
+        const logframe_header *hdr = &frames[f].hdr;
+        int index = hdr->first_index; // of the log, its value slots come after it
+        for (int i = 0; i < frames[f].logs; index += frames[f].records[i++].slots) {
+            const logframe_record *r = &frames[f].records[i];
+            if (r->code == LOGFRAME_INVALID_CODE) continue;
+            char text[TEXT_LEN];
+            utc = logTimeIsUtc(utc, r->code);
+            formatLogMessage(text, sizeof(text), r->code, r->compartment);
+            if (hdr->since_boot) {
+                printf("%d: %s %u seconds after boot.\n", index, text, r->timestamp_s);
+            } else {
+                char when[TEXT_LEN];
+                epoch_format(when, sizeof(when), r->timestamp_s, utc);
+                printf("%d: %s at %s.\n", index, text, when);
+            }
+            printed++;
+        }
+    }
+
+    if (last_frame < 0) {
+        fprintf(stderr, "last frame not received, export incomplete\n");
+        return 2;
+    }
+    fprintf(stderr, "%d logs from %d frames, %d frames missing\n", printed, end - missing, missing);
+    return missing ? 2 : 0;
+}
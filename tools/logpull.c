@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dumpframe.h"
+
+// Pulls the raw EEPROM and flash log from dispensers over their serial lines, one thread per line, in the frames of
+// lib/dumpframe.h. A line is asked to start a dump until the dispenser answers, or until button 3 is pressed on it.
+// The dump is read a chunk at a time and written to <board id>.part in the output directory, so a pull that stopped
+// carries on from where it got to. The .part file starts with the boot, log head and sizes the dispenser sent, and
+// is only carried on from if they are still the same: a dump that was started before the dispenser rebooted or wrote
+// a log is started over, so old and new parts are never joined. When it is complete it is split into
+// <board id>.eeprom, an image logstats reads, and <board id>.flash if the logs are in flash.
+//
+// usage: logpull [-b baud] [-o dir] [-w seconds] port...
+//   -b  baud rate of the dispensers' stdio UART, 115200 by default
+//   -o  directory for the images, the current one by default
+//   -w  how long to wait for a dispenser to answer, 30 s by default
+
+#define HELLO_TIMEOUT_MS 1000 // between requests to start a dump
+#define READ_TIMEOUT_MS 500   // a chunk takes about 25 ms at 115200 baud, the rest is for the main loop's other work
+#define READ_TRIES 10         // for one chunk before the line is given up
+#define RX_LEN 256
+
+// .part file header, then the dump
+#define PART_MAGIC 0x54524150 // "PART", LSB first
+#define PART_HEADER_LEN 16    // magic (4), boot (2), log head (2), EEPROM size (4), flash log size (4)
+
+typedef struct line {
+    int fd;
+    dumpframe_rx rx;
+    uint8_t buf[RX_LEN]; // read from the line but not yet fed to rx
+    size_t len;
+    size_t pos;
+} line;
+
+typedef struct unit {
+    const char *port;
+    const char *error;    // NULL if the pull finished
+    char id[2 * DUMPFRAME_BOARD_ID_LEN + 1];
+    uint16_t boot;
+    uint16_t head;        // index of the next log, changes whenever a log is written
+    uint32_t eeprom_size;
+    uint32_t flash_size;
+    uint16_t chunk;
+    uint32_t resumed_at;  // bytes that were already in the .part file
+    uint32_t retries;
+    double seconds;
+} unit;
+
+static unit *units;
+static int unit_count;
+static speed_t speed = B115200;
+static const char *out_dir = ".";
+static int wait_s = 30;
+
+/**
+ * Gets the time for timeouts.
+ *
+ * @return Milliseconds from an arbitrary start.
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Converts a baud rate to a termios speed.
+ *
+ * @param baud Baud rate.
+ * @return The speed, B0 if the rate isn't supported.
+ */
+static speed_t speed_for(int baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B0;
+    }
+}
+
+/**
+ * Opens a serial port raw, 8N1 without flow control, and throws away what was received before.
+ *
+ * @param l    Pointer to the line.
+ * @param path Path of the port.
+ * @return false if the port can't be opened or set up.
+ */
+static bool line_open(line *l, const char *path) {
+    struct termios tio;
+    memset(l, 0, sizeof(*l));
+    dumpframe_rx_init(&l->rx);
+    l->fd = open(path, O_RDWR | O_NOCTTY);
+    if (l->fd < 0) return false;
+    if (tcgetattr(l->fd, &tio) != 0) return false;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0) return false;
+    if (tcsetattr(l->fd, TCSANOW, &tio) != 0) return false;
+    tcflush(l->fd, TCIOFLUSH);
+    return true;
+}
+
+/**
+ * Sends a frame.
+ *
+ * @param l       Pointer to the line.
+ * @param payload Pointer to the type byte and the fields.
+ * @param len     Length of the payload.
+ * @return false if the port failed.
+ */
+static bool line_send(line *l, const uint8_t *payload, size_t len) {
+    uint8_t frame[DUMPFRAME_MAX_LEN];
+    size_t n = dumpframe_encode(frame, payload, len);
+    for (size_t done = 0; done < n;) {
+        ssize_t w = write(l->fd, frame + done, n - done);
+        if (w < 0 && errno != EINTR && errno != EAGAIN) return false;
+        if (w > 0) done += (size_t)w;
+    }
+    return true;
+}
+
+/**
+ * Waits for the next frame with a matching CRC. Frames that fail their CRC and text between frames are skipped.
+ *
+ * @param l          Pointer to the line.
+ * @param timeout_ms How long to wait.
+ * @return Length of the payload in l->rx.buf, 0 if none arrived in time, -1 if the port failed.
+ */
+static int line_receive(line *l, int timeout_ms) {
+    uint64_t deadline = now_ms() + (uint64_t)timeout_ms;
+    for (;;) {
+        while (l->pos < l->len) {
+            int n = dumpframe_rx_feed(&l->rx, l->buf[l->pos++]);
+            if (n > 0) return n;
+        }
+        uint64_t now = now_ms();
+        if (now >= deadline) return 0;
+        struct pollfd pfd = {.fd = l->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, (int)(deadline - now));
+        if (ready < 0 && errno != EINTR) return -1;
+        if (ready <= 0) continue;
+        ssize_t r = read(l->fd, l->buf, sizeof(l->buf));
+        if (r < 0 && errno != EINTR && errno != EAGAIN) return -1;
+        l->len = r > 0 ? (size_t)r : 0;
+        l->pos = 0;
+    }
+}
+
+/**
+ * Sends a frame with only a type byte.
+ *
+ * @param l    Pointer to the line.
+ * @param type Frame type.
+ * @return false if the port failed.
+ */
+static bool line_send_type(line *l, uint8_t type) {
+    return line_send(l, &type, 1);
+}
+
+/**
+ * Asks the dispenser to start a dump until it answers with the sizes of the dump.
+ *
+ * @param l Pointer to the line.
+ * @param u Pointer to the unit, the answer is stored in it.
+ * @return false if the dispenser didn't answer in time.
+ */
+static bool unit_connect(line *l, unit *u) {
+    uint64_t give_up = now_ms() + (uint64_t)wait_s * 1000;
+    while (now_ms() < give_up) {
+        if (!line_send_type(l, DUMPFRAME_START)) return false;
+        uint64_t deadline = now_ms() + HELLO_TIMEOUT_MS;
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            int n = line_receive(l, (int)(deadline - now));
+            if (n < 0) return false;
+            const uint8_t *p = l->rx.buf;
+            if (n < DUMPFRAME_HELLO_LEN || p[0] != DUMPFRAME_HELLO || p[1] != DUMPFRAME_VERSION) continue;
+            for (int i = 0; i < DUMPFRAME_BOARD_ID_LEN; i++) sprintf(u->id + 2 * i, "%02x", p[2 + i]);
+            u->eeprom_size = dumpframe_get_u32(p + 2 + DUMPFRAME_BOARD_ID_LEN);
+            u->flash_size = dumpframe_get_u32(p + 6 + DUMPFRAME_BOARD_ID_LEN);
+            u->chunk = dumpframe_get_u16(p + 10 + DUMPFRAME_BOARD_ID_LEN);
+            u->boot = dumpframe_get_u16(p + 12 + DUMPFRAME_BOARD_ID_LEN);
+            u->head = dumpframe_get_u16(p + 14 + DUMPFRAME_BOARD_ID_LEN);
+            if (u->chunk == 0 || u->chunk > DUMPFRAME_CHUNK) u->chunk = DUMPFRAME_CHUNK;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reads one chunk of the dump, asking again when the answer is lost. A dispenser that closed the session, or
+ * rebooted, is asked to open it again along with the retry.
+ *
+ * @param l      Pointer to the line.
+ * @param u      Pointer to the unit.
+ * @param offset Offset of the chunk in the dump.
+ * @param want   Bytes to ask for.
+ * @return Number of bytes in l->rx.buf after the DATA header, 0 if the chunk couldn't be read. u->error says why.
+ */
+static int unit_read_chunk(line *l, unit *u, uint32_t offset, uint16_t want) {
+    uint8_t read[DUMPFRAME_READ_LEN];
+    read[0] = DUMPFRAME_READ;
+    dumpframe_put_u32(read + 1, offset);
+    dumpframe_put_u16(read + 5, want);
+    for (int tries = 0; tries < READ_TRIES; tries++) {
+        if (tries > 0) {
+            u->retries++;
+            if (!line_send_type(l, DUMPFRAME_START)) break;
+        }
+        if (!line_send(l, read, sizeof(read))) break;
+        uint64_t deadline = now_ms() + READ_TIMEOUT_MS;
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            int n = line_receive(l, (int)(deadline - now));
+            if (n < 0) {
+                u->error = "port failed";
+                return 0;
+            }
+            const uint8_t *p = l->rx.buf;
+            if (n < DUMPFRAME_DATA_HEADER_LEN || dumpframe_get_u32(p + 1) != offset) continue; // a late answer
+            if (p[0] == DUMPFRAME_ERROR) {
+                u->error = "dispenser couldn't read the dump";
+                return 0;
+            }
+            if (p[0] != DUMPFRAME_DATA) continue;
+            n -= DUMPFRAME_DATA_HEADER_LEN;
+            if (n == 0 || n > want) {
+                u->error = "chunk of the wrong size";
+                return 0;
+            }
+            return n;
+        }
+    }
+    u->error = "dispenser stopped answering";
+    return 0;
+}
+
+/**
+ * Writes part of the dump to a file.
+ *
+ * @param path Path of the file, replaced if it exists.
+ * @param data Pointer to the bytes.
+ * @param size Number of bytes.
+ * @return false if the file can't be written.
+ */
+static bool write_file(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+/**
+ * Fills in the header of a .part file from what the dispenser sent.
+ *
+ * @param u   Pointer to the unit.
+ * @param hdr Pointer to PART_HEADER_LEN bytes.
+ */
+static void part_header(const unit *u, uint8_t *hdr) {
+    dumpframe_put_u32(hdr, PART_MAGIC);
+    dumpframe_put_u16(hdr + 4, u->boot);
+    dumpframe_put_u16(hdr + 6, u->head);
+    dumpframe_put_u32(hdr + 8, u->eeprom_size);
+    dumpframe_put_u32(hdr + 12, u->flash_size);
+}
+
+/**
+ * Finds how much of the dump a .part file already has. A file from another boot, from before a log was written or
+ * from another device size is emptied and started over.
+ *
+ * @param u    Pointer to the unit, after the dispenser answered.
+ * @param fd   File descriptor of the .part file.
+ * @param size Size of the file.
+ * @return Bytes of the dump in the file, -1 if the file can't be written.
+ */
+static int64_t part_resume(const unit *u, int fd, off_t size) {
+    uint8_t want[PART_HEADER_LEN];
+    uint8_t have[PART_HEADER_LEN];
+    uint32_t total = u->eeprom_size + u->flash_size;
+    part_header(u, want);
+    if (size >= PART_HEADER_LEN && size - PART_HEADER_LEN <= (off_t)total &&
+        pread(fd, have, PART_HEADER_LEN, 0) == PART_HEADER_LEN && memcmp(have, want, PART_HEADER_LEN) == 0) {
+        return size - PART_HEADER_LEN;
+    }
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, want, PART_HEADER_LEN, 0) != PART_HEADER_LEN) return -1;
+    return 0;
+}
+
+/**
+ * Splits a complete dump into the EEPROM image and the flash log, then removes it.
+ *
+ * @param u    Pointer to the unit.
+ * @param fd   File descriptor of the .part file.
+ * @param part Path of the .part file.
+ * @return false if the images can't be written. u->error says why.
+ */
+static bool unit_finish(unit *u, int fd, const char *part) {
+    size_t total = (size_t)u->eeprom_size + u->flash_size;
+    uint8_t *dump = malloc(total > 0 ? total : 1);
+    char path[4096];
+    if (dump == NULL || pread(fd, dump, total, PART_HEADER_LEN) != (ssize_t)total) {
+        free(dump);
+        u->error = "can't read back the .part file";
+        return false;
+    }
+    bool ok = true;
+    snprintf(path, sizeof(path), "%s/%s.eeprom", out_dir, u->id);
+    ok = write_file(path, dump, u->eeprom_size) && ok;
+    if (u->flash_size > 0) {
+        snprintf(path, sizeof(path), "%s/%s.flash", out_dir, u->id);
+        ok = write_file(path, dump + u->eeprom_size, u->flash_size) && ok;
+    }
+    free(dump);
+    if (!ok) {
+        u->error = "can't write the images";
+        return false;
+    }
+    unlink(part);
+    return true;
+}
+
+/**
+ * Pulls the dump of one dispenser, carrying on from its .part file if it is from the same boot and log head.
+ * The dispenser is asked once more at the end, a dump it wrote logs during is thrown away.
+ *
+ * @param u Pointer to the unit.
+ */
+static void unit_pull(unit *u) {
+    line l;
+    uint64_t start = now_ms();
+    if (!line_open(&l, u->port)) {
+        u->error = "can't open the port";
+        if (l.fd >= 0) close(l.fd);
+        return;
+    }
+    if (!unit_connect(&l, u)) {
+        u->error = "no answer, press button 3 on the dispenser";
+        close(l.fd);
+        return;
+    }
+
+    char part[4096];
+    snprintf(part, sizeof(part), "%s/%s.part", out_dir, u->id);
+    int fd = open(part, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        u->error = "can't open the .part file";
+        if (fd >= 0) close(fd);
+        close(l.fd);
+        return;
+    }
+    uint32_t total = u->eeprom_size + u->flash_size;
+    int64_t have = part_resume(u, fd, st.st_size);
+    if (have < 0) {
+        u->error = "can't write the .part file";
+        close(fd);
+        close(l.fd);
+        return;
+    }
+    uint32_t offset = (uint32_t)have;
+    u->resumed_at = offset;
+
+    while (offset < total && u->error == NULL) {
+        uint16_t want = total - offset < u->chunk ? (uint16_t)(total - offset) : u->chunk;
+        int n = unit_read_chunk(&l, u, offset, want);
+        if (n == 0) break;
+        if (pwrite(fd, l.rx.buf + DUMPFRAME_DATA_HEADER_LEN, (size_t)n, PART_HEADER_LEN + (off_t)offset) != n) {
+            u->error = "can't write the .part file";
+            break;
+        }
+        offset += (uint32_t)n;
+    }
+    if (u->error == NULL) {
+        unit before = *u;
+        if (!unit_connect(&l, u)) {
+            u->error = "dispenser stopped answering";
+        } else if (u->boot != before.boot || u->head != before.head) {
+            u->error = "logs were written during the pull, pull again";
+            if (ftruncate(fd, 0) != 0) u->error = "can't write the .part file";
+        }
+    }
+    line_send_type(&l, DUMPFRAME_END);
+    if (u->error == NULL) unit_finish(u, fd, part);
+    close(fd);
+    close(l.fd);
+    u->seconds = (now_ms() - start) / 1000.0;
+}
+
+static void *worker(void *arg) {
+    unit_pull(arg);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    bool usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:o:w:")) != -1) {
+        switch (opt) {
+        case 'b':
+            speed = speed_for(atoi(optarg));
+            usage = usage || speed == B0;
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'w':
+            wait_s = atoi(optarg);
+            break;
+        default:
+            usage = true;
+            break;
+        }
+    }
+    if (usage || optind >= argc) {
+        fprintf(stderr, "usage: %s [-b baud] [-o dir] [-w seconds] port...\n", argv[0]);
+        return 1;
+    }
+
+    unit_count = argc - optind;
+    units = calloc(unit_count, sizeof(unit));
+    pthread_t *threads = calloc(unit_count, sizeof(pthread_t));
+    bool *started = calloc(unit_count, sizeof(bool));
+    if (units == NULL || threads == NULL || started == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < unit_count; i++) {
+        units[i].port = argv[optind + i];
+        started[i] = pthread_create(&threads[i], NULL, worker, &units[i]) == 0;
+        if (!started[i]) unit_pull(&units[i]); // no thread, pull it here
+    }
+    for (int i = 0; i < unit_count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+
+    int failed = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < unit_count; i++) {
+        const unit *u = &units[i];
+        if (u->error != NULL) {
+            fprintf(stderr, "%s: %s\n", u->port, u->error);
+            failed++;
+            continue;
+        }
+        uint32_t pulled = u->eeprom_size + u->flash_size - u->resumed_at;
+        printf("%s: board %s boot %u, %u bytes EEPROM, %u bytes flash, %u pulled", u->port, u->id, u->boot,
+               u->eeprom_size, u->flash_size, pulled);
+        if (u->resumed_at > 0) printf(" after %u resumed", u->resumed_at);
+        printf(" in %.1f s (%.1f kB/s), %u retries\n", u->seconds,
+               u->seconds > 0 ? pulled / 1000.0 / u->seconds : 0.0, u->retries);
+        bytes += pulled;
+    }
+    fprintf(stderr, "%d ports, %d failed, %llu bytes pulled\n", unit_count, failed, (unsigned long long)bytes);
+    free(started);
+    free(threads);
+    free(units);
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "logqueue.h"
+
+// Checks that the log queue (src/logqueue.c) never drops a critical log. First a queue full of one critical log gets
+// a different one, then random logs of every priority are put and popped while the logs each queued entry counts
+// are added up. Every critical log put must be in a critical entry that is still queued or was popped.
+//
+// usage: logqueuecheck [puts] [seed]
+
+#define CRITICAL_CODES 17 // critical log numbers in logger_priority()
+
+static long errors = 0;
+
+/**
+ * Reports a failed check.
+ *
+ * @param ok   Result of the check.
+ * @param what What was checked.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    errors++;
+    printf("FAIL: %s\n", what);
+}
+
+/**
+ * Adds up the logs counted by the queued entries of a priority.
+ *
+ * @param q        Pointer to the queue.
+ * @param priority Priority of the entries.
+ * @return Number of logs.
+ */
+static long queued_logs(const log_queue *q, log_priority priority) {
+    long logs = 0;
+    for (int i = 0; i < q->len; i++) {
+        if (q->entries[i].priority == priority) logs += q->entries[i].count;
+    }
+    return logs;
+}
+
+/**
+ * Fills the queue with one critical log and puts a different one, which must be queued by merging two of the first.
+ */
+static void check_full_of_one_log(void) {
+    log_queue q;
+    logqueue_init(&q);
+    for (int i = 0; i < LOGQUEUE_LEN; i++) {
+        logqueue_put(&q, 1, 0, (uint32_t)i, LOG_PRIORITY_CRITICAL, LOGQUEUE_NO_COALESCE);
+    }
+    check(logqueue_put(&q, 13, 2, LOGQUEUE_LEN, LOG_PRIORITY_CRITICAL, LOGQUEUE_NO_COALESCE),
+          "different critical log put into a queue full of one critical log");
+    check(q.len == LOGQUEUE_LEN && q.dropped[LOG_PRIORITY_CRITICAL] == 0, "queue stays full without drops");
+    check(queued_logs(&q, LOG_PRIORITY_CRITICAL) == LOGQUEUE_LEN + 1, "every critical log is counted");
+    check(q.entries[q.len - 1].num == 13 && q.entries[q.len - 1].compartment == 2, "new log is queued last");
+    check(!logqueue_put(&q, 2, 0, 0, LOG_PRIORITY_NORMAL, LOGQUEUE_NO_COALESCE), "normal log is dropped");
+}
+
+int main(int argc, char **argv) {
+    long puts = argc > 1 ? atol(argv[1]) : 1000000;
+    unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+    if (puts <= 0) {
+        fprintf(stderr, "usage: %s [puts] [seed]\n", argv[0]);
+        return 1;
+    }
+    srand(seed);
+
+    check_full_of_one_log();
+
+    log_queue q;
+    logqueue_init(&q);
+    long critical_put = 0, critical_popped = 0, lost = 0;
+    for (long i = 0; i < puts; i++) {
+        if (rand() % 8 == 0) { // the modem sent one
+            log_entry e;
+            if (logqueue_pop(&q, &e) && e.priority == LOG_PRIORITY_CRITICAL) critical_popped += e.count;
+        }
+        log_priority priority = (log_priority)(rand() % LOG_PRIORITY_COUNT);
+        if (priority == LOG_PRIORITY_CRITICAL) {
+            critical_put++;
+            if (!logqueue_put(&q, rand() % CRITICAL_CODES, (uint8_t)(rand() % 8), (uint32_t)i, priority,
+                              LOGQUEUE_NO_COALESCE)) {
+                lost++;
+            }
+        } else {
+            int16_t key = priority == LOG_PRIORITY_LOW ? (int16_t)(rand() % 2) : LOGQUEUE_NO_COALESCE;
+            logqueue_put(&q, 100 + rand() % 20, (uint8_t)(rand() % 8), (uint32_t)i, priority, key);
+        }
+    }
+    check(lost == 0 && q.dropped[LOG_PRIORITY_CRITICAL] == 0, "no critical log is dropped");
+    check(critical_popped + queued_logs(&q, LOG_PRIORITY_CRITICAL) == critical_put, "every critical log is counted");
+
+    printf("%ld puts, %ld critical, %u merged, dropped %u normal and %u low\n", puts, critical_put, q.coalesced,
+           q.dropped[LOG_PRIORITY_NORMAL], q.dropped[LOG_PRIORITY_LOW]);
+    printf("%ld errors\n", errors);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "logHandling.h"
+#include "logrecord.h"
+#include "epoch.h"
+#include "calibcache.h"
+
+// Checks raw EEPROM images and prints statistics for each device: pills dispensed, drop errors, watchdog resets,
+// unclean shutdowns and how far the calibrations drifted. The logs are split into the sessions of each boot.
+// An image is the whole EEPROM, read from address 0, in the layout of Log-Readme.md. Logs are decoded with
+// src/logrecord.c, like the firmware does. Images are checked in parallel, the results are printed in the order
+// the images were given.
+//
+// usage: logstats [-j jobs] [-s] [-c] image...
+//   -j  images checked at once, one per CPU by default
+//   -s  print every session
+//   -c  print one CSV row per image instead of the text report
+
+// EEPROM layout, the same as src/logHandling.c
+#define LOG_END_ADDR 2048
+#define LOW_LOGS (LOG_END_ADDR / LOGRECORD_SLOT_LEN)
+#define RECORDS_END_ADDR 4096
+#define LOG_MAX_COUNT 0xFFFF
+#define STATUS_ADDR 2056
+#define STATUS_ARR_LEN 12
+#define CALIB_CACHE_ADDR 2240
+#define CALIB_CACHE_PAGE 64
+#define EPOCH_ADDR 2496
+#define CRC_LEN 2
+
+#define STALL_KINDS (LOG_WATCHDOG_STALL_LOG_DUMP - LOG_WATCHDOG_STALL_MAIN_LOOP + 1)
+#define CAROUSEL_OF(location) ((location) >> LOG_CAROUSEL_SHIFT)
+#define TEXT_LEN 64
+#define NO_CAUSE 0xFF // the session has no log of what the device was doing when the boot before ended
+
+typedef enum {
+    BOOT_LOG_NONE,
+    BOOT_LOG_PRELUDE, // logged before the restored status of carousel 0
+    BOOT_LOG_RESTORE  // what carousel 0 was doing when the boot before ended, once per boot
+} boot_log;
+
+typedef struct session {
+    uint16_t boot;       // from the boot finished log, 0 if it wasn't found
+    uint8_t cause;       // what carousel 0 was doing when the boot before ended, NO_CAUSE if not logged
+    uint8_t cause_location;
+    bool watchdog;       // the boot started after a watchdog reset
+    bool since_boot;     // written by firmware before there was a device time
+    uint32_t start_s;    // device time of the first and last log
+    uint32_t end_s;
+    uint32_t synced_s;   // device time of the first time synced log, later times are unix times. 0 if never synced
+    uint32_t logs;
+    uint32_t dispensed;
+    uint32_t drop_errors;
+} session;
+
+typedef struct calib_drift {
+    uint32_t count;         // calibration finished logs
+    uint16_t first_steps;   // steps per revolution of the oldest and newest one
+    uint16_t last_steps;
+    uint16_t min_steps;
+    uint16_t max_steps;
+    uint8_t cached;         // calibrations in the cache record
+    uint16_t cache_min;     // steps range of the cached calibrations
+    uint16_t cache_max;
+} calib_drift;
+
+typedef struct device_report {
+    const char *path;
+    const char *error; // NULL if the image could be read
+    uint32_t size;
+    int logs;          // log slots in the image
+    int valid;         // logs with a matching CRC
+    int unused;        // marked unused, or erased
+    int corrupt;       // in use but failing their CRC
+    int bad_values;    // continuation slots that don't belong to a valid log
+    int old_format;    // logs stamped with ms since boot
+    int status_valid;  // carousel status records with a matching CRC
+    bool epoch_valid;
+    epoch ep;
+    uint32_t dispensed;
+    uint32_t drop_errors;
+    uint32_t empty;
+    uint32_t doses_missed;
+    uint32_t watchdog_resets;
+    uint32_t unclean;  // boots after a shutdown during a dispense or calibration
+    uint32_t stalls[STALL_KINDS];
+    uint64_t drop_ms_sum;
+    uint32_t drop_ms_count;
+    calib_drift carousels[LOG_MAX_CAROUSELS];
+    session *sessions;
+    int session_count;
+    int session_room;
+} device_report;
+
+static device_report *reports;
+static int report_count;
+static atomic_int next_report;
+
+/**
+ * Calculates the address of a log in the image, skipping the records.
+ *
+ * @param index Index of the log.
+ * @return Address of the log's first byte.
+ */
+static uint32_t log_address(int index) {
+    if (index < LOW_LOGS) return (uint32_t)index * LOGRECORD_SLOT_LEN;
+    return RECORDS_END_ADDR + (uint32_t)(index - LOW_LOGS) * LOGRECORD_SLOT_LEN;
+}
+
+/**
+ * Checks the CRC at the end of a record.
+ *
+ * @param image Pointer to the image.
+ * @param addr  Address of the record.
+ * @param len   Length of the record without the CRC.
+ * @return true if the CRC matches.
+ */
+static bool record_valid(const uint8_t *image, uint32_t addr, int len) {
+    return crc16(image + addr, len + CRC_LEN) == 0;
+}
+
+/**
+ * Checks if a log slot is erased, as on a new EEPROM.
+ *
+ * @param slot Pointer to the slot.
+ * @return true if every byte is 0xFF.
+ */
+static bool slot_erased(const uint8_t *slot) {
+    for (int i = 0; i < LOGRECORD_SLOT_LEN; i++) {
+        if (slot[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+/**
+ * Finds the logs reboot_sequence() writes first in a boot: the watchdog reset log and an unreadable status come
+ * before the log of what carousel 0 was doing when the boot before ended.
+ *
+ * @param r Pointer to the log.
+ * @return Where the log comes in a boot, BOOT_LOG_NONE for the other logs.
+ */
+static boot_log boot_log_kind(const logrecord *r) {
+    if (r->code == LOG_WATCHDOG_REBOOT) return BOOT_LOG_PRELUDE;
+    if (CAROUSEL_OF(r->location) != 0) return BOOT_LOG_NONE;
+    switch (r->code) {
+    case LOG_GREMLINS:
+        return BOOT_LOG_PRELUDE;
+    case LOG_IDLE:
+    case LOG_DISPENSE_ERROR:
+    case LOG_HALF_CALIBRATION_ERROR:
+    case LOG_FULL_CALIBRATION_ERROR:
+        return BOOT_LOG_RESTORE;
+    default:
+        return (r->code >= LOG_DISPENSE1_ERROR && r->code <= LOG_DISPENSE7_ERROR) ? BOOT_LOG_RESTORE : BOOT_LOG_NONE;
+    }
+}
+
+/**
+ * Adds a session to a report.
+ *
+ * @param rep Pointer to the report.
+ * @return Pointer to the new session, NULL if out of memory.
+ */
+static session *add_session(device_report *rep) {
+    if (rep->session_count == rep->session_room) {
+        int room = rep->session_room ? rep->session_room * 2 : 16;
+        session *grown = realloc(rep->sessions, room * sizeof(session));
+        if (grown == NULL) return NULL;
+        rep->sessions = grown;
+        rep->session_room = room;
+    }
+    session *s = &rep->sessions[rep->session_count++];
+    memset(s, 0, sizeof(*s));
+    s->cause = NO_CAUSE;
+    return s;
+}
+
+/**
+ * Adds a calibration finished log to the drift of its carousel.
+ *
+ * @param d     Pointer to the drift of the carousel.
+ * @param steps Steps per revolution.
+ */
+static void add_calibration(calib_drift *d, uint16_t steps) {
+    if (d->count == 0) {
+        d->first_steps = steps;
+        d->min_steps = steps;
+        d->max_steps = steps;
+    }
+    if (steps < d->min_steps) d->min_steps = steps;
+    if (steps > d->max_steps) d->max_steps = steps;
+    d->last_steps = steps;
+    d->count++;
+}
+
+/**
+ * Counts a valid log in the statistics and the current session.
+ *
+ * @param rep Pointer to the report.
+ * @param s   Pointer to the current session.
+ * @param r   Pointer to the log.
+ */
+static void count_log(device_report *rep, session *s, const logrecord *r) {
+    s->logs++;
+    if (s->logs == 1) s->start_s = r->time_s;
+    if (s->logs == 1 || r->time_s > s->end_s) s->end_s = r->time_s; // stall logs are from the boot before
+    s->since_boot |= r->since_boot;
+    if (r->since_boot) rep->old_format++;
+
+    switch (r->code) {
+    case LOG_PILL_DISPENSED:
+        rep->dispensed++;
+        s->dispensed++;
+        if (r->field_count > 0) {
+            rep->drop_ms_sum += (uint32_t)r->fields[0];
+            rep->drop_ms_count++;
+        }
+        break;
+    case LOG_PILL_ERROR:
+        rep->drop_errors++;
+        s->drop_errors++;
+        break;
+    case LOG_DISPENSER_EMPTY:
+        rep->empty++;
+        break;
+    case LOG_DOSE_MISSED:
+        rep->doses_missed++;
+        break;
+    case LOG_WATCHDOG_REBOOT:
+        rep->watchdog_resets++;
+        s->watchdog = true;
+        break;
+    case LOG_DISPENSE_ERROR:
+    case LOG_HALF_CALIBRATION_ERROR:
+    case LOG_FULL_CALIBRATION_ERROR:
+        rep->unclean++;
+        break;
+    case LOG_CALIBRATION_FINISHED:
+        if (r->field_count > 0) add_calibration(&rep->carousels[CAROUSEL_OF(r->location)], (uint16_t)r->fields[0]);
+        break;
+    case LOG_BOOTFINISHED:
+        if (r->field_count > 0) s->boot = (uint16_t)r->fields[0];
+        break;
+    case LOG_TIME_SYNCED:
+        if (s->synced_s == 0 && !r->since_boot) s->synced_s = r->time_s;
+        break;
+    default:
+        if (r->code >= LOG_DISPENSE1_ERROR && r->code <= LOG_DISPENSE7_ERROR) rep->unclean++;
+        if (r->code >= LOG_WATCHDOG_STALL_MAIN_LOOP && r->code <= LOG_WATCHDOG_STALL_LOG_DUMP) {
+            rep->stalls[r->code - LOG_WATCHDOG_STALL_MAIN_LOOP]++;
+        }
+        break;
+    }
+}
+
+/**
+ * Decodes the logs of an image oldest first, the log after the first unused one is the oldest. Logs are split
+ * into sessions where a boot starts, a boot that ended before its boot finished log still starts a session.
+ *
+ * @param rep   Pointer to the report.
+ * @param image Pointer to the image.
+ */
+static void scan_logs(device_report *rep, const uint8_t *image) {
+    int logs = rep->logs;
+    int unused = 0;
+    while (unused < logs && image[log_address(unused)] != 0) unused++;
+    if (unused == logs) unused = 0;
+
+    session *s = NULL;
+    bool prelude = false; // the current session has started and its restore log hasn't come yet
+    for (int n = 1; n <= logs;) {
+        uint8_t slots[LOGRECORD_MAX_SLOTS * LOGRECORD_SLOT_LEN];
+        int count = 0;
+        for (; count < LOGRECORD_MAX_SLOTS && n + count <= logs; count++) {
+            int index = (unused + n + count) % logs;
+            memcpy(slots + count * LOGRECORD_SLOT_LEN, image + log_address(index), LOGRECORD_SLOT_LEN);
+        }
+
+        logrecord r;
+        int used = logrecord_decode(slots, count, &r);
+        if (used == 0) {
+            if (slots[0] == 0 || slot_erased(slots)) rep->unused++;
+            else if (logrecord_is_continuation(slots)) rep->bad_values++;
+            else rep->corrupt++;
+            n++;
+            continue;
+        }
+        rep->valid++;
+        boot_log kind = boot_log_kind(&r);
+        if (r.code == LOG_WATCHDOG_REBOOT || (kind != BOOT_LOG_NONE && !prelude)) s = NULL;
+        if (s == NULL && (s = add_session(rep)) == NULL) return;
+        if (kind == BOOT_LOG_RESTORE) {
+            s->cause = r.code;
+            s->cause_location = r.location;
+        }
+        if (kind != BOOT_LOG_NONE) prelude = kind == BOOT_LOG_PRELUDE;
+        count_log(rep, s, &r);
+        n += used;
+    }
+}
+
+/**
+ * Checks the records between the logs: the carousel status records, the calibration caches and the device time.
+ *
+ * @param rep   Pointer to the report.
+ * @param image Pointer to the image.
+ */
+static void scan_records(device_report *rep, const uint8_t *image) {
+    for (int c = 0; c < LOG_MAX_CAROUSELS; c++) {
+        if (record_valid(image, STATUS_ADDR + c * STATUS_ARR_LEN, STATUS_ARR_LEN - CRC_LEN)) rep->status_valid++;
+
+        uint32_t addr = CALIB_CACHE_ADDR + c * CALIB_CACHE_PAGE;
+        calib_cache cache;
+        calibcache_init(&cache);
+        if (!record_valid(image, addr, CALIBCACHE_RECORD_LEN) || !calibcache_decode(&cache, image + addr)) continue;
+        calib_drift *d = &rep->carousels[c];
+        for (uint8_t i = 0; i < cache.count; i++) {
+            uint16_t steps = cache.samples[i].step_max;
+            if (d->cached == 0 || steps < d->cache_min) d->cache_min = steps;
+            if (d->cached == 0 || steps > d->cache_max) d->cache_max = steps;
+            d->cached++;
+        }
+    }
+    epoch_init(&rep->ep);
+    rep->epoch_valid = record_valid(image, EPOCH_ADDR, EPOCH_RECORD_LEN) && epoch_decode(&rep->ep, image + EPOCH_ADDR);
+}
+
+/**
+ * Reads an image and fills in its report.
+ *
+ * @param rep Pointer to the report, its path is set.
+ */
+static void analyse(device_report *rep) {
+    FILE *f = fopen(rep->path, "rb");
+    if (f == NULL) {
+        rep->error = "can't open";
+        return;
+    }
+    uint8_t *image = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    if (size >= RECORDS_END_ADDR && fseek(f, 0, SEEK_SET) == 0 && (image = malloc(size)) != NULL &&
+        fread(image, 1, size, f) != (size_t)size) {
+        free(image);
+        image = NULL;
+    }
+    fclose(f);
+    if (image == NULL) {
+        rep->error = size < RECORDS_END_ADDR ? "smaller than the records" : "can't read";
+        return;
+    }
+
+    rep->size = (uint32_t)size;
+    rep->logs = LOW_LOGS + (int)((size - RECORDS_END_ADDR) / LOGRECORD_SLOT_LEN);
+    if (rep->logs > LOG_MAX_COUNT) rep->logs = LOG_MAX_COUNT;
+    scan_records(rep, image);
+    scan_logs(rep, image);
+    free(image);
+}
+
+/**
+ * Checks images until there are none left, run by every worker thread.
+ *
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *worker(void *arg) {
+    (void)arg;
+    int i;
+    while ((i = atomic_fetch_add(&next_report, 1)) < report_count) analyse(&reports[i]);
+    return NULL;
+}
+
+/**
+ * Calculates a rate in percent.
+ *
+ * @param part  Events of interest.
+ * @param whole All events.
+ * @return part / whole in percent, 0 if whole is 0.
+ */
+static double percent(uint32_t part, uint32_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+/**
+ * Writes a session's device time for the report, as a date only after the session synced to the network time.
+ *
+ * @param dst  Pointer to the buffer for the text.
+ * @param size Size of the buffer.
+ * @param s    Pointer to the session.
+ * @param t    Device time.
+ */
+static void format_time(char *dst, size_t size, const session *s, uint32_t t) {
+    if (s->since_boot) snprintf(dst, size, "%u s after boot", t);
+    else epoch_format(dst, size, t, s->synced_s != 0 && t >= s->synced_s);
+}
+
+/**
+ * Prints the text report of an image.
+ *
+ * @param rep           Pointer to the report.
+ * @param show_sessions true to print every session.
+ */
+static void print_report(const device_report *rep, bool show_sessions) {
+    printf("%s: %d logs, %d valid, %d corrupt, %d bad value slots, %d unused", rep->path, rep->logs, rep->valid,
+           rep->corrupt, rep->bad_values, rep->unused);
+    if (rep->old_format) printf(", %d from older firmware", rep->old_format);
+    printf("\n");
+    printf("  %d sessions, %u watchdog resets, %u unclean shutdowns", rep->session_count, rep->watchdog_resets,
+           rep->unclean);
+    if (rep->epoch_valid) {
+        printf(", boot %u%s", rep->ep.boot_count, (rep->ep.flags & EPOCH_BOOT_SYNCED) ? ", synced"
+               : (rep->ep.flags & EPOCH_SYNCED) ? ", not synced since boot" : ", never synced");
+    } else {
+        printf(", no device time record");
+    }
+    printf(", %d of %d status records valid\n", rep->status_valid, LOG_MAX_CAROUSELS);
+    printf("  %u pills dispensed, %u drops not detected (%.1f %%), %u empty, %u doses missed", rep->dispensed,
+           rep->drop_errors, percent(rep->drop_errors, rep->dispensed + rep->drop_errors), rep->empty,
+           rep->doses_missed);
+    if (rep->drop_ms_count) printf(", mean drop %llu ms", (unsigned long long)(rep->drop_ms_sum / rep->drop_ms_count));
+    printf("\n");
+    for (int k = 0; k < STALL_KINDS; k++) {
+        if (rep->stalls[k] == 0) continue;
+        char text[TEXT_LEN];
+        formatLogMessage(text, sizeof(text), LOG_WATCHDOG_STALL_MAIN_LOOP + k, 0);
+        printf("  %s: %u\n", text, rep->stalls[k]);
+    }
+    for (int c = 0; c < LOG_MAX_CAROUSELS; c++) {
+        const calib_drift *d = &rep->carousels[c];
+        if (d->count == 0 && d->cached == 0) continue;
+        printf("  carousel %d: %u calibrations", c + 1, d->count);
+        if (d->count) {
+            printf(", steps %u-%u, drift %+d", d->min_steps, d->max_steps, (int)d->last_steps - d->first_steps);
+        }
+        if (d->cached) printf(", cache %u-%u in %u", d->cache_min, d->cache_max, d->cached);
+        printf("\n");
+    }
+    if (!show_sessions) return;
+    for (int i = 0; i < rep->session_count; i++) {
+        const session *s = &rep->sessions[i];
+        char start[TEXT_LEN];
+        char end[TEXT_LEN];
+        char cause[TEXT_LEN];
+        format_time(start, sizeof(start), s, s->start_s);
+        format_time(end, sizeof(end), s, s->end_s);
+        if (s->cause != NO_CAUSE) formatLogMessage(cause, sizeof(cause), s->cause, s->cause_location);
+        else snprintf(cause, sizeof(cause), "start not logged");
+        printf("  session %d", i + 1);
+        if (s->boot) printf(" (boot %u)", s->boot);
+        printf(": %s to %s, %u logs, %u pills, %u drop errors, %s%s\n", start, end, s->logs, s->dispensed,
+               s->drop_errors, cause, s->watchdog ? ", watchdog reset" : "");
+    }
+}
+
+/**
+ * Prints the CSV row of an image.
+ *
+ * @param rep Pointer to the report.
+ */
+static void print_csv(const device_report *rep) {
+    printf("%s,%d,%d,%d,%d,%d,%d,%u,%u,%u,%.2f,%u,%u,%u,%u", rep->path, rep->logs, rep->valid, rep->corrupt,
+           rep->bad_values, rep->session_count, rep->epoch_valid ? rep->ep.boot_count : 0, rep->watchdog_resets,
+           rep->unclean, rep->dispensed, percent(rep->drop_errors, rep->dispensed + rep->drop_errors), rep->drop_errors,
+           rep->empty, rep->doses_missed,
+           rep->drop_ms_count ? (unsigned)(rep->drop_ms_sum / rep->drop_ms_count) : 0);
+    for (int c = 0; c < LOG_MAX_CAROUSELS; c++) {
+        const calib_drift *d = &rep->carousels[c];
+        printf(",%u,%d", d->count, d->count ? (int)d->last_steps - d->first_steps : 0);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool show_sessions = false;
+    bool csv = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:sc")) != -1) {
+        switch (opt) {
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 's':
+            show_sessions = true;
+            break;
+        case 'c':
+            csv = true;
+            break;
+        default:
+            jobs = 0;
+            break;
+        }
+    }
+    if (jobs < 1 || optind >= argc) {
+        fprintf(stderr, "usage: %s [-j jobs] [-s] [-c] image...\n", argv[0]);
+        return 1;
+    }
+
+    report_count = argc - optind;
+    reports = calloc(report_count, sizeof(device_report));
+    if (reports == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < report_count; i++) reports[i].path = argv[optind + i];
+    if (jobs > report_count) jobs = report_count;
+
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    int started = 0;
+    while (threads != NULL && started < jobs && pthread_create(&threads[started], NULL, worker, NULL) == 0) started++;
+    if (started == 0) worker(NULL); // no threads, check them all here
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+
+    if (csv) {
+        printf("image,logs,valid,corrupt,bad_values,sessions,boots,watchdog_resets,unclean_shutdowns,dispensed,"
+               "drop_error_pct,drop_errors,empty,doses_missed,mean_drop_ms");
+        for (int c = 0; c < LOG_MAX_CAROUSELS; c++) printf(",calibrations_%d,drift_%d", c + 1, c + 1);
+        printf("\n");
+    }
+    int failed = 0;
+    uint64_t dispensed = 0;
+    uint64_t drop_errors = 0;
+    uint64_t resets = 0;
+    for (int i = 0; i < report_count; i++) {
+        const device_report *rep = &reports[i];
+        if (rep->error != NULL) {
+            fprintf(stderr, "%s: %s\n", rep->path, rep->error);
+            failed++;
+            continue;
+        }
+        if (csv) print_csv(rep);
+        else print_report(rep, show_sessions);
+        dispensed += rep->dispensed;
+        drop_errors += rep->drop_errors;
+        resets += rep->watchdog_resets;
+        free(rep->sessions);
+    }
+    fprintf(stderr, "%d images, %d unreadable: %llu pills dispensed, %llu drops not detected, %llu watchdog resets\n",
+            report_count, failed, (unsigned long long)dispensed, (unsigned long long)drop_errors,
+            (unsigned long long)resets);
+    free(reports);
+    return failed ? 2 : 0;
+}
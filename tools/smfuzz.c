@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "statemachine.h"
+
+// Runs the state machine engine (src/statemachine.c) on random nested tables and checks every tick against a model
+// that keeps its own entry time per state. The model finds the transition the engine should take from the guards'
+// results and the timers of the current state and its parents, and how long until the next timer expires.
+// Time starts close to the 32 bit wrap so timers are checked across it. The time taken by ticks is reported, for
+// the table sizes of the fuzz.
+//
+// usage: smfuzz [tables] [ticks per table] [seed]
+
+#define MAX_STATES 16
+#define MAX_TRANSITIONS 32
+
+typedef struct fuzz {
+    sm_state states[MAX_STATES];
+    sm_transition transitions[MAX_TRANSITIONS];
+    sm_table table;
+    uint32_t entered_ms[MAX_STATES]; // model: time each state was last entered
+    uint32_t guards;                 // bit n is the result of the guard of transition n on this tick
+    int taken;                       // transition whose action ran, -1 if none
+} fuzz;
+
+static fuzz f;
+
+/**
+ * Records the entry of a state in the model.
+ *
+ * @param sm    Pointer to the state machine.
+ * @param state State entered.
+ */
+static void fuzz_entry(state_machine *sm, sm_state_id state) {
+    f.entered_ms[state] = sm->time_ms;
+}
+
+// entry actions, guards and transition actions that know which state or transition they belong to
+#define FUZZ_STATE(n) static void entry_##n(state_machine *sm) { fuzz_entry(sm, n); }
+#define FUZZ_TRANSITION(n) \
+    static bool guard_##n(state_machine *sm) { (void)sm; return (f.guards >> n) & 1; } \
+    static void action_##n(state_machine *sm) { (void)sm; f.taken = n; }
+FUZZ_STATE(0) FUZZ_STATE(1) FUZZ_STATE(2) FUZZ_STATE(3) FUZZ_STATE(4) FUZZ_STATE(5) FUZZ_STATE(6) FUZZ_STATE(7)
+FUZZ_STATE(8) FUZZ_STATE(9) FUZZ_STATE(10) FUZZ_STATE(11) FUZZ_STATE(12) FUZZ_STATE(13) FUZZ_STATE(14) FUZZ_STATE(15)
+FUZZ_TRANSITION(0) FUZZ_TRANSITION(1) FUZZ_TRANSITION(2) FUZZ_TRANSITION(3) FUZZ_TRANSITION(4) FUZZ_TRANSITION(5)
+FUZZ_TRANSITION(6) FUZZ_TRANSITION(7) FUZZ_TRANSITION(8) FUZZ_TRANSITION(9) FUZZ_TRANSITION(10) FUZZ_TRANSITION(11)
+FUZZ_TRANSITION(12) FUZZ_TRANSITION(13) FUZZ_TRANSITION(14) FUZZ_TRANSITION(15) FUZZ_TRANSITION(16)
+FUZZ_TRANSITION(17) FUZZ_TRANSITION(18) FUZZ_TRANSITION(19) FUZZ_TRANSITION(20) FUZZ_TRANSITION(21)
+FUZZ_TRANSITION(22) FUZZ_TRANSITION(23) FUZZ_TRANSITION(24) FUZZ_TRANSITION(25) FUZZ_TRANSITION(26)
+FUZZ_TRANSITION(27) FUZZ_TRANSITION(28) FUZZ_TRANSITION(29) FUZZ_TRANSITION(30) FUZZ_TRANSITION(31)
+
+static const sm_action entries[MAX_STATES] = {
+    entry_0, entry_1, entry_2, entry_3, entry_4, entry_5, entry_6, entry_7,
+    entry_8, entry_9, entry_10, entry_11, entry_12, entry_13, entry_14, entry_15,
+};
+static const sm_guard guards[MAX_TRANSITIONS] = {
+    guard_0, guard_1, guard_2, guard_3, guard_4, guard_5, guard_6, guard_7, guard_8, guard_9, guard_10,
+    guard_11, guard_12, guard_13, guard_14, guard_15, guard_16, guard_17, guard_18, guard_19, guard_20,
+    guard_21, guard_22, guard_23, guard_24, guard_25, guard_26, guard_27, guard_28, guard_29, guard_30, guard_31,
+};
+static const sm_action actions[MAX_TRANSITIONS] = {
+    action_0, action_1, action_2, action_3, action_4, action_5, action_6, action_7, action_8, action_9, action_10,
+    action_11, action_12, action_13, action_14, action_15, action_16, action_17, action_18, action_19, action_20,
+    action_21, action_22, action_23, action_24, action_25, action_26, action_27, action_28, action_29, action_30,
+    action_31,
+};
+static const char *names[MAX_STATES] = {
+    "S0", "S1", "S2", "S3", "S4", "S5", "S6", "S7", "S8", "S9", "S10", "S11", "S12", "S13", "S14", "S15",
+};
+
+/**
+ * Gets how deep a state is nested in the fuzz table.
+ *
+ * @param state State to check.
+ * @return 0 for a top level state.
+ */
+static int fuzz_depth(sm_state_id state) {
+    int depth = 0;
+    while (f.states[state].parent != SM_NO_PARENT) {
+        state = f.states[state].parent;
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Builds a random table. Each state's parent is an earlier state or none, up to SM_MAX_DEPTH deep, and the
+ * transitions go from and to any state, with or without a timer and a guard.
+ */
+static void fuzz_table(void) {
+    int state_count = 2 + rand() % (MAX_STATES - 1);
+    int transition_count = 1 + rand() % MAX_TRANSITIONS;
+    for (int i = 0; i < state_count; i++) {
+        sm_state_id parent = (i == 0 || rand() % 3 == 0) ? SM_NO_PARENT : (sm_state_id)(rand() % i);
+        if (parent != SM_NO_PARENT && fuzz_depth(parent) >= SM_MAX_DEPTH - 1) parent = SM_NO_PARENT;
+        f.states[i] = (sm_state){names[i], parent, entries[i], NULL, NULL};
+    }
+    for (int i = 0; i < transition_count; i++) {
+        f.transitions[i] = (sm_transition){
+            .from = (sm_state_id)(rand() % state_count),
+            .after_ms = rand() % 2 ? SM_NO_TIMER : 1 + (uint32_t)(rand() % 500),
+            .guard = rand() % 4 ? guards[i] : NULL,
+            .action = actions[i],
+            .to = (sm_state_id)(rand() % state_count),
+        };
+    }
+    f.table = (sm_table){f.states, (uint8_t)state_count, f.transitions, (uint8_t)transition_count};
+}
+
+/**
+ * Finds the transition the engine should take, from the model's entry times.
+ *
+ * @param sm      Pointer to the state machine, before the tick.
+ * @param time_ms Time of the tick.
+ * @return Index of the transition, -1 if none should be taken.
+ */
+static int fuzz_expected(const state_machine *sm, uint32_t time_ms) {
+    for (sm_state_id s = sm->state; s != SM_NO_PARENT; s = f.states[s].parent) {
+        for (int i = 0; i < f.table.transition_count; i++) {
+            const sm_transition *t = &f.transitions[i];
+            if (t->from != s) continue;
+            if (t->after_ms != SM_NO_TIMER && time_ms - f.entered_ms[s] < t->after_ms) continue;
+            if (t->guard && !((f.guards >> i) & 1)) continue;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Finds how long until the next timer of the current state or its parents expires, from the model's entry times.
+ *
+ * @param sm Pointer to the state machine.
+ * @return Milliseconds, 0 if one already has, UINT32_MAX if there are none.
+ */
+static uint32_t fuzz_next_timer(const state_machine *sm) {
+    uint32_t next = UINT32_MAX;
+    for (sm_state_id s = sm->state; s != SM_NO_PARENT; s = f.states[s].parent) {
+        uint32_t in_state = sm->time_ms - f.entered_ms[s];
+        for (int i = 0; i < f.table.transition_count; i++) {
+            const sm_transition *t = &f.transitions[i];
+            if (t->from != s || t->after_ms == SM_NO_TIMER) continue;
+            uint32_t left = in_state >= t->after_ms ? 0 : t->after_ms - in_state;
+            if (left < next) next = left;
+        }
+    }
+    return next;
+}
+
+/**
+ * Gets a monotonic time for the cost measurement.
+ *
+ * @return Nanoseconds.
+ */
+static uint64_t fuzz_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    long tables = argc > 1 ? atol(argv[1]) : 2000;
+    long ticks = argc > 2 ? atol(argv[2]) : 2000;
+    unsigned seed = argc > 3 ? (unsigned)strtoul(argv[3], NULL, 10) : 1;
+    if (tables <= 0 || ticks <= 0) {
+        fprintf(stderr, "usage: %s [tables] [ticks per table] [seed]\n", argv[0]);
+        return 1;
+    }
+    srand(seed);
+
+    uint32_t *steps = malloc((size_t)ticks * sizeof(uint32_t));
+    uint32_t *guard_bits = malloc((size_t)ticks * sizeof(uint32_t));
+    if (steps == NULL || guard_bits == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    long errors = 0, taken = 0, gotos = 0, total_ticks = 0;
+    uint64_t tick_ns = 0, timer_ns = 0;
+    for (long n = 0; n < tables; n++) {
+        fuzz_table();
+        state_machine sm;
+        uint32_t start_ms = UINT32_MAX - (uint32_t)(rand() % 100000);
+        uint32_t time_ms = start_ms;
+        sm_state_id initial = (sm_state_id)(rand() % f.table.state_count);
+        for (long i = 0; i < ticks; i++) {
+            steps[i] = (uint32_t)(rand() % 60);
+            guard_bits[i] = (uint32_t)rand() & (uint32_t)rand(); // mostly false, so timers get to run
+        }
+
+        f.guards = 0;
+        statemachine_init(&sm, &f.table, initial, NULL, time_ms);
+        for (long i = 0; i < ticks; i++) {
+            if (rand() % 64 == 0) { // a remote command
+                statemachine_goto(&sm, (sm_state_id)(rand() % f.table.state_count));
+                gotos++;
+            }
+            time_ms += steps[i];
+            f.guards = guard_bits[i];
+            int expected = fuzz_expected(&sm, time_ms);
+            sm_state_id from = sm.state;
+
+            f.taken = -1;
+            bool changed = statemachine_tick(&sm, time_ms);
+            if (changed != (expected >= 0) || f.taken != expected ||
+                (expected >= 0 && sm.state != f.transitions[expected].to) || (expected < 0 && sm.state != from)) {
+                if (errors++ < 10) {
+                    printf("table %ld tick %ld in %s: took %d, expected %d\n", n, i, names[from], f.taken, expected);
+                }
+                continue;
+            }
+            if (changed) taken++;
+
+            uint32_t next = statemachine_next_timer_ms(&sm);
+            if (next != fuzz_next_timer(&sm) || statemachine_time_in_state(&sm) != time_ms - f.entered_ms[sm.state]) {
+                if (errors++ < 10) {
+                    printf("table %ld tick %ld in %s: next timer %u, expected %u\n", n, i, names[sm.state], next,
+                           fuzz_next_timer(&sm));
+                }
+            }
+        }
+
+        // the same ticks again without the model, timed as a whole so the clock isn't part of the cost
+        time_ms = start_ms;
+        statemachine_init(&sm, &f.table, initial, NULL, time_ms);
+        uint64_t start = fuzz_now_ns();
+        for (long i = 0; i < ticks; i++) {
+            time_ms += steps[i];
+            f.guards = guard_bits[i];
+            statemachine_tick(&sm, time_ms);
+        }
+        uint64_t middle = fuzz_now_ns();
+        volatile uint32_t sink = 0;
+        for (long i = 0; i < ticks; i++) sink += statemachine_next_timer_ms(&sm);
+        (void)sink;
+        tick_ns += middle - start;
+        timer_ns += fuzz_now_ns() - middle;
+        total_ticks += ticks;
+    }
+    free(steps);
+    free(guard_bits);
+
+    printf("%ld tables, %ld ticks, %ld transitions taken, %ld gotos\n", tables, total_ticks, taken, gotos);
+    printf("tick: mean %.1f ns, next timer: mean %.1f ns\n", (double)tick_ns / total_ticks,
+           (double)timer_ns / total_ticks);
+    printf("%ld errors\n", errors);
+    return errors > 0 ? 1 : 0;
+}